@@ -0,0 +1,49 @@
+# Team: FIX Connectivity& Simulation
+
+name = bench-cppactor
+type = bin
+lang = cpp
+
+source = bench/main.cpp  \
+		 source/actor.cpp \
+		 source/pool_base.cpp \
+		 source/framework.cpp \
+		 source/message.cpp \
+		 source/actor_table.cpp \
+		 source/timer_wheel.cpp \
+		 source/send_buffer.cpp \
+		 source/parallel.cpp \
+		 source/hibernation.cpp \
+		 source/actor_blocks.cpp \
+		 source/pipeline.cpp \
+		 source/journal.cpp \
+		 source/capture.cpp \
+		 source/shm_transport.cpp \
+		 source/uds_transport.cpp \
+		 source/reactor.cpp \
+		 source/file_io.cpp \
+		 source/deadline_queue.cpp \
+		 source/watchdog.cpp \
+		 source/dead_letters.cpp
+
+cpp_compiler_flags += -Wno-unused-parameter        \
+                      -Wno-type-limits             \
+                      -Wno-switch                  \
+                      -Wno-delete-non-virtual-dtor \
+                      -Wno-strict-aliasing         \
+                      -Wno-uninitialized \
+				      -O2
+
+no_pedantic = 0
+
+include_paths = . \
+	include  \
+	../misc/cppactor/include \
+	../miscutils/include \
+    ../../the_arsenal/ttstl/include \
+    ../logger/include \
+
+static_libs = miscutils
+shared_libs = ttlogger
+libraries = rt
+generation_dep = 
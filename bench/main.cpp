@@ -0,0 +1,1561 @@
+/*************************************
+ * Benchmark suite for cppactor
+ *
+ * Runs a set of standard actor workloads and reports the time per operation
+ * for each one, in json (one object per line) or csv. Every workload is run
+ * --reps times and summarised as min/median/mean/stddev/max so results from
+ * two builds can be compared directly.
+ *
+ * usage: bench-cppactor [--threads N] [--reps N] [--scale F] [--filter name] [--format json|csv]
+ *      --threads   Number of threads in each benchmark pool (default 3)
+ *      --reps      Number of timed repetitions per workload (default 5)
+ *      --scale     Multiplier applied to the operation count of every workload (default 1)
+ *      --filter    Only run workloads whose name contains this string
+ *      --format    Output format, json (default) or csv
+ *
+ * Every result also carries the number of heap allocations per operation,
+ * counted by the replacement operator new below.
+ */
+#include <string>
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <functional>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include "cppactor/framework.h"
+#include "cppactor/actor.h"
+#include "cppactor/message.h"
+#include "cppactor/message_id.h"
+#include "cppactor/utility.h"
+#include "cppactor/ask.h"
+#include "cppactor/detail/locks.h"
+#include "cppactor/mpmc_queue.h"
+#include "cppactor/parallel.h"
+#include "cppactor/pipeline.h"
+#include "cppactor/journal.h"
+#include "cppactor/capture.h"
+#include "cppactor/shm_transport.h"
+#include "cppactor/uds_transport.h"
+#include "cppactor/reactor.h"
+#include "cppactor/file_io.h"
+#include "cppactor/detail/low_lock_queue.h"
+#include "miscutils/LockFreeMultiProducerQueue.h"
+
+namespace
+{
+    std::atomic<uint64_t> g_allocations(0);
+}
+
+void *operator new(size_t n)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"     // new is malloc above
+#endif
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+namespace
+{
+    struct Ping;
+    struct Pong;
+    struct Item;
+    struct Start;
+    struct Spawn;
+    struct Sum;
+    typedef cppactor::message_list<1, Ping, Pong, Item, Start, Spawn, Sum> bench_messages;
+}
+CPPACTOR_MESSAGE_BLOCK(bench_messages)
+
+namespace
+{
+    /*************************************************************************************/
+    // Blocks the benchmark thread until the workload signals completion
+    class latch
+    {
+    public:
+        latch()
+        : m_done(false)
+        {}
+
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_done = false;
+        }
+
+        void signal()
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_done = true;
+            m_cv.notify_all();
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [this] {return m_done;});
+        }
+    private:
+        std::mutex m_mtx;
+        std::condition_variable m_cv;
+        bool m_done;
+    };
+
+    // Counts down the outstanding operations of a workload, the last one signals the latch
+    struct countdown
+    {
+        void reset(int64_t n)
+        {
+            done.reset();
+            remaining = n;
+        }
+
+        void count_down()
+        {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                done.signal();
+        }
+
+        std::atomic<int64_t> remaining;
+        latch done;
+    };
+
+    struct options
+    {
+        options()
+        : threads(3)
+        , reps(5)
+        , scale(1.0)
+        , csv(false)
+        {}
+
+        int threads;
+        int reps;
+        double scale;
+        std::string filter;
+        bool csv;
+    };
+
+    options g_options;
+    uint32_t g_next_poolid = 100;
+
+    int64_t scaled(int64_t n)
+    {
+        return std::max<int64_t>(1, static_cast<int64_t>(n * g_options.scale));
+    }
+
+    /*************************************************************************************/
+    // Messages shared by the workloads
+    struct Ping : public cppactor::message
+    {
+        enum {msg_id = bench_messages::id<Ping>()};
+        Ping(cppactor::actor_ref replyto)
+        :cppactor::message(msg_id, replyto)
+        {}
+    };
+
+    struct Pong : public cppactor::message
+    {
+        enum {msg_id = bench_messages::id<Pong>()};
+        Pong()
+        :cppactor::message(msg_id)
+        {}
+    };
+
+    struct Item : public cppactor::message
+    {
+        enum {msg_id = bench_messages::id<Item>()};
+        Item(int64_t n_)
+        :cppactor::message(msg_id)
+        , n(n_)
+        {}
+
+        typedef int64_t shm_layout;
+        void shm_save(shm_layout& out) const {out = n;}
+        static Item *shm_load(const shm_layout& in) {return new Item(in);}
+
+        void journal_save(cppactor::journal_writer& out) const {out.put(n);}
+        static Item *journal_load(cppactor::journal_reader& in)
+        {
+            int64_t n = 0;
+            return in.get(n) ? new Item(n) : nullptr;
+        }
+
+        int64_t n;
+    };
+
+    struct Start : public cppactor::message
+    {
+        enum {msg_id = bench_messages::id<Start>()};
+        Start(int64_t count_)
+        :cppactor::message(msg_id)
+        , count(count_)
+        {}
+
+        int64_t count;
+    };
+
+    struct Spawn : public cppactor::message
+    {
+        enum {msg_id = bench_messages::id<Spawn>()};
+        Spawn(int level_, int64_t num_, cppactor::actor_ref replyto)
+        :cppactor::message(msg_id, replyto)
+        , level(level_)
+        , num(num_)
+        {}
+
+        int level;
+        int64_t num;
+    };
+
+    struct Sum : public cppactor::message
+    {
+        enum {msg_id = bench_messages::id<Sum>()};
+        Sum(int64_t sum_)
+        :cppactor::message(msg_id)
+        , sum(sum_)
+        {}
+
+        int64_t sum;
+    };
+
+    /*************************************************************************************/
+    // ping_pong: one actor bounces a message off another, measures round trip latency
+    class PingActor : public cppactor::actor
+    {
+    public:
+        void on_message(std::unique_ptr<Start>& msg, cppactor::actor_ref& replyto)
+        {
+            m_remaining = msg->count;
+            m_partner.enqueue(new Ping(get_ref()));
+        }
+
+        void on_message(std::unique_ptr<Pong>& msg, cppactor::actor_ref& replyto)
+        {
+            if (--m_remaining == 0)
+            {
+                m_done->signal();
+                return;
+            }
+            m_partner.enqueue(new Ping(get_ref()));
+        }
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            cppactor::Dispatch<Start, Pong>::on_message(this, msg, replyto);
+        }
+
+        cppactor::actor_ref m_partner;
+        latch *m_done;
+        int64_t m_remaining;
+    };
+
+    class PongActor : public cppactor::actor
+    {
+    public:
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            if (replyto)
+                replyto.enqueue(new Pong());
+        }
+    };
+
+    /*************************************************************************************/
+    // ask: keeps a window of requests in flight to an echo actor
+    class EchoActor : public cppactor::actor
+    {
+    public:
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            cppactor::reply(*msg, new Pong());
+        }
+    };
+
+    class AskActor : public cppactor::actor
+    {
+    public:
+        AskActor(cppactor::actor_ref echo, int64_t window, latch *done)
+        : m_echo(echo)
+        , m_window(window)
+        , m_done(done)
+        , m_sent(0)
+        , m_received(0)
+        , m_total(0)
+        {}
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            Start *p = static_cast<Start *>(msg.get());
+            m_total = p->count;
+            for (int64_t i = 0; i < m_window && m_sent < m_total; ++i)
+                send();
+        }
+
+    private:
+        void send()
+        {
+            ++m_sent;
+            cppactor::ask<Pong>(m_echo, new Ping(cppactor::actor_ref()), 5000, [this](std::unique_ptr<Pong>& pong) {
+                if (++m_received == m_total)
+                    m_done->signal();
+                else if (m_sent < m_total)
+                    send();
+            });
+        }
+
+        cppactor::actor_ref m_echo;
+        int64_t m_window;
+        latch *m_done;
+        int64_t m_sent;
+        int64_t m_received;
+        int64_t m_total;
+    };
+
+    /*************************************************************************************/
+    // Counts every message it receives against a shared countdown
+    class SinkActor : public cppactor::actor
+    {
+    public:
+        SinkActor(countdown *c)
+        : m_countdown(c)
+        {}
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            m_countdown->count_down();
+        }
+
+        countdown *m_countdown;
+    };
+
+    // fan_in: every producer sends its share of messages to a single sink
+    class ProducerActor : public cppactor::actor
+    {
+    public:
+        ProducerActor(bool defer = false)
+        {
+            defer_sends(defer);
+        }
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            Start *p = static_cast<Start *>(msg.get());
+            for (int64_t i = 0; i < p->count; ++i)
+            {
+                m_sink->enqueue(new Item(i));
+            }
+        }
+
+        cppactor::actor_iptr m_sink;
+    };
+
+    // pipeline_actors: each stage passes the item on to the next one
+    class StageActor : public cppactor::actor
+    {
+    public:
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            ++static_cast<Item *>(msg.get())->n;
+            m_next->enqueue(msg.release());
+        }
+
+        cppactor::actor_iptr m_next;
+    };
+
+    /*************************************************************************************/
+    // skynet: every actor spawns ten children until the leaf level, the sums travel back up the tree
+    class SkynetActor : public cppactor::actor
+    {
+    public:
+        SkynetActor(uint32_t poolid, latch *done, std::atomic<int64_t> *spawned)
+        : m_poolid(poolid)
+        , m_done(done)
+        , m_spawned(spawned)
+        , m_pending(0)
+        , m_sum(0)
+        {}
+
+        void on_message(std::unique_ptr<Spawn>& msg, cppactor::actor_ref& replyto)
+        {
+            m_parent = replyto;
+            if (msg->level == 0)
+            {
+                finish(msg->num);
+                return;
+            }
+            m_pending = 10;
+            for (int i = 0; i < 10; ++i)
+            {
+                auto child = cppactor::create_actor<SkynetActor>(m_poolid, m_poolid, m_done, m_spawned);
+                m_spawned->fetch_add(1, std::memory_order_relaxed);
+                child->enqueue(new Spawn(msg->level - 1, msg->num * 10 + i, get_ref()));
+            }
+        }
+
+        void on_message(std::unique_ptr<Sum>& msg, cppactor::actor_ref& replyto)
+        {
+            m_sum += msg->sum;
+            if (--m_pending == 0)
+                finish(m_sum);
+        }
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            cppactor::Dispatch<Spawn, Sum>::on_message(this, msg, replyto);
+        }
+
+    private:
+        void finish(int64_t sum)
+        {
+            if (m_parent)
+                m_parent.enqueue(new Sum(sum));
+            else
+                m_done->signal();
+            cppactor::framework::instance()->stop_actor(convert_this());
+        }
+
+        uint32_t m_poolid;
+        latch *m_done;
+        std::atomic<int64_t> *m_spawned;
+        cppactor::actor_ref m_parent;
+        int m_pending;
+        int64_t m_sum;
+    };
+
+    /*************************************************************************************/
+    struct result
+    {
+        std::string name;
+        int64_t ops;
+        std::vector<double> ns_per_op;
+        double refcount_rmw_per_op;
+        double allocs_per_op;
+    };
+
+    void report_header()
+    {
+        if (g_options.csv)
+            std::cout << "benchmark,threads,reps,ops,min_ns_per_op,median_ns_per_op,mean_ns_per_op,stddev_ns_per_op,max_ns_per_op,ops_per_sec,refcount_rmw_per_op,allocs_per_op" << std::endl;
+    }
+
+    void report(const result& r)
+    {
+        std::vector<double> v(r.ns_per_op);
+        std::sort(v.begin(), v.end());
+        double mean = std::accumulate(v.begin(), v.end(), 0.0) / v.size();
+        double var = 0.0;
+        for (double d : v)
+            var += (d - mean) * (d - mean);
+        double stddev = v.size() > 1 ? std::sqrt(var / (v.size() - 1)) : 0.0;
+        double median = v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2.0;
+        double ops_per_sec = mean > 0.0 ? 1e9 / mean : 0.0;
+
+        if (g_options.csv)
+        {
+            std::cout << r.name << "," << g_options.threads << "," << v.size() << "," << r.ops << ","
+                      << v.front() << "," << median << "," << mean << "," << stddev << "," << v.back() << ","
+                      << ops_per_sec << "," << r.refcount_rmw_per_op << "," << r.allocs_per_op << std::endl;
+        }
+        else
+        {
+            std::cout << "{\"benchmark\":\"" << r.name << "\""
+                      << ",\"threads\":" << g_options.threads
+                      << ",\"reps\":" << v.size()
+                      << ",\"ops\":" << r.ops
+                      << ",\"ns_per_op\":{\"min\":" << v.front()
+                      << ",\"median\":" << median
+                      << ",\"mean\":" << mean
+                      << ",\"stddev\":" << stddev
+                      << ",\"max\":" << v.back() << "}"
+                      << ",\"ops_per_sec\":" << ops_per_sec
+                      << ",\"allocs_per_op\":" << r.allocs_per_op;
+            if (r.refcount_rmw_per_op >= 0.0)
+                std::cout << ",\"refcount_rmw_per_op\":" << r.refcount_rmw_per_op;
+            std::cout << "}" << std::endl;
+        }
+    }
+
+#ifdef CPPACTOR_REFCOUNT_STATS
+    // Reference count atomics per operation, only available when built with CPPACTOR_REFCOUNT_STATS
+    uint64_t refcount_rmws()
+    {
+        return cppactor::detail::refcount_rmw_counter().load();
+    }
+#endif
+
+    // false if --filter leaves the workload out
+    bool selected(const std::string& name)
+    {
+        return g_options.filter.empty() || name.find(g_options.filter) != std::string::npos;
+    }
+
+    /*
+     * Runs a workload g_options.reps times.
+     * Each call to run() is timed and returns the number of operations it performed.
+     */
+    template <typename Run>
+    void run_benchmark(const std::string& name, Run run)
+    {
+        if (!selected(name))
+            return;
+
+        result r;
+        r.name = name;
+        r.ops = 0;
+        r.refcount_rmw_per_op = -1.0;
+        r.allocs_per_op = 0.0;
+        for (int rep = 0; rep < g_options.reps; ++rep)
+        {
+#ifdef CPPACTOR_REFCOUNT_STATS
+            uint64_t rmws = refcount_rmws();
+#endif
+            uint64_t allocs = g_allocations.load();
+            auto start = std::chrono::steady_clock::now();
+            int64_t ops = run();
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            r.ops = ops;
+            r.ns_per_op.push_back(static_cast<double>(elapsed.count()) / ops);
+            r.allocs_per_op = static_cast<double>(g_allocations.load() - allocs) / ops;
+#ifdef CPPACTOR_REFCOUNT_STATS
+            r.refcount_rmw_per_op = static_cast<double>(refcount_rmws() - rmws) / ops;
+#endif
+        }
+        report(r);
+    }
+
+    template <typename...ActorTypes>
+    uint32_t bench_pool()
+    {
+        uint32_t poolid = g_next_poolid++;
+        cppactor::create_pool<ActorTypes...>(poolid, g_options.threads);
+        return poolid;
+    }
+
+    template <typename ActorCont>
+    void stop_all(ActorCont& actors)
+    {
+        for (auto& a : actors)
+            cppactor::framework::instance()->stop_actor(a);
+        actors.clear();
+    }
+
+    /*************************************************************************************/
+    void bench_ping_pong()
+    {
+        uint32_t poolid = bench_pool<PingActor, PongActor>();
+        run_benchmark("ping_pong", [=]() -> int64_t {
+            int64_t n = scaled(100000);
+            latch done;
+            auto ping = cppactor::create_actor<PingActor>(poolid);
+            auto pong = cppactor::create_actor<PongActor>(poolid);
+            ping->m_partner = pong->get_ref();
+            ping->m_done = &done;
+            ping->enqueue(new Start(n));
+            done.wait();
+            cppactor::framework::instance()->stop_actor(ping);
+            cppactor::framework::instance()->stop_actor(pong);
+            return n;
+        });
+    }
+
+    void bench_ask()
+    {
+        uint32_t poolid = bench_pool<EchoActor, AskActor>();
+        run_benchmark("ask", [=]() -> int64_t {
+            int64_t n = scaled(200000);
+            latch done;
+            auto echo = cppactor::create_actor<EchoActor>(poolid);
+            auto asker = cppactor::create_actor<AskActor>(poolid, echo->get_ref(), scaled(1000), &done);
+            asker->enqueue(new Start(n));
+            done.wait();
+            cppactor::framework::instance()->stop_actor(asker);
+            cppactor::framework::instance()->stop_actor(echo);
+            return n;
+        });
+    }
+
+    void bench_fan_in(const char *name, bool defer)
+    {
+        uint32_t poolid = bench_pool<SinkActor, ProducerActor>();
+        run_benchmark(name, [=]() -> int64_t {
+            int nproducers = std::max(2, g_options.threads);
+            int64_t per_producer = scaled(400000) / nproducers;
+            countdown c;
+            c.reset(per_producer * nproducers);
+            cppactor::actor_iptr sink = cppactor::create_actor<SinkActor>(poolid, &c);
+            std::vector<cppactor::actor_iptr> producers;
+            for (int i = 0; i < nproducers; ++i)
+            {
+                auto p = cppactor::create_actor<ProducerActor>(poolid, defer);
+                p->m_sink = sink;
+                producers.push_back(p);
+            }
+            for (auto& p : producers)
+                p->enqueue(new Start(per_producer));
+            c.done.wait();
+            stop_all(producers);
+            cppactor::framework::instance()->stop_actor(sink);
+            return per_producer * nproducers;
+        });
+    }
+
+    void bench_broadcast()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        run_benchmark("broadcast", [=]() -> int64_t {
+            const int nreceivers = 64;
+            int64_t rounds = scaled(400000) / nreceivers;
+            countdown c;
+            c.reset(rounds * nreceivers);
+            std::vector<cppactor::actor_iptr> receivers;
+            for (int i = 0; i < nreceivers; ++i)
+                receivers.push_back(cppactor::create_actor<SinkActor>(poolid, &c));
+            for (int64_t i = 0; i < rounds; ++i)
+                cppactor::broadcast<Item>(receivers, i);
+            c.done.wait();
+            stop_all(receivers);
+            return rounds * nreceivers;
+        });
+    }
+
+    void bench_skynet()
+    {
+        uint32_t poolid = bench_pool<SkynetActor>();
+        run_benchmark("skynet", [=]() -> int64_t {
+            int levels = 1;
+            for (int64_t n = 10; n < scaled(10000); n *= 10)
+                ++levels;
+            latch done;
+            std::atomic<int64_t> spawned(1);
+            auto root = cppactor::create_actor<SkynetActor>(poolid, poolid, &done, &spawned);
+            root->enqueue(new Spawn(levels, 0, cppactor::actor_ref()));
+            done.wait();
+            return spawned.load();
+        });
+    }
+
+    void bench_timer_churn()
+    {
+        run_benchmark("timer_churn", [=]() -> int64_t {
+            // Half of the timers are cancelled straight away, the other half must fire
+            int64_t n = scaled(2000) & ~int64_t(1);
+            countdown c;
+            c.reset(n / 2);
+            cppactor::framework& fw = *cppactor::framework::instance();
+            for (int64_t i = 0; i < n; i += 2)
+            {
+                fw.set_timer(10, false, [&c](int) {c.count_down();});
+                int tid = fw.set_timer(10, false, [&c](int) {c.count_down();});
+                fw.cancel_timer(tid);
+            }
+            c.done.wait();
+            return n;
+        });
+    }
+
+    void bench_find_any()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        run_benchmark("find_any", [=]() -> int64_t {
+            const int nactors = 64;
+            int64_t n = scaled(200000);
+            countdown c;
+            c.reset(n);
+            std::vector<cppactor::actor_iptr> actors;
+            for (int i = 0; i < nactors; ++i)
+                actors.push_back(cppactor::create_actor<SinkActor>(poolid, &c));
+            for (int64_t i = 0; i < n; ++i)
+                cppactor::find_any(actors)->enqueue(new Item(i));
+            c.done.wait();
+            stop_all(actors);
+            return n;
+        });
+    }
+
+    void bench_enqueue_message()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        run_benchmark("enqueue_message", [=]() -> int64_t {
+            int64_t n = scaled(400000);
+            countdown c;
+            c.reset(n);
+            cppactor::actor_iptr a = cppactor::create_actor<SinkActor>(poolid, &c);
+            for (int64_t i = 0; i < n; ++i)
+                a->enqueue(new Item(i));
+            c.done.wait();
+            cppactor::framework::instance()->stop_actor(a);
+            return n;
+        });
+    }
+
+    void bench_enqueue_function()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        run_benchmark("enqueue_function", [=]() -> int64_t {
+            int64_t n = scaled(400000);
+            countdown c;
+            c.reset(n);
+            cppactor::actor_iptr a = cppactor::create_actor<SinkActor>(poolid, &c);
+            countdown *pc = &c;
+            for (int64_t i = 0; i < n; ++i)
+                a->enqueue([pc](cppactor::actor_iptr) {pc->count_down();});
+            c.done.wait();
+            cppactor::framework::instance()->stop_actor(a);
+            return n;
+        });
+    }
+
+    // dead_letters: handles Item only, the Pongs sent before it are dead letters
+    class ItemActor : public cppactor::actor
+    {
+    public:
+        ItemActor(countdown *c)
+        : m_countdown(c)
+        {}
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            cppactor::Dispatch<Item>::on_message(this, msg, replyto);
+        }
+
+        void on_message(std::unique_ptr<Item>& msg, cppactor::actor_ref& replyto)
+        {
+            m_countdown->count_down();
+        }
+
+        countdown *m_countdown;
+    };
+
+    /*
+     * dead_letters: a misrouting storm, messages the actor has no handler
+     * for, with samples forwarded to a dead letter actor at 100 a second.
+     * ops is the number of dead letters.
+     */
+    void bench_dead_letters()
+    {
+        if (!selected("dead_letters"))
+            return;
+        uint32_t poolid = bench_pool<ItemActor, SinkActor>();
+        static countdown sampled;      // outlives a sample the stopped office may still be handling
+        sampled.reset(std::numeric_limits<int64_t>::max());
+        cppactor::actor_iptr office = cppactor::create_actor<SinkActor>(poolid, &sampled);
+        cppactor::framework& fw = *cppactor::framework::instance();
+        fw.set_dead_letter_actor(office->get_ref(), 100);
+        run_benchmark("dead_letters", [=]() -> int64_t {
+            int64_t n = scaled(400000);
+            countdown c;
+            c.reset(1);
+            cppactor::actor_iptr a = cppactor::create_actor<ItemActor>(poolid, &c);
+            for (int64_t i = 0; i < n; ++i)
+                a->enqueue(new Pong());
+            a->enqueue(new Item(0));
+            c.done.wait();
+            cppactor::framework::instance()->stop_actor(a);
+            return n;
+        });
+        fw.set_dead_letter_actor(cppactor::actor_ref());
+        fw.stop_actor(office);
+
+        cppactor::dead_letter_stats stats = fw.get_dead_letter_stats();
+        if (!g_options.csv)
+            std::cout << "{\"dead_letters\":" << stats.by_reason[cppactor::DEAD_LETTER_UNHANDLED] << ",\"forwarded\":" << stats.forwarded
+                      << ",\"rate_limited\":" << stats.rate_limited << "}" << std::endl;
+    }
+
+    // The actor-less equivalent of enqueue_function
+    void bench_submit()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        run_benchmark("submit", [=]() -> int64_t {
+            int64_t n = scaled(400000);
+            countdown c;
+            c.reset(n);
+            countdown *pc = &c;
+            cppactor::framework& fw = *cppactor::framework::instance();
+            for (int64_t i = 0; i < n; ++i)
+                fw.submit(poolid, [pc]() {pc->count_down();});
+            c.done.wait();
+            return n;
+        });
+    }
+
+    /*
+     * Actor creation, one at a time and in bulk. ops is the number of actors.
+     * The actors are stopped after the last rep, outside the timings.
+     */
+    void bench_spawn()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        std::shared_ptr<std::vector<cppactor::actor_iptr> > spawned(new std::vector<cppactor::actor_iptr>);
+        run_benchmark("spawn", [=]() -> int64_t {
+            int64_t n = scaled(50000);
+            for (int64_t i = 0; i < n; ++i)
+                spawned->push_back(cppactor::create_actor<SinkActor>(poolid, nullptr));
+            return n;
+        });
+        run_benchmark("spawn_bulk", [=]() -> int64_t {
+            int64_t n = scaled(50000);
+            auto actors = cppactor::create_actors<SinkActor>(poolid, n, [](size_t) {return SinkActor(nullptr);});
+            spawned->insert(spawned->end(), actors.begin(), actors.end());
+            return n;
+        });
+        stop_all(*spawned);
+    }
+
+    /*
+     * parallel_for and parallel_reduce over a vector of doubles, ops is the
+     * number of elements. Each rep is a series of loops on the same data.
+     */
+    void bench_parallel()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        std::shared_ptr<std::vector<double> > data(new std::vector<double>(scaled(1000000)));
+        run_benchmark("parallel_for", [=]() -> int64_t {
+            std::vector<double>& v = *data;
+            for (int loop = 0; loop < 10; ++loop)
+                cppactor::parallel_for(poolid, 0, v.size(), 0, [&](size_t i) {v[i] = v[i] * 0.5 + i;});
+            return static_cast<int64_t>(v.size()) * 10;
+        });
+        run_benchmark("parallel_reduce", [=]() -> int64_t {
+            const std::vector<double>& v = *data;
+            volatile double total = 0.0;
+            for (int loop = 0; loop < 10; ++loop)
+            {
+                total = total + cppactor::parallel_reduce(poolid, 0, v.size(), 0, 0.0,
+                    [&](size_t b, size_t e) {return std::accumulate(v.begin() + b, v.begin() + e, 0.0);},
+                    std::plus<double>());
+            }
+            return static_cast<int64_t>(v.size()) * 10;
+        });
+    }
+
+    /*
+     * Three stages and a sink handing items along: as a chain of actors,
+     * as a pipeline with a thread per stage, and as a pipeline with the
+     * stages fused onto one thread. ops is the number of items.
+     */
+    void bench_pipeline()
+    {
+        uint32_t poolid = bench_pool<StageActor, SinkActor>();
+        run_benchmark("pipeline_actors", [=]() -> int64_t {
+            int64_t n = scaled(400000);
+            countdown c;
+            c.reset(n);
+            cppactor::actor_iptr sink = cppactor::create_actor<SinkActor>(poolid, &c);
+            std::vector<cppactor::actor_iptr> stages;
+            cppactor::actor_iptr next = sink;
+            for (int i = 0; i < 3; ++i)
+            {
+                auto s = cppactor::create_actor<StageActor>(poolid);
+                s->m_next = next;
+                next = s;
+                stages.push_back(s);
+            }
+            for (int64_t i = 0; i < n; ++i)
+                next->enqueue(new Item(i));
+            c.done.wait();
+            stop_all(stages);
+            cppactor::framework::instance()->stop_actor(sink);
+            return n;
+        });
+        run_benchmark("pipeline_spsc", [=]() -> int64_t {
+            int64_t n = scaled(400000);
+            int64_t total = 0;
+            auto p = cppactor::make_pipeline<int64_t>(1024)
+                .stage([](int64_t&& v) {return v + 1;})
+                .stage([](int64_t&& v) {return v + 1;})
+                .stage([](int64_t&& v) {return v + 1;})
+                .sink([&total](int64_t&& v) {total += v;})
+                .build();
+            for (int64_t i = 0; i < n; ++i)
+                p.push(i);
+            p.stop();
+            return n;
+        });
+        run_benchmark("pipeline_fused", [=]() -> int64_t {
+            int64_t n = scaled(400000);
+            int64_t total = 0;
+            auto p = cppactor::make_pipeline<int64_t>(1024)
+                .stage([](int64_t&& v) {return v + 1;})
+                .fuse([](int64_t&& v) {return v + 1;})
+                .fuse([](int64_t&& v) {return v + 1;})
+                .sink([&total](int64_t&& v) {total += v;})
+                .build();
+            for (int64_t i = 0; i < n; ++i)
+                p.push(i);
+            p.stop();
+            return n;
+        });
+    }
+
+    /*
+     * One actor handling messages, without and with a journal appending
+     * each one before the handler runs. ops is the number of messages,
+     * journal_append includes the final sync().
+     */
+    void bench_journal()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        cppactor::register_journal_message<Item>();
+        for (int journaled = 0; journaled < 2; ++journaled)
+        {
+            run_benchmark(journaled ? "journal_append" : "journal_plain", [=]() -> int64_t {
+                int64_t n = scaled(400000);
+                char dir[] = "/tmp/cppactor-bench-XXXXXX";
+                if (mkdtemp(dir) == nullptr)
+                    return 0;
+                int64_t ops = 0;
+                {
+                    cppactor::journal j(dir, "bench");
+                    countdown c;
+                    c.reset(n);
+                    cppactor::actor_iptr sink = cppactor::create_actor<SinkActor>(poolid, &c);
+                    if (journaled)
+                        sink->journal_to(j, 1);
+                    for (int64_t i = 0; i < n; ++i)
+                        sink->enqueue(new Item(i));
+                    c.done.wait();
+                    j.sync();
+                    cppactor::framework::instance()->stop_actor(sink);
+                    ops = n;
+                }
+                std::string cmd = std::string("rm -rf ") + dir;
+                if (system(cmd.c_str()) != 0)
+                    ops = 0;
+                return ops;
+            });
+        }
+    }
+
+    /*
+     * capture_enqueue: messages sent to one actor with a traffic capture
+     * recording them, compare with journal_plain. replay_max: the same
+     * capture sent back to a new actor as fast as possible, ops is the
+     * number of messages in both.
+     */
+    void bench_capture()
+    {
+        uint32_t poolid = bench_pool<SinkActor>();
+        cppactor::register_journal_message<Item>();
+        std::string path = "/tmp/cppactor-bench-" + std::to_string(getpid()) + ".trf";
+        int64_t n = scaled(400000);
+        auto capture_items = [=]() {
+            cppactor::traffic_capture capture(path);
+            countdown c;
+            c.reset(n);
+            cppactor::actor_iptr sink = cppactor::create_actor<SinkActor>(poolid, &c);
+            sink->capture_to(capture, 1);
+            for (int64_t i = 0; i < n; ++i)
+                sink->enqueue(new Item(i));
+            c.done.wait();
+            capture.stop();
+            cppactor::framework::instance()->stop_actor(sink);
+        };
+
+        // untimed, the stream replay_max sends
+        capture_items();
+        cppactor::traffic_replay replay(path);
+
+        run_benchmark("capture_enqueue", [=]() -> int64_t {
+            capture_items();
+            return n;
+        });
+        run_benchmark("replay_max", [&]() -> int64_t {
+            countdown c;
+            c.reset(n);
+            cppactor::actor_iptr sink = cppactor::create_actor<SinkActor>(poolid, &c);
+            cppactor::traffic_replay_options options;
+            options.speed = 0;
+            options.latency_sample = 0;
+            cppactor::traffic_replay_stats stats = replay.run([&](uint64_t) {return sink;}, options);
+            c.done.wait();
+            cppactor::framework::instance()->stop_actor(sink);
+            return stats.messages;
+        });
+        unlink(path.c_str());
+    }
+
+    /*
+     * shm_transport: items sent through an shm_proxy and a shared memory
+     * ring to a sink, both ends in this process. ops is the number of items.
+     */
+    void bench_shm()
+    {
+        uint32_t poolid = bench_pool<cppactor::shm_proxy, SinkActor>();
+        cppactor::register_shm_message<Item>();
+        std::string name = "/cppactor-bench-" + std::to_string(getpid());
+        run_benchmark("shm_transport", [=]() -> int64_t {
+            int64_t n = scaled(400000);
+            countdown c;
+            c.reset(n);
+            cppactor::actor_iptr sink = cppactor::create_actor<SinkActor>(poolid, &c);
+            int64_t sent = 0;
+            {
+                cppactor::shm_receiver receiver(name, sink);
+                cppactor::actor_iptr proxy = cppactor::create_actor<cppactor::shm_proxy>(poolid, name);
+                for (int64_t i = 0; i < n; ++i)
+                    proxy->enqueue(new Item(i));
+                c.done.wait();
+                sent = n;
+                cppactor::framework::instance()->stop_actor(proxy);
+            }
+            cppactor::framework::instance()->stop_actor(sink);
+            return sent;
+        });
+    }
+
+    // Sends every item back through a socket connection
+    class RemoteEchoActor : public cppactor::actor
+    {
+    public:
+        RemoteEchoActor(cppactor::remote_actor back)
+        : m_back(back)
+        {}
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            m_back.enqueue(new Item(static_cast<Item *>(msg.get())->n));
+        }
+
+        cppactor::remote_actor m_back;
+    };
+
+    /*
+     * uds_throughput: items sent through a unix domain socket connection
+     * to a sink, both ends in this process. ops is the number of items.
+     * uds_round_trip: one item at a time to an actor that sends it back
+     * over a second connection, without a linger, ns/op is the latency.
+     * The sending side's messages per syscall are reported after them.
+     */
+    void bench_uds()
+    {
+        uint32_t poolid = bench_pool<SinkActor, RemoteEchoActor>();
+        cppactor::register_journal_message<Item>();
+        std::string path = "/tmp/cppactor-bench-" + std::to_string(getpid()) + ".sock";
+        std::string back_path = path + ".back";
+        cppactor::uds_stats stats[2] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+        auto add_stats = [&](int workload, const cppactor::uds_stats& s) {
+            stats[workload].messages += s.messages;
+            stats[workload].syscalls += s.syscalls;
+        };
+
+        run_benchmark("uds_throughput", [&]() -> int64_t {
+            int64_t n = scaled(400000);
+            countdown c;
+            c.reset(n);
+            cppactor::actor_iptr sink = cppactor::create_actor<SinkActor>(poolid, &c);
+            {
+                cppactor::uds_server server(path);
+                server.bind(1, sink);
+                cppactor::uds_connection connection(path);
+                cppactor::remote_actor remote = connection.remote(1);
+                for (int64_t i = 0; i < n; ++i)
+                    remote.enqueue(new Item(i));
+                c.done.wait();
+                add_stats(0, connection.get_stats());
+            }
+            cppactor::framework::instance()->stop_actor(sink);
+            return n;
+        });
+        run_benchmark("uds_round_trip", [&]() -> int64_t {
+            int64_t n = scaled(20000);
+            cppactor::uds_options options;
+            options.linger_us = 0;
+            countdown c;
+            cppactor::actor_iptr sink = cppactor::create_actor<SinkActor>(poolid, &c);
+            {
+                cppactor::uds_server back_server(back_path, options);
+                back_server.bind(1, sink);
+                cppactor::uds_connection back(back_path, options);
+                cppactor::uds_server server(path, options);
+                cppactor::actor_iptr echo = cppactor::create_actor<RemoteEchoActor>(poolid, back.remote(1));
+                server.bind(1, echo);
+                cppactor::uds_connection connection(path, options);
+                cppactor::remote_actor remote = connection.remote(1);
+                for (int64_t i = 0; i < n; ++i)
+                {
+                    c.reset(1);
+                    remote.enqueue(new Item(i));
+                    c.done.wait();
+                }
+                add_stats(1, connection.get_stats());
+                server.unbind(1);
+                cppactor::framework::instance()->stop_actor(echo);
+            }
+            cppactor::framework::instance()->stop_actor(sink);
+            return n;
+        });
+
+        const char *names[2] = {"uds_throughput", "uds_round_trip"};
+        for (int i = 0; i < 2; ++i)
+        {
+            if (stats[i].syscalls != 0 && !g_options.csv)
+                std::cout << "{\"transport\":\"uds\",\"benchmark\":\"" << names[i] << "\",\"messages_per_syscall\":" << stats[i].messages_per_syscall() << "}" << std::endl;
+        }
+    }
+
+    // Counts the bytes the reactor reads for it
+    class ReceiverActor : public cppactor::actor
+    {
+    public:
+        ReceiverActor(countdown *c)
+        : m_countdown(c)
+        {}
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            if (msg->msg_id == cppactor::io_data::msg_id)
+            {
+                int64_t size = static_cast<cppactor::io_data *>(msg.get())->size();
+                if (m_countdown->remaining.fetch_sub(size, std::memory_order_acq_rel) == size)
+                    m_countdown->done.signal();
+            }
+        }
+
+        countdown *m_countdown;
+    };
+
+    /*
+     * reactor_receive: 64 byte writes to a socket pair watched with
+     * IO_RECEIVE, until the actor has been sent every byte. ops is the
+     * number of writes.
+     */
+    void bench_reactor()
+    {
+        uint32_t poolid = bench_pool<ReceiverActor>();
+        run_benchmark("reactor_receive", [=]() -> int64_t {
+            int64_t n = scaled(200000);
+            const size_t size = 64;
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0)
+                return 0;
+            countdown c;
+            c.reset(n * size);
+            cppactor::actor_iptr receiver = cppactor::create_actor<ReceiverActor>(poolid, &c);
+            cppactor::framework::instance()->watch_fd(receiver, fds[0], cppactor::IO_RECEIVE);
+            char chunk[size] = {};
+            for (int64_t i = 0; i < n; ++i)
+            {
+                size_t written = 0;
+                while (written < size)
+                {
+                    ssize_t w = write(fds[1], chunk + written, size - written);
+                    if (w > 0)
+                        written += w;
+                    else
+                        std::this_thread::yield();
+                }
+            }
+            c.done.wait();
+            cppactor::framework::instance()->unwatch_fd(fds[0]);
+            cppactor::framework::instance()->stop_actor(receiver);
+            close(fds[0]);
+            close(fds[1]);
+            return n;
+        });
+    }
+
+    // Writes a block per item, itself or through a file_io
+    class FileWriterActor : public cppactor::actor
+    {
+    public:
+        enum {BLOCK = 4096};
+
+        FileWriterActor(countdown *c, int fd, cppactor::file_io *io, int file)
+        : m_countdown(c)
+        , m_fd(fd)
+        , m_io(io)
+        , m_file(file)
+        {
+            memset(m_block, 'x', sizeof(m_block));
+        }
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            if (msg->msg_id == cppactor::file_io_done::msg_id)
+            {
+                m_countdown->count_down();
+                return;
+            }
+            uint64_t offset = static_cast<Item *>(msg.get())->n * BLOCK;
+            if (m_io == nullptr)
+            {
+                if (pwrite(m_fd, m_block, BLOCK, offset) == BLOCK)
+                    m_countdown->count_down();
+                return;
+            }
+            cppactor::file_buffer *b = m_io->get_buffer();
+            if (b)
+            {
+                memcpy(b->data, m_block, BLOCK);
+                b->size = BLOCK;
+                m_io->write(get_ref(), m_file, offset, b);
+            }
+            else
+                m_io->write(get_ref(), m_file, offset, m_block, BLOCK);
+        }
+
+        countdown *m_countdown;
+        int m_fd;
+        cppactor::file_io *m_io;
+        int m_file;
+        char m_block[BLOCK];
+    };
+
+    /*
+     * file_write_blocking: an actor pwrite()s a 4K block per message, then
+     * the file is fdatasync()ed. file_write_uring: the actor submits the
+     * writes to a file_io and counts their completions, then the fsync
+     * goes through it too. file_write_uring_sqpoll: the same with the
+     * kernel polling the ring. ops is the number of blocks. The file_io's
+     * operations per io_uring_enter() are reported after them.
+     */
+    void bench_file_io()
+    {
+        uint32_t poolid = bench_pool<FileWriterActor>();
+        std::string path = "/tmp/cppactor-bench-" + std::to_string(getpid()) + ".dat";
+        cppactor::file_io_stats stats = {0, 0, 0, 0, 0};
+        cppactor::file_io_stats sqpoll_stats = {0, 0, 0, 0, 0};
+
+        run_benchmark("file_write_blocking", [&]() -> int64_t {
+            int64_t n = scaled(100000);
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+                return 0;
+            countdown c;
+            c.reset(n);
+            cppactor::actor_iptr writer = cppactor::create_actor<FileWriterActor>(poolid, &c, fd, nullptr, -1);
+            for (int64_t i = 0; i < n; ++i)
+                writer->enqueue(new Item(i));
+            c.done.wait();
+            fdatasync(fd);
+            cppactor::framework::instance()->stop_actor(writer);
+            close(fd);
+            return n;
+        });
+        auto write_uring = [&](const cppactor::file_io_options& options, cppactor::file_io_stats& totals) -> int64_t {
+            int64_t n = scaled(100000);
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+                return 0;
+            countdown c;
+            {
+                cppactor::file_io io(options);
+                int file = io.register_file(fd);
+                c.reset(n);
+                cppactor::actor_iptr writer = cppactor::create_actor<FileWriterActor>(poolid, &c, fd, &io, file);
+                for (int64_t i = 0; i < n; ++i)
+                    writer->enqueue(new Item(i));
+                c.done.wait();
+                c.reset(1);
+                io.fsync(writer->get_ref(), file, true);
+                c.done.wait();
+                cppactor::file_io_stats s = io.get_stats();
+                totals.submitted += s.submitted;
+                totals.enters += s.enters;
+                cppactor::framework::instance()->stop_actor(writer);
+                io.unregister_file(file);
+            }
+            close(fd);
+            return n;
+        };
+        run_benchmark("file_write_uring", [&]() -> int64_t {
+            return write_uring(cppactor::file_io_options(), stats);
+        });
+        run_benchmark("file_write_uring_sqpoll", [&]() -> int64_t {
+            cppactor::file_io_options options;
+            options.sq_poll_idle_ms = 10;
+            return write_uring(options, sqpoll_stats);
+        });
+        unlink(path.c_str());
+
+        if (stats.enters != 0 && !g_options.csv)
+            std::cout << "{\"file_io\":\"file_write_uring\",\"ops_per_enter\":" << stats.ops_per_enter() << "}" << std::endl;
+        if (sqpoll_stats.enters != 0 && !g_options.csv)
+            std::cout << "{\"file_io\":\"file_write_uring_sqpoll\",\"ops_per_enter\":" << sqpoll_stats.ops_per_enter() << "}" << std::endl;
+    }
+
+    // Burns about 'work_ns' per message, then counts it
+    class BusyActor : public cppactor::actor
+    {
+    public:
+        BusyActor(countdown *c, int64_t work_ns)
+        : m_countdown(c)
+        , m_work_ns(work_ns)
+        {}
+
+        void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+        {
+            auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(m_work_ns);
+            while (std::chrono::steady_clock::now() < until)
+                ;
+            m_countdown->count_down();
+        }
+
+        countdown *m_countdown;
+        int64_t m_work_ns;
+    };
+
+    /*
+     * deadline_fifo and deadline_edf: each round queues 4 messages of 5us
+     * work for each of 64 background actors, then one message with a 200us
+     * deadline for an urgent actor, and waits for all of them. ops is the
+     * number of rounds. The urgent messages handled after their deadline
+     * are reported after them, for a FIFO pool and a SCHEDULE_DEADLINE one.
+     */
+    void bench_deadline()
+    {
+        const char *names[2] = {"deadline_fifo", "deadline_edf"};
+        for (int edf = 0; edf < 2; ++edf)
+        {
+            if (!selected(names[edf]))
+                continue;
+            uint32_t poolid = g_next_poolid++;
+            cppactor::create_pool<BusyActor>(poolid, g_options.threads, edf ? cppactor::SCHEDULE_DEADLINE : cppactor::SCHEDULE_FIFO);
+            run_benchmark(names[edf], [=]() -> int64_t {
+                int64_t rounds = scaled(2000);
+                const int background = 64;
+                const int backlog = 4;
+                countdown c;
+                std::vector<cppactor::actor_iptr> actors;
+                for (int i = 0; i < background; ++i)
+                    actors.push_back(cppactor::create_actor<BusyActor>(poolid, &c, 5000));
+                cppactor::actor_iptr urgent = cppactor::create_actor<BusyActor>(poolid, &c, 1000);
+                for (int64_t r = 0; r < rounds; ++r)
+                {
+                    c.reset(background * backlog + 1);
+                    for (int k = 0; k < backlog; ++k)
+                    {
+                        for (auto& a : actors)
+                            a->enqueue(new Item(k));
+                    }
+                    Item *order = new Item(r);
+                    order->set_deadline_after(std::chrono::microseconds(200));
+                    urgent->enqueue(order);
+                    c.done.wait();
+                }
+                stop_all(actors);
+                cppactor::framework::instance()->stop_actor(urgent);
+                return rounds;
+            });
+
+            cppactor::deadline_stats stats = cppactor::framework::instance()->get_deadline_stats(poolid);
+            if (!g_options.csv)
+                std::cout << "{\"scheduling\":\"" << (edf ? "deadline" : "fifo") << "\",\"benchmark\":\"" << names[edf] << "\",\"deadlines\":" << stats.handled
+                          << ",\"missed\":" << stats.missed << ",\"max_lateness_ns\":" << stats.max_lateness_ns << "}" << std::endl;
+        }
+    }
+
+    /*
+     * Lock contention matrix: 1 to 8 threads take the lock in a tight loop
+     * around a short critical section. ops is the total number of acquisitions.
+     */
+    template <typename Lock>
+    void bench_lock(const char *kind)
+    {
+        for (int nthreads = 1; nthreads <= 8; nthreads *= 2)
+        {
+            std::string name = std::string("lock_") + kind + "/" + std::to_string(nthreads);
+            run_benchmark(name, [=]() -> int64_t {
+                int64_t per_thread = scaled(1000000) / nthreads;
+                Lock lock;
+                volatile int64_t shared = 0;
+                std::vector<std::thread> threads;
+                for (int t = 0; t < nthreads; ++t)
+                {
+                    threads.emplace_back([&]() {
+                        for (int64_t i = 0; i < per_thread; ++i)
+                        {
+                            miscutils::SpinLockMonitor<Lock> guard(lock);
+                            shared = shared + 1;
+                        }
+                    });
+                }
+                for (auto& t : threads)
+                    t.join();
+                return per_thread * nthreads;
+            });
+        }
+    }
+
+    /*
+     * Queue matrix: N producer and N consumer threads move int64_t's through
+     * the queue. ops is the number of elements. The bounded queue's
+     * producers yield while it is full. The vendored
+     * miscutils::LowLockMultiProducerQueue is the baseline of
+     * detail::low_lock_queue, its fork.
+     */
+    template <typename Queue>
+    void queue_push(Queue& q, int64_t v)
+    {
+        q.push(std::move(v));
+    }
+
+    void queue_push(cppactor::bounded_mpmc_queue<int64_t>& q, int64_t v)
+    {
+        while (!q.try_push(std::move(v)))
+            std::this_thread::yield();
+    }
+
+    void queue_push(miscutils::LowLockMultiProducerQueue<int64_t>& q, int64_t v)
+    {
+        q.Produce(v);
+    }
+
+    template <typename Queue>
+    bool queue_pop(Queue& q, int64_t& v)
+    {
+        return q.try_pop(v);
+    }
+
+    bool queue_pop(miscutils::LowLockMultiProducerQueue<int64_t>& q, int64_t& v)
+    {
+        return q.Consume(v);
+    }
+
+    template <typename Queue, typename Make>
+    void bench_queue(const char *kind, Make make)
+    {
+        for (int nthreads = 1; nthreads <= 4; nthreads *= 2)
+        {
+            std::string name = std::string("queue_") + kind + "/" + std::to_string(nthreads);
+            run_benchmark(name, [=]() -> int64_t {
+                int64_t per_producer = scaled(1000000) / nthreads;
+                int64_t total = per_producer * nthreads;
+                std::unique_ptr<Queue> q(make());
+                std::atomic<int64_t> consumed(0);
+                std::vector<std::thread> threads;
+                for (int t = 0; t < nthreads; ++t)
+                {
+                    threads.emplace_back([&]() {
+                        for (int64_t i = 0; i < per_producer; ++i)
+                            queue_push(*q, i);
+                    });
+                    threads.emplace_back([&]() {
+                        int64_t v;
+                        while (consumed.load(std::memory_order_relaxed) < total)
+                        {
+                            if (queue_pop(*q, v))
+                                consumed.fetch_add(1, std::memory_order_relaxed);
+                            else
+                                std::this_thread::yield();
+                        }
+                    });
+                }
+                for (auto& t : threads)
+                    t.join();
+                return total;
+            });
+        }
+    }
+
+    // Framework lock counters, only available when built with CPPACTOR_LOCK_STATS
+    void report_lock_stats()
+    {
+#ifdef CPPACTOR_LOCK_STATS
+        cppactor::detail::for_each_lock_stats([](const char *name, cppactor::detail::spin_lock_counters& c) {
+            std::cout << "{\"lock\":\"" << name << "\""
+                      << ",\"acquisitions\":" << c.acquisitions.load()
+                      << ",\"contended\":" << c.contended.load()
+                      << ",\"spin_cycles\":" << c.spin_cycles.load() << "}" << std::endl;
+        });
+#endif
+    }
+
+    bool parse_options(int argc, char *argv[])
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg(argv[i]);
+            bool has_value = i + 1 < argc;
+            if (arg == "--threads" && has_value)
+                g_options.threads = std::max(1, atoi(argv[++i]));
+            else if (arg == "--reps" && has_value)
+                g_options.reps = std::max(1, atoi(argv[++i]));
+            else if (arg == "--scale" && has_value)
+                g_options.scale = std::max(0.0001, atof(argv[++i]));
+            else if (arg == "--filter" && has_value)
+                g_options.filter = argv[++i];
+            else if (arg == "--format" && has_value)
+                g_options.csv = strcmp(argv[++i], "csv") == 0;
+            else
+            {
+                std::cerr << "usage: " << argv[0] << " [--threads N] [--reps N] [--scale F] [--filter name] [--format json|csv]" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (!parse_options(argc, argv))
+        return 1;
+
+    cppactor::framework framework;
+
+    report_header();
+    bench_ping_pong();
+    bench_ask();
+    bench_fan_in("fan_in", false);
+    bench_fan_in("fan_in_deferred", true);
+    bench_broadcast();
+    bench_skynet();
+    bench_timer_churn();
+    bench_find_any();
+    bench_enqueue_message();
+    bench_enqueue_function();
+    bench_dead_letters();
+    bench_submit();
+    bench_parallel();
+    bench_spawn();
+    bench_pipeline();
+    bench_journal();
+    bench_capture();
+    bench_shm();
+    bench_uds();
+    bench_reactor();
+    bench_file_io();
+    bench_deadline();
+    bench_lock<miscutils::SimpleSpinLock>("simple");
+    bench_lock<cppactor::detail::ttas_spin_lock<> >("ttas");
+    bench_lock<cppactor::detail::ticket_spin_lock<> >("ticket");
+    bench_lock<cppactor::detail::mcs_spin_lock<> >("mcs");
+    bench_lock<std::mutex>("mutex");
+    bench_queue<miscutils::LowLockMultiProducerQueue<int64_t> >("miscutils_low_lock", []() {return new miscutils::LowLockMultiProducerQueue<int64_t>();});
+    bench_queue<cppactor::detail::low_lock_queue<int64_t> >("low_lock", []() {return new cppactor::detail::low_lock_queue<int64_t>();});
+    bench_queue<cppactor::bounded_mpmc_queue<int64_t> >("bounded", []() {return new cppactor::bounded_mpmc_queue<int64_t>(1024);});
+    bench_queue<cppactor::unbounded_mpmc_queue<int64_t> >("unbounded", []() {return new cppactor::unbounded_mpmc_queue<int64_t>();});
+    report_lock_stats();
+
+    framework.shutdown();
+    return 0;
+}
@@ -7,7 +7,23 @@ lang = cpp
 source = source/actor.cpp \
 		 source/pool_base.cpp \
 		 source/framework.cpp \
-		 source/message.cpp
+		 source/message.cpp \
+		 source/actor_table.cpp \
+		 source/timer_wheel.cpp \
+		 source/send_buffer.cpp \
+		 source/parallel.cpp \
+		 source/hibernation.cpp \
+		 source/actor_blocks.cpp \
+		 source/pipeline.cpp \
+		 source/journal.cpp \
+		 source/capture.cpp \
+		 source/shm_transport.cpp \
+		 source/uds_transport.cpp \
+		 source/reactor.cpp \
+		 source/file_io.cpp \
+		 source/deadline_queue.cpp \
+		 source/watchdog.cpp \
+		 source/dead_letters.cpp
 
 cpp_compiler_flags += -Wno-unused-parameter        \
                       -Wno-type-limits             \
@@ -18,15 +18,45 @@
 #include <atomic>
 #include <memory>
 #include <cassert>
+#include <cstddef>
+#include <new>
 #include <functional>
+#include <typeinfo>
+#include <ttstl/platform.h>
 #include "cppactor/detail/pool_base.h"
-#include <queue>
-#include "miscutils/binary_spin_lock.h"
+#include "cppactor/actor_ref.h"
+#include "cppactor/detail/ask_table.h"
+#include <vector>
+#include "cppactor/detail/locks.h"
+#include "cppactor/detail/mailbox.h"
 
 namespace cppactor
 {
     class message;
     class framework;
+    class journal;
+    class journal_writer;
+    class journal_reader;
+    class traffic_capture;
+
+    namespace detail
+    {
+        class send_buffer;
+        class exit_msg;
+
+        uint16_t next_actor_type_index(const char *name);
+
+        // The demangled name of the actor type with that index, for reports
+        const char *actor_type_name(uint16_t index);
+
+        // Dense index of an actor type, numbered from 1 on first use
+        template <typename Actor>
+        uint16_t actor_type_index()
+        {
+            static const uint16_t index = next_actor_type_index(typeid(Actor).name());
+            return index;
+        }
+    }
 
 #define private_impl public
 
@@ -37,15 +67,36 @@ namespace cppactor
     {
     public:
         actor()
-        : type_id(0)
+        : m_suspended(0)
+        , type_id(0)
+        , m_asks(nullptr)
         , actor_id(0)
+        , m_hibernate_ticks(0)
+        , m_idle_since(0)
+        , m_interleave(false)
+        , m_defer_sends(false)
+        , m_hibernated(false)
         , stopped(false)
+        , m_in_turn(false)
+        , m_active(false)
+        , m_release_mailbox(false)
+        , m_pool(0)
+        , m_journal(0)
+        , m_capture(0)
         {}
 
         ~actor();
 
+        // Actors made by create_actors() share a block of memory
+        static void *operator new(size_t n);
+        static void *operator new(size_t n, std::align_val_t align);
+        static void operator delete(void *p, size_t n);
+        static void operator delete(void *p, size_t n, std::align_val_t align);
+
         /* 
-         * Send a message to this actor
+         * Send a message to this actor. Returns 0 if the actor has been
+         * stopped, the message is then the caller's and counted as a dead
+         * letter, see framework::get_dead_letter_stats().
          */
         unsigned int enqueue(message *);
         
@@ -68,8 +119,71 @@ namespace cppactor
          */
         virtual void on_timer(int timerid) {}
 
+        /* Called on the actor's thread when it goes into hibernation, see
+         * hibernate_after(). Release what can be rebuilt later and return
+         * the number of bytes freed, for the statistics.
+         */
+        virtual size_t on_hibernate() {return 0;}
+
+        /* Called on the actor's thread before the first message it handles
+         * after hibernating
+         */
+        virtual void on_wake() {}
+
         uint32_t get_actorid() const {return actor_id;}
         bool is_stopped() {return stopped;}
+
+        /* Returns the address of this actor, see actor_ref.h
+         */
+        actor_ref get_ref() const {return m_ref;}
+
+        /* Returns the actor whose handler is running on this thread, if any
+         */
+        static actor *current() {return t_current;}
+
+        /* By default no other message is handled while a coroutine handler of
+         * this actor is suspended, see coroutine.h. Pass true to let messages
+         * interleave with suspended handlers.
+         */
+        void allow_interleaving(bool allow) {m_interleave = allow;}
+
+        /* Pass true to stage the messages this actor's handlers send, and
+         * deliver them when the handler returns. Each target then takes one
+         * lock and at most one wakeup per handler, however many messages it
+         * was sent. Messages to the same target keep their order. While
+         * staged, enqueue() returns 1 rather than the queue size.
+         */
+        void defer_sends(bool defer) {m_defer_sends = defer;}
+
+        /* Opt in to hibernation. Once this actor has been sent no message
+         * for idle_ms, on_hibernate() is called and its mailbox storage is
+         * freed. The next enqueue() wakes it up transparently. Idle actors
+         * are found by a sweep of all actors, so idle_ms is rounded up to the
+         * time a sweep takes, about 10ms per 8192 actors. 0 opts out.
+         */
+        void hibernate_after(int idle_ms);
+
+        /* Opt in to journaling, see journal.h. The messages of registered
+         * types are appended to j under 'key' before they are handled, from
+         * the first message sent after this call. The key must name this
+         * actor to journal::replay() after a restart.
+         */
+        void journal_to(journal& j, uint64_t key);
+
+        /* Called on the actor's thread for a journal checkpoint, write the
+         * state the messages journaled so far have built up
+         */
+        virtual void on_journal_snapshot(journal_writer& out) {}
+
+        /* Called on the actor's thread by journal::replay(), with what
+         * on_journal_snapshot() wrote, before the messages that followed it
+         */
+        virtual void on_journal_restore(journal_reader& in) {}
+
+        /* Record the messages sent to this actor in c under 'key', see
+         * capture.h. The key must name this actor to traffic_replay::run().
+         */
+        void capture_to(traffic_capture& c, uint64_t key);
     protected:
         /* Returns an actor_iptr (instrusive_ptr<actor>) for this. 
          * Derived classes can call this to call api's that require
@@ -79,19 +193,90 @@ namespace cppactor
     private_impl: 
         bool consume_one_item(cppactor::message*& pMsg);
         bool requeue();
+        size_t queued_messages();
+
+        // ask<>() support, see ask.h
+        detail::ask_table& get_asks();
+        bool ask_pending(uint32_t token) const;
+        void complete_ask(std::unique_ptr<message>& msg);
+        void expire_ask(uint32_t token);
+
+        // coroutine support, see coroutine.h
+        bool holds_messages() const {return m_suspended != 0 && !m_interleave;}
+        void release_held_messages();
+
+        // deadline scheduled pools, under the mailbox lock. The mailbox
+        // keeps the earliest deadline of the messages not handled yet.
+        unsigned int enqueue_by_deadline(detail::pool_base *p, message *pMsg);
+        void note_deadline(const message *pMsg);
+        void forget_deadline(const message *pMsg);
+
+        // sent while stopped, see dead_letter.h
+        void dead_letter(const message *pMsg);
+
+        // deferred sends, see defer_sends()
+        unsigned int enqueue_batch(message **msgs, size_t count);
+        static void flush_deferred_sends() {if (t_have_deferred) flush_sends();}
+        static void defer_send(actor *target, message *pMsg);
+        static void flush_sends();
+
+        // framework::shutdown() support
+        void begin_exit(detail::exit_msg *pMsg);
+        void exit(detail::exit_msg *pMsg);
+
+        // hibernation support, see hibernate_after()
+        void sweep_idle(uint32_t now);
+        void hibernate();
+        void wake();
+        void release_mailbox();
+
+        detail::pool_base *pool() const {return detail::pool_base::from_slot(m_pool);}
+        void hold(message *pMsg);
+
+        // journaling support, see journal_to()
+        void journal_message(const message *pMsg);
+
+        // traffic capture support, see capture_to()
+        void capture_message(const message *pMsg);
     private_impl:
-        size_t type_id;
-        std::queue<message*> m_queue;
-        detail::pool_t m_pPool;
+        // Used by the thread handling the actor. The first two fill the
+        // padding at the end of instrusive_base.
+        uint16_t m_suspended;                       // coroutine handlers waiting to resume
+        uint16_t type_id;                           // detail::actor_type_index<>() of the most derived type
+        std::atomic<detail::ask_table *> m_asks;    // allocated by the first ask<>()
+        std::unique_ptr<std::vector<message*> > m_held; // messages held back while a handler is suspended
+        actor_ref m_ref;
         uint32_t actor_id;
+        std::atomic<uint32_t> m_hibernate_ticks;    // idle period in hibernation::TICK_MS, 0 if not opted in
+        uint32_t m_idle_since;                      // hibernation::now() when last seen active
+        bool m_interleave;
+        bool m_defer_sends;
+        bool m_hibernated;
 
-        miscutils::SimpleSpinLock m_spin_lock;
+        // Used by senders, under the mailbox lock. Define
+        // CPPACTOR_SPLIT_ACTOR_LINES to give them their own cache line, at
+        // the cost of up to 64 more bytes per actor.
+#ifdef CPPACTOR_SPLIT_ACTOR_LINES
+        alignas(TT_CACHE_LINE_SIZE)
+#endif
+        detail::mailbox_lock m_spin_lock;
+        std::atomic<bool> stopped;
+        bool m_in_turn;                             // a pool thread is handling the front message
+        bool m_active;                              // handled a message since the last idle sweep
+        bool m_release_mailbox;                     // hibernating, free the mailbox once empty
+        uint16_t m_pool;                            // detail::pool_base::get_slot()
+        uint8_t m_journal;                          // journal::get_slot(), 0 if not journaling. Used by the
+                                                    // thread handling the actor, here to fill padding
+        std::atomic<uint8_t> m_capture;             // traffic_capture::get_slot(), 0 if not captured
+        detail::mailbox m_queue;
 
         static std::atomic<uint32_t> m_actorids;
+        static thread_local actor *t_current;
+        static thread_local bool t_have_deferred;
+        static thread_local detail::send_buffer t_sends;
     private:
         friend framework;
         void stop() {stopped = true;}
-        std::atomic<bool> stopped;
     };
 
     inline actor_iptr actor::convert_this() {return actor_iptr(this);}
@@ -111,43 +296,96 @@ namespace cppactor
     {
         assert(type_id != 0);   // This actor should have been created with cppactor::create_actor<>()
         if (stopped)
+        {
+            dead_letter(pMsg);
             return 0;
+        }
+        if (m_capture.load(std::memory_order_relaxed) != 0)
+            capture_message(pMsg);
 
-        miscutils::SpinLockMonitor<miscutils::SimpleSpinLock> lock(m_spin_lock);
-        m_queue.push(pMsg);
+        actor *sender = t_current;
+        if (sender && sender->m_defer_sends)
+        {
+            defer_send(this, pMsg);
+            return 1;
+        }
+
+        miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+        detail::pool_base *p = pool();
+        if (p->by_deadline())
+            return enqueue_by_deadline(p, pMsg);
+        m_queue.push_back(pMsg);
         if (m_queue.size()==1)
-            m_pPool->notify_one(this);
+            p->notify_one(this);
         else
-            m_pPool->notify_one();
+            p->notify_one();
 
         return m_queue.size();// use outside lock for statistical and logging use only
     }
 
     inline bool actor::consume_one_item(cppactor::message*& pMsg)
     {
-        miscutils::SpinLockMonitor<miscutils::SimpleSpinLock> lock(m_spin_lock);
+        miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
         if (m_queue.empty())
             return false;
 
         pMsg=m_queue.front();// note no pop
+        m_in_turn = true;
+        if (pool()->by_deadline())
+            forget_deadline(pMsg);  // ranks the actor only while it waits
         return true;
     }
 
     inline bool actor::requeue()
     {
-        miscutils::SpinLockMonitor<miscutils::SimpleSpinLock> lock(m_spin_lock);
+        miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
 
         // release the last processed msg and see where we are queue wise
         if (m_queue.size())
-            m_queue.pop();
+            m_queue.pop_front();
+        m_in_turn = false;
+        m_active = true;
+        if (m_release_mailbox)
+            release_mailbox();
 
         if (!stopped && m_queue.size())
         {
-            m_pPool->notify_one(this);
+            pool()->notify_one(this);
             return true;
         }
         return false;
     }
+
+    // Under the mailbox lock, hibernation may free the mailbox's storage
+    inline size_t actor::queued_messages()
+    {
+        miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+        return m_queue.size();
+    }
+
+    inline void actor::hold(message *pMsg)
+    {
+        if (!m_held)
+            m_held.reset(new std::vector<message*>());
+        m_held->push_back(pMsg);
+    }
+
+    inline void actor::release_held_messages()
+    {
+        if (!m_held || m_held->empty() || holds_messages())
+            return;
+
+        // The held messages arrived before anything still queued. The front of the
+        // queue is the message being processed, requeue() will pop it.
+        miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+        if (pool()->by_deadline())
+        {
+            for (message *pMsg : *m_held)
+                note_deadline(pMsg);
+        }
+        m_queue.insert(m_queue.empty() ? 0 : 1, m_held->begin(), m_held->end());
+        m_held->clear();
+    }
 }   // cppactor
 
 
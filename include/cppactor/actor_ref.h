@@ -0,0 +1,91 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include "cppactor/instrusive_ptr.h"
+
+namespace cppactor
+{
+    class message;
+    class actor;
+    typedef instrusive_ptr<actor> actor_iptr;
+
+    /****************************************************************
+     * The address of an actor.
+     *
+     * An actor_ref is a slot index and generation in the framework's
+     * actor table. It is trivially copyable and does not keep the actor
+     * alive. Sending through it from a pool thread costs no reference
+     * count operations, and once the actor is stopped every send through
+     * an old actor_ref is detected and dropped.
+     *
+     * Example:
+     *      void on_message(std::unique_ptr<Ping>& msg, cppactor::actor_ref& replyto)
+     *      {
+     *          if (replyto)
+     *              replyto.enqueue(new Pong(...));
+     *      }
+     */
+    class actor_ref
+    {
+    public:
+        actor_ref()
+        : m_slot(0)
+        , m_generation(0)
+        {}
+
+        actor_ref(uint32_t slot, uint32_t generation)
+        : m_slot(slot)
+        , m_generation(generation)
+        {}
+
+        /*
+         * Send a message to the actor. The message is deleted if the
+         * actor has been stopped. Returns the queue length, 0 if dropped.
+         */
+        unsigned int enqueue(message *) const;
+
+        /*
+         * Enqueue a function to be executed by the actor.
+         */
+        unsigned int enqueue(std::function<void (cppactor::actor_iptr)>&&) const;
+
+        /*
+         * Returns a counted reference to the actor, or null if it has been stopped.
+         */
+        actor_iptr resolve() const;
+
+        // true if this refers to an actor, it may have been stopped since
+        explicit operator bool() const {return m_generation != 0;}
+
+        // Allows reply_to->enqueue(...) in handlers written for actor_iptr
+        const actor_ref *operator->() const {return this;}
+
+        uint32_t get_slot() const {return m_slot;}
+        uint32_t get_generation() const {return m_generation;}
+
+        bool operator==(const actor_ref& rhs) const {return m_slot == rhs.m_slot && m_generation == rhs.m_generation;}
+        bool operator!=(const actor_ref& rhs) const {return !(*this == rhs);}
+    private:
+        uint32_t m_slot;
+        uint32_t m_generation;      // 0 is the null reference
+    };
+
+    static_assert(std::is_trivially_copyable<actor_ref>::value, "actor_ref must be trivially copyable");
+} // cppactor
@@ -0,0 +1,115 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <memory>
+#include <cassert>
+#include <utility>
+#include <type_traits>
+#include "cppactor/actor.h"
+#include "cppactor/message.h"
+#include "cppactor/framework.h"
+#include "cppactor/detail/system_messages.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        // Adapts the user's callback to the continuation signature
+        template <typename Reply, typename F>
+        struct ask_continuation
+        {
+            template <typename G>
+            explicit ask_continuation(G&& g)
+            : func(std::forward<G>(g))
+            {}
+
+            void operator()(message_uptr& msg)
+            {
+                std::unique_ptr<Reply> reply;
+                if (msg && msg->msg_id == Reply::msg_id)
+                    reply.reset(static_cast<Reply *>(msg.release()));
+                func(reply);
+            }
+
+            F func;
+        };
+    }
+
+/********************************************************************
+ * Send a request and run a continuation when the reply arrives.
+ *
+ * Must be called from an actor's message handler. The callback runs later
+ * on that actor's thread, in place of an on_message() call, with either the
+ * reply or an empty pointer if timeout_ms expired first (or the target has
+ * been stopped). A reply of another type is treated as a timeout. A
+ * timeout_ms of 0 waits forever.
+ *
+ * Continuations are kept in a per-actor pool and timeouts in the timer
+ * wheel, neither allocates per request once warmed up. Keep the callback's
+ * captures small (continuation::INLINE_SIZE bytes) to stay off the heap.
+ *
+ * Reply:    The expected response type
+ * F:        void(std::unique_ptr<Reply>& reply)
+ * Example:
+ *      cppactor::ask<Pong>(pinger, new Ping(...), 100, [this](std::unique_ptr<Pong>& pong) {
+ *          if (pong)
+ *              ...
+ *      });
+ *
+ * The receiving actor answers with cppactor::reply(*msg, new Pong(...)).
+ */
+template <typename Reply, typename F>
+void ask(actor_ref target, message *msg, int timeout_ms, F&& callback)
+{
+    actor *self = actor::current();
+    assert(self != nullptr);    // ask<>() is only valid inside a message handler
+
+    typedef detail::ask_continuation<Reply, typename std::decay<F>::type> continuation_type;
+    uint32_t token = self->get_asks().add(continuation_type(std::forward<F>(callback)));
+
+    msg->m_reply_to = self->get_ref();
+    msg->m_request_token = token;
+    if (timeout_ms > 0)
+        framework::instance()->get_timer_wheel().add(self->get_ref(), token, timeout_ms);
+
+    if (target.enqueue(msg) == 0)
+    {
+        // the target has been stopped, fail on the next turn rather than re-entering the caller
+        message *timeout = new detail::ask_timeout_msg(token);
+        if (self->enqueue(timeout) == 0)
+            delete timeout;     // and so has the caller
+    }
+}
+
+template <typename Reply, typename F>
+void ask(const actor_iptr& target, message *msg, int timeout_ms, F&& callback)
+{
+    ask<Reply>(target->get_ref(), msg, timeout_ms, std::forward<F>(callback));
+}
+
+/********************************************************************
+ * Answer a request. The response goes to the request's reply_to, and
+ * completes the asker's continuation if the request came from ask<>().
+ * Returns 0 if the response was dropped.
+ */
+inline unsigned int reply(const message& request, message *response)
+{
+    response->m_reply_token = request.m_request_token;
+    return request.m_reply_to.enqueue(response);
+}
+
+} // cppactor
@@ -0,0 +1,206 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include "cppactor/actor.h"
+#include "cppactor/actor_ref.h"
+#include "cppactor/detail/locks.h"
+
+/********************************************************************
+ * Traffic capture and replay
+ *
+ * A traffic_capture records the messages sent to the actors that called
+ * actor::capture_to(), as they are enqueued: when, to which actor, the
+ * msg_id and the flat form of the message. Message types are flattened by
+ * the functions registered with register_journal_message<>(), see
+ * journal.h, other types are recorded without a payload.
+ *
+ *      cppactor::traffic_capture capture("/tmp/orders.trf");
+ *      for (auto& b : books)
+ *          b->capture_to(capture, b->instrument_id());
+ *      ...
+ *      capture.stop();
+ *
+ * A load test builds the same actors from a new build and sends them the
+ * recorded stream with traffic_replay, at the recorded speed, N times
+ * faster, or as fast as possible:
+ *
+ *      cppactor::traffic_replay replay("/tmp/orders.trf");
+ *      cppactor::traffic_replay_options options;
+ *      options.speed = 4.0;
+ *      auto stats = replay.run([&](uint64_t key) {return find_book(key);}, options);
+ *
+ * and reports the throughput and the latency from sending a message to
+ * its handler returning, to compare releases on real traffic shapes.
+ *
+ * Senders copy the records into a buffer under a spin lock, a writer
+ * thread writes it to the file every flush_interval_ms.
+ */
+namespace cppactor
+{
+    struct traffic_capture_options
+    {
+        traffic_capture_options()
+        : flush_interval_ms(10)
+        , max_buffer(64 << 20)
+        {}
+
+        int flush_interval_ms;      // the writer thread writes the buffer this often
+        size_t max_buffer;          // bytes waiting for the writer, records beyond it are dropped
+    };
+
+    class traffic_capture
+    {
+    public:
+        enum {MAX_CAPTURES = 255};
+
+        // Creates, or truncates, the file at path
+        explicit traffic_capture(const std::string& path, const traffic_capture_options& options = traffic_capture_options());
+        ~traffic_capture();
+
+        traffic_capture(const traffic_capture&) = delete;
+        traffic_capture& operator = (const traffic_capture&) = delete;
+
+        // Stops recording and writes out what was recorded. Destroy the
+        // capture after stop(), once no more messages are being sent to
+        // the actors, or after framework::shutdown().
+        void stop();
+
+        bool ok() const {return !m_failed.load(std::memory_order_relaxed);}
+        uint64_t get_record_count() const {return m_records.load(std::memory_order_relaxed);}
+        uint64_t get_dropped_count() const {return m_dropped.load(std::memory_order_relaxed);}
+
+    private_impl:
+        uint8_t get_slot() const {return m_slot;}
+        static traffic_capture *from_slot(uint8_t slot) {return s_slots[slot].load(std::memory_order_acquire);}
+
+        // see actor::capture_to()
+        void add_actor(actor *a, uint64_t key);
+        void forget(const actor *a);
+        void record(const actor *a, const message *msg);
+
+    private:
+        struct entry
+        {
+            uint64_t key;
+            actor_ref ref;
+        };
+
+        void run_writer();
+        void write_out(std::vector<char>& buffer);
+
+        const traffic_capture_options m_options;
+        uint8_t m_slot;
+        int m_fd;
+        const uint64_t m_start_ns;          // steady clock, the records are relative to it
+
+        // under m_lock
+        detail::capture_lock m_lock;
+        bool m_stopped;
+        std::vector<char> m_buffer;
+        std::unordered_map<const actor *, entry> m_actors;
+
+        std::atomic<uint64_t> m_records;
+        std::atomic<uint64_t> m_dropped;
+        std::atomic<bool> m_failed;
+
+        // under m_writer_mtx
+        std::mutex m_writer_mtx;
+        std::condition_variable m_writer_cv;
+        bool m_quit;
+        std::thread m_writer;
+
+        static std::mutex s_slots_mtx;
+        static std::atomic<traffic_capture *> s_slots[MAX_CAPTURES + 1];
+    };
+
+    struct traffic_replay_options
+    {
+        traffic_replay_options()
+        : speed(1.0)
+        , latency_sample(16)
+        , drain_timeout_ms(10000)
+        {}
+
+        double speed;               // 1 for the recorded speed, 2 for twice as fast, 0 for as fast as possible
+        size_t latency_sample;      // time every Nth message, 0 for none
+        int drain_timeout_ms;       // how long run() waits for the actors to handle what they were sent
+    };
+
+    struct traffic_replay_stats
+    {
+        size_t messages;            // messages sent
+        size_t skipped;             // records of unknown keys or types, or for stopped actors
+        bool drained;               // the actors handled every message before drain_timeout_ms
+        uint64_t recorded_ns;       // from the first to the last record of the capture
+        uint64_t elapsed_ns;        // from the first message sent to the last one handled
+        uint64_t max_lag_ns;        // how far sending fell behind the schedule
+        double messages_per_sec;
+
+        // from sending a message to its handler returning, over 'samples' messages
+        size_t samples;
+        uint64_t latency_p50_ns;
+        uint64_t latency_p90_ns;
+        uint64_t latency_p99_ns;
+        uint64_t latency_p999_ns;
+        uint64_t latency_max_ns;
+    };
+
+    /****************************************************************
+     * Sends a capture back to the actors of a new run, from the calling
+     * thread. The latency of a sampled message is measured by a function
+     * enqueued to its actor right behind it, so it includes the time the
+     * message waited in the mailbox.
+     */
+    class traffic_replay
+    {
+    public:
+        // Reads the file written by a traffic_capture
+        explicit traffic_replay(const std::string& path);
+
+        // false if the file could not be read or is not a capture
+        bool ok() const {return m_ok;}
+        size_t get_record_count() const {return m_records.size();}
+
+        // Sends every record to the actor resolve(key) returns, a null
+        // actor skips the key, and waits for the actors to handle them
+        traffic_replay_stats run(const std::function<actor_iptr(uint64_t key)>& resolve,
+                                 const traffic_replay_options& options = traffic_replay_options());
+
+    private:
+        struct record
+        {
+            uint64_t time_ns;
+            uint64_t key;
+            int msg_id;
+            uint32_t size;
+            size_t offset;          // of the payload in m_data
+        };
+
+        std::vector<char> m_data;
+        std::vector<record> m_records;
+        bool m_ok;
+    };
+} // cppactor
@@ -0,0 +1,358 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "cppactor/coroutine.h requires C++20 coroutines"
+#endif
+#include <coroutine>
+#include <memory>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include "cppactor/actor.h"
+#include "cppactor/ask.h"
+#include "cppactor/framework.h"
+
+/********************************************************************
+ * Coroutine message handlers
+ *
+ * A handler declared to return cppactor::task may co_await a reply or a
+ * delay. The handler runs up to its first co_await inside the normal
+ * on_message() call, and is resumed later on the actor's thread, in place
+ * of an on_message() call, when the reply, the timeout or the delay arrives.
+ *
+ * Coroutine handlers must take the message and the reply address by value,
+ * a reference would dangle once the handler suspends:
+ *
+ *      cppactor::task on_message(std::unique_ptr<Request> msg, cppactor::actor_ref replyto)
+ *      {
+ *          std::unique_ptr<Price> price = co_await cppactor::ask<Price>(pricer, new GetPrice(...), 100);
+ *          if (!price)
+ *              ... timed out
+ *          co_await cppactor::delay(10);
+ *          replyto.enqueue(new Response(...));
+ *      }
+ *
+ * By default an actor handles no other message while one of its handlers
+ * is suspended, they are held and delivered in order once it completes, so
+ * the handler sees the actor's state as it left it. Call
+ * allow_interleaving(true) on the actor to handle other messages meanwhile.
+ *
+ * Frames are allocated from a per-thread cache of recycled blocks, and the
+ * resume points use the actor's ask<>() slots and the timer wheel, so a
+ * steady stream of coroutine handlers does not go to the heap. A frame
+ * whose handler is never resumed, because the actor was destroyed first,
+ * is destroyed with the actor.
+ *
+ * An exception escaping a coroutine handler terminates the pool, as it does
+ * for any other handler.
+ */
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * Per thread cache of coroutine frames, in power of two size
+         * classes from 64 bytes to 4K. Larger frames use operator new.
+         */
+        class frame_allocator
+        {
+        public:
+            enum
+            {
+                MIN_SHIFT = 6
+                , MAX_SHIFT = 12
+                , CLASSES = MAX_SHIFT - MIN_SHIFT + 1
+                , MAX_CACHED = 64       // per size class
+            };
+
+            static void *allocate(size_t n)
+            {
+                int c = size_class(n);
+                if (c < 0)
+                    return ::operator new(n);
+                cache& fc = get_cache();
+                block *b = fc.free[c];
+                if (b)
+                {
+                    fc.free[c] = b->next;
+                    --fc.count[c];
+                    return b;
+                }
+                return ::operator new(size_t(1) << (c + MIN_SHIFT));
+            }
+
+            static void deallocate(void *p, size_t n)
+            {
+                int c = size_class(n);
+                if (c < 0)
+                {
+                    ::operator delete(p);
+                    return;
+                }
+                cache& fc = get_cache();
+                if (fc.count[c] >= MAX_CACHED)
+                {
+                    ::operator delete(p);
+                    return;
+                }
+                block *b = static_cast<block *>(p);
+                b->next = fc.free[c];
+                fc.free[c] = b;
+                ++fc.count[c];
+            }
+
+        private:
+            struct block
+            {
+                block *next;
+            };
+
+            struct cache
+            {
+                cache()
+                {
+                    for (int i = 0; i < CLASSES; ++i)
+                    {
+                        free[i] = nullptr;
+                        count[i] = 0;
+                    }
+                }
+
+                ~cache()
+                {
+                    for (int i = 0; i < CLASSES; ++i)
+                    {
+                        while (free[i])
+                        {
+                            block *b = free[i];
+                            free[i] = b->next;
+                            ::operator delete(b);
+                        }
+                    }
+                }
+
+                block *free[CLASSES];
+                int count[CLASSES];
+            };
+
+            static int size_class(size_t n)
+            {
+                int c = 0;
+                while ((size_t(1) << (c + MIN_SHIFT)) < n)
+                {
+                    if (++c == CLASSES)
+                        return -1;
+                }
+                return c;
+            }
+
+            static cache& get_cache()
+            {
+                static thread_local cache fc;
+                return fc;
+            }
+        };
+
+        /****************************************************************
+         * Resumes a suspended handler from an ask<>() slot. If the slot is
+         * destroyed without being run, the actor is going away and so does
+         * the frame.
+         */
+        class resume_handler
+        {
+        public:
+            resume_handler(std::coroutine_handle<> h, actor *self)
+            : m_handle(h)
+            , m_self(self)
+            {}
+
+            resume_handler(resume_handler&& other)
+            : m_handle(other.m_handle)
+            , m_self(other.m_self)
+            {
+                other.m_handle = nullptr;
+            }
+
+            ~resume_handler()
+            {
+                if (m_handle)
+                    m_handle.destroy();
+            }
+
+            resume_handler(const resume_handler&) = delete;
+            resume_handler& operator = (const resume_handler&) = delete;
+            resume_handler& operator = (resume_handler&&) = delete;
+
+            void resume()
+            {
+                std::coroutine_handle<> h = m_handle;
+                m_handle = nullptr;
+                --m_self->m_suspended;
+                h.resume();
+            }
+
+        private:
+            std::coroutine_handle<> m_handle;
+            actor *m_self;
+        };
+
+        template <typename Reply>
+        struct resume_with_reply
+        {
+            resume_with_reply(std::coroutine_handle<> h, actor *self, std::unique_ptr<Reply> *result)
+            : handler(h, self)
+            , result(result)
+            {}
+
+            void operator()(std::unique_ptr<Reply>& reply)
+            {
+                *result = std::move(reply);
+                handler.resume();
+            }
+
+            resume_handler handler;
+            std::unique_ptr<Reply> *result;
+        };
+
+        struct resume_after_delay
+        {
+            resume_after_delay(std::coroutine_handle<> h, actor *self)
+            : handler(h, self)
+            {}
+
+            void operator()(message_uptr&)
+            {
+                handler.resume();
+            }
+
+            resume_handler handler;
+        };
+
+        template <typename Reply>
+        class ask_awaitable
+        {
+        public:
+            ask_awaitable(actor_ref target, message *msg, int timeout_ms)
+            : m_target(target)
+            , m_msg(msg)
+            , m_timeout(timeout_ms)
+            {}
+
+            ~ask_awaitable()
+            {
+                delete m_msg;   // never awaited
+            }
+
+            ask_awaitable(const ask_awaitable&) = delete;
+            ask_awaitable& operator = (const ask_awaitable&) = delete;
+
+            bool await_ready() const {return false;}
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                actor *self = actor::current();
+                assert(self != nullptr);    // only valid inside a message handler
+                ++self->m_suspended;
+                message *msg = m_msg;
+                m_msg = nullptr;
+                cppactor::ask<Reply>(m_target, msg, m_timeout, resume_with_reply<Reply>(h, self, &m_reply));
+            }
+
+            std::unique_ptr<Reply> await_resume() {return std::move(m_reply);}
+
+        private:
+            actor_ref m_target;
+            message *m_msg;
+            int m_timeout;
+            std::unique_ptr<Reply> m_reply;
+        };
+
+        class delay_awaitable
+        {
+        public:
+            explicit delay_awaitable(int milliseconds)
+            : m_milliseconds(milliseconds)
+            {}
+
+            bool await_ready() const {return false;}
+
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                actor *self = actor::current();
+                assert(self != nullptr);    // only valid inside a message handler
+                ++self->m_suspended;
+                // an ask<>() slot with no request, only the timeout completes it
+                uint32_t token = self->get_asks().add(resume_after_delay(h, self));
+                framework::instance()->get_timer_wheel().add(self->get_ref(), token, m_milliseconds);
+            }
+
+            void await_resume() {}
+
+        private:
+            int m_milliseconds;
+        };
+    }
+
+/********************************************************************
+ * The return type of a coroutine message handler.
+ * The handler starts eagerly and its frame is freed when it completes,
+ * there is nothing to wait on.
+ */
+class task
+{
+public:
+    struct promise_type
+    {
+        task get_return_object() {return task();}
+        std::suspend_never initial_suspend() noexcept {return {};}
+        std::suspend_never final_suspend() noexcept {return {};}
+        void return_void() {}
+        void unhandled_exception() {throw;}
+
+        static void *operator new(size_t n) {return detail::frame_allocator::allocate(n);}
+        static void operator delete(void *p, size_t n) {detail::frame_allocator::deallocate(p, n);}
+    };
+};
+
+/********************************************************************
+ * co_await the reply to a request, see ask.h.
+ * Resumes with the reply, or an empty pointer if timeout_ms expired first
+ * or the target has been stopped. A timeout_ms of 0 waits forever.
+ */
+template <typename Reply>
+detail::ask_awaitable<Reply> ask(actor_ref target, message *msg, int timeout_ms)
+{
+    return detail::ask_awaitable<Reply>(target, msg, timeout_ms);
+}
+
+template <typename Reply>
+detail::ask_awaitable<Reply> ask(const actor_iptr& target, message *msg, int timeout_ms)
+{
+    return detail::ask_awaitable<Reply>(target->get_ref(), msg, timeout_ms);
+}
+
+/********************************************************************
+ * co_await to resume the handler after at least 'milliseconds', with the
+ * resolution of the timer wheel (10ms).
+ */
+inline detail::delay_awaitable delay(int milliseconds)
+{
+    return detail::delay_awaitable(milliseconds);
+}
+
+} // cppactor
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <cstdint>
+#include <memory>
+#include "cppactor/message.h"
+#include "cppactor/framework.h"
+#include "cppactor/detail/system_messages.h"
+
+/********************************************************************
+ * Dead letters
+ *
+ * A message that reaches no handler is a dead letter: its msg_id is not
+ * in the Dispatch<> of the actor, the actor was stopped, its actor_ref no
+ * longer resolves, or the actor's pool was not created with its type. The
+ * framework counts them per reason, actor type and msg_id, see
+ * framework::get_dead_letter_stats(), and the first unhandled message of
+ * each type and msg_id is logged.
+ *
+ * An actor can be sent samples of them, up to max_per_second:
+ *
+ *      framework::instance()->set_dead_letter_actor(auditor->get_ref(), 50);
+ *
+ *      case cppactor::dead_letter::msg_id:
+ *      {
+ *          cppactor::dead_letter *d = static_cast<cppactor::dead_letter *>(msg.get());
+ *          log_misroute(d->reason, d->actor_type, d->message_id);
+ *          break;
+ *      }
+ *
+ * A dead_letter holds the message itself when the framework would have
+ * deleted it. The message a caller of actor::enqueue() keeps, when 0 is
+ * returned, is only described. Dead letters of the dead letter actor are
+ * counted and not forwarded.
+ */
+namespace cppactor
+{
+class dead_letter : public message
+{
+public:
+    enum {msg_id = detail::dead_letter_message_sample};
+
+    dead_letter(dead_letter_reason reason_, uint32_t actor_id_, const char *actor_type_, int message_id_, message_uptr original_)
+    : message(msg_id)
+    , reason(reason_)
+    , actor_id(actor_id_)
+    , actor_type(actor_type_)
+    , message_id(message_id_)
+    , original(std::move(original_))
+    {}
+
+    dead_letter_reason reason;
+    uint32_t actor_id;              // 0 if the actor is not known
+    const char *actor_type;         // "" if the actor is not known
+    int message_id;                 // of the dead letter
+    message_uptr original;          // may be empty, see above
+};
+} // cppactor
@@ -0,0 +1,64 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * Storage for the actors made by create_actors(). They are built
+         * side by side in blocks of up to BLOCK_ACTORS, and a block is freed
+         * once its last actor has been destroyed. actor::operator delete
+         * calls release() to find out whether an actor lives in a block,
+         * which costs nothing until the first block is allocated.
+         */
+        class actor_blocks
+        {
+        public:
+            enum {BLOCK_ACTORS = 4096};
+
+            // Room for count actors of 'stride' bytes, aligned to 'align'
+            static char *allocate(size_t stride, size_t count, size_t align);
+
+            // Free a block whose actors were never handed out
+            static void deallocate(char *block);
+
+            // true if p is an actor in a block, the block goes with its last actor
+            static bool release(void *p);
+
+        private:
+            struct block
+            {
+                size_t bytes;
+                size_t align;
+                size_t live;
+            };
+
+            static void free_block(char *begin, const block& b);
+
+            static std::mutex s_mtx;
+            static std::map<uintptr_t, block> s_blocks;     // by start address
+            static std::atomic<size_t> s_count;
+        };
+    }
+} // cppactor
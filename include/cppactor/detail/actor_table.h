@@ -0,0 +1,169 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include "cppactor/actor_ref.h"
+#include "cppactor/instrusive_ptr.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * Maps actor_ref's to actors.
+         *
+         * Slots live in fixed size segments that are never freed, so a slot
+         * can be read without a lock. The table keeps one reference to each
+         * registered actor. When an actor is retired its generation is bumped,
+         * so no new lookups succeed, and the reference is released once every
+         * pool thread has passed a quiescent point (between two messages or
+         * while idle). Until then a pointer resolved by a pool thread stays valid.
+         *
+         * Threads that are not pool threads take the slower resolve_shared()
+         * path, which holds the table lock while it takes a reference.
+         */
+        class actor_table
+        {
+        public:
+            actor_table();
+            ~actor_table();
+
+            actor_table(const actor_table&) = delete;
+            actor_table& operator = (const actor_table&) = delete;
+
+            // Register an actor and set its actor_ref, the table holds a reference until retire()
+            actor_ref add(const actor_iptr& a);
+
+            // Register count actors under one lock
+            void add(actor *const *actors, size_t count);
+
+            // Invalidate ref, the reference is released by a later reclaim()
+            void retire(actor_ref ref);
+
+            // Release retired actors that no pool thread can still be using
+            void reclaim();
+
+            // Release every actor, used at shutdown
+            void clear();
+
+            // Lock free lookup, only valid on a reader thread until its next quiescent point
+            inline actor *resolve(actor_ref ref) const;
+
+            // Lookup from any thread, returns a counted reference
+            actor_iptr resolve_shared(actor_ref ref);
+
+            // Walk the slots on a reader thread. Returns false past the last
+            // allocated slot, otherwise a is the occupant of slot index, if any
+            inline bool peek(uint32_t index, actor *&a) const;
+
+            // Send through ref, deletes the message if the actor was stopped
+            unsigned int enqueue(actor_ref ref, message *pMsg);
+
+            // Pool threads register as readers, and report quiescent points
+            void register_reader();
+            void unregister_reader();
+            inline void quiescent();
+            void online();
+            void offline();
+            static bool is_reader();
+
+        private:
+            enum
+            {
+                SEGMENT_BITS = 12
+                , SEGMENT_SIZE = 1 << SEGMENT_BITS
+                , MAX_SEGMENTS = 1024
+            };
+
+            struct slot
+            {
+                slot()
+                : ptr(nullptr)
+                , generation(1)
+                {}
+
+                std::atomic<actor *> ptr;
+                std::atomic<uint32_t> generation;   // generation of the current occupant
+                actor_iptr strong;                  // guarded by m_mtx
+            };
+
+            struct reader
+            {
+                reader()
+                : epoch(0)
+                {}
+
+                std::atomic<uint64_t> epoch;        // 0 when offline
+                char pad[64 - sizeof(std::atomic<uint64_t>)];
+            };
+
+            struct retired
+            {
+                uint32_t index;
+                uint64_t epoch;
+            };
+
+            inline slot *get_slot(uint32_t index) const;
+            slot& make_slot(uint32_t index);
+            actor_ref add_locked(const actor_iptr& a);
+
+            std::atomic<slot *> m_segments[MAX_SEGMENTS];
+            std::atomic<uint64_t> m_epoch;
+            std::mutex m_mtx;
+            uint32_t m_next;
+            std::vector<uint32_t> m_free;
+            std::vector<retired> m_retired;
+            std::vector<reader *> m_readers;
+
+            static thread_local reader *t_reader;
+        };
+
+        inline actor_table::slot *actor_table::get_slot(uint32_t index) const
+        {
+            slot *seg = m_segments[index >> SEGMENT_BITS].load(std::memory_order_acquire);
+            return seg ? seg + (index & (SEGMENT_SIZE - 1)) : nullptr;
+        }
+
+        inline actor *actor_table::resolve(actor_ref ref) const
+        {
+            if (!ref || (ref.get_slot() >> SEGMENT_BITS) >= MAX_SEGMENTS)
+                return nullptr;
+            slot *s = get_slot(ref.get_slot());
+            if (s == nullptr || s->generation.load(std::memory_order_acquire) != ref.get_generation())
+                return nullptr;
+            return s->ptr.load(std::memory_order_acquire);
+        }
+
+        inline bool actor_table::peek(uint32_t index, actor *&a) const
+        {
+            slot *s = (index >> SEGMENT_BITS) < MAX_SEGMENTS ? get_slot(index) : nullptr;
+            if (s == nullptr)
+                return false;
+            a = s->ptr.load(std::memory_order_acquire);
+            return true;
+        }
+
+        inline void actor_table::quiescent()
+        {
+            if (t_reader)
+                t_reader->epoch.store(m_epoch.load(std::memory_order_acquire), std::memory_order_release);
+        }
+    }
+} // cppactor
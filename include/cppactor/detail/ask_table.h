@@ -0,0 +1,229 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace cppactor
+{
+    class message;
+    typedef std::unique_ptr<message> message_uptr;
+
+    namespace detail
+    {
+        /****************************************************************
+         * A type erased void(message_uptr&) callable.
+         * Callables up to INLINE_SIZE bytes are stored in place, larger ones
+         * go to the heap.
+         */
+        class continuation
+        {
+        public:
+            enum {INLINE_SIZE = 48};
+
+            continuation()
+            : m_invoke(nullptr)
+            , m_destroy(nullptr)
+            {}
+
+            ~continuation()
+            {
+                reset();
+            }
+
+            continuation(const continuation&) = delete;
+            continuation& operator = (const continuation&) = delete;
+
+            template<typename F>
+            void assign(F&& f)
+            {
+                typedef typename std::decay<F>::type functor;
+                reset();
+                assign_impl<functor>(std::forward<F>(f), std::integral_constant<bool, fits_inline<functor>::value>());
+            }
+
+            void operator()(message_uptr& msg)
+            {
+                assert(m_invoke);
+                m_invoke(&m_storage, msg);
+            }
+
+            void reset()
+            {
+                if (m_destroy)
+                    m_destroy(&m_storage);
+                m_invoke = nullptr;
+                m_destroy = nullptr;
+            }
+
+            explicit operator bool() const {return m_invoke != nullptr;}
+
+        private:
+            template<typename functor>
+            struct fits_inline
+            {
+                static const bool value = sizeof(functor) <= INLINE_SIZE && alignof(functor) <= alignof(std::max_align_t);
+            };
+
+            template<typename functor, typename F>
+            void assign_impl(F&& f, std::true_type)
+            {
+                new (&m_storage) functor(std::forward<F>(f));
+                m_invoke = [](void *p, message_uptr& msg) {(*static_cast<functor *>(p))(msg);};
+                m_destroy = [](void *p) {static_cast<functor *>(p)->~functor();};
+            }
+
+            template<typename functor, typename F>
+            void assign_impl(F&& f, std::false_type)
+            {
+                *reinterpret_cast<functor **>(&m_storage) = new functor(std::forward<F>(f));
+                m_invoke = [](void *p, message_uptr& msg) {(**static_cast<functor **>(p))(msg);};
+                m_destroy = [](void *p) {delete *static_cast<functor **>(p);};
+            }
+
+            typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type m_storage;
+            void (*m_invoke)(void *, message_uptr&);
+            void (*m_destroy)(void *);
+        };
+
+        /****************************************************************
+         * Outstanding ask<>() requests of one actor.
+         *
+         * Slots are allocated in chunks that are kept for the life of the
+         * actor and recycled through a free list, so a steady stream of
+         * requests does not allocate. A token is the slot index plus a
+         * generation, a reply or timeout carrying a stale token is ignored.
+         *
+         * Only the owning actor's thread adds and completes. pending() may be
+         * called from the timer thread.
+         */
+        class ask_table
+        {
+        public:
+            enum
+            {
+                INDEX_BITS = 20
+                , CHUNK_BITS = 10
+                , CHUNK_SIZE = 1 << CHUNK_BITS
+                , MAX_CHUNKS = 1 << (INDEX_BITS - CHUNK_BITS)
+                , GENERATION_MASK = (1 << (32 - INDEX_BITS)) - 1
+            };
+
+            ask_table()
+            : m_next(0)
+            , m_in_flight(0)
+            {
+                for (auto& c : m_chunks)
+                    c.store(nullptr, std::memory_order_relaxed);
+            }
+
+            ~ask_table()
+            {
+                for (auto& c : m_chunks)
+                    delete [] c.load(std::memory_order_relaxed);
+            }
+
+            ask_table(const ask_table&) = delete;
+            ask_table& operator = (const ask_table&) = delete;
+
+            // Store a continuation, returns its token
+            template<typename F>
+            uint32_t add(F&& f)
+            {
+                uint32_t index;
+                if (!m_free.empty())
+                {
+                    index = m_free.back();
+                    m_free.pop_back();
+                }
+                else
+                {
+                    index = m_next++;
+                    assert(index < (1u << INDEX_BITS));  // too many requests in flight
+                    uint32_t chunk = index >> CHUNK_BITS;
+                    if (m_chunks[chunk].load(std::memory_order_relaxed) == nullptr)
+                        m_chunks[chunk].store(new slot[CHUNK_SIZE], std::memory_order_release);
+                }
+                slot& s = get_slot(index);
+                s.generation = (s.generation + 1) & GENERATION_MASK;
+                if (s.generation == 0)
+                    s.generation = 1;
+                s.func.assign(std::forward<F>(f));
+                uint32_t token = (s.generation << INDEX_BITS) | index;
+                s.token.store(token, std::memory_order_release);
+                ++m_in_flight;
+                return token;
+            }
+
+            // true if token is waiting for a reply or timeout
+            bool pending(uint32_t token) const
+            {
+                uint32_t index = token & ((1u << INDEX_BITS) - 1);
+                slot *chunk = m_chunks[index >> CHUNK_BITS].load(std::memory_order_acquire);
+                return chunk && chunk[index & (CHUNK_SIZE - 1)].token.load(std::memory_order_acquire) == token;
+            }
+
+            // Run and release the continuation of token, msg is null on timeout.
+            // Returns false if token is no longer pending.
+            bool complete(uint32_t token, message_uptr& msg)
+            {
+                if (!pending(token))
+                    return false;
+                uint32_t index = token & ((1u << INDEX_BITS) - 1);
+                slot& s = get_slot(index);
+                s.token.store(0, std::memory_order_release);
+                --m_in_flight;
+                s.func(msg);
+                s.func.reset();
+                m_free.push_back(index);
+                return true;
+            }
+
+            size_t in_flight() const {return m_in_flight;}
+
+        private:
+            struct slot
+            {
+                slot()
+                : token(0)
+                , generation(0)
+                {}
+
+                std::atomic<uint32_t> token;    // 0 when free
+                uint32_t generation;
+                continuation func;
+            };
+
+            slot& get_slot(uint32_t index)
+            {
+                return m_chunks[index >> CHUNK_BITS].load(std::memory_order_relaxed)[index & (CHUNK_SIZE - 1)];
+            }
+
+            std::atomic<slot *> m_chunks[MAX_CHUNKS];
+            std::vector<uint32_t> m_free;
+            uint32_t m_next;
+            size_t m_in_flight;
+        };
+    }
+} // cppactor
@@ -0,0 +1,93 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "cppactor/actor_ref.h"
+
+namespace cppactor
+{
+    class actor;
+    class message;
+    struct dead_letter_stats;
+
+    namespace detail
+    {
+        /****************************************************************
+         * Counts the messages that reach no handler, by reason, actor type
+         * and msg_id, and sends samples of them to a dead letter actor.
+         *
+         * The counters are a fixed open addressed table claimed with a
+         * compare and swap, a dead letter costs two atomic increments and
+         * no lock. Keys that find no free slot within MAX_PROBES are only
+         * counted by reason. Forwarding is limited to max_per_second
+         * dead_letter messages, the rest are counted as rate limited.
+         */
+        class dead_letter_office
+        {
+        public:
+            enum
+            {
+                TABLE_SIZE = 4096               // a power of 2
+                , MAX_PROBES = 16
+                , REASONS = 4                   // DEAD_LETTER_REASONS
+            };
+
+            dead_letter_office();
+
+            dead_letter_office(const dead_letter_office&) = delete;
+            dead_letter_office& operator = (const dead_letter_office&) = delete;
+
+            // msg was sent to or handled by 'to', which may be null. The
+            // first leaves msg to the caller, the second may forward it
+            // and leaves msg empty then.
+            void report(int reason, const actor *to, const message *msg);
+            void report(int reason, const actor *to, std::unique_ptr<message>& msg);
+
+            // An empty actor_ref stops the forwarding
+            void set_actor(actor_ref to, int max_per_second);
+
+            dead_letter_stats get_stats() const;
+
+        private:
+            struct counter
+            {
+                std::atomic<uint64_t> key;      // 0 if free, see make_key()
+                std::atomic<uint64_t> count;
+            };
+
+            static uint64_t make_key(int reason, uint16_t type_id, int msg_id);
+            void count(int reason, uint16_t type_id, int msg_id);
+            bool may_forward();
+            void forward(int reason, const actor *to, int msg_id, std::unique_ptr<message>& original);
+
+            counter m_counters[TABLE_SIZE];
+            std::atomic<uint64_t> m_by_reason[REASONS];
+            std::atomic<uint64_t> m_untracked;
+            std::atomic<uint64_t> m_forwarded;
+            std::atomic<uint64_t> m_rate_limited;
+
+            std::atomic<uint64_t> m_target;         // the actor_ref's slot << 32 | generation, 0 for none
+            std::atomic<int> m_max_per_second;
+            std::atomic<int64_t> m_second;          // of the current rate window
+            std::atomic<int> m_in_second;           // forwarded or tried in it
+
+            static thread_local bool t_forwarding;
+        };
+    }
+} // cppactor
@@ -0,0 +1,89 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include "cppactor/instrusive_ptr.h"
+#include "cppactor/detail/locks.h"
+
+namespace cppactor
+{
+    class actor;
+    typedef instrusive_ptr<actor> actor_iptr;
+
+    namespace detail
+    {
+        /****************************************************************
+         * The ready queue of a deadline scheduled pool, see create_pool().
+         * Actors are ranked by the earliest deadline in their mailbox, and
+         * those without one follow in the order they became ready.
+         *
+         * An actor whose mailbox is sent an earlier deadline while it waits
+         * here is pushed again with the new rank. Its older entry is left in
+         * the heap and skipped when it comes out, the actor's mailbox keeps
+         * the seq of its current entry under the mailbox lock.
+         */
+        class deadline_queue
+        {
+        public:
+            deadline_queue();
+
+            deadline_queue(const deadline_queue&) = delete;
+            deadline_queue& operator = (const deadline_queue&) = delete;
+
+            // An actor became ready, deadline is 0 if its mailbox has none.
+            // Under the actor's mailbox lock.
+            void push(actor_iptr&& a, uint64_t deadline);
+
+            // a was sent an earlier deadline, rank it by that if it is
+            // still waiting. Does nothing if it is being handled. Under the
+            // actor's mailbox lock.
+            void promote(actor *a, uint64_t deadline);
+
+            // Takes the mailbox lock of each actor it pops, once the queue's
+            // lock is released
+            bool try_pop(actor_iptr& a);
+
+            uint64_t get_promoted() const {return m_promoted.load(std::memory_order_relaxed);}
+
+        private:
+            struct entry
+            {
+                uint64_t rank;          // the deadline, NO_DEADLINE if none
+                uint64_t seq;
+                actor_iptr actor;
+            };
+
+            // std::push_heap() keeps the greatest at the front
+            struct later
+            {
+                bool operator()(const entry& a, const entry& b) const
+                {
+                    return a.rank != b.rank ? a.rank > b.rank : a.seq > b.seq;
+                }
+            };
+
+            static const uint64_t NO_DEADLINE = ~uint64_t(0);
+
+            deadline_queue_lock m_lock;
+            std::vector<entry> m_heap;
+            uint64_t m_seq;
+            std::atomic<uint64_t> m_promoted;
+        };
+    }
+} // cppactor
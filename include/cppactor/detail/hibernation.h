@@ -0,0 +1,97 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * Finds idle actors that opted in with actor::hibernate_after().
+         *
+         * The timer actor calls tick() every 10ms, which walks the next
+         * SWEEP_SLOTS slots of the actor table. An actor that has handled
+         * no message since the previous visit, for at least its idle
+         * period, is sent a hibernate message. The idle period is therefore
+         * rounded up to the time a full sweep of the table takes.
+         */
+        class hibernation
+        {
+        public:
+            enum
+            {
+                TICK_MS = 10
+                , SWEEP_SLOTS = 8192
+            };
+
+            hibernation()
+            : m_any(false)
+            , m_cursor(0)
+            , m_hibernated(0)
+            , m_hibernations(0)
+            , m_wakeups(0)
+            , m_bytes_reclaimed(0)
+            {}
+
+            hibernation(const hibernation&) = delete;
+            hibernation& operator = (const hibernation&) = delete;
+
+            // An actor opted in, the sweep starts running
+            void enable() {m_any.store(true, std::memory_order_relaxed);}
+
+            // Timer thread only
+            void tick();
+
+            // Milliseconds clock in TICK_MS units, for the idle stamps
+            static uint32_t now();
+
+            void hibernated(size_t bytes)
+            {
+                m_hibernated.fetch_add(1, std::memory_order_relaxed);
+                m_hibernations.fetch_add(1, std::memory_order_relaxed);
+                reclaimed(bytes);
+            }
+
+            void reclaimed(size_t bytes) {m_bytes_reclaimed.fetch_add(bytes, std::memory_order_relaxed);}
+
+            void woken()
+            {
+                m_hibernated.fetch_sub(1, std::memory_order_relaxed);
+                m_wakeups.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // a hibernating actor was destroyed
+            void forget() {m_hibernated.fetch_sub(1, std::memory_order_relaxed);}
+
+            size_t get_hibernated() const {return m_hibernated.load(std::memory_order_relaxed);}
+            uint64_t get_hibernations() const {return m_hibernations.load(std::memory_order_relaxed);}
+            uint64_t get_wakeups() const {return m_wakeups.load(std::memory_order_relaxed);}
+            uint64_t get_bytes_reclaimed() const {return m_bytes_reclaimed.load(std::memory_order_relaxed);}
+
+        private:
+            std::atomic<bool> m_any;
+            uint32_t m_cursor;
+            std::atomic<size_t> m_hibernated;
+            std::atomic<uint64_t> m_hibernations;
+            std::atomic<uint64_t> m_wakeups;
+            std::atomic<uint64_t> m_bytes_reclaimed;
+        };
+    }
+} // cppactor
@@ -0,0 +1,88 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include "miscutils/binary_spin_lock.h"
+#include "cppactor/detail/spin_locks.h"
+
+/********************************************************************
+ * The framework's spin locks.
+ *
+ * Build with CPPACTOR_LOCK_STATS to count acquisitions, contended
+ * acquisitions and spin cycles per lock site, see for_each_lock_stats().
+ */
+namespace cppactor
+{
+    namespace detail
+    {
+        struct mailbox_lock_tag {};
+        struct timer_wheel_lock_tag {};
+        struct journal_lock_tag {};
+        struct capture_lock_tag {};
+        struct remote_lock_tag {};
+        struct io_buffer_lock_tag {};
+        struct file_io_lock_tag {};
+        struct deadline_queue_lock_tag {};
+
+#ifdef CPPACTOR_LOCK_STATS
+        template <typename Tag>
+        using lock_stats = spin_lock_stats<Tag>;
+#else
+        template <typename Tag>
+        using lock_stats = no_spin_lock_stats;
+#endif
+
+        // actor mailboxes, held for a push, pop or splice
+        typedef ttas_spin_lock<lock_stats<mailbox_lock_tag> > mailbox_lock;
+
+        // timer_wheel staging, taken by every ask<>() with a timeout
+        typedef ttas_spin_lock<lock_stats<timer_wheel_lock_tag> > timer_wheel_lock;
+
+        // journal appends, held to copy one record into the log
+        typedef ttas_spin_lock<lock_stats<journal_lock_tag> > journal_lock;
+
+        // traffic capture, held by senders to copy one record into the buffer
+        typedef ttas_spin_lock<lock_stats<capture_lock_tag> > capture_lock;
+
+        // socket transport, held by senders to copy one message into the batch
+        typedef ttas_spin_lock<lock_stats<remote_lock_tag> > remote_lock;
+
+        // reactor receive buffers, held to take or return one
+        typedef ttas_spin_lock<lock_stats<io_buffer_lock_tag> > io_buffer_lock;
+
+        // file_io submissions, held to fill one ring entry
+        typedef ttas_spin_lock<lock_stats<file_io_lock_tag> > file_io_lock;
+
+        // deadline scheduled ready queues, held to push or pop one actor
+        typedef ttas_spin_lock<lock_stats<deadline_queue_lock_tag> > deadline_queue_lock;
+
+#ifdef CPPACTOR_LOCK_STATS
+        // Calls f(name, spin_lock_counters&) for every lock site
+        template <typename F>
+        void for_each_lock_stats(F&& f)
+        {
+            f("mailbox", spin_lock_stats<mailbox_lock_tag>::counters());
+            f("timer_wheel", spin_lock_stats<timer_wheel_lock_tag>::counters());
+            f("journal", spin_lock_stats<journal_lock_tag>::counters());
+            f("capture", spin_lock_stats<capture_lock_tag>::counters());
+            f("remote", spin_lock_stats<remote_lock_tag>::counters());
+            f("io_buffer", spin_lock_stats<io_buffer_lock_tag>::counters());
+            f("file_io", spin_lock_stats<file_io_lock_tag>::counters());
+            f("deadline_queue", spin_lock_stats<deadline_queue_lock_tag>::counters());
+        }
+#endif
+    }
+} // cppactor
@@ -0,0 +1,113 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <utility>
+#include <ttstl/platform.h>
+#include "cppactor/detail/spin_locks.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * miscutils::LowLockMultiProducerQueue, the two lock linked list
+         * queue, with values moved in and out and a backoff while a lock
+         * is taken. It has the push() and try_pop() of the queues in
+         * mpmc_queue.h, pools use it for their ready actors when built
+         * with CPPACTOR_LOW_LOCK_READY_QUEUE.
+         */
+        template <typename T>
+        class low_lock_queue
+        {
+        public:
+            low_lock_queue()
+            : m_first(new node(nullptr))
+            , m_consumer_lock(false)
+            , m_last(m_first)
+            , m_producer_lock(false)
+            {}
+
+            ~low_lock_queue()
+            {
+                while (m_first != nullptr)
+                {
+                    node *tmp = m_first;
+                    m_first = tmp->next;
+                    delete tmp->value;
+                    delete tmp;
+                }
+            }
+
+            low_lock_queue(const low_lock_queue&) = delete;
+            low_lock_queue& operator = (const low_lock_queue&) = delete;
+
+            void push(T&& value)
+            {
+                node *tmp = new node(new T(std::move(value)));
+                spin_backoff backoff;
+                while (m_producer_lock.exchange(true, std::memory_order_acquire))
+                    backoff.wait();
+                m_last->next = tmp;     // publish to consumers
+                m_last = tmp;
+                m_producer_lock.store(false, std::memory_order_release);
+            }
+
+            bool try_pop(T& result)
+            {
+                spin_backoff backoff;
+                while (m_consumer_lock.exchange(true, std::memory_order_acquire))
+                    backoff.wait();
+
+                node *first = m_first;
+                node *next = first->next;
+                if (next == nullptr)
+                {
+                    m_consumer_lock.store(false, std::memory_order_release);
+                    return false;
+                }
+                T *value = next->value;
+                next->value = nullptr;
+                m_first = next;         // next is the new dummy
+                m_consumer_lock.store(false, std::memory_order_release);
+
+                result = std::move(*value);
+                delete value;
+                delete first;
+                return true;
+            }
+
+        private:
+            struct node
+            {
+                node(T *value_)
+                : value(value_)
+                , next(nullptr)
+                {}
+
+                T *value;
+                std::atomic<node *> next;
+            };
+
+            // consumers and producers on their own cache lines
+            alignas(TT_CACHE_LINE_SIZE) node *m_first;
+            std::atomic<bool> m_consumer_lock;
+            alignas(TT_CACHE_LINE_SIZE) node *m_last;
+            std::atomic<bool> m_producer_lock;
+        };
+    }
+} // cppactor
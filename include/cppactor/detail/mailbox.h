@@ -0,0 +1,194 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+namespace cppactor
+{
+    class message;
+
+    namespace detail
+    {
+        // Allocator that adds up the bytes its container holds
+        template <typename T>
+        class counting_allocator
+        {
+        public:
+            typedef T value_type;
+
+            explicit counting_allocator(size_t *bytes)
+            : m_bytes(bytes)
+            {}
+
+            template <typename U>
+            counting_allocator(const counting_allocator<U>& other)
+            : m_bytes(other.m_bytes)
+            {}
+
+            T *allocate(size_t n)
+            {
+                *m_bytes += n * sizeof(T);
+                return static_cast<T *>(::operator new(n * sizeof(T)));
+            }
+
+            void deallocate(T *p, size_t n)
+            {
+                *m_bytes -= n * sizeof(T);
+                ::operator delete(p);
+            }
+
+            template <typename U>
+            bool operator == (const counting_allocator<U>& other) const {return m_bytes == other.m_bytes;}
+            template <typename U>
+            bool operator != (const counting_allocator<U>& other) const {return m_bytes != other.m_bytes;}
+
+            size_t *m_bytes;
+        };
+
+        /****************************************************************
+         * An actor's message queue, a single pointer in the actor. The deque
+         * is allocated by the first push and release() frees it again, so an
+         * actor that is never sent a message, or is hibernating, holds no
+         * queue storage. Guarded by the actor's mailbox lock.
+         */
+        class mailbox
+        {
+        public:
+            typedef std::deque<message *, counting_allocator<message *> > queue_type;
+
+            mailbox()
+            : m_block(nullptr)
+            {}
+
+            ~mailbox()
+            {
+                delete m_block;
+            }
+
+            mailbox(const mailbox&) = delete;
+            mailbox& operator = (const mailbox&) = delete;
+
+            bool empty() const {return m_block == nullptr || m_block->queue.empty();}
+            size_t size() const {return m_block ? m_block->queue.size() : 0;}
+            message *front() {return m_block->queue.front();}
+            void pop_front() {m_block->queue.pop_front();}
+            void push_back(message *pMsg) {live().push_back(pMsg);}
+
+            void insert(size_t pos, message *pMsg)
+            {
+                queue_type& q = live();
+                q.insert(q.begin() + pos, pMsg);
+            }
+
+            template <typename It>
+            void insert(size_t pos, It first, It last)
+            {
+                queue_type& q = live();
+                q.insert(q.begin() + pos, first, last);
+            }
+
+            // The earliest deadline of the queued messages, 0 if none has
+            // one. Only kept up to date in deadline scheduled pools, where
+            // the actor adds each message's deadline and removes it again.
+            uint64_t earliest_deadline() const
+            {
+                return m_block && !m_block->deadlines.empty() ? m_block->deadlines.front() : 0;
+            }
+
+            void add_deadline(uint64_t deadline)
+            {
+                live();
+                std::vector<uint64_t>& d = m_block->deadlines;
+                d.push_back(deadline);
+                std::push_heap(d.begin(), d.end(), std::greater<uint64_t>());
+            }
+
+            void remove_deadline(uint64_t deadline)
+            {
+                // removed lazily, once the deadlines before it are gone too
+                std::vector<uint64_t>& d = m_block->deadlines;
+                std::vector<uint64_t>& r = m_block->removed;
+                r.push_back(deadline);
+                std::push_heap(r.begin(), r.end(), std::greater<uint64_t>());
+                while (!r.empty() && r.front() == d.front())
+                {
+                    std::pop_heap(d.begin(), d.end(), std::greater<uint64_t>());
+                    d.pop_back();
+                    std::pop_heap(r.begin(), r.end(), std::greater<uint64_t>());
+                    r.pop_back();
+                }
+            }
+
+            // The deadline_queue entry ranking the actor while it waits in
+            // a deadline scheduled pool, seq is 0 if it has none
+            uint64_t ready_rank() const {return m_block ? m_block->ready_rank : 0;}
+            uint64_t ready_seq() const {return m_block ? m_block->ready_seq : 0;}
+
+            void set_ready(uint64_t rank, uint64_t seq)
+            {
+                if (m_block == nullptr && seq == 0)
+                    return;
+                live();
+                m_block->ready_rank = rank;
+                m_block->ready_seq = seq;
+            }
+
+            // Free the storage of an empty queue, returns the bytes released
+            size_t release()
+            {
+                if (m_block == nullptr || !m_block->queue.empty())
+                    return 0;
+                size_t bytes = sizeof(block) + m_block->bytes;
+                delete m_block;
+                m_block = nullptr;
+                return bytes;
+            }
+
+        private:
+            struct block
+            {
+                block()
+                : bytes(0)
+                , queue(counting_allocator<message *>(&bytes))
+                , ready_rank(0)
+                , ready_seq(0)
+                {}
+
+                size_t bytes;       // held by the deque, counted by its allocator
+                queue_type queue;
+                std::vector<uint64_t> deadlines;    // min heaps, see remove_deadline()
+                std::vector<uint64_t> removed;
+                uint64_t ready_rank;
+                uint64_t ready_seq;
+            };
+
+            queue_type& live()
+            {
+                if (m_block == nullptr)
+                    m_block = new block();
+                return m_block->queue;
+            }
+
+            block *m_block;
+        };
+    }
+} // cppactor
@@ -0,0 +1,94 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <exception>
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include "cppactor/instrusive_ptr.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * How parallel_for() splits a range: chunks of 'grain' elements,
+         * worked on by the calling thread plus 'helpers' pool threads.
+         */
+        struct parallel_plan
+        {
+            size_t first;
+            size_t last;
+            size_t grain;
+            size_t chunks;
+            unsigned helpers;
+        };
+
+        // grain 0 picks about four chunks per participant
+        parallel_plan plan_parallel(uint32_t poolid, size_t first, size_t last, size_t grain);
+
+        /****************************************************************
+         * One parallel_for() call. The chunks are dealt out as one
+         * contiguous span per participant. A participant works through its
+         * own span, then steals what is left of the others'. The job is
+         * reference counted, a helper task that only starts after the caller
+         * has returned finds no chunks left and exits.
+         * A chunk that throws still counts as completed, the exception is
+         * kept for wait() and the remaining chunks run as usual.
+         */
+        class parallel_job : public instrusive_base
+        {
+        public:
+            typedef void (*chunk_fn)(void *ctx, size_t chunk, size_t begin, size_t end);
+
+            parallel_job(const parallel_plan& plan, chunk_fn fn, void *ctx);
+
+            parallel_job(const parallel_job&) = delete;
+            parallel_job& operator = (const parallel_job&) = delete;
+
+            // Run chunks until there are none left to claim
+            void work(unsigned participant);
+
+            // Block until every chunk has completed, then rethrow the first
+            // exception a chunk threw, if any
+            void wait();
+
+        private:
+            struct alignas(64) span
+            {
+                std::atomic<size_t> next;
+                size_t end;
+            };
+
+            parallel_plan m_plan;
+            unsigned m_participants;
+            std::unique_ptr<span[]> m_spans;
+            std::atomic<size_t> m_completed;
+            std::mutex m_mtx;
+            std::condition_variable m_cv;
+            std::exception_ptr m_error;
+            chunk_fn m_fn;
+            void *m_ctx;
+        };
+
+        // Submit the helpers and work on the chunks from the calling thread, returns once all are done
+        void run_parallel(uint32_t poolid, const parallel_plan& plan, parallel_job::chunk_fn fn, void *ctx);
+    }
+} // cppactor
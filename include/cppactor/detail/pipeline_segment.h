@@ -0,0 +1,242 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include "cppactor/spsc_queue.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        // The type a stage returns for an input of type In
+        template <typename F, typename In>
+        struct stage_result
+        {
+            typedef typename std::decay<decltype(std::declval<F&>()(std::declval<In&&>()))>::type type;
+        };
+
+        // Stages run on one thread, one after the other
+        template <typename F, typename G>
+        struct fused_stage
+        {
+            template <typename T>
+            auto operator()(T&& value) -> decltype(std::declval<G&>()(std::declval<F&>()(std::forward<T>(value))))
+            {
+                return second(first(std::forward<T>(value)));
+            }
+
+            F first;
+            G second;
+        };
+
+        /****************************************************************
+         * Waits of a stage thread that found its input empty, or its
+         * output full. Spins, then yields, then sleeps once the pipeline
+         * has been idle for a while.
+         */
+        class stage_backoff
+        {
+        public:
+            enum
+            {
+                SPINS = 64
+                , YIELDS = 1024
+                , SLEEP_US = 50
+            };
+
+            stage_backoff()
+            : m_count(0)
+            {}
+
+            void reset() {m_count = 0;}
+            void wait();
+
+        private:
+            unsigned m_count;
+        };
+
+        class pipeline_ring_base
+        {
+        public:
+            virtual ~pipeline_ring_base() {}
+        };
+
+        template <typename T>
+        class pipeline_ring : public pipeline_ring_base
+        {
+        public:
+            explicit pipeline_ring(size_t capacity)
+            : queue(capacity)
+            {}
+
+            bounded_spsc_queue<T> queue;
+        };
+
+        /****************************************************************
+         * One thread of a pipeline, running one or more fused stages.
+         * The thread takes items from its input ring until the upstream
+         * segment (or the pipeline's producer) is done and the ring is
+         * empty, then marks itself done for the next segment.
+         */
+        class pipeline_segment
+        {
+        public:
+            pipeline_segment(const std::atomic<bool> *upstream_done, int cpu)
+            : m_upstream_done(upstream_done)
+            , m_cpu(cpu)
+            , m_done(false)
+            {}
+
+            virtual ~pipeline_segment() {}
+
+            pipeline_segment(const pipeline_segment&) = delete;
+            pipeline_segment& operator = (const pipeline_segment&) = delete;
+
+            void start();
+            void join();
+
+            const std::atomic<bool> *done() const {return &m_done;}
+
+        protected:
+            // Runs the stages for one input item, false if the input is empty
+            virtual bool poll(stage_backoff& backoff) = 0;
+
+        private:
+            void run();
+
+            const std::atomic<bool> *m_upstream_done;
+            int m_cpu;
+            std::atomic<bool> m_done;
+            std::thread m_thread;
+        };
+
+        template <typename In, typename Out, typename Fn>
+        class pipeline_segment_impl : public pipeline_segment
+        {
+        public:
+            pipeline_segment_impl(const std::atomic<bool> *upstream_done, int cpu, bounded_spsc_queue<In> *input, bounded_spsc_queue<Out> *output, Fn&& fn)
+            : pipeline_segment(upstream_done, cpu)
+            , m_input(input)
+            , m_output(output)
+            , m_fn(std::move(fn))
+            {}
+
+        protected:
+            bool poll(stage_backoff& backoff) override
+            {
+                In *item = m_input->front();
+                if (item == nullptr)
+                    return false;
+                Out result(m_fn(std::move(*item)));
+                m_input->pop();
+
+                // backpressure, wait for the next segment to make room
+                backoff.reset();
+                while (!m_output->try_push(std::move(result)))
+                    backoff.wait();
+                return true;
+            }
+
+        private:
+            bounded_spsc_queue<In> *m_input;
+            bounded_spsc_queue<Out> *m_output;
+            Fn m_fn;
+        };
+
+        // The last segment, its stages end with a sink
+        template <typename In, typename Fn>
+        class pipeline_segment_impl<In, void, Fn> : public pipeline_segment
+        {
+        public:
+            pipeline_segment_impl(const std::atomic<bool> *upstream_done, int cpu, bounded_spsc_queue<In> *input, bounded_spsc_queue<void> *, Fn&& fn)
+            : pipeline_segment(upstream_done, cpu)
+            , m_input(input)
+            , m_fn(std::move(fn))
+            {}
+
+        protected:
+            bool poll(stage_backoff&) override
+            {
+                In *item = m_input->front();
+                if (item == nullptr)
+                    return false;
+                m_fn(std::move(*item));
+                m_input->pop();
+                return true;
+            }
+
+        private:
+            bounded_spsc_queue<In> *m_input;
+            Fn m_fn;
+        };
+
+        /****************************************************************
+         * What a pipeline owns. The segments are joined before the rings
+         * they use are freed.
+         */
+        class pipeline_core
+        {
+        public:
+            pipeline_core()
+            : m_closed(false)
+            , m_started(false)
+            {}
+
+            ~pipeline_core()
+            {
+                stop();
+            }
+
+            pipeline_core(const pipeline_core&) = delete;
+            pipeline_core& operator = (const pipeline_core&) = delete;
+
+            template <typename T>
+            bounded_spsc_queue<T> *add_ring(size_t capacity)
+            {
+                pipeline_ring<T> *ring = new pipeline_ring<T>(capacity);
+                m_rings.push_back(std::unique_ptr<pipeline_ring_base>(ring));
+                return &ring->queue;
+            }
+
+            pipeline_segment *add_segment(pipeline_segment *segment)
+            {
+                m_segments.push_back(std::unique_ptr<pipeline_segment>(segment));
+                return segment;
+            }
+
+            void start();
+
+            // Lets the items already pushed through, then joins the threads
+            void stop();
+
+            const std::atomic<bool> *closed() const {return &m_closed;}
+            bool is_closed() const {return m_closed.load(std::memory_order_relaxed);}
+            size_t get_thread_count() const {return m_segments.size();}
+
+        private:
+            std::atomic<bool> m_closed;
+            bool m_started;
+            std::vector<std::unique_ptr<pipeline_ring_base> > m_rings;
+            std::vector<std::unique_ptr<pipeline_segment> > m_segments;
+        };
+    }
+} // cppactor
@@ -19,7 +19,6 @@
 #include <string>
 #include <iostream>
 #include <vector>
-#include <typeinfo>
 #include <mutex>
 #include <thread>
 #include <atomic>
@@ -31,47 +30,62 @@
 #include "cppactor/detail/pool_base.h"
 #include "cppactor/framework.h"
 #include "cppactor/detail/system_messages.h"
+#include "cppactor/message_id.h"
 #include "miscutils/LockFreeMultiProducerQueue.h"
 #include <cassert>
+#include <type_traits>
+#include <utility>
 #include "logger/logger.h"
 
 namespace cppactor
 {
     namespace detail
     {
-        template<typename...Typelist>
-        struct on_message_helper;
-
-        template<typename ActorType, typename...Typelist>
-        struct on_message_helper<ActorType, Typelist...>
+        // true if the actor's handler is on_message(message_uptr&, actor_ref&),
+        // otherwise it takes an actor_iptr and reply_to has to be resolved
+        template<typename ActorType>
+        struct takes_actor_ref
         {
-            inline static void on_message(actor_iptr ab, std::unique_ptr<cppactor::message>& msg)
-            {
-                if (ab->type_id == typeid(ActorType).hash_code())
-                {
-                    cppactor::actor_iptr a = msg->get_reply_to();
-                    ab.cast<ActorType>()->on_message(msg, a);
-                }
-                else
-                {
-                    on_message_helper<Typelist...>::on_message(ab, msg);
-                }
-            }
+            template<typename A>
+            static auto test(int) -> decltype(std::declval<A&>().on_message(std::declval<message_uptr&>(), std::declval<actor_ref&>()), std::true_type());
+
+            template<typename A>
+            static std::false_type test(...);
+
+            static const bool value = decltype(test<ActorType>(0))::value;
         };
 
-        template<> 
-        struct on_message_helper<>  
+        template<typename ActorType>
+        inline void invoke_on_message(ActorType *a, std::unique_ptr<cppactor::message>& msg, std::true_type)
         {
-            inline static void on_message(actor_iptr, std::unique_ptr<cppactor::message>&) {}
-        };
+            actor_ref r = msg->get_reply_ref();
+            a->on_message(msg, r);
+        }
+
+        template<typename ActorType>
+        inline void invoke_on_message(ActorType *a, std::unique_ptr<cppactor::message>& msg, std::false_type)
+        {
+            cppactor::actor_iptr r = msg->get_reply_to();
+            a->on_message(msg, r);
+        }
+
+        template<typename ActorType>
+        void handle_message(actor *ab, std::unique_ptr<cppactor::message>& msg)
+        {
+            invoke_on_message(static_cast<ActorType *>(ab), msg, std::integral_constant<bool, takes_actor_ref<ActorType>::value>());
+        }
 
         /**************************************************************************************/
 
+        // The actors' handlers are found by indexing m_dispatch with
+        // their type_id, no comparison per type of the pool
         template <typename...Typelist>
         class pool : public pool_base
         {
+            static_assert(distinct_types<Typelist...>::value, "an actor type is given to the pool twice");
+
         public:
-            pool(uint32_t poolid);
+            pool(uint32_t poolid, bool by_deadline = false);
 
             pool(const pool&) = delete;
             pool(pool&&) = delete;
@@ -83,14 +97,29 @@ namespace cppactor
             void start_threads(int numThreads);
 
         private:
-            void thread_worker();
+            template <typename ActorType>
+            void add_handler();
+
+            void thread_worker(int index);
         };
 
 
         template <typename...Typelist>
-        pool<Typelist...>::pool(uint32_t poolid)
-        :pool_base(poolid)
+        pool<Typelist...>::pool(uint32_t poolid, bool by_deadline)
+        :pool_base(poolid, by_deadline)
+        {
+            int expand[] = {0, (add_handler<Typelist>(), 0)...};
+            (void)expand;
+        }
+
+        template <typename...Typelist>
+        template <typename ActorType>
+        void pool<Typelist...>::add_handler()
         {
+            uint16_t type_id = actor_type_index<ActorType>();
+            if (type_id >= m_dispatch.size())
+                m_dispatch.resize(type_id + 1, nullptr);
+            m_dispatch[type_id] = &handle_message<ActorType>;
         }
 
         template <typename...Typelist>
@@ -102,33 +131,52 @@ namespace cppactor
         template <typename...Typelist>
         void pool<Typelist...>::start_threads(int numThreads)
         {
+            m_handlers.reset(new handler_slot[numThreads]);
             for (int i = 0; i < numThreads; ++i)
             {
-                m_workers.emplace_back(new std::thread(&pool::thread_worker, this));
+                m_workers.emplace_back(new std::thread(&pool::thread_worker, this, i));
             }
         }
 
         template <typename...Typelist>
-        void pool<Typelist...>::thread_worker()
+        void pool<Typelist...>::thread_worker(int index)
         {
+            detail::actor_table& table = framework::instance()->get_actor_table();
+            handler_slot& slot = m_handlers[index];
+            table.register_reader();
+            task_function task;
+            unsigned turn = 0;
             try
             {
                 while (!m_quit)
                 {
+                    // nothing resolved through the actor table is held past this point
+                    table.quiescent();
+
                     actor_iptr ab;
-                    bool haveItem=false;
-                    if (!m_actorsWaitingForWork.Consume(ab))
+                    work_kind kind = take_work(ab, task, turn);
+                    if (kind == NO_WORK)
                     {
                         std::unique_lock<std::mutex> lockList(m_lockJobsList);
-                        if (!m_actorsWaitingForWork.Consume(ab))
+                        kind = take_work(ab, task, turn);
+                        if (kind == NO_WORK && !m_quit)
+                        {
+                            table.offline();
+                            ++m_idle;
                             m_notify_job.wait(lockList);
-                        else
-                            haveItem=true;
+                            --m_idle;
+                            ++m_wakeups;
+                            table.online();
+                        }
                     }
-                    else
-                        haveItem=true;
 
-                    if (haveItem)
+                    if (kind == TASK_WORK)
+                    {
+                        slot.begin(0, 0, 0, watchdog::now());
+                        run_task(task);
+                        slot.end();
+                    }
+                    else if (kind == ACTOR_WORK)
                     {
                         if (ab->is_stopped() == false)
                         {
@@ -136,7 +184,41 @@ namespace cppactor
                             // take one work item and one work item only
                             if (ab->consume_one_item(pMsg))
                             {
-                                if (pMsg->msg_id == detail::timer_on_timer::msg_id)
+                                actor::t_current = ab.get();
+                                slot.begin(ab->actor_id, ab->type_id, pMsg->msg_id, watchdog::now());
+                                uint64_t deadline = pMsg->get_deadline();
+                                if (ab->m_hibernated)
+                                    ab->wake();
+                                if (pMsg->get_reply_token() != 0)
+                                {
+                                    // reply to an ask<>(), run the continuation
+                                    std::unique_ptr<cppactor::message> msg(pMsg);
+                                    ab->complete_ask(msg);
+                                }
+                                else if (pMsg->msg_id == detail::ask_timeout_msg::msg_id)
+                                {
+                                    detail::ask_timeout_msg *p = static_cast<detail::ask_timeout_msg *>(pMsg);
+                                    ab->expire_ask(p->m_token);
+                                    delete p;
+                                }
+                                else if (pMsg->msg_id == detail::exit_msg::msg_id)
+                                {
+                                    // framework::shutdown(), the actor's last turn
+                                    detail::exit_msg *p = static_cast<detail::exit_msg *>(pMsg);
+                                    ab->exit(p);
+                                    delete p;
+                                }
+                                else if (pMsg->msg_id == detail::hibernate_msg::msg_id)
+                                {
+                                    ab->hibernate();
+                                    delete pMsg;
+                                }
+                                else if (ab->holds_messages())
+                                {
+                                    // a coroutine handler is suspended, keep this until it completes
+                                    ab->hold(pMsg);
+                                }
+                                else if (pMsg->msg_id == detail::timer_on_timer::msg_id)
                                 {
                                     // looks like a timer message, call on_timer()
                                     detail::timer_on_timer *p = static_cast<detail::timer_on_timer *>(pMsg);
@@ -151,11 +233,24 @@ namespace cppactor
                                 }
                                 else
                                 {
+                                    // journaled before it is handled, see actor::journal_to()
+                                    if (ab->m_journal != 0)
+                                        ab->journal_message(pMsg);
                                     std::unique_ptr<cppactor::message> msg(pMsg);
-                                    on_message_helper<Typelist...>::on_message(ab, msg);
+                                    if (ab->type_id < m_dispatch.size() && m_dispatch[ab->type_id])
+                                        m_dispatch[ab->type_id](ab.get(), msg);
+                                    else
+                                        framework::instance()->get_dead_letters().report(DEAD_LETTER_WRONG_POOL, ab.get(), msg);
                                 }
+                                ab->release_held_messages();
+                                actor::t_current = nullptr;
+                                if (deadline != 0)
+                                    handled_deadline(deadline);
+                                // deliver what the handler sent, if its actor defers sends
+                                actor::flush_deferred_sends();
                                 // see if there is more work, and should requeue the actor
                                 ab->requeue();
+                                slot.end();
                             }
                         }
                         else
@@ -178,6 +273,7 @@ namespace cppactor
                 TTLOG( ERROR, 13 )  << "Unknown exception in cppa pool -  will terminate";
                 quick_exit(EXIT_FAILURE);
             }
+            table.unregister_reader();
             TTLOG(INFO, 0) << "Pool thread shutdown";
         }
 
@@ -20,8 +20,13 @@
 #include <thread>
 #include <atomic>
 #include <memory>
+#include <cstdint>
 #include "cppactor/actor.h"
-#include "miscutils/LockFreeMultiProducerQueue.h"
+#include "cppactor/detail/low_lock_queue.h"
+#include "cppactor/mpmc_queue.h"
+#include "cppactor/detail/task_function.h"
+#include "cppactor/detail/deadline_queue.h"
+#include "cppactor/detail/watchdog.h"
 #include <cassert>
 #include "cppactor/instrusive_ptr.h"
 #include <mutex>
@@ -31,36 +36,140 @@
 namespace cppactor
 {
     class actor;
+    class message;
     typedef instrusive_ptr<actor> actor_iptr;
 
     namespace detail
     {
+        // Actors with work waiting for a pool thread. Build with
+        // CPPACTOR_LOW_LOCK_READY_QUEUE to go back to the linked list queue.
+#ifdef CPPACTOR_LOW_LOCK_READY_QUEUE
+        typedef low_lock_queue<cppactor::actor_iptr> ready_queue;
+#else
+        typedef unbounded_mpmc_queue<cppactor::actor_iptr> ready_queue;
+#endif
+
+        // Calls a type's on_message(), see pool<>
+        typedef void (*actor_handler)(actor *a, std::unique_ptr<message>& msg);
+
         class pool_base : public instrusive_base
         {
         public:
-            pool_base(uint32_t poolid);
+            enum {MAX_POOLS = 1024};
+
+            // by_deadline, run ready actors earliest deadline first rather
+            // than in the order they became ready
+            pool_base(uint32_t poolid, bool by_deadline = false);
 
-            virtual ~pool_base() {}
+            virtual ~pool_base();
 
             // for actors to notify of new inbound work
-            void notify_one(cppactor::actor_iptr actor);
+            void notify_one(cppactor::actor_iptr&& actor);
             void notify_one();
 
+            // Deadline scheduling, see create_pool(). Called under a's
+            // mailbox lock, a was sent an earlier deadline than its mailbox had.
+            bool by_deadline() const {return m_by_deadline != nullptr;}
+            void promote(actor *a, uint64_t deadline) {m_by_deadline->promote(a, deadline);}
+
+            // A message with a deadline was handled, in any pool
+            void handled_deadline(uint64_t deadline);
+
+            // Counters of the messages with a deadline handled so far
+            uint64_t get_deadlines_handled() const {return m_deadlines_handled.load(std::memory_order_relaxed);}
+            uint64_t get_deadlines_missed() const {return m_deadlines_missed.load(std::memory_order_relaxed);}
+            uint64_t get_max_lateness_ns() const {return m_max_lateness_ns.load(std::memory_order_relaxed);}
+            uint64_t get_promoted() const {return m_by_deadline ? m_by_deadline->get_promoted() : 0;}
+
+            // queue an actor-less task, see framework::submit(). Once the
+            // pool has quit the task is cancelled instead.
+            void submit(task_function&& task);
+
+            // Completes the task's handle, if any, without running it
+            static void cancel_task(task_function& task);
+
             // for actor threads to requeue actors with work still to do
             void renotify_from_the_worker_thread(cppactor::actor_iptr actor);
             void wait_quit();
 
+            // wait_quit() in two steps, so that several pools can stop together
+            void signal_quit();
+            void join();
+
+            // Instead of join(), when a thread is stuck in a handler. The
+            // threads are detached, signal_quit() them once it has returned.
+            // The pool is leaked since they still use it.
+            void abandon();
+
+            // true if every thread is waiting for work. 'wakeups' is increased
+            // by the number of times a thread of this pool has woken up, a
+            // pool that stayed idle between two calls added the same amount.
+            bool is_idle(uint64_t& wakeups);
+
             uint32_t get_poolid() const {return m_pool_id;}
+            size_t get_thread_count() const {return m_workers.size();}
+
+            // true if the pool was created with the actor type, see actor_type_index<>()
+            bool handles(uint16_t type_id) const {return type_id < m_dispatch.size() && m_dispatch[type_id] != nullptr;}
+
+            // What each thread is running, for the watchdog
+            handler_slot *get_handler_slots() {return m_handlers.get();}
+
+            // Actors refer to their pool by a slot number rather than a
+            // counted pointer, the framework keeps the pool alive
+            uint16_t get_slot() const {return m_slot;}
+            static pool_base *from_slot(uint16_t slot) {return s_slots[slot].load(std::memory_order_acquire);}
         protected:
-            volatile bool m_quit;
+            enum work_kind {NO_WORK, ACTOR_WORK, TASK_WORK};
+
+            // Take the next actor or task, alternating between the two queues
+            // when both have work. 'turn' is the calling thread's own state.
+            inline work_kind take_work(actor_iptr& actor, task_function& task, unsigned& turn);
+            bool take_actor(actor_iptr& actor) {return m_by_deadline ? m_by_deadline->try_pop(actor) : m_actorsWaitingForWork.try_pop(actor);}
+            void run_task(task_function& task);
+            void cancel_tasks();
+
+            std::atomic<bool> m_quit;
             uint32_t m_pool_id;
             std::mutex m_lockJobsList;
             std::condition_variable m_notify_job;
-            miscutils::LowLockMultiProducerQueue<cppactor::actor_iptr> m_actorsWaitingForWork;
+            size_t m_idle;          // threads waiting on m_notify_job, under m_lockJobsList
+            uint64_t m_wakeups;     // under m_lockJobsList
+            ready_queue m_actorsWaitingForWork;
+            std::unique_ptr<deadline_queue> m_by_deadline;     // replaces m_actorsWaitingForWork if deadline scheduled
+            unbounded_mpmc_queue<task_function> m_tasks;
             std::vector<std::unique_ptr<std::thread> > m_workers;
+            std::unique_ptr<handler_slot[]> m_handlers;         // one per thread
+            std::vector<actor_handler> m_dispatch;              // by actor type_id, nullptr for the types of other pools
         private:
+            uint16_t m_slot;
+            std::atomic<uint64_t> m_deadlines_handled;
+            std::atomic<uint64_t> m_deadlines_missed;
+            std::atomic<uint64_t> m_max_lateness_ns;
+
+            static std::mutex s_slots_mtx;
+            static std::atomic<pool_base *> s_slots[MAX_POOLS];
         };
 
+        inline pool_base::work_kind pool_base::take_work(actor_iptr& actor, task_function& task, unsigned& turn)
+        {
+            if (++turn & 1)
+            {
+                if (take_actor(actor))
+                    return ACTOR_WORK;
+                if (m_tasks.try_pop(task))
+                    return TASK_WORK;
+            }
+            else
+            {
+                if (m_tasks.try_pop(task))
+                    return TASK_WORK;
+                if (take_actor(actor))
+                    return ACTOR_WORK;
+            }
+            return NO_WORK;
+        }
+
         typedef instrusive_ptr<pool_base> pool_t;
     }
 } // cppactor
@@ -0,0 +1,197 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <sys/epoll.h>
+#include "cppactor/actor.h"
+#include "cppactor/actor_ref.h"
+#include "cppactor/message.h"
+#include "cppactor/framework.h"
+#include "cppactor/instrusive_base.h"
+#include "cppactor/detail/locks.h"
+#include "cppactor/detail/system_messages.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * The io_data buffers, all of io_data::BUFFER_SIZE. Returned
+         * buffers are kept for the next read, up to MAX_KEPT.
+         */
+        class io_buffer_pool
+        {
+        public:
+            enum {MAX_KEPT = 1024};
+
+            io_buffer_pool();
+            ~io_buffer_pool();
+
+            io_buffer_pool(const io_buffer_pool&) = delete;
+            io_buffer_pool& operator = (const io_buffer_pool&) = delete;
+
+            char *get();
+            void put(char *buffer);
+
+            uint64_t get_allocated() const {return m_allocated.load(std::memory_order_relaxed);}
+            uint64_t get_reused() const {return m_reused.load(std::memory_order_relaxed);}
+
+        private:
+            io_buffer_lock m_lock;
+            std::vector<char *> m_free;
+            std::atomic<uint64_t> m_allocated;
+            std::atomic<uint64_t> m_reused;
+        };
+
+        // One watched descriptor, shared by the reactor and the messages it sent
+        struct io_watch : public instrusive_base
+        {
+            io_watch(const actor_iptr& reactor_, int fd_, io_mode mode_, bool stream_, actor_ref owner_, uint64_t token_)
+            : reactor(reactor_)
+            , fd(fd_)
+            , mode(mode_)
+            , stream(stream_)
+            , owner(owner_)
+            , token(token_)
+            , removed(false)
+            , edges(0)
+            , in_flight(0)
+            , throttled(false)
+            {}
+
+            actor_iptr reactor;                 // a reactor_actor, kept until the last message of the watch is deleted
+            const int fd;
+            const io_mode mode;
+            const bool stream;                  // a short read means it is drained
+            const actor_ref owner;
+            const uint64_t token;               // epoll data, 0 is the wake up eventfd
+            std::atomic<bool> removed;          // no longer in the epoll set
+
+            // IO_READABLE, edges seen since the io_ready was sent, 0 if none is
+            std::atomic<uint32_t> edges;
+
+            // IO_RECEIVE, io_data not deleted yet, the reactor stops reading at MAX_IN_FLIGHT
+            std::atomic<uint32_t> in_flight;
+            std::atomic<bool> throttled;
+        };
+
+        class reactor_watch_msg : public message
+        {
+        public:
+            enum {msg_id = reactor_message_watch};
+            reactor_watch_msg(int fd_, io_mode mode_, actor_ref owner_)
+            : message(msg_id)
+            , fd(fd_)
+            , mode(mode_)
+            , owner(owner_)
+            {}
+
+            int fd;
+            io_mode mode;
+            actor_ref owner;
+        };
+
+        class reactor_unwatch_msg : public message
+        {
+        public:
+            enum {msg_id = reactor_message_unwatch};
+            reactor_unwatch_msg(int fd_)
+            : message(msg_id)
+            , fd(fd_)
+            {}
+
+            int fd;
+        };
+
+        // A throttled descriptor's actor caught up, read it again
+        class reactor_resume_msg : public message
+        {
+        public:
+            enum {msg_id = reactor_message_resume};
+            reactor_resume_msg(instrusive_ptr<io_watch>& watch_)
+            : message(msg_id)
+            , watch(watch_)
+            {}
+
+            instrusive_ptr<io_watch> watch;
+        };
+
+        /****************************************************************
+         * The reactor, the only actor of the POOLID_REACTOR pool. Like the
+         * timer actor it keeps its thread: each poll message waits in
+         * epoll_wait() for up to TICK_MS and is sent again. Registrations
+         * are messages to it, followed by a write to an eventfd in the
+         * epoll set so a waiting poll returns for them.
+         *
+         * Descriptors are registered edge triggered, an event is one batch
+         * of reads for IO_RECEIVE and at most one io_ready for IO_READABLE.
+         */
+        class reactor_actor : public actor
+        {
+        public:
+            enum
+            {
+                TICK_MS = 10
+                , MAX_EVENTS = 256
+            };
+
+            reactor_actor();
+            ~reactor_actor();
+
+            void on_start();
+            void on_exit();
+            void on_message(message_uptr& msg, actor_ref& replyto);
+
+            // Any thread, queue a registration message and wake the poll up
+            void post(message *msg);
+
+            // io_ready and io_data, when they are deleted
+            void io_ready_done(instrusive_ptr<io_watch>& w);
+            void io_data_done(instrusive_ptr<io_watch>& w, char *buffer);
+
+            reactor_stats get_stats() const;
+
+        private:
+            void poll(message_uptr& msg);
+            void watch(reactor_watch_msg& msg);
+            void unwatch(int fd);
+            void remove(instrusive_ptr<io_watch>& w);
+            void receive(instrusive_ptr<io_watch>& w, bool drain);
+            void ready(instrusive_ptr<io_watch>& w);
+            bool deliver(instrusive_ptr<io_watch>& w, message *msg);
+
+            int m_epoll_fd;
+            int m_wake_fd;
+            uint64_t m_next_token;
+            std::unordered_map<uint64_t, instrusive_ptr<io_watch> > m_watches;
+            std::unordered_map<int, uint64_t> m_tokens;            // by fd
+            std::vector<epoll_event> m_events;
+
+            std::atomic<size_t> m_watched;
+            std::atomic<uint64_t> m_wakeups;
+            std::atomic<uint64_t> m_event_count;
+            std::atomic<uint64_t> m_messages;
+            std::atomic<uint64_t> m_bytes;
+            std::atomic<uint64_t> m_throttled;
+        };
+
+        io_buffer_pool& io_buffers();
+    }
+} // cppactor
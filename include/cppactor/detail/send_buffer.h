@@ -0,0 +1,67 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+#include "cppactor/instrusive_ptr.h"
+
+namespace cppactor
+{
+    class actor;
+    class message;
+    typedef instrusive_ptr<actor> actor_iptr;
+
+    namespace detail
+    {
+        /****************************************************************
+         * Sends staged by a handler of an actor that defers its sends, see
+         * actor::defer_sends(). One per pool thread.
+         *
+         * Messages are grouped by target in the order they were sent, and
+         * flush() hands each group to its target in one splice, with at most
+         * one wakeup. The groups keep their storage between handlers.
+         */
+        class send_buffer
+        {
+        public:
+            enum {MAX_KEPT = 1024};     // larger groups release their storage after a flush
+
+            send_buffer();
+            ~send_buffer();
+
+            send_buffer(const send_buffer&) = delete;
+            send_buffer& operator = (const send_buffer&) = delete;
+
+            void add(actor *target, message *pMsg);
+            void flush();
+            bool empty() const {return m_used == 0;}
+
+        private:
+            struct batch
+            {
+                actor_iptr target;
+                std::vector<message *> msgs;
+            };
+
+            std::vector<batch> m_batches;
+            std::unordered_map<actor *, size_t> m_index;
+            size_t m_used;
+            size_t m_last;
+        };
+    }
+} // cppactor
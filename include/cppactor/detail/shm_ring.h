@@ -0,0 +1,160 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * What the two processes share, at the start of the mapping.
+         * The slots follow it. Only fixed size types and lock free
+         * atomics, and a fixed line size rather than TT_CACHE_LINE_SIZE,
+         * the processes may be different builds.
+         */
+        struct shm_ring_header
+        {
+            std::atomic<uint32_t> state;        // 0 new, 1 being set up, 2 ready
+            uint32_t magic;
+            uint32_t slot_size;
+            uint32_t slot_count;                // a power of two
+            std::atomic<int32_t> producer;      // pid of the attached proxy, 0 if none
+
+            alignas(64)
+            std::atomic<uint64_t> tail;         // next slot the producer fills
+
+            alignas(64)
+            std::atomic<uint64_t> head;         // next slot the consumer reads
+            std::atomic<uint32_t> sleeping;     // the consumer is waiting on 'wakeups'
+            std::atomic<uint32_t> wakeups;      // futex word
+        };
+
+        // At the start of each slot, the message's layout follows it
+        struct shm_slot
+        {
+            int32_t msg_id;
+            uint32_t size;
+        };
+
+        /****************************************************************
+         * A single producer, single consumer ring of fixed size slots in
+         * a POSIX shared memory object, mapped by both processes. The
+         * consumer polls, then sleeps on a futex the producer only wakes
+         * when it is asleep.
+         */
+        class shm_ring
+        {
+        public:
+            enum {MAGIC = 0x63706172};          // 'cpar'
+
+            shm_ring()
+            : m_header(nullptr)
+            , m_slots(nullptr)
+            , m_size(0)
+            , m_mask(0)
+            , m_slot_size(0)
+            , m_cached_head(0)
+            , m_cached_tail(0)
+            {}
+
+            ~shm_ring()
+            {
+                close();
+            }
+
+            shm_ring(const shm_ring&) = delete;
+            shm_ring& operator = (const shm_ring&) = delete;
+
+            // Creates the shared memory object 'name', or maps it if the
+            // other side got there first. False if it exists with another
+            // geometry, or on a system error.
+            bool open(const std::string& name, uint32_t slot_count, uint32_t slot_size);
+            void close();
+            bool is_open() const {return m_header != nullptr;}
+
+            // The producer side, one process at a time
+            bool attach_producer();
+            void detach_producer();
+
+            // The next free slot, nullptr if the ring is full
+            shm_slot *claim()
+            {
+                uint64_t tail = m_header->tail.load(std::memory_order_relaxed);
+                if (tail - m_cached_head >= m_mask + 1)
+                {
+                    m_cached_head = m_header->head.load(std::memory_order_acquire);
+                    if (tail - m_cached_head >= m_mask + 1)
+                        return nullptr;
+                }
+                return slot(tail);
+            }
+
+            // Makes the claimed slot visible, wakes the consumer if it sleeps
+            void publish()
+            {
+                m_header->tail.store(m_header->tail.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+                if (m_header->sleeping.load(std::memory_order_seq_cst) != 0)
+                    wake();
+            }
+
+            // The consumer side
+            shm_slot *front()
+            {
+                uint64_t head = m_header->head.load(std::memory_order_relaxed);
+                if (head == m_cached_tail)
+                {
+                    m_cached_tail = m_header->tail.load(std::memory_order_acquire);
+                    if (head == m_cached_tail)
+                        return nullptr;
+                }
+                return slot(head);
+            }
+
+            void pop()
+            {
+                m_header->head.store(m_header->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            // Sleeps until the producer publishes, or timeout_ms
+            void wait(int timeout_ms);
+
+            // Wakes the consumer, from either side
+            void wake();
+
+            uint32_t payload_capacity() const {return m_slot_size - sizeof(shm_slot);}
+            size_t size() const {return m_header->tail.load(std::memory_order_relaxed) - m_header->head.load(std::memory_order_relaxed);}
+
+        private:
+            shm_slot *slot(uint64_t n) const
+            {
+                return reinterpret_cast<shm_slot *>(m_slots + (n & m_mask) * m_slot_size);
+            }
+
+            shm_ring_header *m_header;
+            char *m_slots;
+            size_t m_size;                      // of the mapping
+            uint64_t m_mask;
+            uint32_t m_slot_size;
+            uint64_t m_cached_head;             // producer's copy
+            uint64_t m_cached_tail;             // consumer's copy
+        };
+    }
+} // cppactor
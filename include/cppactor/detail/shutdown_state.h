@@ -0,0 +1,120 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+#include "cppactor/instrusive_base.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * Tracks the actors framework::shutdown() is waiting on, and adds
+         * up the messages they dropped. Each actor calls exited() from its
+         * own pool thread once its on_exit() has run. Counted, each
+         * exit_msg holds a reference: an actor stuck in a handler past the
+         * deadline calls exited() after shutdown() has returned.
+         */
+        class shutdown_state : public instrusive_base
+        {
+        public:
+            explicit shutdown_state(std::vector<uint32_t>&& actorids)
+            : m_pending(std::move(actorids))
+            , m_dropped(0)
+            {}
+
+            shutdown_state(const shutdown_state&) = delete;
+            shutdown_state& operator = (const shutdown_state&) = delete;
+
+            void exited(uint32_t actorid, size_t dropped)
+            {
+                std::function<void()> done;
+                {
+                    std::lock_guard<std::mutex> lock(m_mtx);
+                    m_dropped += dropped;
+                    auto it = std::find(m_pending.begin(), m_pending.end(), actorid);
+                    if (it != m_pending.end())
+                    {
+                        *it = m_pending.back();
+                        m_pending.pop_back();
+                    }
+                    if (!m_pending.empty())
+                        return;
+                    m_cv.notify_all();
+                    done.swap(m_done);
+                }
+                if (done)
+                    done();
+            }
+
+            // Calls f once every actor has exited, now if they all have
+            void when_done(std::function<void()>&& f)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mtx);
+                    if (!m_pending.empty())
+                    {
+                        m_done = std::move(f);
+                        return;
+                    }
+                }
+                f();
+            }
+
+            // Block until every actor has exited
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                m_cv.wait(lock, [this] {return m_pending.empty();});
+            }
+
+            // Same, false if some actors had not exited by the deadline
+            bool wait_until(std::chrono::steady_clock::time_point deadline)
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                return m_cv.wait_until(lock, deadline, [this] {return m_pending.empty();});
+            }
+
+            // The actors that have not exited yet
+            std::vector<uint32_t> pending()
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                return m_pending;
+            }
+
+            size_t dropped()
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                return m_dropped;
+            }
+
+        private:
+            std::mutex m_mtx;
+            std::condition_variable m_cv;
+            std::vector<uint32_t> m_pending;    // actor ids, unordered
+            size_t m_dropped;
+            std::function<void()> m_done;       // see when_done()
+        };
+    }
+} // cppactor
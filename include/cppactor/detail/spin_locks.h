@@ -0,0 +1,386 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cassert>
+#include <cstdint>
+#include <ttstl/platform.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/********************************************************************
+ * Spin locks of the framework, next to miscutils::SimpleSpinLock.
+ * All of them have lock()/unlock() so they work with
+ * miscutils::SpinLockMonitor, and take a stats policy, see
+ * detail/locks.h for the lock sites built on them.
+ */
+namespace cppactor
+{
+    namespace detail
+    {
+        // Tells the cpu we are in a spin wait loop.
+        inline void spin_pause() noexcept
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            _mm_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield" ::: "memory");
+#endif
+        }
+
+        // A cheap timestamp for measuring spin time, cpu cycles where available.
+        inline uint64_t spin_clock() noexcept
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+        }
+
+        /****************************************************************
+         * Exponential backoff for spin wait loops. Pauses 'backoff' times
+         * and doubles it, once it reaches MAX_BACKOFF gives up the time
+         * slice instead, so a preempted lock holder gets to run.
+         */
+        class spin_backoff
+        {
+        public:
+            enum {MIN_BACKOFF = 4, MAX_BACKOFF = 1024};
+
+            spin_backoff() noexcept
+            : m_backoff(MIN_BACKOFF)
+            {
+            }
+
+            void wait() noexcept
+            {
+                if (m_backoff < MAX_BACKOFF)
+                {
+                    for (unsigned i = 0; i < m_backoff; ++i)
+                        spin_pause();
+                    m_backoff *= 2;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+        private:
+            unsigned m_backoff;
+        };
+
+        /****************************************************************
+         * Acquisitions, contended acquisitions and the time spent spinning
+         * in spin_clock() units, for the lock(s) sharing one spin_lock_stats
+         * tag.
+         */
+        struct spin_lock_counters
+        {
+            std::atomic<uint64_t> acquisitions{0};
+            std::atomic<uint64_t> contended{0};
+            std::atomic<uint64_t> spin_cycles{0};
+
+            void reset() noexcept
+            {
+                acquisitions.store(0, std::memory_order_relaxed);
+                contended.store(0, std::memory_order_relaxed);
+                spin_cycles.store(0, std::memory_order_relaxed);
+            }
+        };
+
+        // Stats policy of the spin locks below that records nothing, the default.
+        struct no_spin_lock_stats
+        {
+            static void acquired() noexcept {}
+            static void contended(uint64_t) noexcept {}
+        };
+
+        // Stats policy that records into counters shared by every lock declared
+        // with the same Tag. The counters are themselves contended, use it to
+        // find hot locks rather than in production.
+        template <typename Tag>
+        struct spin_lock_stats
+        {
+            static spin_lock_counters& counters() noexcept
+            {
+                static spin_lock_counters c;
+                return c;
+            }
+
+            static void acquired() noexcept
+            {
+                counters().acquisitions.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            static void contended(uint64_t spin_cycles) noexcept
+            {
+                spin_lock_counters& c = counters();
+                c.acquisitions.fetch_add(1, std::memory_order_relaxed);
+                c.contended.fetch_add(1, std::memory_order_relaxed);
+                c.spin_cycles.fetch_add(spin_cycles, std::memory_order_relaxed);
+            }
+        };
+
+        /****************************************************************
+         * Test-and-test-and-set lock with exponential backoff. Cheapest
+         * when uncontended, no fairness.
+         */
+        template <typename Stats = no_spin_lock_stats>
+        class ttas_spin_lock
+        {
+        public:
+            ttas_spin_lock() noexcept
+            : m_locked(false)
+            {
+            }
+
+            ttas_spin_lock(const ttas_spin_lock&) = delete;
+            ttas_spin_lock& operator=(const ttas_spin_lock&) = delete;
+
+            void lock() noexcept
+            {
+                if (!m_locked.exchange(true, std::memory_order_acquire))
+                {
+                    Stats::acquired();
+                    return;
+                }
+                uint64_t start = spin_clock();
+                spin_backoff backoff;
+                do
+                {
+                    while (m_locked.load(std::memory_order_relaxed))
+                        backoff.wait();
+                } while (m_locked.exchange(true, std::memory_order_acquire));
+                Stats::contended(spin_clock() - start);
+            }
+
+            bool try_lock() noexcept
+            {
+                if (m_locked.load(std::memory_order_relaxed) || m_locked.exchange(true, std::memory_order_acquire))
+                    return false;
+                Stats::acquired();
+                return true;
+            }
+
+            void unlock() noexcept
+            {
+                m_locked.store(false, std::memory_order_release);
+            }
+
+            bool is_locked() const noexcept
+            {
+                return m_locked.load(std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<bool> m_locked;
+        };
+
+        /****************************************************************
+         * FIFO lock, waiters are served in arrival order. The wait is
+         * proportional to the number of threads ahead, and yields when
+         * the queue is long or the wait drags on.
+         * Avoid when there are more spinning threads than cores, a
+         * preempted waiter holds up everyone behind it.
+         */
+        template <typename Stats = no_spin_lock_stats>
+        class ticket_spin_lock
+        {
+        public:
+            enum {PAUSES_PER_WAITER = 32, YIELD_AHEAD = 8, WAITS_BEFORE_YIELD = 64};
+
+            ticket_spin_lock() noexcept
+            : m_next(0)
+            , m_serving(0)
+            {
+            }
+
+            ticket_spin_lock(const ticket_spin_lock&) = delete;
+            ticket_spin_lock& operator=(const ticket_spin_lock&) = delete;
+
+            void lock() noexcept
+            {
+                uint32_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+                uint32_t serving = m_serving.load(std::memory_order_acquire);
+                if (serving == ticket)
+                {
+                    Stats::acquired();
+                    return;
+                }
+                uint64_t start = spin_clock();
+                unsigned waits = 0;
+                do
+                {
+                    uint32_t ahead = ticket - serving;
+                    if (ahead >= YIELD_AHEAD || ++waits > WAITS_BEFORE_YIELD)
+                    {
+                        std::this_thread::yield();
+                    }
+                    else
+                    {
+                        for (uint32_t i = 0; i < ahead * PAUSES_PER_WAITER; ++i)
+                            spin_pause();
+                    }
+                    serving = m_serving.load(std::memory_order_acquire);
+                } while (serving != ticket);
+                Stats::contended(spin_clock() - start);
+            }
+
+            void unlock() noexcept
+            {
+                // only the holder writes m_serving
+                m_serving.store(m_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            bool is_locked() const noexcept
+            {
+                return m_next.load(std::memory_order_relaxed) != m_serving.load(std::memory_order_relaxed);
+            }
+
+        private:
+            alignas(TT_CACHE_LINE_SIZE) std::atomic<uint32_t> m_next;
+            alignas(TT_CACHE_LINE_SIZE) std::atomic<uint32_t> m_serving;
+        };
+
+        // A waiter's queue entry in an mcs_spin_lock, one per lock held or awaited.
+        struct alignas(TT_CACHE_LINE_SIZE) mcs_node
+        {
+            std::atomic<mcs_node *> next;
+            std::atomic<bool> locked;
+        };
+
+        // Per thread mcs_node's, mcs locks held by one thread must be released
+        // in reverse order of acquisition, as SpinLockMonitor does.
+        class mcs_node_stack
+        {
+        public:
+            enum {MAX_NESTING = 8};
+
+            static mcs_node *push() noexcept
+            {
+                mcs_node_stack& s = get();
+                assert(s.m_depth < MAX_NESTING);
+                return &s.m_nodes[s.m_depth++];
+            }
+
+            static void pop(mcs_node *node) noexcept
+            {
+                mcs_node_stack& s = get();
+                assert(s.m_depth > 0 && node == &s.m_nodes[s.m_depth - 1]);
+                (void)node;
+                --s.m_depth;
+            }
+
+        private:
+            mcs_node_stack() noexcept
+            : m_depth(0)
+            {
+            }
+
+            static mcs_node_stack& get() noexcept
+            {
+                static thread_local mcs_node_stack s;
+                return s;
+            }
+
+            mcs_node m_nodes[MAX_NESTING];
+            int m_depth;
+        };
+
+        /****************************************************************
+         * Queue lock, FIFO like the ticket lock, but each waiter spins on
+         * its own cache line, so a release only disturbs the next waiter.
+         * Best under heavy contention on many cores.
+         */
+        template <typename Stats = no_spin_lock_stats>
+        class mcs_spin_lock
+        {
+        public:
+            enum {SPINS_BEFORE_YIELD = 1024};
+
+            mcs_spin_lock() noexcept
+            : m_tail(nullptr)
+            , m_owner(nullptr)
+            {
+            }
+
+            mcs_spin_lock(const mcs_spin_lock&) = delete;
+            mcs_spin_lock& operator=(const mcs_spin_lock&) = delete;
+
+            void lock() noexcept
+            {
+                mcs_node *me = mcs_node_stack::push();
+                me->next.store(nullptr, std::memory_order_relaxed);
+                me->locked.store(true, std::memory_order_relaxed);
+                mcs_node *pred = m_tail.exchange(me, std::memory_order_acq_rel);
+                if (pred == nullptr)
+                {
+                    Stats::acquired();
+                }
+                else
+                {
+                    uint64_t start = spin_clock();
+                    pred->next.store(me, std::memory_order_release);
+                    unsigned spins = 0;
+                    while (me->locked.load(std::memory_order_acquire))
+                    {
+                        if (++spins < SPINS_BEFORE_YIELD)
+                            spin_pause();
+                        else
+                            std::this_thread::yield();
+                    }
+                    Stats::contended(spin_clock() - start);
+                }
+                m_owner = me;
+            }
+
+            void unlock() noexcept
+            {
+                mcs_node *me = m_owner;
+                mcs_node *succ = me->next.load(std::memory_order_acquire);
+                if (succ == nullptr)
+                {
+                    mcs_node *expected = me;
+                    if (m_tail.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed))
+                    {
+                        mcs_node_stack::pop(me);
+                        return;
+                    }
+                    // a waiter is linking itself in
+                    while ((succ = me->next.load(std::memory_order_acquire)) == nullptr)
+                        spin_pause();
+                }
+                succ->locked.store(false, std::memory_order_release);
+                mcs_node_stack::pop(me);
+            }
+
+            bool is_locked() const noexcept
+            {
+                return m_tail.load(std::memory_order_relaxed) != nullptr;
+            }
+
+        private:
+            std::atomic<mcs_node *> m_tail;
+            mcs_node *m_owner;      // only accessed by the holder
+        };
+    }
+} // cppactor
@@ -1,20 +1,37 @@
 #pragma once
 #include "cppactor/message.h"
+#include "cppactor/instrusive_ptr.h"
+#include "cppactor/detail/shutdown_state.h"
 #include <functional>
+#include <climits>
 
 namespace cppactor
 {
     namespace detail
     {
-        enum system_message_types
+        // The framework's ids are negative, applications use ids from 0,
+        // see message_list<> in message_id.h
+        enum system_message_types : int
         {
             system_message_type_none = 0
-            , system_message_start = 1 << 31    // not a real message, system message sstart at this id
+            , system_message_start = INT_MIN    // not a real message, system messages start at this id
             , timer_message_invoke              // Internal message to wake up timer actor
             , timer_message_set_timer
             , timer_message_on_timer
             , timer_message_cancel_timer
             , function_message_invoke
+            , ask_message_timeout
+            , shutdown_message_exit
+            , hibernate_message_sleep
+            , reactor_message_poll              // Internal message to keep the reactor actor polling
+            , reactor_message_watch
+            , reactor_message_unwatch
+            , reactor_message_resume
+            , io_message_ready                  // Sent to actors by the reactor, see reactor.h
+            , io_message_data
+            , io_message_closed
+            , file_message_done                 // Sent to actors by a file_io, see file_io.h
+            , dead_letter_message_sample        // Sent to the dead letter actor, see dead_letter.h
         };
 
         class timer_on_timer : public cppactor::message
@@ -52,6 +69,44 @@ namespace cppactor
 
             std::function<void (cppactor::actor_iptr)> m_func;
         };
+
+        // Sent by the timer wheel when an ask<>() request times out
+        class ask_timeout_msg : public message
+        {
+        public:
+            enum {msg_id = ask_message_timeout};
+            ask_timeout_msg(uint32_t token)
+            : message(msg_id)
+            , m_token(token)
+            {}
+
+            uint32_t m_token;
+        };
+
+        // Sent by the hibernation sweep to an idle actor
+        class hibernate_msg : public message
+        {
+        public:
+            enum {msg_id = hibernate_message_sleep};
+            hibernate_msg()
+            : message(msg_id)
+            {}
+        };
+
+        // Sent by framework::shutdown(), the last message an actor handles
+        class exit_msg : public message
+        {
+        public:
+            enum {msg_id = shutdown_message_exit};
+            exit_msg(const instrusive_ptr<shutdown_state>& state, bool count_dropped)
+            : message(msg_id)
+            , m_state(state)
+            , m_count_dropped(count_dropped)
+            {}
+
+            instrusive_ptr<shutdown_state> m_state;
+            bool m_count_dropped;   // false for the framework's own actors
+        };
     }
 }
 
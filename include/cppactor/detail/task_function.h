@@ -0,0 +1,161 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <cstddef>
+#include <cassert>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace cppactor
+{
+    class task_handle;
+
+    namespace detail
+    {
+        /****************************************************************
+         * A movable, type erased void() callable for framework::submit().
+         * Callables up to INLINE_SIZE bytes are stored in place, so a task
+         * costs no allocation as it passes through the pool's task queue,
+         * larger ones go to the heap.
+         */
+        class task_function
+        {
+        public:
+            enum {INLINE_SIZE = 48};
+
+            task_function()
+            : m_ops(nullptr)
+            , m_handle(nullptr)
+            {}
+
+            template<typename F>
+            task_function(F&& f, task_handle *handle)
+            : m_handle(handle)
+            {
+                typedef typename std::decay<F>::type functor;
+                assign<functor>(std::forward<F>(f), std::integral_constant<bool, fits_inline<functor>::value>());
+            }
+
+            task_function(task_function&& other)
+            : m_ops(other.m_ops)
+            , m_handle(other.m_handle)
+            {
+                if (m_ops)
+                    m_ops->move(&other.m_storage, &m_storage);
+                other.m_ops = nullptr;
+                other.m_handle = nullptr;
+            }
+
+            task_function& operator = (task_function&& other)
+            {
+                if (this != &other)
+                {
+                    reset();
+                    m_ops = other.m_ops;
+                    m_handle = other.m_handle;
+                    if (m_ops)
+                        m_ops->move(&other.m_storage, &m_storage);
+                    other.m_ops = nullptr;
+                    other.m_handle = nullptr;
+                }
+                return *this;
+            }
+
+            ~task_function()
+            {
+                reset();
+            }
+
+            task_function(const task_function&) = delete;
+            task_function& operator = (const task_function&) = delete;
+
+            void operator()()
+            {
+                assert(m_ops);
+                m_ops->invoke(&m_storage);
+            }
+
+            task_handle *get_handle() const {return m_handle;}
+
+            void reset()
+            {
+                if (m_ops)
+                    m_ops->destroy(&m_storage);
+                m_ops = nullptr;
+                m_handle = nullptr;
+            }
+
+            explicit operator bool() const {return m_ops != nullptr;}
+
+        private:
+            struct ops
+            {
+                void (*invoke)(void *);
+                void (*move)(void *from, void *to);
+                void (*destroy)(void *);
+            };
+
+            template<typename functor>
+            struct fits_inline
+            {
+                static const bool value = sizeof(functor) <= INLINE_SIZE && alignof(functor) <= alignof(std::max_align_t)
+                    && std::is_nothrow_move_constructible<functor>::value;
+            };
+
+            template<typename functor>
+            struct inline_ops
+            {
+                static void invoke(void *p) {(*static_cast<functor *>(p))();}
+                static void move(void *from, void *to)
+                {
+                    new (to) functor(std::move(*static_cast<functor *>(from)));
+                    static_cast<functor *>(from)->~functor();
+                }
+                static void destroy(void *p) {static_cast<functor *>(p)->~functor();}
+            };
+
+            template<typename functor>
+            struct heap_ops
+            {
+                static void invoke(void *p) {(**static_cast<functor **>(p))();}
+                static void move(void *from, void *to) {*static_cast<functor **>(to) = *static_cast<functor **>(from);}
+                static void destroy(void *p) {delete *static_cast<functor **>(p);}
+            };
+
+            template<typename functor, typename F>
+            void assign(F&& f, std::true_type)
+            {
+                static const ops o = {&inline_ops<functor>::invoke, &inline_ops<functor>::move, &inline_ops<functor>::destroy};
+                new (&m_storage) functor(std::forward<F>(f));
+                m_ops = &o;
+            }
+
+            template<typename functor, typename F>
+            void assign(F&& f, std::false_type)
+            {
+                static const ops o = {&heap_ops<functor>::invoke, &heap_ops<functor>::move, &heap_ops<functor>::destroy};
+                *reinterpret_cast<functor **>(&m_storage) = new functor(std::forward<F>(f));
+                m_ops = &o;
+            }
+
+            typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type m_storage;
+            const ops *m_ops;
+            task_handle *m_handle;
+        };
+    }
+} // cppactor
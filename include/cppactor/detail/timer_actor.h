@@ -6,6 +6,7 @@
 #include "cppactor/message.h"
 #include "cppactor/detail/system_messages.h"
 #include "cppactor/timer.h"
+#include "cppactor/framework.h"
 #include <iostream>
 #include <memory>
 #include <ctime>
@@ -75,7 +76,7 @@ namespace cppactor
                 }
             }
 
-            void on_message(std::unique_ptr<message>& msg, actor_iptr reply_to)
+            void on_message(std::unique_ptr<message>& msg, actor_ref& reply_to)
             {
                 switch (msg->msg_id)
                 {
@@ -98,6 +99,11 @@ namespace cppactor
                             m_timers.erase(it++);
                         }
 
+                        // release actors stopped since the last tick, and expire ask<>() timeouts
+                        framework::instance()->get_actor_table().reclaim();
+                        framework::instance()->get_timer_wheel().tick();
+                        framework::instance()->get_hibernation().tick();
+
                         //std::cout << "Timer" << std::endl;
                         message *pMsg = msg.release();
 
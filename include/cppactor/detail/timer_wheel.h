@@ -0,0 +1,76 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "cppactor/actor_ref.h"
+#include "cppactor/detail/locks.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        /****************************************************************
+         * Hashed timing wheel for ask<>() timeouts.
+         *
+         * add() can be called from any thread, it appends to a staging vector
+         * under a spin lock. The timer actor calls tick() every 10ms, which
+         * moves staged entries into the wheel and expires the due ones by
+         * sending an ask_timeout_msg to the actor, if the request is still
+         * pending. Buckets are vectors that keep their capacity, so a steady
+         * load of timeouts does not allocate.
+         */
+        class timer_wheel
+        {
+        public:
+            enum
+            {
+                TICK_MS = 10
+                , WHEEL_SIZE = 512
+            };
+
+            timer_wheel();
+
+            timer_wheel(const timer_wheel&) = delete;
+            timer_wheel& operator = (const timer_wheel&) = delete;
+
+            // Expire token on target after at least 'milliseconds'
+            void add(actor_ref target, uint32_t token, int milliseconds);
+
+            // Timer thread only
+            void tick();
+
+        private:
+            struct entry
+            {
+                actor_ref target;
+                uint32_t token;
+                uint32_t ticks;     // ticks to go when staged, full rotations to go once in a bucket
+            };
+
+            void expire(const entry& e);
+
+            timer_wheel_lock m_lock;
+            std::vector<entry> m_staged;
+            std::vector<entry> m_incoming;
+            std::vector<entry> m_buckets[WHEEL_SIZE];
+            uint32_t m_cursor;
+            std::chrono::steady_clock::time_point m_last;
+        };
+    }
+} // cppactor
@@ -0,0 +1,127 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+#include <ttstl/platform.h>
+
+namespace cppactor
+{
+    struct stalled_handler;
+    struct watchdog_stats;
+
+    namespace detail
+    {
+        /****************************************************************
+         * What a pool thread is running, written by the thread around each
+         * handler and read by the watchdog. seq is odd while a handler runs,
+         * the watchdog reads the other fields between two equal reads of it.
+         */
+        struct alignas(TT_CACHE_LINE_SIZE) handler_slot
+        {
+            handler_slot()
+            : seq(0)
+            , actor_id(0)
+            , msg_id(0)
+            , type_id(0)
+            , start_ms(0)
+            , reported(0)
+            {}
+
+            // Pool thread only
+            void begin(uint32_t actor_id_, uint16_t type_id_, int msg_id_, uint32_t now_ms)
+            {
+                uint32_t s = seq.load(std::memory_order_relaxed);
+                // orders the stores below after end()'s, a watchdog that reads
+                // one of them then sees seq move on from the value it read
+                std::atomic_thread_fence(std::memory_order_release);
+                actor_id.store(actor_id_, std::memory_order_relaxed);
+                type_id.store(type_id_, std::memory_order_relaxed);
+                msg_id.store(msg_id_, std::memory_order_relaxed);
+                start_ms.store(now_ms, std::memory_order_relaxed);
+                seq.store(s + 1, std::memory_order_release);
+            }
+
+            void end()
+            {
+                seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            }
+
+            std::atomic<uint32_t> seq;
+            std::atomic<uint32_t> actor_id;     // 0 for a task
+            std::atomic<int> msg_id;
+            std::atomic<uint16_t> type_id;
+            std::atomic<uint32_t> start_ms;     // watchdog::now()
+            uint32_t reported;                  // watchdog only, the seq last reported
+        };
+
+        /****************************************************************
+         * Reports handlers that run for longer than a threshold. A thread
+         * checks the handler_slots of every pool each threshold / 4, and
+         * reports a handler found running past the threshold once, while
+         * it still runs.
+         *
+         * The pool threads read no clock. They stamp a handler with now(),
+         * a millisecond clock the watchdog thread advances on each check,
+         * so the time a handler has run is known to a quarter of the
+         * threshold.
+         */
+        class watchdog
+        {
+        public:
+            typedef std::function<void (const stalled_handler&)> callback;
+
+            watchdog();
+            ~watchdog();
+
+            watchdog(const watchdog&) = delete;
+            watchdog& operator = (const watchdog&) = delete;
+
+            void start(int threshold_ms, callback report);
+            void stop();
+
+            watchdog_stats get_stats();
+
+            static uint32_t now() {return s_now_ms.load(std::memory_order_relaxed);}
+
+        private:
+            void run();
+            void check(uint32_t now_ms);
+            static uint32_t clock_ms();
+
+            std::mutex m_mtx;
+            std::condition_variable m_cv;
+            bool m_quit;
+            int m_threshold_ms;
+            uint32_t m_start_ms;        // handlers stamped before start() have a stale now()
+            callback m_report;
+            std::thread m_thread;
+
+            // under m_mtx
+            uint64_t m_stalls;
+            std::unordered_map<int, uint64_t> m_by_msg_id;
+
+            static std::atomic<uint32_t> s_now_ms;
+        };
+    }
+} // cppactor
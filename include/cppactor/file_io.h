@@ -0,0 +1,240 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "cppactor/actor_ref.h"
+#include "cppactor/message.h"
+#include "cppactor/detail/locks.h"
+#include "cppactor/detail/system_messages.h"
+
+struct io_uring_sqe;
+
+/********************************************************************
+ * Asynchronous file I/O
+ *
+ * A file_io runs one io_uring. Actors submit reads, writes and fsyncs to
+ * it and are sent a file_io_done when each completes, so a handler never
+ * waits on the disk:
+ *
+ *      cppactor::file_io io;
+ *      int audit = io.register_file(open("audit.log", O_WRONLY | O_CREAT | O_APPEND, 0644));
+ *
+ *      // in a handler
+ *      cppactor::file_buffer *b = io.get_buffer();
+ *      b->size = format_record(b->data, b->capacity, order);
+ *      io.write(get_ref(), audit, m_offset, b);
+ *      m_offset += b->size;
+ *
+ *      case cppactor::file_io_done::msg_id:
+ *          if (static_cast<cppactor::file_io_done *>(msg.get())->result < 0) ...
+ *
+ * Files are registered with the ring, and file_buffers come from memory
+ * registered with it, so the kernel neither looks the file up nor maps
+ * the buffer on every operation. write() and read() also take plain
+ * memory, at the cost of a copy.
+ *
+ * Submitting fills a ring entry under a spin lock. The file_io's thread
+ * turns the completions into messages, then hands all the entries added
+ * since its last call to the kernel in the io_uring_enter() that waits
+ * for the next completions. A submitter only wakes it while it waits
+ * for none, the entries added while it runs or while operations are in
+ * flight go with its next call. With sq_poll_idle_ms a kernel thread
+ * picks the entries up as they are added instead, at the cost of a core
+ * it keeps busy until it has been idle that long.
+ *
+ * The messages go to actor_refs, an empty one is sent nothing. Operations
+ * on one file are not ordered, fsync() after the writes it covers have
+ * completed.
+ */
+namespace cppactor
+{
+    class file_io;
+
+    enum file_op
+    {
+        FILE_READ
+        , FILE_WRITE
+        , FILE_FSYNC
+    };
+
+    struct file_io_options
+    {
+        file_io_options()
+        : queue_depth(256)
+        , buffer_count(64)
+        , buffer_size(64 << 10)
+        , max_files(64)
+        , sq_poll_idle_ms(0)
+        {}
+
+        unsigned int queue_depth;   // ring entries, submitters wait for room beyond it
+        unsigned int buffer_count;  // registered buffers
+        size_t buffer_size;
+        unsigned int max_files;     // registered files
+        unsigned int sq_poll_idle_ms;   // 0 for no kernel polling thread, or when it may not be created
+    };
+
+    struct file_io_stats
+    {
+        uint64_t submitted;
+        uint64_t completed;
+        uint64_t failed;            // completed with an error
+        uint64_t enters;            // io_uring_enter() calls
+        uint64_t copies;            // operations on memory that is not a registered buffer
+
+        double ops_per_enter() const {return enters ? static_cast<double>(submitted) / enters : 0.0;}
+    };
+
+    // Memory registered with the ring, see file_io::get_buffer()
+    struct file_buffer
+    {
+        char *data;
+        size_t capacity;
+        size_t size;                // bytes to write
+        int index;                  // in the ring's registration, -1 if not registered
+    };
+
+/********************************************************************
+ * Sent when an operation completes. A read's buffer goes back to the
+ * file_io when the message is deleted.
+ */
+class file_io_done : public message
+{
+public:
+    enum {msg_id = detail::file_message_done};
+    ~file_io_done();
+
+    // What a read returned
+    const char *data() const {return m_buffer ? m_buffer->data : nullptr;}
+    size_t size() const {return result > 0 ? result : 0;}
+
+    file_op op;
+    int file;
+    uint64_t offset;
+    uint64_t tag;               // given to the call
+    int result;                 // bytes read or written, 0 for an fsync, -errno on failure
+
+private_impl:
+    file_io_done(file_io *io, actor_ref to, file_op op_, int file_, uint64_t offset_, uint64_t tag_, file_buffer *buffer);
+
+    file_io *m_io;
+    actor_ref m_to;
+    file_buffer *m_buffer;
+};
+
+class file_io
+{
+public:
+    explicit file_io(const file_io_options& options = file_io_options());
+
+    // Waits for the operations in flight, their messages are sent
+    ~file_io();
+
+    file_io(const file_io&) = delete;
+    file_io& operator = (const file_io&) = delete;
+
+    // false if the ring could not be set up, every submission then fails
+    bool is_open() const {return m_ring_fd >= 0;}
+
+    // The index to pass for fd, -1 if max_files are registered. The
+    // caller still owns fd, and closes it after unregister_file().
+    int register_file(int fd);
+    void unregister_file(int file);
+
+    // A registered buffer to fill and pass to write(), nullptr if they
+    // are all in use. release_buffer() if it is not written after all.
+    file_buffer *get_buffer();
+    void release_buffer(file_buffer *buffer);
+
+    // Writes buffer->size bytes at offset, the buffer is returned once written
+    bool write(actor_ref to, int file, uint64_t offset, file_buffer *buffer, uint64_t tag = 0);
+
+    // Copies data, into a registered buffer if one is free
+    bool write(actor_ref to, int file, uint64_t offset, const void *data, size_t size, uint64_t tag = 0);
+
+    // Reads up to size bytes at offset into the done message
+    bool read(actor_ref to, int file, uint64_t offset, size_t size, uint64_t tag = 0);
+
+    bool fsync(actor_ref to, int file, bool datasync = false, uint64_t tag = 0);
+
+    file_io_stats get_stats() const;
+
+private_impl:
+    void put_buffer(file_buffer *buffer);
+
+private:
+    bool setup();
+    bool submit(file_io_done *done, uint8_t opcode, uint32_t fsync_flags);
+    io_uring_sqe *next_sqe(bool wake_read);
+    void wake();
+    void wake_poller();
+    void run();
+    void complete(file_io_done *done, int result);
+
+    const file_io_options m_options;
+    int m_ring_fd;
+    bool m_sq_poll;
+    int m_wake_fd;
+    uint64_t m_wake_value;
+
+    // the ring, shared with the kernel
+    void *m_sq_ring;
+    size_t m_sq_ring_size;
+    void *m_cq_ring;
+    size_t m_cq_ring_size;
+    io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+    std::atomic<uint32_t> *m_sq_head;
+    std::atomic<uint32_t> *m_sq_tail;
+    std::atomic<uint32_t> *m_sq_flags;
+    uint32_t *m_sq_array;
+    uint32_t m_sq_mask;
+    uint32_t m_sq_entries;
+    std::atomic<uint32_t> *m_cq_head;
+    std::atomic<uint32_t> *m_cq_tail;
+    void *m_cqes;
+    uint32_t m_cq_mask;
+
+    char *m_memory;                                 // the registered buffers
+    std::vector<file_buffer> m_buffers;
+
+    // under m_lock
+    detail::file_io_lock m_lock;
+    uint32_t m_unsubmitted;                         // entries added since the last io_uring_enter()
+    size_t m_in_flight;
+    bool m_quit;
+    std::vector<file_buffer *> m_free;
+
+    std::atomic<bool> m_sleeping;                   // the thread waits in io_uring_enter(), a submitter wakes it
+
+    std::mutex m_files_mtx;
+    std::vector<int> m_files;                       // fd per index, -1 if free
+
+    std::atomic<uint64_t> m_submitted;
+    std::atomic<uint64_t> m_completed;
+    std::atomic<uint64_t> m_failed;
+    std::atomic<uint64_t> m_enters;
+    std::atomic<uint64_t> m_copies;
+    std::thread m_thread;
+};
+
+} // cppactor
@@ -17,10 +17,19 @@
 #pragma once
 #include <unordered_map>
 #include <mutex>
+#include <vector>
+#include <chrono>
 #include <utility>
 #include <iostream>
 #include "cppactor/instrusive_ptr.h"
 #include "cppactor/timer.h"
+#include "cppactor/detail/actor_table.h"
+#include "cppactor/detail/timer_wheel.h"
+#include "cppactor/detail/hibernation.h"
+#include "cppactor/detail/watchdog.h"
+#include "cppactor/detail/dead_letters.h"
+#include "cppactor/detail/task_function.h"
+#include "cppactor/task_handle.h"
 
 namespace cppactor
 {
@@ -28,10 +37,114 @@ namespace cppactor
     {
         class pool_base;
         typedef instrusive_ptr<pool_base> pool_t;
+        class reactor_actor;
     }
     class actor;
     typedef instrusive_ptr<actor> actor_iptr;
 
+    // What framework::shutdown() does with the messages still queued
+    enum shutdown_mode
+    {
+        SHUTDOWN_DROP       // drop them, each actor exits after the handler it is running
+        , SHUTDOWN_DRAIN    // handle them first, until the pools go idle or the deadline passes
+    };
+
+    struct shutdown_report
+    {
+        size_t actors;              // actors whose on_exit() was called
+        size_t dropped_messages;    // messages left in a mailbox when its actor exited
+        bool drained;               // SHUTDOWN_DRAIN only, the pools went idle before the deadline
+        int elapsed_ms;
+        std::vector<uint32_t> not_exited;   // actors still in a handler at the deadline, their pools were left running
+    };
+
+    struct hibernation_stats
+    {
+        size_t resident;            // actors not hibernating
+        size_t hibernated;          // actors hibernating now
+        uint64_t hibernations;      // times an actor went into hibernation
+        uint64_t wakeups;           // times a hibernating actor was woken up
+        uint64_t bytes_reclaimed;   // mailbox storage freed, plus what on_hibernate() reported
+    };
+
+    // How a pool picks the next actor to run, see create_pool()
+    enum pool_scheduling
+    {
+        SCHEDULE_FIFO           // in the order actors became ready
+        , SCHEDULE_DEADLINE     // the earliest message::get_deadline() first, then FIFO
+    };
+
+    struct deadline_stats
+    {
+        uint64_t handled;           // messages with a deadline whose handler returned
+        uint64_t missed;            // of those, returned after the deadline
+        uint64_t max_lateness_ns;
+        uint64_t promoted;          // SCHEDULE_DEADLINE, waiting actors moved up by an earlier deadline
+    };
+
+    // A handler found running past the watchdog threshold, see framework::start_watchdog()
+    struct stalled_handler
+    {
+        uint32_t poolid;
+        int thread;                 // index in the pool
+        uint32_t actor_id;          // 0 for a task, see framework::submit()
+        const char *actor_type;     // "" for a task
+        int msg_id;
+        int elapsed_ms;             // so far, it is still running
+    };
+
+    struct watchdog_stats
+    {
+        uint64_t stalls;                                // handlers reported
+        std::vector<std::pair<int, uint64_t> > by_msg_id;  // reported handlers per message id
+    };
+
+    // Why a message reached no handler, see framework::set_dead_letter_actor()
+    enum dead_letter_reason
+    {
+        DEAD_LETTER_UNHANDLED           // Dispatch<> has no handler for its msg_id
+        , DEAD_LETTER_STOPPED           // sent to a stopped actor
+        , DEAD_LETTER_NO_ACTOR          // sent through an actor_ref whose actor is gone
+        , DEAD_LETTER_WRONG_POOL        // the actor's pool was not created with its type
+        , DEAD_LETTER_REASONS
+    };
+
+    struct dead_letter_count
+    {
+        dead_letter_reason reason;
+        const char *actor_type;     // "" if the actor is not known
+        int msg_id;
+        uint64_t count;
+    };
+
+    struct dead_letter_stats
+    {
+        uint64_t by_reason[DEAD_LETTER_REASONS];
+        uint64_t forwarded;                     // sent to the dead letter actor
+        uint64_t rate_limited;                  // not sent, over max_per_second
+        uint64_t untracked;                     // counted by reason only, the table was full
+        std::vector<dead_letter_count> counts;  // per reason, actor type and msg_id
+    };
+
+    // How framework::watch_fd() delivers a descriptor, see reactor.h
+    enum io_mode
+    {
+        IO_READABLE         // an io_ready when it has data, the actor reads
+        , IO_RECEIVE        // io_data with what the reactor read, io_closed at the end
+    };
+
+    struct reactor_stats
+    {
+        size_t watched;             // descriptors watched now
+        uint64_t wakeups;           // epoll_wait() calls that returned events
+        uint64_t events;
+        uint64_t messages;          // io_ready and io_data sent
+        uint64_t bytes;             // read by the reactor
+        uint64_t throttled;         // times a descriptor had MAX_IN_FLIGHT io_data waiting
+        uint64_t buffers_allocated;
+        uint64_t buffers_reused;
+    };
+
     class framework
     {
     public:
@@ -39,7 +152,10 @@ namespace cppactor
         // Get an instance of a framework
         static framework * instance();
         
-        void add_actor(actor_iptr a);
+        void add_actor(const actor_iptr& a);
+
+        // Register count actors under one lock, see create_actors()
+        void add_actors(actor *const *actors, size_t count);
 
         // Stop an actor and release all framework references to it.
         // This will immediately stop the actor, any messages on the queue will
@@ -49,8 +165,16 @@ namespace cppactor
         void stop_actor(actor_iptr actor);
 
         // Shutdown all thread pools. This is a synchronous call.
-        // Each actor's on_exit() will be called.
-        void shutdown();
+        // Each actor's on_exit() will be called, on one of its pool's threads
+        // once its running handler, if any, has returned. The actors of all
+        // pools exit concurrently, then the pools stop together.
+        // With SHUTDOWN_DRAIN the queued messages are handled first, for at
+        // most deadline_ms, and whatever is left then is dropped.
+        // A deadline_ms > 0 also bounds the wait for the actors to exit: the
+        // pools of an actor still in a handler then are left running until
+        // it has exited, see shutdown_report::not_exited. 0 waits for as
+        // long as it takes.
+        shutdown_report shutdown(shutdown_mode mode = SHUTDOWN_DROP, int deadline_ms = 0);
 
         // Timer for non-actor receivers. 
         // This will be called within the context of the timer thread.
@@ -64,29 +188,100 @@ namespace cppactor
         // 'period' parameter is in milliseconds and should be
         // a multiple of 10 milliseconds.
         // Returns a timer id
-        int set_timer(actor_iptr actor, int period, bool repeat);
+        int set_timer(const actor_iptr& actor, int period, bool repeat);
 
         // Cancel a timer. The timerid was returned by one of the set_timer() functions
         void cancel_timer(int timerid);
 
+        // Watch fd with the framework's reactor on behalf of actor, which is
+        // sent what it sees as messages, see reactor.h. Registration is
+        // asynchronous, a descriptor epoll refuses is an io_closed.
+        void watch_fd(const actor_iptr& actor, int fd, io_mode mode);
+
+        // Stop watching fd, before the owner closes it
+        void unwatch_fd(int fd);
+
+        reactor_stats get_reactor_stats();
+
+        // Counters of the messages with a deadline a pool has handled,
+        // kept whatever its pool_scheduling
+        deadline_stats get_deadline_stats(uint32_t poolid);
+
+        // Start a thread that reports handlers running for longer than
+        // threshold_ms, once per handler while it still runs. report is
+        // called on that thread, without one they are logged. Pool threads
+        // only publish what they run, the checks cost them nothing. The
+        // internal pools are not watched.
+        void start_watchdog(int threshold_ms, std::function<void (const stalled_handler&)> report = nullptr);
+        void stop_watchdog();
+        watchdog_stats get_watchdog_stats();
+
+        // Messages that reach no handler are counted per reason, actor type
+        // and msg_id, on the thread that finds them and without a lock.
+        // With an actor set, up to max_per_second of them are also sent to
+        // it as a dead_letter, see dead_letter.h. An empty actor_ref stops
+        // that.
+        void set_dead_letter_actor(actor_ref to, int max_per_second = 100);
+        dead_letter_stats get_dead_letter_stats();
+
         // Get an actor given the actor id
         actor_iptr get_actor(uint32_t actorid);
+
+        // Counters for actors that opted in with actor::hibernate_after()
+        hibernation_stats get_hibernation_stats();
+
+        // Run a plain void() task on one of the pool's threads, without an
+        // actor. Tasks share the pool's threads with its actors, a thread
+        // alternates between the two when both have work. Tasks may run
+        // concurrently and in any order.
+        // Captures up to detail::task_function::INLINE_SIZE bytes are stored
+        // in the task queue, larger tasks are allocated.
+        // If 'done' is given it is completed once the task has run, the
+        // caller must keep it alive until then. A task submitted once
+        // shutdown() has begun is not run, 'done' is completed as
+        // cancelled and a warning is logged.
+        template <typename F>
+        void submit(uint32_t poolid, F&& task, task_handle *done = nullptr)
+        {
+            submit_task(poolid, detail::task_function(std::forward<F>(task), done));
+        }
+    private_impl:
+        detail::actor_table& get_actor_table() {return m_actor_table;}
+        detail::timer_wheel& get_timer_wheel() {return m_timer_wheel;}
+        detail::hibernation& get_hibernation() {return m_hibernation;}
+        detail::dead_letter_office& get_dead_letters() {return m_dead_letters;}
+        size_t get_pool_size(uint32_t poolid);     // number of threads, 0 if there is no such pool
+        detail::pool_t get_pool(uint32_t poolid);
+        std::vector<detail::pool_t> get_pools();
+        instrusive_ptr<detail::reactor_actor> get_reactor();   // created on first use, null after shutdown()
     private:
         template <typename...ActorTypes>
-        friend void create_pool(uint32_t poolid, int nThreads);
+        friend void create_pool(uint32_t poolid, int nThreads, pool_scheduling scheduling);
 
         template <typename Actor, typename...Args>
         friend instrusive_ptr<Actor> create_actor(uint32_t poolid, Args&&... args);
 
-        void add_pool(detail::pool_t p);
-        detail::pool_t get_pool(uint32_t poolid);
+        void add_pool(const detail::pool_t& p);
+        void submit_task(uint32_t poolid, detail::task_function&& task);
+        bool wait_idle(std::vector<detail::pool_t>& pools, std::chrono::steady_clock::time_point deadline);
     private:
+        enum {POOL_INDEX_SIZE = 256};
+
         static framework *theObject;
         std::unordered_map<uint32_t, actor_iptr > m_actors;
         std::unordered_map<uint32_t, detail::pool_t > m_pools;
+        std::vector<detail::pool_t> m_stopped_pools;                        // by shutdown(), kept for submit_task()
+        std::atomic<detail::pool_base *> m_pool_index[POOL_INDEX_SIZE];     // lock free lookup of small pool ids, owned by m_pools or m_stopped_pools
+        detail::actor_table m_actor_table;
+        detail::timer_wheel m_timer_wheel;
+        detail::hibernation m_hibernation;
+        detail::dead_letter_office m_dead_letters;
         std::mutex m_mtx;
         uint32_t m_timerActorId;
         std::atomic<int> m_timeridpool;
+        std::once_flag m_reactor_once;
+        actor_iptr m_reactor;                   // under m_mtx, reset by shutdown()
+        detail::watchdog m_watchdog;            // last, its thread reads m_pools
     };
 }
 
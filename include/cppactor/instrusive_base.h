@@ -16,6 +16,26 @@
  ***************************************************************************/
 #pragma once
 #include <atomic>
+#include <cstdint>
+
+#ifdef CPPACTOR_REFCOUNT_STATS
+namespace cppactor
+{
+    namespace detail
+    {
+        // Number of atomic read-modify-writes done on reference counts.
+        // Only compiled in for benchmarking, the counter itself is contended.
+        inline std::atomic<uint64_t>& refcount_rmw_counter()
+        {
+            static std::atomic<uint64_t> counter(0);
+            return counter;
+        }
+    }
+}
+#define CPPACTOR_COUNT_REFCOUNT_RMW() cppactor::detail::refcount_rmw_counter().fetch_add(1, std::memory_order_relaxed)
+#else
+#define CPPACTOR_COUNT_REFCOUNT_RMW()
+#endif
 
 namespace cppactor
 {
@@ -29,14 +49,22 @@ namespace cppactor
         virtual ~instrusive_base()
         { }
 
+        // Releases a reference. The release/acquire pair makes every write done
+        // through other references visible to whoever deletes the object.
         int dec_ref()
         {
-            int val = refcount.fetch_add(-1);
+            CPPACTOR_COUNT_REFCOUNT_RMW();
+            int val = refcount.fetch_sub(1, std::memory_order_release);
+            if (val == 1)
+                std::atomic_thread_fence(std::memory_order_acquire);
             return val-1;
         }
+
+        // A new reference can only be made from an existing one, so no ordering is needed
         void inc_ref()
         {
-            refcount.fetch_add(1);
+            CPPACTOR_COUNT_REFCOUNT_RMW();
+            refcount.fetch_add(1, std::memory_order_relaxed);
         }
         mutable std::atomic<int> refcount;
     };
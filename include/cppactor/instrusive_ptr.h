@@ -15,6 +15,7 @@
  *
  ***************************************************************************/
 #pragma once
+#include <utility>
 #include "instrusive_base.h"
 
 namespace cppactor
@@ -59,6 +60,21 @@ namespace cppactor
             reset(cc.object);
         }
 
+        // Move constructor, takes over the reference without touching the count
+        instrusive_ptr(instrusive_ptr<T>&& mv) noexcept
+        :object(mv.object)
+        {
+            mv.object = nullptr;
+        }
+
+        // Move from a derived type
+        template<typename U>
+        instrusive_ptr(instrusive_ptr<U>&& mv) noexcept
+        :object(mv.object)
+        {
+            mv.object = nullptr;
+        }
+
         instrusive_ptr& operator=(const instrusive_ptr& rhs)
         {
             reset(rhs.object);
@@ -73,8 +89,27 @@ namespace cppactor
             return *this;
         }
 
+        instrusive_ptr& operator=(instrusive_ptr&& rhs) noexcept
+        {
+            instrusive_ptr(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        // move assignment from a derived type
+        template<typename U>
+        instrusive_ptr& operator=(instrusive_ptr<U>&& rhs) noexcept
+        {
+            instrusive_ptr(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        void swap(instrusive_ptr& other) noexcept
+        {
+            std::swap(object, other.object);
+        }
+
         // true if not null
-        operator bool() {return object != nullptr;}
+        operator bool() const {return object != nullptr;}
 
         // Cast to type U, usually used to downcast to derived type
         // example:
@@ -114,9 +149,11 @@ namespace cppactor
 
         void reset(pointer p)
         {
-            dec_ref(object);
+            // take the new reference first, p may be kept alive only by object
+            inc_ref(p);
+            pointer old = object;
             object = p;
-            inc_ref(object);
+            dec_ref(old);
         }
 
         pointer get()
@@ -0,0 +1,328 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <type_traits>
+#include "cppactor/actor.h"
+#include "cppactor/actor_ref.h"
+#include "cppactor/detail/locks.h"
+
+/********************************************************************
+ * Message journal
+ *
+ * An actor that opted in with actor::journal_to() has the messages of
+ * registered types appended to a memory mapped log, by the pool thread
+ * that is about to handle them. After a restart journal::replay() sends
+ * them back to the actors, through the normal on_message() path, so the
+ * actors rebuild their state without asking anyone for a snapshot.
+ *
+ * A message type is registered once at startup, and provides its flat
+ * form:
+ *
+ *      struct Fill : public cppactor::message
+ *      {
+ *          void journal_save(cppactor::journal_writer& out) const {out.put(price); out.put(qty);}
+ *          static Fill *journal_load(cppactor::journal_reader& in)
+ *          {
+ *              Fill *f = new Fill();
+ *              in.get(f->price);
+ *              in.get(f->qty);
+ *              return f;
+ *          }
+ *          ...
+ *      };
+ *      cppactor::register_journal_message<Fill>();
+ *
+ * The log is a series of segment files of journal_options::segment_size
+ * bytes, written through a shared mapping. A record survives a crash of
+ * the process as soon as it is appended. A flusher thread msyncs what was
+ * appended in one batch every flush_interval_ms, which covers the host
+ * going down, sync() waits for that.
+ *
+ * checkpoint() asks every journaled actor for a snapshot of its state,
+ * see actor::on_journal_snapshot(), on its own thread. Once all of them
+ * are in the log, the segments before the checkpoint are deleted. replay()
+ * restores each actor from its latest snapshot and only sends it the
+ * messages that came after.
+ *
+ * The journal must outlive the actors journaling to it, destroy it after
+ * framework::shutdown().
+ */
+namespace cppactor
+{
+    class message;
+
+    /****************************************************************
+     * Builds the flat form of a message or snapshot
+     */
+    class journal_writer
+    {
+    public:
+        template <typename T>
+        void put(const T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "write the fields of non trivial types one by one");
+            put_bytes(&value, sizeof(T));
+        }
+
+        void put(const std::string& s)
+        {
+            put(static_cast<uint32_t>(s.size()));
+            put_bytes(s.data(), s.size());
+        }
+
+        void put_bytes(const void *data, size_t size)
+        {
+            const char *p = static_cast<const char *>(data);
+            m_data.insert(m_data.end(), p, p + size);
+        }
+
+        const char *data() const {return m_data.data();}
+        size_t size() const {return m_data.size();}
+        void clear() {m_data.clear();}
+
+    private:
+        std::vector<char> m_data;
+    };
+
+    /****************************************************************
+     * Reads back what a journal_writer wrote. A read past the end
+     * fails, and so does every read after it.
+     */
+    class journal_reader
+    {
+    public:
+        journal_reader(const char *data, size_t size)
+        : m_data(data)
+        , m_size(size)
+        , m_pos(0)
+        , m_ok(true)
+        {}
+
+        template <typename T>
+        bool get(T& value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "read the fields of non trivial types one by one");
+            return get_bytes(&value, sizeof(T));
+        }
+
+        bool get(std::string& s)
+        {
+            uint32_t n = 0;
+            if (!get(n) || m_size - m_pos < n)
+                return m_ok = false;
+            s.assign(m_data + m_pos, n);
+            m_pos += n;
+            return true;
+        }
+
+        bool get_bytes(void *data, size_t size)
+        {
+            if (!m_ok || m_size - m_pos < size)
+                return m_ok = false;
+            memcpy(data, m_data + m_pos, size);
+            m_pos += size;
+            return true;
+        }
+
+        bool ok() const {return m_ok;}
+        size_t remaining() const {return m_size - m_pos;}
+
+    private:
+        const char *m_data;
+        size_t m_size;
+        size_t m_pos;
+        bool m_ok;
+    };
+
+    struct journal_options
+    {
+        journal_options()
+        : segment_size(64 << 20)
+        , flush_interval_ms(10)
+        , checkpoint_interval_ms(0)
+        {}
+
+        size_t segment_size;        // bytes per segment file, a record must fit in one
+        int flush_interval_ms;      // the flusher msyncs new records this often
+        int checkpoint_interval_ms; // the flusher calls checkpoint() this often, 0 for never
+    };
+
+    struct journal_replay_stats
+    {
+        size_t segments;            // segment files read
+        size_t snapshots;           // actors restored from a snapshot
+        size_t messages;            // messages sent to the actors
+        size_t skipped;             // records of unknown keys or types, and messages older than a snapshot
+        size_t torn;                // segments ending in a damaged record, the rest of them was ignored
+    };
+
+    namespace detail
+    {
+        struct journal_codec
+        {
+            void (*save)(const message& msg, journal_writer& out);
+            message *(*load)(journal_reader& in);
+        };
+
+        void add_journal_codec(int msg_id, const journal_codec& codec);
+        const journal_codec *find_journal_codec(int msg_id);
+
+        template <typename Msg>
+        void save_journal_message(const message& msg, journal_writer& out)
+        {
+            static_cast<const Msg&>(msg).journal_save(out);
+        }
+
+        template <typename Msg>
+        message *load_journal_message(journal_reader& in)
+        {
+            return Msg::journal_load(in);
+        }
+    }
+
+/********************************************************************
+ * Register Msg for journaling, at startup before any actor journals.
+ * Messages of other types are not journaled.
+ * Msg:     void journal_save(journal_writer& out) const
+ *          static Msg *journal_load(journal_reader& in), nullptr if the data is bad
+ */
+template <typename Msg>
+void register_journal_message()
+{
+    detail::journal_codec codec = {&detail::save_journal_message<Msg>, &detail::load_journal_message<Msg>};
+    detail::add_journal_codec(Msg::msg_id, codec);
+}
+
+    class journal
+    {
+    public:
+        enum {MAX_JOURNALS = 64};
+
+        // Opens the log 'name' in 'directory'. The segments already there
+        // are kept for replay(), this journal appends to new ones.
+        journal(const std::string& directory, const std::string& name, const journal_options& options = journal_options());
+        ~journal();
+
+        journal(const journal&) = delete;
+        journal& operator = (const journal&) = delete;
+
+        // Sends the records of the segments that were there at open back to
+        // the actors resolve(key) returns, a null actor skips the key. Each
+        // actor is restored from its latest snapshot, then sent the messages
+        // that followed it. Call once at startup, before checkpoint().
+        journal_replay_stats replay(const std::function<actor_iptr(uint64_t key)>& resolve);
+
+        // Snapshot every journaled actor, then delete the segments that are
+        // no longer needed. Returns at once, the snapshots are written on the
+        // actors' threads.
+        void checkpoint();
+
+        // Blocks until every record appended so far has been msync'ed
+        void sync();
+
+        uint64_t get_record_count() const {return m_records.load(std::memory_order_relaxed);}
+        size_t get_segment_count();
+
+    private_impl:
+        uint8_t get_slot() const {return m_slot;}
+        static journal *from_slot(uint8_t slot) {return s_slots[slot].load(std::memory_order_acquire);}
+
+        // see actor::journal_to()
+        void add_actor(actor *a, uint64_t key);
+        void forget(const actor *a);
+        void append(const actor *a, const message *msg);
+        void write_snapshot(actor *a, uint64_t key);
+        void checkpoint_done(uint64_t before, bool complete);
+        void truncate(uint64_t before);     // delete the segments before index 'before'
+
+    private:
+        struct segment
+        {
+            segment()
+            : index(0)
+            , base(nullptr)
+            , size(0)
+            , fd(-1)
+            {}
+
+            uint64_t index;
+            char *base;
+            size_t size;
+            int fd;
+        };
+
+        struct entry
+        {
+            uint64_t key;
+            actor_ref ref;
+        };
+
+        std::string segment_path(uint64_t index) const;
+        bool open_segment(uint64_t index, bool writable, segment& s);
+        static void close_segment(segment& s);
+        void append_record(uint32_t kind, uint64_t key, int msg_id, const journal_writer& payload);
+        void run_flusher();
+        void flush();
+
+        const std::string m_directory;
+        const std::string m_name;
+        const journal_options m_options;
+        uint8_t m_slot;
+
+        // under m_lock
+        detail::journal_lock m_lock;
+        segment m_current;
+        size_t m_offset;
+        bool m_failed;
+        std::vector<segment> m_retired;     // full segments, the flusher syncs and unmaps them
+        std::unordered_map<const actor *, entry> m_actors;
+
+        std::atomic<uint64_t> m_records;
+        std::atomic<bool> m_checkpointing;
+        uint64_t m_first_new;               // the first segment this journal wrote
+
+        // under m_files_mtx
+        std::mutex m_files_mtx;
+        std::deque<uint64_t> m_files;       // segment indexes on disk, oldest first
+
+        // under m_flush_mtx
+        std::mutex m_flush_mtx;
+        std::condition_variable m_flush_cv;
+        bool m_quit;
+        bool m_sync_requested;
+        uint64_t m_flushed;                 // position up to which records are synced
+        std::thread m_flusher;
+
+        // flusher thread only
+        uint64_t m_synced_index;
+        size_t m_synced_offset;
+
+        static std::mutex s_slots_mtx;
+        static std::atomic<journal *> s_slots[MAX_JOURNALS];
+    };
+} // cppactor
@@ -18,7 +18,10 @@
 #include "cppactor/actor.h"
 #include <memory>
 #include <cassert>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 
 namespace cppactor
 {
@@ -29,13 +32,46 @@ namespace cppactor
 
         message(int id, actor_iptr& replyto);
 
+        message(int id, actor_ref replyto);
+
         virtual ~message() {}
 
-        actor_iptr get_reply_to();
+        // Returns a counted reference to the reply_to actor, null if there is none
+        // or it has been stopped. get_reply_ref() is cheaper.
+        actor_iptr get_reply_to() const;
+
+        actor_ref get_reply_ref() const {return m_reply_to;}
+
+        // Set on requests sent with ask<>() and copied to the response by reply()
+        uint32_t get_request_token() const {return m_request_token;}
+        uint32_t get_reply_token() const {return m_reply_token;}
+
+        // When the message should have been handled by. A deadline scheduled
+        // pool, see create_pool(), runs the actor with the earliest one
+        // first. Set it before the message is sent.
+        void set_deadline(std::chrono::steady_clock::time_point t)
+        {
+            m_deadline = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count());
+        }
+
+        void set_deadline_after(std::chrono::nanoseconds timeout) {set_deadline(std::chrono::steady_clock::now() + timeout);}
+
+        // steady_clock nanoseconds, 0 if there is no deadline
+        uint64_t get_deadline() const {return m_deadline;}
 
         int msg_id;
     private:
-        actor_iptr m_reply_to;
+        template <typename Reply, typename F>
+        friend void ask(actor_ref target, message *msg, int timeout_ms, F&& callback);
+        friend unsigned int reply(const message& request, message *response);
+        friend class journal;
+        friend class traffic_capture;
+
+        actor_ref m_reply_to;
+        uint32_t m_request_token;
+        uint32_t m_reply_token;
+        bool m_replayed;            // sent by journal::replay(), not journaled or captured again
+        uint64_t m_deadline;
     };
 
     typedef std::unique_ptr<message> message_uptr;
@@ -0,0 +1,116 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <type_traits>
+#include <cstddef>
+
+/********************************************************************
+ * Message ids numbered by the compiler
+ *
+ * A module lists its message types once, in a block of its own, and each
+ * type takes its position in the list as its id:
+ *
+ *      // trading_messages.h
+ *      struct Order;
+ *      struct Fill;
+ *      struct Cancel;
+ *      typedef cppactor::message_list<TRADING_BLOCK, Order, Fill, Cancel> trading_messages;
+ *
+ *      struct Order : public cppactor::message
+ *      {
+ *          enum {msg_id = trading_messages::id<Order>()};
+ *          ...
+ *      };
+ *
+ *      // trading_messages.cpp, exactly one per list
+ *      CPPACTOR_MESSAGE_BLOCK(trading_messages)
+ *
+ * The ids of a block are dense, from block * MESSAGE_BLOCK_SIZE. A type
+ * listed twice, or looked up in a list it is not in, does not compile.
+ * CPPACTOR_MESSAGE_BLOCK() defines a symbol named after the block, so two
+ * modules claiming the same block fail to link. Dispatch<> indexes a table
+ * rather than comparing ids when the ids it is given are dense.
+ *
+ * Ids below 0 are the framework's, see detail::system_message_types.
+ */
+namespace cppactor
+{
+    enum
+    {
+        MESSAGE_BLOCK_SIZE = 1 << 12
+        , MESSAGE_BLOCKS = (1 << 19) - 1        // block * MESSAGE_BLOCK_SIZE stays below INT_MAX
+    };
+
+    namespace detail
+    {
+        template <typename T, typename...Typelist>
+        struct type_index_of;
+
+        template <typename T, typename...Typelist>
+        struct type_index_of<T, T, Typelist...> : std::integral_constant<int, 0>
+        {
+        };
+
+        template <typename T, typename U, typename...Typelist>
+        struct type_index_of<T, U, Typelist...> : std::integral_constant<int, 1 + type_index_of<T, Typelist...>::value>
+        {
+        };
+
+        template <typename T>
+        struct type_index_of<T>
+        {
+            static_assert(!std::is_same<T, T>::value, "the type is not in the list");
+        };
+
+        // true if no type appears twice in the list
+        template <typename...Typelist>
+        struct distinct_types : std::true_type
+        {
+        };
+
+        template <typename T, typename...Typelist>
+        struct distinct_types<T, Typelist...> : std::integral_constant<bool, !std::disjunction<std::is_same<T, Typelist>...>::value && distinct_types<Typelist...>::value>
+        {
+        };
+
+        // Defined by CPPACTOR_MESSAGE_BLOCK(), once per block in a program
+        template <int Block>
+        const char *message_block_owner();
+    }
+
+    template <int Block, typename...Messages>
+    struct message_list
+    {
+        static_assert(Block >= 0 && Block < MESSAGE_BLOCKS, "message block out of range");
+        static_assert(sizeof...(Messages) <= MESSAGE_BLOCK_SIZE, "too many messages for one block");
+        static_assert(detail::distinct_types<Messages...>::value, "a message type is listed twice");
+
+        enum
+        {
+            block = Block
+            , first_id = Block * MESSAGE_BLOCK_SIZE
+            , size = sizeof...(Messages)
+        };
+
+        template <typename Message>
+        static constexpr int id() {return first_id + detail::type_index_of<Message, Messages...>::value;}
+    };
+} // cppactor
+
+// In one source file per message_list, see above
+#define CPPACTOR_MESSAGE_BLOCK(List) \
+    template <> const char *cppactor::detail::message_block_owner<List::block>() {return #List;}
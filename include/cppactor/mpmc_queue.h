@@ -0,0 +1,336 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+// The bounded queue is Dmitry Vyukov's array based MPMC queue
+// http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+// Each cell carries a sequence number that tells producers and consumers
+// whether it is free for the position they claimed, so there are no locks
+// and no allocation after construction.
+
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <ttstl/platform.h>
+#include "miscutils/binary_spin_lock.h"
+#include "cppactor/detail/spin_locks.h"
+
+namespace cppactor
+{
+    template <typename T>
+    class unbounded_mpmc_queue;
+
+    /****************************************************************
+     * Bounded multi producer, multi consumer queue.
+     * The capacity is rounded up to a power of two. try_push() fails when
+     * the queue is full, try_pop() when it is empty. Elements only need to
+     * be move constructible.
+     */
+    template <typename T>
+    class bounded_mpmc_queue
+    {
+    public:
+        explicit bounded_mpmc_queue(size_t capacity)
+        : m_mask(round_up(capacity) - 1)
+        , m_cells(new cell[m_mask + 1])
+        , m_enqueue_pos(0)
+        , m_dequeue_pos(0)
+        {
+            for (size_t i = 0; i <= m_mask; ++i)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ~bounded_mpmc_queue()
+        {
+            size_t end = m_enqueue_pos.load(std::memory_order_relaxed) & ~CLOSED_BIT;
+            for (size_t pos = m_dequeue_pos.load(std::memory_order_relaxed); pos != end; ++pos)
+                m_cells[pos & m_mask].get()->~T();
+            delete [] m_cells;
+        }
+
+        bounded_mpmc_queue(const bounded_mpmc_queue&) = delete;
+        bounded_mpmc_queue& operator = (const bounded_mpmc_queue&) = delete;
+
+        bool try_push(T&& value)
+        {
+            return push_impl(std::move(value)) == PUSHED;
+        }
+
+        bool try_push(const T& value)
+        {
+            T copy(value);
+            return push_impl(std::move(copy)) == PUSHED;
+        }
+
+        bool try_pop(T& result)
+        {
+            cell *c;
+            size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                c = &m_cells[pos & m_mask];
+                size_t seq = c->sequence.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+                if (dif == 0)
+                {
+                    if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (dif < 0)
+                {
+                    return false;   // empty
+                }
+                else
+                {
+                    pos = m_dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            T *p = c->get();
+            result = std::move(*p);
+            p->~T();
+            c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t capacity() const {return m_mask + 1;}
+
+        // Stops further pushes, try_push() fails from now on while try_pop()
+        // still drains what is queued. Returns the final enqueue position.
+        size_t close()
+        {
+            size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            while (!(pos & CLOSED_BIT) && !m_enqueue_pos.compare_exchange_weak(pos, pos | CLOSED_BIT, std::memory_order_relaxed))
+                ;
+            return pos & ~CLOSED_BIT;
+        }
+
+        // Accept pushes again, the positions carry on where they stopped
+        void reopen()
+        {
+            m_enqueue_pos.store(m_enqueue_pos.load(std::memory_order_relaxed) & ~CLOSED_BIT, std::memory_order_release);
+        }
+
+    private:
+        friend class unbounded_mpmc_queue<T>;
+
+        enum push_result {PUSHED, FULL, CLOSED};
+
+        // set in m_enqueue_pos by close(), producers then fail with CLOSED
+        static const size_t CLOSED_BIT = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+        struct cell
+        {
+            std::atomic<size_t> sequence;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+            T *get() {return reinterpret_cast<T *>(&storage);}
+        };
+
+        static size_t round_up(size_t n)
+        {
+            size_t r = 2;
+            while (r < n)
+                r <<= 1;
+            return r;
+        }
+
+        push_result push_impl(T&& value)
+        {
+            cell *c;
+            size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                if (pos & CLOSED_BIT)
+                    return CLOSED;
+                c = &m_cells[pos & m_mask];
+                size_t seq = c->sequence.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+                if (dif == 0)
+                {
+                    if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (dif < 0)
+                {
+                    return FULL;
+                }
+                else
+                {
+                    pos = m_enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+            new (c->get()) T(std::move(value));
+            c->sequence.store(pos + 1, std::memory_order_release);
+            return PUSHED;
+        }
+
+        size_t dequeue_pos() const {return m_dequeue_pos.load(std::memory_order_acquire);}
+
+        const size_t m_mask;
+        cell *const m_cells;
+        alignas(TT_CACHE_LINE_SIZE) std::atomic<size_t> m_enqueue_pos;
+        alignas(TT_CACHE_LINE_SIZE) std::atomic<size_t> m_dequeue_pos;
+    };
+
+    /****************************************************************
+     * Unbounded multi producer, multi consumer queue, a chain of
+     * bounded_mpmc_queue segments. push() and try_pop() stay on the
+     * lock free path of the current segment. Only moving to a new segment
+     * takes a spin lock: a producer that finds the tail full links another
+     * one, and a consumer that drains the head closes it and moves on.
+     *
+     * Drained segments go to a free list and are reused, they are only
+     * freed with the queue, so a thread still looking at a retired segment
+     * never touches freed memory. A closed segment refuses pushes, and a
+     * reused one carries on its positions, so such a thread either fails
+     * and retries, or works on a live segment of this queue.
+     *
+     * Elements are FIFO within a segment. A thread that was preempted
+     * around a segment change can push or pop out of order, which suits
+     * scheduling queues.
+     */
+    template <typename T>
+    class unbounded_mpmc_queue
+    {
+    public:
+        enum {DEFAULT_SEGMENT_SIZE = 256};
+
+        explicit unbounded_mpmc_queue(size_t segment_size = DEFAULT_SEGMENT_SIZE)
+        : m_segment_size(segment_size)
+        , m_allocated(1)
+        {
+            segment *s = new segment(m_segment_size);
+            m_head.store(s, std::memory_order_relaxed);
+            m_tail.store(s, std::memory_order_relaxed);
+        }
+
+        ~unbounded_mpmc_queue()
+        {
+            segment *s = m_head.load(std::memory_order_relaxed);
+            while (s)
+            {
+                segment *next = s->next.load(std::memory_order_relaxed);
+                delete s;
+                s = next;
+            }
+            for (segment *f : m_free)
+                delete f;
+        }
+
+        unbounded_mpmc_queue(const unbounded_mpmc_queue&) = delete;
+        unbounded_mpmc_queue& operator = (const unbounded_mpmc_queue&) = delete;
+
+        void push(T&& value)
+        {
+            for (;;)
+            {
+                segment *s = m_tail.load(std::memory_order_acquire);
+                if (s->ring.push_impl(std::move(value)) == bounded_mpmc_queue<T>::PUSHED)
+                    return;
+                grow(s);
+            }
+        }
+
+        void push(const T& value)
+        {
+            T copy(value);
+            push(std::move(copy));
+        }
+
+        bool try_pop(T& result)
+        {
+            for (;;)
+            {
+                segment *s = m_head.load(std::memory_order_acquire);
+                if (s->ring.try_pop(result))
+                    return true;
+                if (s->next.load(std::memory_order_acquire) == nullptr)
+                    return false;
+                if (!retire(s, result))
+                    continue;
+                return true;
+            }
+        }
+
+        // Segments allocated so far, including the ones on the free list
+        size_t segments_allocated() const {return m_allocated.load(std::memory_order_relaxed);}
+
+    private:
+        struct segment
+        {
+            explicit segment(size_t size)
+            : ring(size)
+            , next(nullptr)
+            {}
+
+            bounded_mpmc_queue<T> ring;
+            std::atomic<segment *> next;
+        };
+
+        // s was full, make sure the tail has moved past it
+        void grow(segment *s)
+        {
+            miscutils::SpinLockMonitor<detail::ttas_spin_lock<> > lock(m_lock);
+            if (m_tail.load(std::memory_order_relaxed) != s)
+                return;
+            segment *n;
+            if (!m_free.empty())
+            {
+                n = m_free.back();
+                m_free.pop_back();
+                n->next.store(nullptr, std::memory_order_relaxed);
+                n->ring.reopen();
+            }
+            else
+            {
+                n = new segment(m_segment_size);
+                m_allocated.fetch_add(1, std::memory_order_relaxed);
+            }
+            s->next.store(n, std::memory_order_release);
+            m_tail.store(n, std::memory_order_release);
+        }
+
+        // s looked empty and has a successor. Close it and, once every
+        // claimed cell has been consumed, unlink it. Returns true if an
+        // element turned up in s meanwhile.
+        bool retire(segment *s, T& result)
+        {
+            miscutils::SpinLockMonitor<detail::ttas_spin_lock<> > lock(m_lock);
+            if (m_head.load(std::memory_order_relaxed) != s)
+                return false;
+            size_t end = s->ring.close();
+            if (s->ring.try_pop(result))
+                return true;
+            if (s->ring.dequeue_pos() != end)
+                return false;   // a producer is still writing its cell, s stays the head
+            m_head.store(s->next.load(std::memory_order_acquire), std::memory_order_release);
+            m_free.push_back(s);
+            return false;
+        }
+
+        const size_t m_segment_size;
+        alignas(TT_CACHE_LINE_SIZE) std::atomic<segment *> m_head;
+        alignas(TT_CACHE_LINE_SIZE) std::atomic<segment *> m_tail;
+        alignas(TT_CACHE_LINE_SIZE) detail::ttas_spin_lock<> m_lock;
+        std::vector<segment *> m_free;
+        std::atomic<size_t> m_allocated;
+    };
+}   // cppactor
@@ -0,0 +1,119 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+#include "cppactor/detail/parallel_job.h"
+
+/********************************************************************
+ * Data parallel loops on a pool's threads
+ *
+ * The range [first, last) is cut into chunks of 'grain' indexes. The
+ * calling thread and up to one framework::submit() task per pool thread
+ * work through the chunks, each participant starting on its own share and
+ * stealing from the others once it runs out. The call returns when every
+ * chunk has run. A grain of 0 picks about four chunks per participant.
+ *
+ * The caller always takes part, so the loops can be called from a message
+ * handler, even on the pool they run on, and complete if no pool thread
+ * is free. They do block the calling thread until then.
+ *
+ * If fn throws, the other chunks still run and the first exception is
+ * rethrown to the caller.
+ */
+namespace cppactor
+{
+    namespace detail
+    {
+        template <typename F>
+        struct for_context
+        {
+            static void run(void *ctx, size_t, size_t begin, size_t end)
+            {
+                F& fn = *static_cast<F *>(ctx);
+                for (size_t i = begin; i < end; ++i)
+                    fn(i);
+            }
+        };
+
+        // one per chunk, a struct so that vector<bool> does not pack them
+        template <typename T>
+        struct partial_result
+        {
+            T value;
+        };
+
+        template <typename T, typename F>
+        struct reduce_context
+        {
+            static void run(void *ctx, size_t chunk, size_t begin, size_t end)
+            {
+                reduce_context& rc = *static_cast<reduce_context *>(ctx);
+                rc.partials[chunk].value = rc.fn(begin, end);
+            }
+
+            F& fn;
+            std::vector<partial_result<T> >& partials;
+        };
+    }
+
+/********************************************************************
+ * Call fn(i) for every i in [first, last).
+ * F:   void(size_t i)
+ * Example:
+ *      cppactor::parallel_for(1, 0, prices.size(), 0, [&](size_t i) {
+ *          prices[i] *= fx;
+ *      });
+ */
+template <typename F>
+void parallel_for(uint32_t poolid, size_t first, size_t last, size_t grain, F&& fn)
+{
+    typedef typename std::remove_reference<F>::type fn_type;
+    detail::parallel_plan plan = detail::plan_parallel(poolid, first, last, grain);
+    detail::run_parallel(poolid, plan, &detail::for_context<fn_type>::run, const_cast<void *>(static_cast<const void *>(&fn)));
+}
+
+/********************************************************************
+ * Reduce [first, last). fn(begin, end) reduces one chunk, the chunk
+ * results are then folded into 'identity' with combine() on the calling
+ * thread, in index order, so combine only needs to be associative.
+ * F:       T(size_t begin, size_t end)
+ * Combine: T(T accumulated, T chunk)
+ * Example:
+ *      double total = cppactor::parallel_reduce(1, 0, v.size(), 0, 0.0,
+ *          [&](size_t b, size_t e) {return std::accumulate(&v[b], &v[e], 0.0);},
+ *          std::plus<double>());
+ */
+template <typename T, typename F, typename Combine>
+T parallel_reduce(uint32_t poolid, size_t first, size_t last, size_t grain, T identity, F&& fn, Combine&& combine)
+{
+    detail::parallel_plan plan = detail::plan_parallel(poolid, first, last, grain);
+    std::vector<detail::partial_result<T> > partials(plan.chunks, detail::partial_result<T>{identity});
+    typedef typename std::remove_reference<F>::type fn_type;
+    detail::reduce_context<T, fn_type> ctx = {fn, partials};
+    detail::run_parallel(poolid, plan, &detail::reduce_context<T, fn_type>::run, &ctx);
+
+    T result = std::move(identity);
+    for (detail::partial_result<T>& partial : partials)
+        result = combine(std::move(result), std::move(partial.value));
+    return result;
+}
+
+} // cppactor
@@ -0,0 +1,295 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <memory>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+#include "cppactor/actor.h"
+#include "cppactor/spsc_queue.h"
+#include "cppactor/detail/pipeline_segment.h"
+
+/********************************************************************
+ * Pipelines
+ *
+ * A fixed chain of stages, each with exactly one producer, connected by
+ * bounded_spsc_queue rings instead of actor mailboxes. Each stage() starts
+ * a new thread, optionally pinned to a cpu, and fuse() runs a stage on the
+ * thread of the stage before it. The chain ends with a sink, a plain
+ * function or an actor the results are sent to.
+ *
+ *      auto feed = cppactor::make_pipeline<Packet>(4096)
+ *          .stage([](Packet&& p) {return decode(p);}, 2)
+ *          .fuse([](Decoded&& d) {return normalize(d);})
+ *          .stage([&](Normalized&& n) {return book.apply(n);}, 3)
+ *          .to_actor(publisher, [](BookUpdate&& u) {return new BookMsg(u);})
+ *          .build();
+ *      feed.push(packet);
+ *
+ * A stage is a function taking its input by rvalue reference (or by
+ * value) and returning the next stage's input. A full ring blocks the
+ * stage feeding it, and eventually push(), so a slow stage slows the
+ * producer down rather than queueing without bound.
+ *
+ * Only one thread at a time may push. An ordinary actor can feed a
+ * pipeline from its handler, its turns never overlap.
+ *
+ * Stage threads poll their input, they spin, then yield, then sleep 50us
+ * at a time once the pipeline has been idle for a while. An exception
+ * escaping a stage terminates the process, as it does in a handler.
+ */
+namespace cppactor
+{
+    namespace detail
+    {
+        template <typename F>
+        struct sink_stage
+        {
+            template <typename T>
+            void operator()(T&& value)
+            {
+                fn(std::forward<T>(value));
+            }
+
+            F fn;
+        };
+
+        template <typename Convert>
+        struct actor_sink
+        {
+            template <typename T>
+            void operator()(T&& value)
+            {
+                target.enqueue(convert(std::forward<T>(value)));
+            }
+
+            actor_ref target;
+            Convert convert;
+        };
+    }
+
+    template <typename In>
+    class pipeline;
+
+    template <typename In, typename SegIn, typename Out, typename Fn>
+    class pipeline_builder;
+
+/********************************************************************
+ * A running pipeline, returned by pipeline_builder::build().
+ * Destroying it stops it.
+ */
+template <typename In>
+class pipeline
+{
+public:
+    pipeline()
+    : m_input(nullptr)
+    {}
+
+    pipeline(pipeline&&) = default;
+    pipeline& operator = (pipeline&&) = default;
+
+    // Returns false if the first ring is full
+    bool try_push(In&& value)
+    {
+        assert(m_core && !m_core->is_closed());
+        return m_input->try_push(std::move(value));
+    }
+
+    bool try_push(const In& value)
+    {
+        assert(m_core && !m_core->is_closed());
+        return m_input->try_push(value);
+    }
+
+    // Waits while the first ring is full
+    void push(In&& value)
+    {
+        assert(m_core && !m_core->is_closed());
+        detail::stage_backoff backoff;
+        while (!m_input->try_push(std::move(value)))
+            backoff.wait();
+    }
+
+    void push(const In& value)
+    {
+        In copy(value);
+        push(std::move(copy));
+    }
+
+    // Lets the items pushed so far through every stage, then stops the
+    // threads. Nothing can be pushed after.
+    void stop()
+    {
+        if (m_core)
+            m_core->stop();
+    }
+
+    // Items waiting for the first stage
+    size_t size() const {return m_input ? m_input->size() : 0;}
+
+    size_t get_thread_count() const {return m_core ? m_core->get_thread_count() : 0;}
+
+private_impl:
+    pipeline(std::unique_ptr<detail::pipeline_core>&& core, bounded_spsc_queue<In> *input)
+    : m_core(std::move(core))
+    , m_input(input)
+    {}
+
+private:
+    std::unique_ptr<detail::pipeline_core> m_core;
+    bounded_spsc_queue<In> *m_input;
+};
+
+/********************************************************************
+ * Builds a pipeline<In>. Out is the output type of the last stage added,
+ * the stages since the last stage() call run on one thread. Each call
+ * consumes the builder it is called on.
+ */
+template <typename In, typename SegIn, typename Out, typename Fn>
+class pipeline_builder
+{
+public:
+    // Runs f on a new thread, pinned to 'cpu' unless it is negative
+    template <typename F>
+    pipeline_builder<In, Out, typename detail::stage_result<typename std::decay<F>::type, Out>::type, typename std::decay<F>::type>
+    stage(F&& f, int cpu = -1)
+    {
+        static_assert(!std::is_void<Out>::value, "nothing can follow a sink");
+        typedef typename std::decay<F>::type G;
+        typedef typename detail::stage_result<G, Out>::type R;
+
+        bounded_spsc_queue<Out> *ring = m_core->template add_ring<Out>(m_capacity);
+        detail::pipeline_segment *segment = m_core->add_segment(
+            new detail::pipeline_segment_impl<SegIn, Out, Fn>(m_upstream, m_cpu, m_segment_input, ring, std::move(m_fn)));
+        return pipeline_builder<In, Out, R, G>(std::move(m_core), m_capacity, m_input, segment->done(), ring, cpu, G(std::forward<F>(f)));
+    }
+
+    // Runs f on the same thread as the stage before it
+    template <typename F>
+    pipeline_builder<In, SegIn, typename detail::stage_result<typename std::decay<F>::type, Out>::type, detail::fused_stage<Fn, typename std::decay<F>::type> >
+    fuse(F&& f)
+    {
+        static_assert(!std::is_void<Out>::value, "nothing can follow a sink");
+        typedef typename std::decay<F>::type G;
+        typedef typename detail::stage_result<G, Out>::type R;
+        typedef detail::fused_stage<Fn, G> fused;
+
+        return pipeline_builder<In, SegIn, R, fused>(std::move(m_core), m_capacity, m_input, m_upstream, m_segment_input, m_cpu,
+                                                     fused{std::move(m_fn), G(std::forward<F>(f))});
+    }
+
+    // Ends the pipeline with f(Out&&), on the thread of the last stage
+    template <typename F>
+    pipeline_builder<In, SegIn, void, detail::fused_stage<Fn, detail::sink_stage<typename std::decay<F>::type> > >
+    sink(F&& f)
+    {
+        typedef typename std::decay<F>::type G;
+        return fuse(detail::sink_stage<G>{G(std::forward<F>(f))});
+    }
+
+    // Ends the pipeline by sending convert(Out&&), a message *, to target
+    template <typename Convert>
+    pipeline_builder<In, SegIn, void, detail::fused_stage<Fn, detail::sink_stage<detail::actor_sink<typename std::decay<Convert>::type> > > >
+    to_actor(actor_ref target, Convert&& convert)
+    {
+        typedef typename std::decay<Convert>::type C;
+        return sink(detail::actor_sink<C>{target, C(std::forward<Convert>(convert))});
+    }
+
+    template <typename Convert>
+    pipeline_builder<In, SegIn, void, detail::fused_stage<Fn, detail::sink_stage<detail::actor_sink<typename std::decay<Convert>::type> > > >
+    to_actor(const actor_iptr& target, Convert&& convert)
+    {
+        return to_actor(target->get_ref(), std::forward<Convert>(convert));
+    }
+
+    // Starts the threads
+    pipeline<In> build()
+    {
+        static_assert(std::is_void<Out>::value, "end the pipeline with sink() or to_actor()");
+        m_core->add_segment(
+            new detail::pipeline_segment_impl<SegIn, void, Fn>(m_upstream, m_cpu, m_segment_input, nullptr, std::move(m_fn)));
+        m_core->start();
+        return pipeline<In>(std::move(m_core), m_input);
+    }
+
+private_impl:
+    pipeline_builder(std::unique_ptr<detail::pipeline_core>&& core, size_t capacity, bounded_spsc_queue<In> *input,
+                     const std::atomic<bool> *upstream, bounded_spsc_queue<SegIn> *segment_input, int cpu, Fn&& fn)
+    : m_core(std::move(core))
+    , m_capacity(capacity)
+    , m_input(input)
+    , m_upstream(upstream)
+    , m_segment_input(segment_input)
+    , m_cpu(cpu)
+    , m_fn(std::move(fn))
+    {}
+
+private:
+    std::unique_ptr<detail::pipeline_core> m_core;
+    size_t m_capacity;
+    bounded_spsc_queue<In> *m_input;
+    const std::atomic<bool> *m_upstream;        // done flag of the segment feeding this one
+    bounded_spsc_queue<SegIn> *m_segment_input;
+    int m_cpu;
+    Fn m_fn;
+};
+
+/********************************************************************
+ * The start of a pipeline, see make_pipeline()
+ */
+template <typename In>
+class pipeline_source
+{
+public:
+    explicit pipeline_source(size_t capacity)
+    : m_core(new detail::pipeline_core())
+    , m_capacity(capacity)
+    , m_input(m_core->template add_ring<In>(capacity))
+    {}
+
+    // Runs f on a new thread, pinned to 'cpu' unless it is negative
+    template <typename F>
+    pipeline_builder<In, In, typename detail::stage_result<typename std::decay<F>::type, In>::type, typename std::decay<F>::type>
+    stage(F&& f, int cpu = -1)
+    {
+        typedef typename std::decay<F>::type G;
+        typedef typename detail::stage_result<G, In>::type R;
+
+        const std::atomic<bool> *closed = m_core->closed();
+        return pipeline_builder<In, In, R, G>(std::move(m_core), m_capacity, m_input, closed, m_input, cpu, G(std::forward<F>(f)));
+    }
+
+private:
+    std::unique_ptr<detail::pipeline_core> m_core;
+    size_t m_capacity;
+    bounded_spsc_queue<In> *m_input;
+};
+
+/********************************************************************
+ * Start building a pipeline taking items of type In. Every ring between
+ * two threads holds up to 'capacity' items, rounded up to a power of two.
+ */
+template <typename In>
+pipeline_source<In> make_pipeline(size_t capacity = 1024)
+{
+    return pipeline_source<In>(capacity);
+}
+
+} // cppactor
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <cstddef>
+#include "cppactor/message.h"
+#include "cppactor/instrusive_ptr.h"
+#include "cppactor/detail/system_messages.h"
+
+/********************************************************************
+ * Socket readiness as actor messages
+ *
+ * framework::watch_fd() hands a file descriptor to the framework's
+ * reactor, an epoll thread on its own internal pool, on behalf of an
+ * actor. No thread per connection, what the reactor sees goes straight
+ * into the actor's mailbox:
+ *
+ *      framework::instance()->watch_fd(session, fd, cppactor::IO_RECEIVE);
+ *
+ *      void Session::on_message(cppactor::message_uptr& msg, cppactor::actor_ref& replyto)
+ *      {
+ *          switch (msg->msg_id)
+ *          {
+ *          case cppactor::io_data::msg_id:
+ *          {
+ *              cppactor::io_data *d = static_cast<cppactor::io_data *>(msg.get());
+ *              m_parser.feed(d->data(), d->size());
+ *              break;
+ *          }
+ *          case cppactor::io_closed::msg_id:
+ *              close(static_cast<cppactor::io_closed *>(msg.get())->fd);
+ *              break;
+ *          }
+ *      }
+ *
+ * With IO_RECEIVE the reactor reads the descriptor itself, each io_data
+ * holds what one read returned, up to io_data::BUFFER_SIZE bytes, in a
+ * buffer that goes back to a shared pool when the message is deleted.
+ * At most MAX_IN_FLIGHT of them per descriptor wait in the mailbox, then
+ * the reactor stops reading it until the actor catches up. End of file
+ * or an error is an io_closed, after which the descriptor is no longer
+ * watched. The actor owns the descriptor and closes it.
+ *
+ * With IO_READABLE the actor reads itself. An io_ready stands for every
+ * edge seen until it is handled, the handler reads until EAGAIN.
+ *
+ * The descriptor is made non-blocking. Call unwatch_fd() before closing a
+ * descriptor that has not had an io_closed.
+ */
+namespace cppactor
+{
+    namespace detail
+    {
+        struct io_watch;
+    }
+
+    // Sent to an IO_READABLE actor, fd has data
+    class io_ready : public message
+    {
+    public:
+        enum {msg_id = detail::io_message_ready};
+        io_ready(const instrusive_ptr<detail::io_watch>& watch, int fd_);
+        ~io_ready();
+
+        int fd;
+
+    private:
+        instrusive_ptr<detail::io_watch> m_watch;
+    };
+
+    // Sent to an IO_RECEIVE actor, what one read of fd returned
+    class io_data : public message
+    {
+    public:
+        enum {msg_id = detail::io_message_data};
+        enum
+        {
+            BUFFER_SIZE = 16 << 10
+            , MAX_IN_FLIGHT = 64        // per descriptor
+        };
+
+        io_data(const instrusive_ptr<detail::io_watch>& watch, int fd_, char *buffer, size_t size);
+        ~io_data();
+
+        const char *data() const {return m_buffer;}
+        size_t size() const {return m_size;}
+
+        int fd;
+
+    private:
+        instrusive_ptr<detail::io_watch> m_watch;
+        char *m_buffer;
+        size_t m_size;
+    };
+
+    // Sent to an IO_RECEIVE actor, fd reached end of file or failed and is no longer watched
+    class io_closed : public message
+    {
+    public:
+        enum {msg_id = detail::io_message_closed};
+        io_closed(int fd_, int error_)
+        : message(msg_id)
+        , fd(fd_)
+        , error(error_)
+        {}
+
+        int fd;
+        int error;                  // errno, 0 at end of file
+    };
+} // cppactor
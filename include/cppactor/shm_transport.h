@@ -0,0 +1,188 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cstdint>
+#include <type_traits>
+#include "cppactor/actor.h"
+#include "cppactor/actor_ref.h"
+#include "cppactor/message.h"
+#include "cppactor/detail/shm_ring.h"
+
+/********************************************************************
+ * Shared memory transport
+ *
+ * Connects an actor in one process to an actor in another process on
+ * the same host. In the sending process an shm_proxy actor stands in for
+ * the remote actor, the messages sent to it are written to a single
+ * producer, single consumer ring in a POSIX shared memory object. In the
+ * receiving process an shm_receiver thread reads the ring and enqueues
+ * the messages to the local actor. Both sides name the ring the same way.
+ *
+ *      // strategy process
+ *      cppactor::register_shm_message<Order>();
+ *      cppactor::shm_receiver orders("/gw-orders", engine);
+ *
+ *      // gateway process
+ *      cppactor::register_shm_message<Order>();
+ *      cppactor::create_pool<cppactor::shm_proxy, Session>(POOLID_GATEWAY, 2);
+ *      auto engine = cppactor::create_actor<cppactor::shm_proxy>(POOLID_GATEWAY, "/gw-orders");
+ *      engine->enqueue(new Order(...));
+ *
+ * A message type crosses processes as a flat, trivially copyable layout
+ * struct, registered on both sides. The proxy builds the layout in place
+ * in the ring, and the receiver builds the message from the ring, there
+ * is no serialization buffer and no copy through the kernel:
+ *
+ *      struct Order : public cppactor::message
+ *      {
+ *          struct layout {int64_t id; double price; int32_t qty;};
+ *          typedef layout shm_layout;
+ *          void shm_save(shm_layout& out) const {out.id = id; out.price = price; out.qty = qty;}
+ *          static Order *shm_load(const shm_layout& in) {return new Order(in.id, in.price, in.qty);}
+ *          ...
+ *      };
+ *
+ * The receiver polls the ring, then sleeps on a futex that the proxy only
+ * wakes when the receiver is asleep. With shm_options::busy_poll it never
+ * sleeps. A full ring holds the proxy's handler back for up to
+ * full_timeout_ms, then the message is dropped.
+ *
+ * The reply_to of a message does not cross, nor do asks. One proxy at a
+ * time may send on a ring, one receiver reads it and owns the name.
+ */
+namespace cppactor
+{
+    namespace detail
+    {
+        struct shm_codec
+        {
+            uint32_t size;                      // of the layout
+            void (*save)(const message& msg, void *out);
+            message *(*load)(const void *in);
+        };
+
+        void add_shm_codec(int msg_id, const shm_codec& codec);
+        const shm_codec *find_shm_codec(int msg_id);
+
+        template <typename Msg>
+        void save_shm_message(const message& msg, void *out)
+        {
+            static_cast<const Msg&>(msg).shm_save(*static_cast<typename Msg::shm_layout *>(out));
+        }
+
+        template <typename Msg>
+        message *load_shm_message(const void *in)
+        {
+            return Msg::shm_load(*static_cast<const typename Msg::shm_layout *>(in));
+        }
+    }
+
+/********************************************************************
+ * Register Msg for the shared memory transport, at startup in both
+ * processes. Messages of other types are dropped by the proxy.
+ * Msg:     typedef ... shm_layout, trivially copyable
+ *          void shm_save(shm_layout& out) const
+ *          static Msg *shm_load(const shm_layout& in), nullptr if the data is bad
+ */
+template <typename Msg>
+void register_shm_message()
+{
+    typedef typename Msg::shm_layout layout;
+    static_assert(std::is_trivially_copyable<layout>::value, "the shm_layout of a message must be trivially copyable");
+    static_assert(alignof(layout) <= 8, "the shm_layout of a message must not need more than 8 byte alignment");
+    detail::shm_codec codec = {static_cast<uint32_t>(sizeof(layout)), &detail::save_shm_message<Msg>, &detail::load_shm_message<Msg>};
+    detail::add_shm_codec(Msg::msg_id, codec);
+}
+
+    struct shm_options
+    {
+        shm_options()
+        : slot_count(4096)
+        , slot_size(256)
+        , busy_poll(false)
+        , spin_polls(4096)
+        , full_timeout_ms(1000)
+        {}
+
+        uint32_t slot_count;        // messages the ring holds, rounded up to a power of two
+        uint32_t slot_size;         // bytes per message, 8 of them for the header. Both sides must agree.
+        bool busy_poll;             // the receiver never sleeps, lowest latency for a cpu
+        uint32_t spin_polls;        // empty polls before the receiver sleeps
+        int full_timeout_ms;        // how long the proxy waits for room before dropping a message
+    };
+
+/********************************************************************
+ * Stands in for an actor in another process, see above. List it in the
+ * create_pool<>() of the pool it runs on.
+ */
+class shm_proxy : public actor
+{
+public:
+    explicit shm_proxy(const std::string& name, const shm_options& options = shm_options());
+    ~shm_proxy();
+
+    void on_message(message_uptr& msg, actor_ref& replyto);
+
+    // false if the ring could not be opened, or has another proxy
+    bool is_connected() const {return m_connected;}
+
+    uint64_t get_sent_count() const {return m_sent.load(std::memory_order_relaxed);}
+    uint64_t get_dropped_count() const {return m_dropped.load(std::memory_order_relaxed);}
+
+private:
+    const shm_options m_options;
+    detail::shm_ring m_ring;
+    bool m_connected;
+    std::atomic<uint64_t> m_sent;
+    std::atomic<uint64_t> m_dropped;
+};
+
+/********************************************************************
+ * Reads the ring 'name' on its own thread and sends what arrives to
+ * target. Destroying it stops the thread and removes the name.
+ */
+class shm_receiver
+{
+public:
+    shm_receiver(const std::string& name, const actor_iptr& target, const shm_options& options = shm_options());
+    ~shm_receiver();
+
+    shm_receiver(const shm_receiver&) = delete;
+    shm_receiver& operator = (const shm_receiver&) = delete;
+
+    bool is_open() const {return m_ring.is_open();}
+
+    uint64_t get_received_count() const {return m_received.load(std::memory_order_relaxed);}
+    uint64_t get_dropped_count() const {return m_dropped.load(std::memory_order_relaxed);}
+
+private:
+    void run();
+
+    const std::string m_name;
+    actor_iptr m_target;
+    const shm_options m_options;
+    detail::shm_ring m_ring;
+    std::atomic<bool> m_quit;
+    std::atomic<uint64_t> m_received;
+    std::atomic<uint64_t> m_dropped;
+    std::thread m_thread;
+};
+
+} // cppactor
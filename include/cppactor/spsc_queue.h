@@ -0,0 +1,154 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+// A ring buffer with one producer and one consumer. Each side owns its
+// index and keeps a cached copy of the other's, so the shared cache lines
+// are only read when the ring looks full or empty.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <ttstl/platform.h>
+
+namespace cppactor
+{
+    /****************************************************************
+     * Bounded single producer, single consumer queue.
+     * The capacity is rounded up to a power of two. try_push() fails when
+     * the queue is full, front() returns nullptr when it is empty. The
+     * consumer can work on the front element in place and pop() it after.
+     * Elements only need to be move constructible.
+     *
+     * One thread at a time may push and one may pop. A producer or
+     * consumer can move between threads if the move itself synchronizes,
+     * as the turns of an actor do.
+     */
+    template <typename T>
+    class bounded_spsc_queue
+    {
+    public:
+        explicit bounded_spsc_queue(size_t capacity)
+        : m_mask(round_up(capacity) - 1)
+        , m_slots(new slot[m_mask + 1])
+        , m_head(0)
+        , m_tail_cache(0)
+        , m_tail(0)
+        , m_head_cache(0)
+        {}
+
+        ~bounded_spsc_queue()
+        {
+            while (front())
+                pop();
+            delete [] m_slots;
+        }
+
+        bounded_spsc_queue(const bounded_spsc_queue&) = delete;
+        bounded_spsc_queue& operator = (const bounded_spsc_queue&) = delete;
+
+        // Producer. The value is only moved from if it was pushed.
+        bool try_push(T&& value)
+        {
+            return try_emplace(std::move(value));
+        }
+
+        bool try_push(const T& value)
+        {
+            return try_emplace(value);
+        }
+
+        template <typename...Args>
+        bool try_emplace(Args&&... args)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_head_cache > m_mask)
+            {
+                m_head_cache = m_head.load(std::memory_order_acquire);
+                if (tail - m_head_cache > m_mask)
+                    return false;   // full
+            }
+            new (get(tail)) T(std::forward<Args>(args)...);
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer. The oldest element, or nullptr if the queue is empty.
+        T *front()
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail_cache)
+            {
+                m_tail_cache = m_tail.load(std::memory_order_acquire);
+                if (head == m_tail_cache)
+                    return nullptr;
+            }
+            return get(head);
+        }
+
+        // Consumer. Destroys the element returned by front()
+        void pop()
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            get(head)->~T();
+            m_head.store(head + 1, std::memory_order_release);
+        }
+
+        bool try_pop(T& result)
+        {
+            T *p = front();
+            if (p == nullptr)
+                return false;
+            result = std::move(*p);
+            pop();
+            return true;
+        }
+
+        // Approximate when called concurrently with push or pop
+        size_t size() const
+        {
+            return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const {return m_mask + 1;}
+
+    private:
+        typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+
+        static size_t round_up(size_t n)
+        {
+            size_t r = 2;
+            while (r < n)
+                r <<= 1;
+            return r;
+        }
+
+        T *get(size_t pos) {return reinterpret_cast<T *>(&m_slots[pos & m_mask]);}
+
+        const size_t m_mask;
+        slot *const m_slots;
+
+        // consumer's line
+        alignas(TT_CACHE_LINE_SIZE) std::atomic<size_t> m_head;
+        size_t m_tail_cache;
+
+        // producer's line
+        alignas(TT_CACHE_LINE_SIZE) std::atomic<size_t> m_tail;
+        size_t m_head_cache;
+    };
+}   // cppactor
@@ -0,0 +1,95 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+namespace cppactor
+{
+#define private_impl public
+
+    /****************************************************************
+     * Completion handle for framework::submit().
+     * The caller owns the handle and must keep it alive until the task
+     * has completed, wait() or done() returning true. A handle can be
+     * reset() and reused once its task has completed.
+     * A task submitted to a pool that has been shut down never runs, its
+     * handle completes with cancelled() true.
+     */
+    class task_handle
+    {
+    public:
+        task_handle()
+        : m_done(false)
+        , m_cancelled(false)
+        {}
+
+        task_handle(const task_handle&) = delete;
+        task_handle& operator = (const task_handle&) = delete;
+
+        // true once the task has run, or has been cancelled
+        bool done()
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return m_done;
+        }
+
+        // true if the task was dropped without running, its pool had been shut down
+        bool cancelled()
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return m_cancelled;
+        }
+
+        // Block until the task has run
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [this] {return m_done;});
+        }
+
+        // Block until the task has run or the timeout expires, returns done()
+        bool wait_for(std::chrono::milliseconds timeout)
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            return m_cv.wait_for(lock, timeout, [this] {return m_done;});
+        }
+
+        void reset()
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_done = false;
+            m_cancelled = false;
+        }
+    private_impl:
+        // Called by the pool thread. Notifies under the lock, the handle
+        // may be destroyed as soon as the waiter gets the lock back.
+        void complete(bool ran = true)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_done = true;
+            m_cancelled = !ran;
+            m_cv.notify_all();
+        }
+    private:
+        std::mutex m_mtx;
+        std::condition_variable m_cv;
+        bool m_done;
+        bool m_cancelled;
+    };
+}   // cppactor
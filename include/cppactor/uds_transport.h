@@ -0,0 +1,238 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <unordered_map>
+#include "cppactor/actor.h"
+#include "cppactor/detail/locks.h"
+
+/********************************************************************
+ * Unix domain socket transport
+ *
+ * Sends messages to actors in another process over a stream socket, for
+ * when shared memory (shm_transport.h) is not an option. The receiving
+ * process runs a uds_server and binds its actors to ids, the sending
+ * process opens a uds_connection and sends through remote_actor handles:
+ *
+ *      // strategy process
+ *      cppactor::uds_server server("/var/run/strategy.sock");
+ *      server.bind(ENGINE_ID, engine);
+ *
+ *      // gateway process
+ *      cppactor::uds_connection strategy("/var/run/strategy.sock");
+ *      cppactor::remote_actor engine = strategy.remote(ENGINE_ID);
+ *      engine.enqueue(new Order(...));
+ *
+ * Message types are flattened by the functions registered with
+ * register_journal_message<>(), see journal.h, on both sides.
+ *
+ * remote_actor::enqueue() flattens the message on the calling thread into
+ * the connection's batch, under a spin lock. The connection's writer
+ * thread sends the batch with one gather write once it holds batch_bytes,
+ * or linger_us after its first message, so a burst costs one syscall
+ * rather than one per message. get_stats() reports the messages per
+ * syscall. Messages to one remote actor keep their order.
+ *
+ * The reply_to of a message does not cross, nor do asks.
+ */
+namespace cppactor
+{
+    class message;
+    class uds_connection;
+
+    struct uds_options
+    {
+        uds_options()
+        : batch_bytes(64 << 10)
+        , linger_us(50)
+        , max_pending(64 << 20)
+        , connect_timeout_ms(1000)
+        {}
+
+        size_t batch_bytes;         // a batch this full is sent at once
+        int linger_us;              // how long a batch waits for more messages, 0 to send as soon as the writer wakes up
+        size_t max_pending;         // bytes waiting to be written, messages beyond it are dropped
+        int connect_timeout_ms;     // how long uds_connection retries a server that is not listening yet
+    };
+
+    struct uds_stats
+    {
+        uint64_t messages;          // sent, or received
+        uint64_t bytes;
+        uint64_t syscalls;          // writes, or reads
+        uint64_t dropped;           // not sent, or not delivered
+
+        double messages_per_syscall() const {return syscalls ? static_cast<double>(messages) / syscalls : 0.0;}
+    };
+
+/********************************************************************
+ * An actor bound to an id by the uds_server at the other end of a
+ * connection. Copyable, the connection must outlive it.
+ */
+class remote_actor
+{
+public:
+    remote_actor()
+    : m_connection(nullptr)
+    , m_id(0)
+    {}
+
+    // Flattens msg into the connection's batch and deletes it. Returns 0
+    // if it was dropped: not registered, not connected or too much pending.
+    unsigned int enqueue(message *msg) const;
+
+    uint64_t get_id() const {return m_id;}
+    explicit operator bool() const {return m_connection != nullptr;}
+
+private_impl:
+    remote_actor(uds_connection *connection, uint64_t id)
+    : m_connection(connection)
+    , m_id(id)
+    {}
+
+private:
+    uds_connection *m_connection;
+    uint64_t m_id;
+};
+
+/********************************************************************
+ * The sending side, one socket to one uds_server
+ */
+class uds_connection
+{
+public:
+    explicit uds_connection(const std::string& path, const uds_options& options = uds_options());
+
+    // Sends what is pending, then closes the socket
+    ~uds_connection();
+
+    uds_connection(const uds_connection&) = delete;
+    uds_connection& operator = (const uds_connection&) = delete;
+
+    remote_actor remote(uint64_t id) {return remote_actor(this, id);}
+
+    // see remote_actor::enqueue()
+    unsigned int send(uint64_t id, message *msg);
+
+    // Blocks until everything sent so far has been written to the socket
+    void flush();
+
+    bool is_connected() const {return m_connected.load(std::memory_order_relaxed);}
+    uds_stats get_stats() const;
+
+private:
+    struct batch
+    {
+        batch()
+        : messages(0)
+        {}
+
+        std::vector<char> data;
+        size_t messages;
+    };
+
+    void run_writer();
+    void write_batches(std::vector<batch>& batches);
+    void wake_writer();
+
+    const uds_options m_options;
+    int m_fd;
+    std::atomic<bool> m_connected;
+
+    // under m_lock
+    detail::remote_lock m_lock;
+    batch m_current;                                // the batch being filled
+    std::chrono::steady_clock::time_point m_current_start;
+    std::vector<batch> m_full;                      // batches waiting for the writer
+    std::vector<batch> m_spare;                     // written batches, kept for their capacity
+    size_t m_pending;
+    uint64_t m_queued_bytes;
+
+    // under m_writer_mtx
+    std::mutex m_writer_mtx;
+    std::condition_variable m_writer_cv;
+    std::condition_variable m_flushed_cv;
+    bool m_wake;
+    bool m_flush_requested;
+    bool m_quit;
+    uint64_t m_written_bytes;
+    std::thread m_writer;
+
+    std::atomic<uint64_t> m_messages;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_syscalls;
+    std::atomic<uint64_t> m_dropped;
+};
+
+/********************************************************************
+ * The receiving side. Listens on path, reads every connection on one
+ * thread and sends the messages to the actors bound to their ids.
+ * Destroying it closes the connections and removes path.
+ */
+class uds_server
+{
+public:
+    explicit uds_server(const std::string& path, const uds_options& options = uds_options());
+    ~uds_server();
+
+    uds_server(const uds_server&) = delete;
+    uds_server& operator = (const uds_server&) = delete;
+
+    // Messages for 'id' go to a from now on
+    void bind(uint64_t id, const actor_iptr& a);
+    void unbind(uint64_t id);
+
+    bool is_open() const {return m_listen_fd >= 0;}
+    uds_stats get_stats() const;
+
+private:
+    struct client
+    {
+        int fd;
+        std::vector<char> buffer;
+        size_t used;
+    };
+
+    void run();
+    bool read_client(client& c);
+    void deliver(uint64_t id, int msg_id, const char *payload, uint32_t size);
+
+    const std::string m_path;
+    const uds_options m_options;
+    int m_listen_fd;
+    int m_wake_fd;
+    std::atomic<bool> m_quit;
+
+    // under m_lock
+    detail::remote_lock m_lock;
+    std::unordered_map<uint64_t, actor_iptr> m_bound;
+
+    std::atomic<uint64_t> m_messages;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_syscalls;
+    std::atomic<uint64_t> m_dropped;
+    std::thread m_thread;
+};
+
+} // cppactor
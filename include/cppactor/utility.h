@@ -21,37 +21,64 @@
 #include "cppactor/detail/pool_base.h"
 #include "cppactor/detail/pool.h"
 #include "cppactor/framework.h"
+#include "cppactor/parallel.h"
+#include "cppactor/detail/actor_blocks.h"
+#include "logger/logger.h"
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <new>
+#include <type_traits>
 #include <cassert>
 
 namespace cppactor
 {
-    enum {POOLID_INTERNAL=1<<31};
+    enum {POOLID_INTERNAL=0x80000000u, POOLID_REACTOR};
 
 /*************************************************************************************/
 // Create a pool
+// With SCHEDULE_DEADLINE a thread runs the ready actor with the earliest
+// message deadline first, see message::set_deadline(). An actor is ranked
+// by the earliest deadline among its messages not handled yet, and still
+// handles its messages in order. Actors without one follow, in the order
+// they became ready, so a steady stream of deadlines starves them.
+// The ready actors are kept in a heap under a spin lock rather than the
+// lock free queue of SCHEDULE_FIFO.
 template <typename...ActorTypes>
-void create_pool(uint32_t poolid, int nThreads)
+void create_pool(uint32_t poolid, int nThreads, pool_scheduling scheduling)
 {
-    auto pPool = new detail::pool<ActorTypes...>(poolid);
+    auto pPool = new detail::pool<ActorTypes...>(poolid, scheduling == SCHEDULE_DEADLINE);
     pPool->start_threads(nThreads);
     detail::pool_t p(pPool);
     framework::instance()->add_pool(p);
 }
 
+template <typename...ActorTypes>
+void create_pool(uint32_t poolid, int nThreads)
+{
+    create_pool<ActorTypes...>(poolid, nThreads, SCHEDULE_FIFO);
+}
+
 /*************************************************************************************/
 // Create an actor
 template <typename Actor, typename...Args>
 instrusive_ptr<Actor> create_actor(uint32_t poolid, Args&&... args)
 {
-    Actor *t =  new Actor(std::forward<Args>(args)...);
-    t->type_id = typeid(Actor).hash_code();
-    t->m_pPool = framework::instance()->get_pool(poolid);
-    if (t->m_pPool.get() == nullptr)
+    detail::pool_t pool = framework::instance()->get_pool(poolid);
+    if (pool.get() == nullptr)
+    {
+        assert(false);
+        return instrusive_ptr<Actor>();
+    }
+    if (!pool->handles(detail::actor_type_index<Actor>()))
     {
+        TTLOG(ERROR, 13) << "CPPACTOR | Pool " << poolid << " was not created with the actor type " << detail::actor_type_name(detail::actor_type_index<Actor>());
         assert(false);
-        delete t;
         return instrusive_ptr<Actor>();
     }
+    Actor *t =  new Actor(std::forward<Args>(args)...);
+    t->type_id = detail::actor_type_index<Actor>();
+    t->m_pool = pool->get_slot();
     t->actor_id = actor::m_actorids.fetch_add(1);
 
     instrusive_ptr<Actor> p(t);
@@ -60,6 +87,88 @@ instrusive_ptr<Actor> create_actor(uint32_t poolid, Args&&... args)
     return p;
 }
 
+/*************************************************************************************/
+// Create 'count' actors at once, for large actor populations.
+// factory(i) returns the i-th actor by value, and it is constructed in place.
+// The actors are allocated side by side in blocks, get consecutive actor ids
+// and are registered with the framework under one lock. Their on_start() is
+// called on the pool's threads with parallel_for() if start_on_pool is true,
+// otherwise on the calling thread.
+// Example:
+//      auto accounts = cppactor::create_actors<Account>(POOLID_ACCOUNTS, ids.size(),
+//          [&](size_t i) {return Account(ids[i]);}, true);
+template <typename Actor, typename Factory>
+std::vector<instrusive_ptr<Actor> > create_actors(uint32_t poolid, size_t count, Factory&& factory, bool start_on_pool = false)
+{
+    std::vector<instrusive_ptr<Actor> > actors;
+    detail::pool_t pool = framework::instance()->get_pool(poolid);
+    if (pool.get() == nullptr)
+    {
+        assert(false);
+        return actors;
+    }
+    if (!pool->handles(detail::actor_type_index<Actor>()))
+    {
+        TTLOG(ERROR, 13) << "CPPACTOR | Pool " << poolid << " was not created with the actor type " << detail::actor_type_name(detail::actor_type_index<Actor>());
+        assert(false);
+        return actors;
+    }
+    actors.reserve(count);
+    std::vector<actor *> batch;
+    batch.reserve(count);
+
+    uint16_t type_id = detail::actor_type_index<Actor>();
+    uint32_t actor_id = actor::m_actorids.fetch_add(static_cast<uint32_t>(count));
+    const size_t stride = sizeof(Actor);
+    for (size_t first = 0; first < count; first += detail::actor_blocks::BLOCK_ACTORS)
+    {
+        size_t n = std::min<size_t>(count - first, detail::actor_blocks::BLOCK_ACTORS);
+        char *block = detail::actor_blocks::allocate(stride, n, alignof(Actor));
+        size_t built = 0;
+        try
+        {
+            for (; built < n; ++built)
+                ::new (block + built * stride) Actor(factory(first + built));
+        }
+        catch (...)
+        {
+            // the actors of earlier blocks are released with 'actors'
+            for (size_t i = 0; i < built; ++i)
+                reinterpret_cast<Actor *>(block + i * stride)->~Actor();
+            detail::actor_blocks::deallocate(block);
+            throw;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            Actor *t = reinterpret_cast<Actor *>(block + i * stride);
+            t->type_id = type_id;
+            t->m_pool = pool->get_slot();
+            t->actor_id = actor_id++;
+            actors.push_back(instrusive_ptr<Actor>(t));
+            batch.push_back(t);
+        }
+    }
+
+    framework::instance()->add_actors(batch.data(), batch.size());
+    if (start_on_pool)
+    {
+        parallel_for(poolid, 0, actors.size(), 0, [&](size_t i) {actors[i]->on_start();});
+    }
+    else
+    {
+        for (auto& a : actors)
+            a->on_start();
+    }
+    return actors;
+}
+
+template <typename Actor>
+std::vector<instrusive_ptr<Actor> > create_actors(uint32_t poolid, size_t count, bool start_on_pool = false)
+{
+    return create_actors<Actor>(poolid, count, [](size_t) {return Actor();}, start_on_pool);
+}
+
 /*************************************************************************************/
 template<typename T>
 auto get_actor(T& t)->decltype(t)
@@ -68,7 +177,7 @@ auto get_actor(T& t)->decltype(t)
 }
 
 template <typename K, typename V>
-auto get_actor(std::pair<K, V>& p)->decltype(p.second)
+auto get_actor(std::pair<K, V>& p)->V&
 {
    return p.second;
 }
@@ -111,8 +220,8 @@ auto find_any(ActorCont& actors)->Actor *
     typename ActorCont::iterator itMin = actors.end();
     for (auto it = actors.begin(); it != actors.end(); ++it)
     {
-        auto pActor = get_actor(*it);
-        int n = pActor->m_queue.size();
+        auto& pActor = get_actor(*it);
+        int n = static_cast<int>(pActor->queued_messages());
         if (n == 0)
         {
             return static_cast<Actor *>(pActor.get());
@@ -147,7 +256,7 @@ void broadcast(ActorCont& actors, Args&&...args)
 {
     for (auto it = actors.begin(); it != actors.end(); ++it)
     {
-        actor_iptr pActor = get_actor(*it);
+        auto& pActor = get_actor(*it);
         pActor->enqueue(new MessageType(std::forward<Args>(args)...));
     }
 }
@@ -168,8 +277,9 @@ void broadcast_call(ActorCont& actors, std::function<void(cppactor::actor_iptr)>
 {
     for (auto it = actors.begin(); it != actors.end(); ++it)
     {
-        actor_iptr pActor = get_actor(*it);
-        pActor->enqueue(std::forward<std::function<void(cppactor::actor_iptr)>>(f));
+        auto& pActor = get_actor(*it);
+        // each actor gets its own copy
+        pActor->enqueue(std::function<void(cppactor::actor_iptr)>(f));
     }
 }
 
@@ -182,6 +292,12 @@ void broadcast_call(ActorCont& actors, std::function<void(cppactor::actor_iptr)>
  * using a switch statement on the msg.msg_id to determine the message type 
  * and cast or use the Dispatch helper
  *
+ * replyto may also be declared as cppactor::actor_ref&, which avoids the
+ * reference count operations of actor_iptr. Dispatch passes it on as it is.
+ *
+ * A handler may also take the message by value, std::unique_ptr<MyMessage1>,
+ * to take ownership of it. Coroutine handlers must do so, see coroutine.h.
+ *
  * Example:
  * void on_message(cppactor::message_uptr& msg, cppactor::actor_iptr& replyto)
  * {
@@ -193,34 +309,179 @@ void broadcast_call(ActorCont& actors, std::function<void(cppactor::actor_iptr)>
  *    void on_message(std::unique_ptr<MyMessage2>& msg, actor_iptr& replyto)
  *    void on_message(std::unique_ptr<MyMessage3>& msg, actor_iptr& replyto)
  */
-template<typename...Typelist>
-struct Dispatch;
-
-template<typename MsgType, typename...Args>
-struct Dispatch<MsgType, Args...>
+namespace detail
 {
+    // Handlers take the message by reference, or by value to take ownership
+    template<typename Actor, typename MsgType, typename ReplyTo>
+    auto dispatch_to(Actor *actor, std::unique_ptr<MsgType>& msg, ReplyTo& replyto, int) -> decltype(actor->on_message(msg, replyto), void())
+    {
+        actor->on_message(msg, replyto);
+    }
+
+    template<typename Actor, typename MsgType, typename ReplyTo>
+    void dispatch_to(Actor *actor, std::unique_ptr<MsgType>& msg, ReplyTo& replyto, long)
+    {
+        actor->on_message(std::move(msg), replyto);
+    }
+
+    template<typename Actor, typename MsgType, typename ReplyTo>
+    void dispatch_one(Actor *actor, cppactor::message_uptr& msg, ReplyTo& replyto)
+    {
+        std::unique_ptr<MsgType> pmsg(static_cast<MsgType *>(msg.release()));
+        dispatch_to(actor, pmsg, replyto, 0);
+    }
+
+    // The actor a message was sent to. Dispatch<> also serves classes that
+    // are not actors, their messages were sent to the running one.
+    template<typename Actor>
+    const actor *unhandled_by(Actor *a, std::true_type)
+    {
+        return a;
+    }
+
     template<typename Actor>
-    static void on_message(Actor *actor, cppactor::message_uptr& msg, cppactor::actor_iptr& replyto)
+    const actor *unhandled_by(Actor *, std::false_type)
+    {
+        return actor::current();
+    }
+
+    // A dead letter, see dead_letter.h
+    template<typename Actor, typename ReplyTo>
+    void dispatch_unhandled(Actor *a, cppactor::message_uptr& msg, ReplyTo&)
     {
-        if (msg->msg_id == MsgType::msg_id)
+        const actor *to = unhandled_by(a, std::is_convertible<Actor *, const actor *>());
+        framework::instance()->get_dead_letters().report(DEAD_LETTER_UNHANDLED, to, msg);
+    }
+
+    template <size_t N>
+    constexpr bool distinct_ids(const long long (&ids)[N])
+    {
+        for (size_t i = 0; i < N; ++i)
         {
-            std::unique_ptr<MsgType> pmsg(static_cast<MsgType *>(msg.release()));
-            actor->on_message(pmsg, replyto);
+            for (size_t j = i + 1; j < N; ++j)
+            {
+                if (ids[i] == ids[j])
+                    return false;
+            }
         }
-        else
+        return true;
+    }
+
+    template <size_t N>
+    constexpr long long min_id(const long long (&ids)[N])
+    {
+        long long m = ids[0];
+        for (size_t i = 1; i < N; ++i)
+            m = ids[i] < m ? ids[i] : m;
+        return m;
+    }
+
+    template <size_t N>
+    constexpr long long max_id(const long long (&ids)[N])
+    {
+        long long m = ids[0];
+        for (size_t i = 1; i < N; ++i)
+            m = ids[i] > m ? ids[i] : m;
+        return m;
+    }
+
+    // Compares the id with each type's in turn
+    template<typename...Typelist>
+    struct dispatch_chain;
+
+    template<typename MsgType, typename...Args>
+    struct dispatch_chain<MsgType, Args...>
+    {
+        template<typename Actor, typename ReplyTo>
+        static void on_message(Actor *actor, cppactor::message_uptr& msg, ReplyTo& replyto)
+        {
+            if (msg->msg_id == MsgType::msg_id)
+                dispatch_one<Actor, MsgType>(actor, msg, replyto);
+            else
+                dispatch_chain<Args...>::on_message(actor, msg, replyto);
+        }
+    };
+
+    template<>
+    struct dispatch_chain<>
+    {
+        template<typename Actor, typename ReplyTo>
+        static void on_message(Actor *actor, cppactor::message_uptr& msg, ReplyTo& replyto)
         {
-            Dispatch<Args...>::on_message(actor, msg, replyto);
+            dispatch_unhandled(actor, msg, replyto);
         }
+    };
+
+    // Indexes a table of handlers by id - FIRST, for dense ids
+    template<long long FIRST, long long COUNT, typename...Typelist>
+    struct dispatch_table
+    {
+        template<typename Actor, typename ReplyTo>
+        struct handlers
+        {
+            typedef void (*handler)(Actor *, cppactor::message_uptr&, ReplyTo&);
+
+            static constexpr std::array<handler, COUNT> make()
+            {
+                std::array<handler, COUNT> table {};
+                const long long ids[] = {static_cast<long long>(Typelist::msg_id)...};
+                const handler each[] = {&dispatch_one<Actor, Typelist, ReplyTo>...};
+                for (size_t i = 0; i < sizeof...(Typelist); ++i)
+                    table[ids[i] - FIRST] = each[i];
+                return table;
+            }
+
+            static constexpr std::array<handler, COUNT> table = make();
+        };
+
+        template<typename Actor, typename ReplyTo>
+        static void on_message(Actor *actor, cppactor::message_uptr& msg, ReplyTo& replyto)
+        {
+            const auto& table = handlers<Actor, ReplyTo>::table;
+            unsigned long long index = static_cast<long long>(msg->msg_id) - FIRST;
+            if (index < static_cast<unsigned long long>(COUNT) && table[index])
+                table[index](actor, msg, replyto);
+            else
+                dispatch_unhandled(actor, msg, replyto);
+        }
+    };
+
+    template<typename...Typelist>
+    struct dispatch_ids
+    {
+        static constexpr long long ids[] = {static_cast<long long>(Typelist::msg_id)...};
+        static constexpr long long first = min_id(ids);
+        static constexpr long long count = max_id(ids) - first + 1;
+
+        // a table for four or more ids, with at most three slots in four empty
+        static constexpr bool dense = sizeof...(Typelist) >= 4 && count <= 4 * static_cast<long long>(sizeof...(Typelist));
+        static constexpr bool distinct = distinct_ids(ids);
+    };
+}
+
+template<typename...Typelist>
+struct Dispatch
+{
+    typedef detail::dispatch_ids<Typelist...> ids;
+    static_assert(ids::distinct, "two message types of the Dispatch<> have the same msg_id");
+
+    template<typename Actor, typename ReplyTo>
+    static void on_message(Actor *actor, cppactor::message_uptr& msg, ReplyTo& replyto)
+    {
+        typedef typename std::conditional<ids::dense,
+            detail::dispatch_table<ids::first, ids::dense ? ids::count : 1, Typelist...>,
+            detail::dispatch_chain<Typelist...> >::type dispatcher;
+        dispatcher::on_message(actor, msg, replyto);
     }
 };
 
-template<> 
-struct Dispatch<>  
+template<>
+struct Dispatch<>
 {
-    template<typename Actor>
-    inline static void on_message(Actor *, cppactor::message_uptr& msg, cppactor::actor_iptr&) 
+    template<typename Actor, typename ReplyTo>
+    inline static void on_message(Actor *actor, cppactor::message_uptr& msg, ReplyTo& replyto)
     {
-        std::cout << "Unhandled message, msg_id=" << msg->msg_id << std::endl;
+        detail::dispatch_unhandled(actor, msg, replyto);
     }
 };
 
@@ -1,21 +1,316 @@
+#include <cxxabi.h>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
 #include "cppactor/actor.h"
 #include "cppactor/detail/pool_base.h"
 #include "cppactor/message.h"
 #include "cppactor/detail/system_messages.h"
+#include "cppactor/detail/send_buffer.h"
+#include "cppactor/detail/shutdown_state.h"
+#include "cppactor/detail/hibernation.h"
+#include "cppactor/detail/actor_blocks.h"
+#include "cppactor/journal.h"
+#include "cppactor/capture.h"
+#include "cppactor/framework.h"
+#include "cppactor/message.h"
 
 namespace cppactor
 {
     std::atomic<uint32_t> actor::m_actorids(1);
+    thread_local actor *actor::t_current = nullptr;
+    thread_local bool actor::t_have_deferred = false;
+    thread_local detail::send_buffer actor::t_sends;
+
+    namespace detail
+    {
+        namespace
+        {
+            std::mutex s_type_names_mtx;
+            std::deque<std::string> s_type_names;       // by index - 1, a deque keeps the strings in place
+        }
+
+        uint16_t next_actor_type_index(const char *name)
+        {
+            int status = 0;
+            char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+            std::lock_guard<std::mutex> lock(s_type_names_mtx);
+            s_type_names.push_back(demangled && status == 0 ? demangled : name);
+            free(demangled);
+            assert(s_type_names.size() < 65536);     // more than 65535 actor types
+            return static_cast<uint16_t>(s_type_names.size());
+        }
+
+        const char *actor_type_name(uint16_t index)
+        {
+            std::lock_guard<std::mutex> lock(s_type_names_mtx);
+            if (index == 0 || index > s_type_names.size())
+                return "";
+            return s_type_names[index - 1].c_str();
+        }
+    }
 
     actor::~actor()
     {
-        miscutils::SpinLockMonitor<miscutils::SimpleSpinLock> lock(m_spin_lock);
+        miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
 
         while(!m_queue.empty())
         {
             delete m_queue.front();
-            m_queue.pop();
+            m_queue.pop_front();
+        }
+        if (m_held)
+        {
+            for (message *pMsg : *m_held)
+                delete pMsg;
+        }
+        delete m_asks.load(std::memory_order_relaxed);
+        if (m_hibernated && framework::instance())
+            framework::instance()->get_hibernation().forget();
+        if (m_journal != 0)
+        {
+            if (journal *j = journal::from_slot(m_journal))
+                j->forget(this);
+        }
+        if (uint8_t slot = m_capture.load(std::memory_order_relaxed))
+        {
+            if (traffic_capture *c = traffic_capture::from_slot(slot))
+                c->forget(this);
+        }
+    }
+
+    void *actor::operator new(size_t n)
+    {
+        return ::operator new(n);
+    }
+
+    void *actor::operator new(size_t n, std::align_val_t align)
+    {
+        return ::operator new(n, align);
+    }
+
+    void actor::operator delete(void *p, size_t n)
+    {
+        if (!detail::actor_blocks::release(p))
+            ::operator delete(p);
+    }
+
+    void actor::operator delete(void *p, size_t n, std::align_val_t align)
+    {
+        if (!detail::actor_blocks::release(p))
+            ::operator delete(p, align);
+    }
+
+    detail::ask_table& actor::get_asks()
+    {
+        detail::ask_table *asks = m_asks.load(std::memory_order_relaxed);
+        if (asks == nullptr)
+        {
+            asks = new detail::ask_table();
+            m_asks.store(asks, std::memory_order_release);
+        }
+        return *asks;
+    }
+
+    bool actor::ask_pending(uint32_t token) const
+    {
+        detail::ask_table *asks = m_asks.load(std::memory_order_acquire);
+        return asks && asks->pending(token);
+    }
+
+    void actor::complete_ask(std::unique_ptr<message>& msg)
+    {
+        detail::ask_table *asks = m_asks.load(std::memory_order_relaxed);
+        if (asks)
+            asks->complete(msg->get_reply_token(), msg);
+        // a late reply, after the timeout, is dropped with msg
+    }
+
+    void actor::expire_ask(uint32_t token)
+    {
+        detail::ask_table *asks = m_asks.load(std::memory_order_relaxed);
+        if (asks)
+        {
+            message_uptr none;
+            asks->complete(token, none);
+        }
+    }
+
+    unsigned int actor::enqueue_batch(message **msgs, size_t count)
+    {
+        if (stopped)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                message_uptr msg(msgs[i]);
+                framework::instance()->get_dead_letters().report(DEAD_LETTER_STOPPED, this, msg);
+            }
+            return 0;
+        }
+
+        miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+        detail::pool_base *p = pool();
+        bool was_empty = m_queue.empty();
+        uint64_t earliest = m_queue.earliest_deadline();
+        if (p->by_deadline())
+        {
+            for (size_t i = 0; i < count; ++i)
+                note_deadline(msgs[i]);
+        }
+        m_queue.insert(m_queue.size(), msgs, msgs + count);
+        if (was_empty)
+            p->notify_one(this);
+        else
+        {
+            if (p->by_deadline() && m_queue.earliest_deadline() != earliest)
+                p->promote(this, m_queue.earliest_deadline());
+            p->notify_one();
+        }
+
+        return m_queue.size();
+    }
+
+    void actor::dead_letter(const message *pMsg)
+    {
+        framework::instance()->get_dead_letters().report(DEAD_LETTER_STOPPED, this, pMsg);
+    }
+
+    unsigned int actor::enqueue_by_deadline(detail::pool_base *p, message *pMsg)
+    {
+        uint64_t earliest = m_queue.earliest_deadline();
+        note_deadline(pMsg);
+        m_queue.push_back(pMsg);
+        if (m_queue.size() == 1)
+            p->notify_one(this);
+        else
+        {
+            // waiting behind a later deadline, or none
+            uint64_t deadline = pMsg->get_deadline();
+            if (deadline != 0 && (earliest == 0 || deadline < earliest))
+                p->promote(this, deadline);
+            p->notify_one();
+        }
+        return m_queue.size();
+    }
+
+    void actor::note_deadline(const message *pMsg)
+    {
+        if (uint64_t deadline = pMsg->get_deadline())
+            m_queue.add_deadline(deadline);
+    }
+
+    void actor::forget_deadline(const message *pMsg)
+    {
+        if (uint64_t deadline = pMsg->get_deadline())
+            m_queue.remove_deadline(deadline);
+    }
+
+    void actor::begin_exit(detail::exit_msg *pMsg)
+    {
+        {
+            miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+            if (!stopped)
+            {
+                // jump the queue, only a message already being handled goes first
+                m_queue.insert(m_in_turn ? 1 : 0, pMsg);
+                if (m_queue.size() == 1)
+                    pool()->notify_one(this);
+                return;
+            }
+        }
+        // stopped already, there is nothing to wait for
+        pMsg->m_state->exited(get_actorid(), 0);
+        delete pMsg;
+    }
+
+    void actor::exit(detail::exit_msg *pMsg)
+    {
+        on_exit();
+
+        size_t dropped;
+        {
+            miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+            stopped = true;
+            dropped = m_queue.size() - 1 + (m_held ? m_held->size() : 0);   // the front is pMsg
+        }
+        pMsg->m_state->exited(get_actorid(), pMsg->m_count_dropped ? dropped : 0);
+    }
+
+    void actor::hibernate_after(int idle_ms)
+    {
+        uint32_t ticks = idle_ms <= 0 ? 0 : (idle_ms + detail::hibernation::TICK_MS - 1) / detail::hibernation::TICK_MS;
+        {
+            miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+            m_active = true;    // the idle period starts at the next sweep
+            m_hibernate_ticks.store(ticks, std::memory_order_relaxed);
         }
+        if (ticks)
+            framework::instance()->get_hibernation().enable();
+    }
+
+    void actor::sweep_idle(uint32_t now)
+    {
+        miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+        if (stopped || m_hibernated)
+            return;
+        if (m_active || !m_queue.empty())
+        {
+            m_active = false;
+            m_idle_since = now;
+            return;
+        }
+        if (now - m_idle_since < m_hibernate_ticks.load(std::memory_order_relaxed) || m_suspended != 0 || (m_held && !m_held->empty()))
+            return;
+
+        // handled on the actor's thread like any message, so on_hibernate() cannot race a handler
+        m_queue.push_back(new detail::hibernate_msg());
+        pool()->notify_one(this);
+    }
+
+    void actor::hibernate()
+    {
+        {
+            miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+            if (m_queue.size() != 1)
+                return;     // sent a message meanwhile, stay awake
+        }
+        size_t bytes = on_hibernate();
+        {
+            miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+            m_hibernated = true;
+            m_release_mailbox = true;
+        }
+        framework::instance()->get_hibernation().hibernated(bytes);
+    }
+
+    void actor::wake()
+    {
+        {
+            miscutils::SpinLockMonitor<detail::mailbox_lock> lock(m_spin_lock);
+            m_hibernated = false;
+        }
+        framework::instance()->get_hibernation().woken();
+        on_wake();
+    }
+
+    void actor::release_mailbox()
+    {
+        // under the mailbox lock, from requeue()
+        m_release_mailbox = false;
+        framework::instance()->get_hibernation().reclaimed(m_queue.release());
+    }
+
+    void actor::defer_send(actor *target, message *pMsg)
+    {
+        t_sends.add(target, pMsg);
+        t_have_deferred = true;
+    }
+
+    void actor::flush_sends()
+    {
+        t_have_deferred = false;
+        t_sends.flush();
     }
 
     unsigned int actor::enqueue(std::function<void (cppactor::actor_iptr)>&& f)
@@ -24,4 +319,30 @@ namespace cppactor
         return enqueue(pMsg);
     }
 
+    void actor::journal_to(journal& j, uint64_t key)
+    {
+        j.add_actor(this, key);
+        uint8_t slot = j.get_slot();
+        // set on the actor's thread, behind the messages already queued
+        enqueue([slot](actor_iptr self) {self->m_journal = slot;});
+    }
+
+    void actor::journal_message(const message *pMsg)
+    {
+        if (journal *j = journal::from_slot(m_journal))
+            j->append(this, pMsg);
+    }
+
+    void actor::capture_to(traffic_capture& c, uint64_t key)
+    {
+        c.add_actor(this, key);
+        m_capture.store(c.get_slot(), std::memory_order_relaxed);
+    }
+
+    void actor::capture_message(const message *pMsg)
+    {
+        if (traffic_capture *c = traffic_capture::from_slot(m_capture.load(std::memory_order_relaxed)))
+            c->record(this, pMsg);
+    }
+
 }
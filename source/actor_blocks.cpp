@@ -0,0 +1,88 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <new>
+#include <cassert>
+#include "cppactor/detail/actor_blocks.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        std::mutex actor_blocks::s_mtx;
+        std::map<uintptr_t, actor_blocks::block> actor_blocks::s_blocks;
+        std::atomic<size_t> actor_blocks::s_count(0);
+
+        char *actor_blocks::allocate(size_t stride, size_t count, size_t align)
+        {
+            block b;
+            b.bytes = stride * count;
+            b.align = align;
+            b.live = count;
+            char *begin = static_cast<char *>(::operator new(b.bytes, std::align_val_t(align)));
+
+            std::lock_guard<std::mutex> lock(s_mtx);
+            s_blocks.insert(std::make_pair(reinterpret_cast<uintptr_t>(begin), b));
+            s_count.fetch_add(1, std::memory_order_relaxed);
+            return begin;
+        }
+
+        void actor_blocks::deallocate(char *begin)
+        {
+            block b;
+            {
+                std::lock_guard<std::mutex> lock(s_mtx);
+                auto it = s_blocks.find(reinterpret_cast<uintptr_t>(begin));
+                assert(it != s_blocks.end());
+                b = it->second;
+                s_blocks.erase(it);
+                s_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+            free_block(begin, b);
+        }
+
+        bool actor_blocks::release(void *p)
+        {
+            if (s_count.load(std::memory_order_relaxed) == 0)
+                return false;
+
+            uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+            block b;
+            {
+                std::lock_guard<std::mutex> lock(s_mtx);
+                auto it = s_blocks.upper_bound(addr);
+                if (it == s_blocks.begin())
+                    return false;
+                --it;
+                if (addr >= it->first + it->second.bytes)
+                    return false;
+                if (--it->second.live != 0)
+                    return true;
+                p = reinterpret_cast<void *>(it->first);
+                b = it->second;
+                s_blocks.erase(it);
+                s_count.fetch_sub(1, std::memory_order_relaxed);
+            }
+            free_block(static_cast<char *>(p), b);
+            return true;
+        }
+
+        void actor_blocks::free_block(char *begin, const block& b)
+        {
+            ::operator delete(begin, std::align_val_t(b.align));
+        }
+    } // detail
+} // cppactor
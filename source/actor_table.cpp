@@ -0,0 +1,264 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <algorithm>
+#include <limits>
+#include <cassert>
+#include "cppactor/detail/actor_table.h"
+#include "cppactor/actor.h"
+#include "cppactor/message.h"
+#include "cppactor/framework.h"
+#include "cppactor/detail/system_messages.h"
+
+namespace cppactor
+{
+    unsigned int actor_ref::enqueue(message *pMsg) const
+    {
+        return framework::instance()->get_actor_table().enqueue(*this, pMsg);
+    }
+
+    unsigned int actor_ref::enqueue(std::function<void (cppactor::actor_iptr)>&& f) const
+    {
+        return enqueue(new detail::function_invoke_msg(std::move(f)));
+    }
+
+    actor_iptr actor_ref::resolve() const
+    {
+        return framework::instance()->get_actor_table().resolve_shared(*this);
+    }
+
+    namespace detail
+    {
+        namespace
+        {
+            // the actor may stop between resolve() and enqueue()
+            unsigned int enqueue_or_delete(actor *a, message *pMsg)
+            {
+                unsigned int n = a->enqueue(pMsg);
+                if (n == 0)
+                    delete pMsg;
+                return n;
+            }
+        }
+
+        thread_local actor_table::reader *actor_table::t_reader = nullptr;
+
+        actor_table::actor_table()
+        : m_epoch(1)
+        , m_next(0)
+        {
+            for (auto& seg : m_segments)
+                seg.store(nullptr, std::memory_order_relaxed);
+        }
+
+        actor_table::~actor_table()
+        {
+            clear();
+            for (auto& seg : m_segments)
+                delete [] seg.load(std::memory_order_relaxed);
+        }
+
+        actor_table::slot& actor_table::make_slot(uint32_t index)
+        {
+            uint32_t seg = index >> SEGMENT_BITS;
+            assert(seg < MAX_SEGMENTS);
+            if (m_segments[seg].load(std::memory_order_relaxed) == nullptr)
+                m_segments[seg].store(new slot[SEGMENT_SIZE], std::memory_order_release);
+            return *get_slot(index);
+        }
+
+        actor_ref actor_table::add(const actor_iptr& a)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            return add_locked(a);
+        }
+
+        void actor_table::add(actor *const *actors, size_t count)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            for (size_t i = 0; i < count; ++i)
+                add_locked(actor_iptr(actors[i]));
+        }
+
+        actor_ref actor_table::add_locked(const actor_iptr& a)
+        {
+            uint32_t index;
+            if (!m_free.empty())
+            {
+                index = m_free.back();
+                m_free.pop_back();
+            }
+            else
+            {
+                index = m_next++;
+            }
+            slot& s = make_slot(index);
+            s.strong = a;
+            s.strong->m_ref = actor_ref(index, s.generation.load(std::memory_order_relaxed));
+            s.ptr.store(s.strong.get(), std::memory_order_release);
+            return s.strong->m_ref;
+        }
+
+        void actor_table::retire(actor_ref ref)
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            slot *s = ref ? get_slot(ref.get_slot()) : nullptr;
+            if (s == nullptr || s->generation.load(std::memory_order_relaxed) != ref.get_generation())
+                return;
+
+            uint32_t next = ref.get_generation() + 1;
+            s->generation.store(next ? next : 1, std::memory_order_release);
+
+            retired r;
+            r.index = ref.get_slot();
+            r.epoch = m_epoch.fetch_add(1) + 1;
+            m_retired.push_back(r);
+        }
+
+        void actor_table::reclaim()
+        {
+            std::vector<actor_iptr> dead;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                if (m_retired.empty())
+                    return;
+
+                // The oldest epoch any online reader may still be reading under
+                uint64_t oldest = std::numeric_limits<uint64_t>::max();
+                for (reader *r : m_readers)
+                {
+                    uint64_t e = r->epoch.load();
+                    if (e != 0 && e < oldest)
+                        oldest = e;
+                }
+
+                auto it = std::partition(m_retired.begin(), m_retired.end(), [=](const retired& r) {return r.epoch > oldest;});
+                for (auto rit = it; rit != m_retired.end(); ++rit)
+                {
+                    slot *s = get_slot(rit->index);
+                    s->ptr.store(nullptr, std::memory_order_relaxed);
+                    dead.push_back(std::move(s->strong));
+                    m_free.push_back(rit->index);
+                }
+                m_retired.erase(it, m_retired.end());
+            }
+            // the actors in dead are destroyed outside the lock
+        }
+
+        void actor_table::clear()
+        {
+            std::vector<actor_iptr> dead;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                for (uint32_t index = 0; index < m_next; ++index)
+                {
+                    slot *s = get_slot(index);
+                    if (s->strong)
+                    {
+                        uint32_t next = s->generation.load(std::memory_order_relaxed) + 1;
+                        s->generation.store(next ? next : 1, std::memory_order_release);
+                        s->ptr.store(nullptr, std::memory_order_relaxed);
+                        dead.push_back(std::move(s->strong));
+                    }
+                }
+                m_retired.clear();
+                m_free.clear();
+                m_next = 0;
+            }
+        }
+
+        actor_iptr actor_table::resolve_shared(actor_ref ref)
+        {
+            if (!ref)
+                return actor_iptr();
+            if (t_reader)
+                return actor_iptr(resolve(ref));
+
+            std::lock_guard<std::mutex> lock(m_mtx);
+            slot *s = (ref && (ref.get_slot() >> SEGMENT_BITS) < MAX_SEGMENTS) ? get_slot(ref.get_slot()) : nullptr;
+            if (s == nullptr || s->generation.load(std::memory_order_relaxed) != ref.get_generation())
+                return actor_iptr();
+            return s->strong;
+        }
+
+        unsigned int actor_table::enqueue(actor_ref ref, message *pMsg)
+        {
+            if (t_reader)
+            {
+                actor *a = resolve(ref);
+                if (a)
+                    return enqueue_or_delete(a, pMsg);
+            }
+            else
+            {
+                actor_iptr a = resolve_shared(ref);
+                if (a)
+                    return enqueue_or_delete(a.get(), pMsg);
+            }
+            // the actor has been stopped and removed
+            message_uptr msg(pMsg);
+            framework::instance()->get_dead_letters().report(DEAD_LETTER_NO_ACTOR, nullptr, msg);
+            return 0;
+        }
+
+        void actor_table::register_reader()
+        {
+            assert(t_reader == nullptr);
+            reader *r = new reader();
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_readers.push_back(r);
+            }
+            t_reader = r;
+            online();
+        }
+
+        void actor_table::unregister_reader()
+        {
+            reader *r = t_reader;
+            if (r == nullptr)
+                return;
+            offline();
+            t_reader = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                m_readers.erase(std::remove(m_readers.begin(), m_readers.end(), r), m_readers.end());
+            }
+            delete r;
+        }
+
+        void actor_table::online()
+        {
+            if (t_reader)
+            {
+                t_reader->epoch.store(m_epoch.load());
+                // no lookup may be ordered before the announcement
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        void actor_table::offline()
+        {
+            if (t_reader)
+                t_reader->epoch.store(0, std::memory_order_release);
+        }
+
+        bool actor_table::is_reader()
+        {
+            return t_reader != nullptr;
+        }
+    } // detail
+} // cppactor
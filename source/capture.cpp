@@ -0,0 +1,440 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include "cppactor/capture.h"
+#include "cppactor/journal.h"
+#include "cppactor/message.h"
+#include "cppactor/detail/system_messages.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    namespace
+    {
+        // The file starts with the magic, then holds records one after the
+        // other, each a header followed by 'size' bytes of payload
+        const char MAGIC[8] = {'C', 'P', 'P', 'A', 'T', 'R', 'F', '1'};
+
+        struct record_header
+        {
+            uint64_t time_ns;       // since the capture started
+            uint64_t key;
+            int32_t msg_id;
+            uint32_t size;
+        };
+
+        // The replay thread sleeps until this close to a record's time, then
+        // yields, leaving the cpu to the pools on a busy host
+        const uint64_t SPIN_NS = 200000;
+
+        uint64_t now_ns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        bool is_system_message(int msg_id)
+        {
+            return static_cast<uint32_t>(msg_id) >= static_cast<uint32_t>(detail::system_message_start);
+        }
+
+        thread_local journal_writer t_writer;
+
+        // Shared by run() and the functions it enqueues behind the messages
+        class replay_probes
+        {
+        public:
+            explicit replay_probes(size_t samples)
+            : m_latencies(samples, std::numeric_limits<uint64_t>::max())
+            , m_pending(0)
+            , m_last_ns(0)
+            {}
+
+            void expect()
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                ++m_pending;
+            }
+
+            // a probe was dropped with its actor
+            void cancel()
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                if (--m_pending == 0)
+                    m_cv.notify_all();
+            }
+
+            void handled(size_t sample, uint64_t sent_ns)
+            {
+                uint64_t now = now_ns();
+                std::lock_guard<std::mutex> lock(m_mtx);
+                if (sample < m_latencies.size())
+                    m_latencies[sample] = now - sent_ns;
+                m_last_ns = std::max(m_last_ns, now);
+                if (--m_pending == 0)
+                    m_cv.notify_all();
+            }
+
+            bool wait(int timeout_ms)
+            {
+                std::unique_lock<std::mutex> lock(m_mtx);
+                return m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {return m_pending == 0;});
+            }
+
+            // after wait()
+            std::vector<uint64_t> latencies()
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                std::vector<uint64_t> result;
+                for (uint64_t l : m_latencies)
+                {
+                    if (l != std::numeric_limits<uint64_t>::max())
+                        result.push_back(l);
+                }
+                return result;
+            }
+
+            uint64_t last_ns()
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                return m_last_ns;
+            }
+
+        private:
+            std::vector<uint64_t> m_latencies;      // a slot per sample
+            std::mutex m_mtx;
+            std::condition_variable m_cv;
+            size_t m_pending;
+            uint64_t m_last_ns;
+        };
+
+        uint64_t percentile(const std::vector<uint64_t>& sorted, double p)
+        {
+            if (sorted.empty())
+                return 0;
+            size_t i = static_cast<size_t>(p * sorted.size());
+            return sorted[std::min(i, sorted.size() - 1)];
+        }
+    }
+
+    std::mutex traffic_capture::s_slots_mtx;
+    std::atomic<traffic_capture *> traffic_capture::s_slots[MAX_CAPTURES + 1];
+
+    traffic_capture::traffic_capture(const std::string& path, const traffic_capture_options& options)
+    : m_options(options)
+    , m_slot(1)
+    , m_fd(-1)
+    , m_start_ns(now_ns())
+    , m_stopped(false)
+    , m_records(0)
+    , m_dropped(0)
+    , m_failed(false)
+    , m_quit(false)
+    {
+        {
+            std::lock_guard<std::mutex> lock(s_slots_mtx);
+            while (m_slot < MAX_CAPTURES && s_slots[m_slot].load(std::memory_order_relaxed) != nullptr)
+                ++m_slot;
+            assert(s_slots[m_slot].load(std::memory_order_relaxed) == nullptr);     // too many captures
+            s_slots[m_slot].store(this, std::memory_order_release);
+        }
+
+        m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0)
+        {
+            TTLOG(ERROR, 13) << "Traffic capture " << path << " could not be created, errno " << errno;
+            m_failed = true;
+            m_stopped = true;
+        }
+        else
+        {
+            m_buffer.insert(m_buffer.end(), MAGIC, MAGIC + sizeof(MAGIC));
+        }
+        m_writer = std::thread([this] {run_writer();});
+    }
+
+    traffic_capture::~traffic_capture()
+    {
+        stop();
+        {
+            std::lock_guard<std::mutex> lock(s_slots_mtx);
+            s_slots[m_slot].store(nullptr, std::memory_order_relaxed);
+        }
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    void traffic_capture::stop()
+    {
+        std::vector<actor_ref> refs;
+        {
+            miscutils::SpinLockMonitor<detail::capture_lock> lock(m_lock);
+            m_stopped = true;
+            for (auto& e : m_actors)
+                refs.push_back(e.second.ref);
+            m_actors.clear();
+        }
+        for (actor_ref& ref : refs)
+        {
+            if (actor_iptr a = ref.resolve())
+            {
+                uint8_t slot = m_slot;
+                a->m_capture.compare_exchange_strong(slot, 0, std::memory_order_relaxed);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_writer_mtx);
+            m_quit = true;
+            m_writer_cv.notify_all();
+        }
+        if (m_writer.joinable())
+            m_writer.join();
+
+        std::vector<char> rest;
+        {
+            miscutils::SpinLockMonitor<detail::capture_lock> lock(m_lock);
+            rest.swap(m_buffer);
+        }
+        write_out(rest);
+    }
+
+    void traffic_capture::add_actor(actor *a, uint64_t key)
+    {
+        miscutils::SpinLockMonitor<detail::capture_lock> lock(m_lock);
+        if (m_stopped)
+            return;
+        entry& e = m_actors[a];
+        e.key = key;
+        e.ref = a->get_ref();
+    }
+
+    void traffic_capture::forget(const actor *a)
+    {
+        miscutils::SpinLockMonitor<detail::capture_lock> lock(m_lock);
+        m_actors.erase(a);
+    }
+
+    void traffic_capture::record(const actor *a, const message *msg)
+    {
+        // the framework's own messages, replies to ask<>() and journal
+        // recovery are not traffic
+        if (is_system_message(msg->msg_id) || msg->get_reply_token() != 0 || msg->m_replayed)
+            return;
+
+        record_header h;
+        h.time_ns = now_ns() - m_start_ns;
+        h.msg_id = msg->msg_id;
+
+        t_writer.clear();
+        if (const detail::journal_codec *codec = detail::find_journal_codec(msg->msg_id))
+            codec->save(*msg, t_writer);
+        h.size = static_cast<uint32_t>(t_writer.size());
+
+        miscutils::SpinLockMonitor<detail::capture_lock> lock(m_lock);
+        if (m_stopped)
+            return;
+        auto it = m_actors.find(a);
+        if (it == m_actors.end())
+            return;
+        h.key = it->second.key;
+        if (m_buffer.size() + sizeof(h) + h.size > m_options.max_buffer)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        const char *p = reinterpret_cast<const char *>(&h);
+        m_buffer.insert(m_buffer.end(), p, p + sizeof(h));
+        m_buffer.insert(m_buffer.end(), t_writer.data(), t_writer.data() + t_writer.size());
+        m_records.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void traffic_capture::run_writer()
+    {
+        auto interval = std::chrono::milliseconds(std::max(1, m_options.flush_interval_ms));
+        std::vector<char> buffer;
+
+        std::unique_lock<std::mutex> lock(m_writer_mtx);
+        while (!m_quit)
+        {
+            m_writer_cv.wait_for(lock, interval, [this] {return m_quit;});
+            lock.unlock();
+
+            {
+                miscutils::SpinLockMonitor<detail::capture_lock> buffer_lock(m_lock);
+                buffer.swap(m_buffer);
+            }
+            write_out(buffer);
+            lock.lock();
+        }
+    }
+
+    void traffic_capture::write_out(std::vector<char>& buffer)
+    {
+        size_t done = 0;
+        while (done < buffer.size() && m_fd >= 0 && ok())
+        {
+            ssize_t n = write(m_fd, buffer.data() + done, buffer.size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                TTLOG(ERROR, 13) << "Traffic capture write failed, errno " << errno << ", capture stopped";
+                m_failed = true;
+                break;
+            }
+            done += n;
+        }
+        buffer.clear();
+    }
+
+    traffic_replay::traffic_replay(const std::string& path)
+    : m_ok(false)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            TTLOG(ERROR, 13) << "Traffic capture " << path << " could not be opened, errno " << errno;
+            return;
+        }
+        char chunk[1 << 16];
+        for (;;)
+        {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            m_data.insert(m_data.end(), chunk, chunk + n);
+        }
+        close(fd);
+
+        if (m_data.size() < sizeof(MAGIC) || memcmp(m_data.data(), MAGIC, sizeof(MAGIC)) != 0)
+        {
+            TTLOG(ERROR, 13) << "Traffic capture " << path << " is not a capture file";
+            return;
+        }
+        m_ok = true;
+
+        // a capture cut short by a crash ends in part of a record
+        size_t offset = sizeof(MAGIC);
+        while (m_data.size() - offset >= sizeof(record_header))
+        {
+            record_header h;
+            memcpy(&h, m_data.data() + offset, sizeof(h));
+            offset += sizeof(h);
+            if (h.size > m_data.size() - offset)
+                break;
+            record r = {h.time_ns, h.key, h.msg_id, h.size, offset};
+            m_records.push_back(r);
+            offset += h.size;
+        }
+    }
+
+    traffic_replay_stats traffic_replay::run(const std::function<actor_iptr(uint64_t key)>& resolve, const traffic_replay_options& options)
+    {
+        traffic_replay_stats stats = {0, 0, true, 0, 0, 0, 0.0, 0, 0, 0, 0, 0, 0};
+        if (m_records.empty())
+            return stats;
+        stats.recorded_ns = m_records.back().time_ns - m_records.front().time_ns;
+
+        size_t every = options.latency_sample;
+        std::shared_ptr<replay_probes> probes(new replay_probes(every ? m_records.size() / every + 1 : 0));
+        std::unordered_map<uint64_t, actor_iptr> actors;
+
+        uint64_t base = m_records.front().time_ns;
+        uint64_t start = now_ns();
+        for (const record& r : m_records)
+        {
+            if (options.speed > 0)
+            {
+                uint64_t due = start + static_cast<uint64_t>((r.time_ns - base) / options.speed);
+                uint64_t now = now_ns();
+                if (now + SPIN_NS < due)
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(due - now - SPIN_NS));
+                while ((now = now_ns()) < due)
+                    std::this_thread::yield();
+                stats.max_lag_ns = std::max(stats.max_lag_ns, now - due);
+            }
+
+            auto found = actors.find(r.key);
+            if (found == actors.end())
+                found = actors.emplace(r.key, resolve(r.key)).first;
+            actor *a = found->second.get();
+
+            const detail::journal_codec *codec = detail::find_journal_codec(r.msg_id);
+            journal_reader in(m_data.data() + r.offset, r.size);
+            message *msg = (a && codec) ? codec->load(in) : nullptr;
+            if (msg == nullptr)
+            {
+                ++stats.skipped;
+                continue;
+            }
+
+            uint64_t sent = now_ns();
+            if (a->enqueue(msg) == 0)
+            {
+                delete msg;
+                ++stats.skipped;
+                continue;
+            }
+            if (every != 0 && stats.messages % every == 0)
+            {
+                // runs once the handler of msg has returned
+                size_t sample = stats.messages / every;
+                probes->expect();
+                if (a->enqueue([probes, sample, sent](actor_iptr) {probes->handled(sample, sent);}) == 0)
+                    probes->cancel();
+            }
+            ++stats.messages;
+        }
+
+        // one more probe per actor, to know when everything was handled
+        for (auto& e : actors)
+        {
+            actor *a = e.second.get();
+            if (a == nullptr)
+                continue;
+            probes->expect();
+            if (a->enqueue([probes](actor_iptr) {probes->handled(std::numeric_limits<size_t>::max(), 0);}) == 0)
+                probes->cancel();
+        }
+        stats.drained = probes->wait(options.drain_timeout_ms);
+
+        uint64_t last = probes->last_ns();
+        stats.elapsed_ns = (stats.drained && last > start) ? last - start : now_ns() - start;
+        if (stats.elapsed_ns > 0)
+            stats.messages_per_sec = stats.messages * 1e9 / stats.elapsed_ns;
+
+        std::vector<uint64_t> latencies = probes->latencies();
+        std::sort(latencies.begin(), latencies.end());
+        stats.samples = latencies.size();
+        stats.latency_p50_ns = percentile(latencies, 0.50);
+        stats.latency_p90_ns = percentile(latencies, 0.90);
+        stats.latency_p99_ns = percentile(latencies, 0.99);
+        stats.latency_p999_ns = percentile(latencies, 0.999);
+        stats.latency_max_ns = latencies.empty() ? 0 : latencies.back();
+        return stats;
+    }
+} // cppactor
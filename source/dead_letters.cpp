@@ -0,0 +1,185 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <chrono>
+#include "cppactor/actor.h"
+#include "cppactor/message.h"
+#include "cppactor/framework.h"
+#include "cppactor/dead_letter.h"
+#include "cppactor/detail/dead_letters.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        static_assert(static_cast<int>(dead_letter_office::REASONS) == static_cast<int>(DEAD_LETTER_REASONS), "dead_letter_office::REASONS is out of date");
+
+        namespace
+        {
+            const char *reason_name(int reason)
+            {
+                switch (reason)
+                {
+                    case DEAD_LETTER_UNHANDLED: return "unhandled";
+                    case DEAD_LETTER_STOPPED: return "stopped";
+                    case DEAD_LETTER_NO_ACTOR: return "no actor";
+                    case DEAD_LETTER_WRONG_POOL: return "wrong pool";
+                }
+                return "";
+            }
+        }
+
+        thread_local bool dead_letter_office::t_forwarding = false;
+
+        dead_letter_office::dead_letter_office()
+        : m_untracked(0)
+        , m_forwarded(0)
+        , m_rate_limited(0)
+        , m_target(0)
+        , m_max_per_second(0)
+        , m_second(0)
+        , m_in_second(0)
+        {
+            for (auto& c : m_counters)
+            {
+                c.key.store(0, std::memory_order_relaxed);
+                c.count.store(0, std::memory_order_relaxed);
+            }
+            for (auto& n : m_by_reason)
+                n.store(0, std::memory_order_relaxed);
+        }
+
+        uint64_t dead_letter_office::make_key(int reason, uint16_t type_id, int msg_id)
+        {
+            // the top bit keeps it from 0
+            return (1ull << 63) | (static_cast<uint64_t>(reason) << 48) | (static_cast<uint64_t>(type_id) << 32) | static_cast<uint32_t>(msg_id);
+        }
+
+        void dead_letter_office::report(int reason, const actor *to, const message *msg)
+        {
+            count(reason, to ? to->type_id : 0, msg->msg_id);
+            if (m_target.load(std::memory_order_relaxed) != 0)
+            {
+                message_uptr none;
+                forward(reason, to, msg->msg_id, none);
+            }
+        }
+
+        void dead_letter_office::report(int reason, const actor *to, std::unique_ptr<message>& msg)
+        {
+            count(reason, to ? to->type_id : 0, msg->msg_id);
+            if (m_target.load(std::memory_order_relaxed) != 0)
+                forward(reason, to, msg->msg_id, msg);
+        }
+
+        void dead_letter_office::count(int reason, uint16_t type_id, int msg_id)
+        {
+            m_by_reason[reason].fetch_add(1, std::memory_order_relaxed);
+
+            uint64_t key = make_key(reason, type_id, msg_id);
+            size_t index = (key * 0x9E3779B97F4A7C15ull) >> 52;
+            for (int probe = 0; probe < MAX_PROBES; ++probe)
+            {
+                counter& c = m_counters[(index + probe) & (TABLE_SIZE - 1)];
+                uint64_t found = c.key.load(std::memory_order_acquire);
+                if (found == 0)
+                {
+                    if (c.key.compare_exchange_strong(found, key, std::memory_order_acq_rel))
+                    {
+                        c.count.fetch_add(1, std::memory_order_relaxed);
+                        // a bug rather than a race with a stopping actor, say so once
+                        if (reason == DEAD_LETTER_UNHANDLED || reason == DEAD_LETTER_WRONG_POOL)
+                        {
+                            TTLOG(WARNING, 0) << "CPPACTOR | Dead letter, " << reason_name(reason) << " msg_id " << msg_id
+                                << " for actor type " << actor_type_name(type_id) << ", the next ones are only counted";
+                        }
+                        return;
+                    }
+                    // found is the key that took the slot
+                }
+                if (found == key)
+                {
+                    c.count.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            m_untracked.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        bool dead_letter_office::may_forward()
+        {
+            int64_t second = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t current = m_second.load(std::memory_order_relaxed);
+            if (second != current && m_second.compare_exchange_strong(current, second, std::memory_order_relaxed))
+                m_in_second.store(0, std::memory_order_relaxed);
+            return m_in_second.fetch_add(1, std::memory_order_relaxed) < m_max_per_second.load(std::memory_order_relaxed);
+        }
+
+        // Sending the sample may find another dead letter, which is only counted
+        void dead_letter_office::forward(int reason, const actor *to, int msg_id, std::unique_ptr<message>& original)
+        {
+            if (t_forwarding || msg_id == dead_letter::msg_id)
+                return;
+            uint64_t target = m_target.load(std::memory_order_acquire);
+            if (target == 0)
+                return;
+            if (!may_forward())
+            {
+                m_rate_limited.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            t_forwarding = true;
+            actor_ref ref(static_cast<uint32_t>(target >> 32), static_cast<uint32_t>(target));
+            const char *type = to ? actor_type_name(to->type_id) : "";
+            dead_letter *d = new dead_letter(static_cast<dead_letter_reason>(reason), to ? to->actor_id : 0, type, msg_id, std::move(original));
+            if (ref.enqueue(d) != 0)
+                m_forwarded.fetch_add(1, std::memory_order_relaxed);
+            t_forwarding = false;
+        }
+
+        void dead_letter_office::set_actor(actor_ref to, int max_per_second)
+        {
+            m_max_per_second.store(max_per_second, std::memory_order_relaxed);
+            uint64_t target = to ? (static_cast<uint64_t>(to.get_slot()) << 32) | to.get_generation() : 0;
+            m_target.store(target, std::memory_order_release);
+        }
+
+        dead_letter_stats dead_letter_office::get_stats() const
+        {
+            dead_letter_stats stats;
+            for (int i = 0; i < REASONS; ++i)
+                stats.by_reason[i] = m_by_reason[i].load(std::memory_order_relaxed);
+            stats.forwarded = m_forwarded.load(std::memory_order_relaxed);
+            stats.rate_limited = m_rate_limited.load(std::memory_order_relaxed);
+            stats.untracked = m_untracked.load(std::memory_order_relaxed);
+            for (const counter& c : m_counters)
+            {
+                uint64_t key = c.key.load(std::memory_order_acquire);
+                if (key == 0)
+                    continue;
+                dead_letter_count n;
+                n.reason = static_cast<dead_letter_reason>((key >> 48) & 0x7fff);
+                n.actor_type = actor_type_name(static_cast<uint16_t>(key >> 32));
+                n.msg_id = static_cast<int>(static_cast<uint32_t>(key));
+                n.count = c.count.load(std::memory_order_relaxed);
+                stats.counts.push_back(n);
+            }
+            return stats;
+        }
+    }
+} // cppactor
@@ -0,0 +1,93 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <algorithm>
+#include <utility>
+#include "cppactor/actor.h"
+#include "cppactor/detail/deadline_queue.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        deadline_queue::deadline_queue()
+        : m_seq(0)
+        , m_promoted(0)
+        {
+        }
+
+        void deadline_queue::push(actor_iptr&& a, uint64_t deadline)
+        {
+            miscutils::SpinLockMonitor<deadline_queue_lock> lock(m_lock);
+            entry e;
+            e.rank = deadline ? deadline : NO_DEADLINE;
+            e.seq = ++m_seq;
+            a->m_queue.set_ready(e.rank, e.seq);
+            e.actor = std::move(a);
+            m_heap.push_back(std::move(e));
+            std::push_heap(m_heap.begin(), m_heap.end(), later());
+        }
+
+        void deadline_queue::promote(actor *a, uint64_t deadline)
+        {
+            if (a->m_queue.ready_seq() == 0 || a->m_queue.ready_rank() <= deadline)
+                return;
+            miscutils::SpinLockMonitor<deadline_queue_lock> lock(m_lock);
+            entry e;
+            e.rank = deadline;
+            e.seq = ++m_seq;
+            e.actor = actor_iptr(a);
+            a->m_queue.set_ready(e.rank, e.seq);
+            m_heap.push_back(std::move(e));
+            std::push_heap(m_heap.begin(), m_heap.end(), later());
+            m_promoted.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        bool deadline_queue::try_pop(actor_iptr& a)
+        {
+            for (;;)
+            {
+                entry e;
+                {
+                    miscutils::SpinLockMonitor<deadline_queue_lock> lock(m_lock);
+                    if (m_heap.empty())
+                        return false;
+                    std::pop_heap(m_heap.begin(), m_heap.end(), later());
+                    e = std::move(m_heap.back());
+                    m_heap.pop_back();
+                }
+
+                // The mailbox lock comes after the queue lock is released,
+                // push() and promote() take them the other way round. A
+                // promote() meanwhile makes this entry a stale one.
+                bool current;
+                {
+                    miscutils::SpinLockMonitor<mailbox_lock> lock(e.actor->m_spin_lock);
+                    current = e.actor->m_queue.ready_seq() == e.seq;
+                    if (current)
+                        e.actor->m_queue.set_ready(0, 0);
+                }
+                if (current)
+                {
+                    a = std::move(e.actor);
+                    return true;
+                }
+                // promoted since, or handled already. The entry may hold the
+                // last reference, it goes with no lock held.
+            }
+        }
+    }
+} // cppactor
@@ -0,0 +1,568 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include "cppactor/file_io.h"
+#include "cppactor/detail/pipeline_segment.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    namespace
+    {
+        // No liburing, the three system calls are all it needs
+        int uring_setup(unsigned int entries, io_uring_params *p)
+        {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+        }
+
+        int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+        {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+        }
+
+        int uring_register(int fd, unsigned int opcode, const void *arg, unsigned int count)
+        {
+            return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+        }
+
+        // user_data of the read on the wake up eventfd, operations use their file_io_done
+        const uint64_t WAKE_DATA = 0;
+
+        // With this many operations in flight the thread waits for a
+        // quarter of them to complete rather than for the first one
+        const size_t BATCH_WAIT = 16;
+
+        file_buffer *allocate_buffer(size_t size)
+        {
+            file_buffer *b = new file_buffer;
+            b->data = new char[std::max<size_t>(size, 1)];
+            b->capacity = size;
+            b->size = size;
+            b->index = -1;
+            return b;
+        }
+    }
+
+    file_io_done::file_io_done(file_io *io, actor_ref to, file_op op_, int file_, uint64_t offset_, uint64_t tag_, file_buffer *buffer)
+    : message(msg_id)
+    , op(op_)
+    , file(file_)
+    , offset(offset_)
+    , tag(tag_)
+    , result(0)
+    , m_io(io)
+    , m_to(to)
+    , m_buffer(buffer)
+    {
+    }
+
+    file_io_done::~file_io_done()
+    {
+        if (m_buffer)
+            m_io->put_buffer(m_buffer);
+    }
+
+    file_io::file_io(const file_io_options& options)
+    : m_options(options)
+    , m_ring_fd(-1)
+    , m_sq_poll(false)
+    , m_wake_fd(-1)
+    , m_wake_value(0)
+    , m_sq_ring(MAP_FAILED)
+    , m_sq_ring_size(0)
+    , m_cq_ring(MAP_FAILED)
+    , m_cq_ring_size(0)
+    , m_sqes(nullptr)
+    , m_sqes_size(0)
+    , m_sq_head(nullptr)
+    , m_sq_tail(nullptr)
+    , m_sq_flags(nullptr)
+    , m_sq_array(nullptr)
+    , m_sq_mask(0)
+    , m_sq_entries(0)
+    , m_cq_head(nullptr)
+    , m_cq_tail(nullptr)
+    , m_cqes(nullptr)
+    , m_cq_mask(0)
+    , m_memory(nullptr)
+    , m_unsubmitted(0)
+    , m_in_flight(0)
+    , m_quit(false)
+    , m_sleeping(false)
+    , m_files(options.max_files, -1)
+    , m_submitted(0)
+    , m_completed(0)
+    , m_failed(0)
+    , m_enters(0)
+    , m_copies(0)
+    {
+        if (!setup())
+        {
+            if (m_ring_fd >= 0)
+                close(m_ring_fd);
+            m_ring_fd = -1;
+            return;
+        }
+
+        // the thread's first entry, it reads the wake up eventfd
+        io_uring_sqe *sqe = next_sqe(true);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = m_wake_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&m_wake_value);
+        sqe->len = sizeof(m_wake_value);
+        sqe->user_data = WAKE_DATA;
+        m_sq_tail->store(m_sq_tail->load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        m_unsubmitted = 1;
+        m_thread = std::thread([this] {run();});
+    }
+
+    bool file_io::setup()
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = m_options.queue_depth * 2;
+        if (m_options.sq_poll_idle_ms)
+        {
+            p.flags |= IORING_SETUP_SQPOLL;
+            p.sq_thread_idle = m_options.sq_poll_idle_ms;
+        }
+        m_ring_fd = uring_setup(m_options.queue_depth, &p);
+        if (m_ring_fd < 0 && (p.flags & IORING_SETUP_SQPOLL))
+        {
+            TTLOG(WARNING, 0) << "io_uring polling thread could not be created, errno " << errno << ", the ring is used without it";
+            memset(&p, 0, sizeof(p));
+            p.flags = IORING_SETUP_CQSIZE;
+            p.cq_entries = m_options.queue_depth * 2;
+            m_ring_fd = uring_setup(m_options.queue_depth, &p);
+        }
+        if (m_ring_fd < 0)
+        {
+            TTLOG(ERROR, 13) << "io_uring could not be set up, errno " << errno;
+            return false;
+        }
+        m_sq_poll = (p.flags & IORING_SETUP_SQPOLL) != 0;
+
+        m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+        if (m_sq_ring == MAP_FAILED)
+            return false;
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            m_cq_ring = m_sq_ring;
+        else
+        {
+            m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+            if (m_cq_ring == MAP_FAILED)
+                return false;
+        }
+        m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+        char *sq = static_cast<char *>(m_sq_ring);
+        m_sq_head = reinterpret_cast<std::atomic<uint32_t> *>(sq + p.sq_off.head);
+        m_sq_tail = reinterpret_cast<std::atomic<uint32_t> *>(sq + p.sq_off.tail);
+        m_sq_flags = reinterpret_cast<std::atomic<uint32_t> *>(sq + p.sq_off.flags);
+        m_sq_mask = *reinterpret_cast<uint32_t *>(sq + p.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<uint32_t *>(sq + p.sq_off.array);
+        m_sq_entries = p.sq_entries;
+        char *cq = static_cast<char *>(m_cq_ring);
+        m_cq_head = reinterpret_cast<std::atomic<uint32_t> *>(cq + p.cq_off.head);
+        m_cq_tail = reinterpret_cast<std::atomic<uint32_t> *>(cq + p.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<uint32_t *>(cq + p.cq_off.ring_mask);
+        m_cqes = cq + p.cq_off.cqes;
+
+        // an empty table, register_file() fills it in
+        if (uring_register(m_ring_fd, IORING_REGISTER_FILES, m_files.data(), m_files.size()) < 0)
+        {
+            TTLOG(ERROR, 13) << "io_uring files could not be registered, errno " << errno;
+            return false;
+        }
+
+        // The buffers work unregistered too, with a copy in the kernel.
+        // Registering pins them, which RLIMIT_MEMLOCK may not allow.
+        size_t size = (m_options.buffer_size + 4095) & ~size_t(4095);
+        void *memory = nullptr;
+        if (m_options.buffer_count && posix_memalign(&memory, 4096, size * m_options.buffer_count) == 0)
+        {
+            m_memory = static_cast<char *>(memory);
+            std::vector<iovec> iov(m_options.buffer_count);
+            m_buffers.resize(m_options.buffer_count);
+            for (unsigned int i = 0; i < m_options.buffer_count; ++i)
+            {
+                iov[i].iov_base = m_memory + i * size;
+                iov[i].iov_len = size;
+                m_buffers[i].data = m_memory + i * size;
+                m_buffers[i].capacity = m_options.buffer_size;
+                m_buffers[i].size = 0;
+                m_buffers[i].index = i;
+            }
+            if (uring_register(m_ring_fd, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) < 0)
+            {
+                TTLOG(WARNING, 0) << "io_uring buffers could not be registered, errno " << errno << ", they are used unregistered";
+                for (file_buffer& b : m_buffers)
+                    b.index = -1;
+            }
+            for (file_buffer& b : m_buffers)
+                m_free.push_back(&b);
+        }
+
+        m_wake_fd = eventfd(0, EFD_CLOEXEC);
+        return m_wake_fd >= 0;
+    }
+
+    file_io::~file_io()
+    {
+        if (m_thread.joinable())
+        {
+            {
+                miscutils::SpinLockMonitor<detail::file_io_lock> lock(m_lock);
+                m_quit = true;
+            }
+            wake();
+            m_thread.join();
+        }
+        if (m_sqes)
+            munmap(m_sqes, m_sqes_size);
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+            munmap(m_cq_ring, m_cq_ring_size);
+        if (m_sq_ring != MAP_FAILED)
+            munmap(m_sq_ring, m_sq_ring_size);
+        if (m_ring_fd >= 0)
+            close(m_ring_fd);
+        if (m_wake_fd >= 0)
+            close(m_wake_fd);
+        free(m_memory);
+    }
+
+    int file_io::register_file(int fd)
+    {
+        std::lock_guard<std::mutex> lock(m_files_mtx);
+        auto it = std::find(m_files.begin(), m_files.end(), -1);
+        if (!is_open() || it == m_files.end())
+            return -1;
+        io_uring_files_update update;
+        memset(&update, 0, sizeof(update));
+        update.offset = static_cast<uint32_t>(it - m_files.begin());
+        update.fds = reinterpret_cast<uint64_t>(&fd);
+        if (uring_register(m_ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) < 0)
+        {
+            TTLOG(ERROR, 13) << "io_uring file " << fd << " could not be registered, errno " << errno;
+            return -1;
+        }
+        *it = fd;
+        return static_cast<int>(update.offset);
+    }
+
+    void file_io::unregister_file(int file)
+    {
+        std::lock_guard<std::mutex> lock(m_files_mtx);
+        if (file < 0 || static_cast<size_t>(file) >= m_files.size() || m_files[file] < 0)
+            return;
+        int none = -1;
+        io_uring_files_update update;
+        memset(&update, 0, sizeof(update));
+        update.offset = file;
+        update.fds = reinterpret_cast<uint64_t>(&none);
+        uring_register(m_ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+        m_files[file] = -1;
+    }
+
+    file_buffer *file_io::get_buffer()
+    {
+        miscutils::SpinLockMonitor<detail::file_io_lock> lock(m_lock);
+        if (m_free.empty())
+            return nullptr;
+        file_buffer *b = m_free.back();
+        m_free.pop_back();
+        b->size = 0;
+        return b;
+    }
+
+    void file_io::release_buffer(file_buffer *buffer)
+    {
+        put_buffer(buffer);
+    }
+
+    void file_io::put_buffer(file_buffer *buffer)
+    {
+        std::less<const file_buffer *> before;
+        if (m_buffers.empty() || before(buffer, &m_buffers.front()) || before(&m_buffers.back(), buffer))
+        {
+            delete [] buffer->data;
+            delete buffer;
+            return;
+        }
+        miscutils::SpinLockMonitor<detail::file_io_lock> lock(m_lock);
+        m_free.push_back(buffer);
+    }
+
+    bool file_io::write(actor_ref to, int file, uint64_t offset, file_buffer *buffer, uint64_t tag)
+    {
+        file_io_done *done = new file_io_done(this, to, FILE_WRITE, file, offset, tag, buffer);
+        return submit(done, buffer->index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, 0);
+    }
+
+    bool file_io::write(actor_ref to, int file, uint64_t offset, const void *data, size_t size, uint64_t tag)
+    {
+        file_buffer *b = size <= m_options.buffer_size ? get_buffer() : nullptr;
+        if (b == nullptr)
+        {
+            b = allocate_buffer(size);
+            m_copies.fetch_add(1, std::memory_order_relaxed);
+        }
+        memcpy(b->data, data, size);
+        b->size = size;
+        return write(to, file, offset, b, tag);
+    }
+
+    bool file_io::read(actor_ref to, int file, uint64_t offset, size_t size, uint64_t tag)
+    {
+        file_buffer *b = size <= m_options.buffer_size ? get_buffer() : nullptr;
+        if (b == nullptr)
+        {
+            b = allocate_buffer(size);
+            m_copies.fetch_add(1, std::memory_order_relaxed);
+        }
+        b->size = size;
+        file_io_done *done = new file_io_done(this, to, FILE_READ, file, offset, tag, b);
+        return submit(done, b->index >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, 0);
+    }
+
+    bool file_io::fsync(actor_ref to, int file, bool datasync, uint64_t tag)
+    {
+        file_io_done *done = new file_io_done(this, to, FILE_FSYNC, file, 0, tag, nullptr);
+        return submit(done, IORING_OP_FSYNC, datasync ? IORING_FSYNC_DATASYNC : 0);
+    }
+
+    // Under m_lock, a cleared entry at the tail, nullptr if the ring or
+    // the completion queue is full. Operations leave one entry for the
+    // wake up read, without it the thread would not see the next batch.
+    io_uring_sqe *file_io::next_sqe(bool wake_read)
+    {
+        uint32_t limit = wake_read ? m_sq_entries : m_sq_entries - 1;
+        uint32_t tail = m_sq_tail->load(std::memory_order_relaxed);
+        if (tail - m_sq_head->load(std::memory_order_acquire) >= limit || m_in_flight >= limit)
+            return nullptr;
+        io_uring_sqe *sqe = &m_sqes[tail & m_sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[tail & m_sq_mask] = tail & m_sq_mask;
+        return sqe;
+    }
+
+    bool file_io::submit(file_io_done *done, uint8_t opcode, uint32_t fsync_flags)
+    {
+        if (!is_open())
+        {
+            delete done;
+            return false;
+        }
+
+        bool sleeping = false;
+        bool quit = false;
+        detail::stage_backoff backoff;
+        while (!quit)
+        {
+            {
+                miscutils::SpinLockMonitor<detail::file_io_lock> lock(m_lock);
+                quit = m_quit;
+                if (quit)
+                    break;
+                io_uring_sqe *sqe = next_sqe(false);
+                if (sqe)
+                {
+                    sqe->opcode = opcode;
+                    sqe->flags = IOSQE_FIXED_FILE;
+                    sqe->fd = done->file;
+                    sqe->off = done->offset;
+                    if (done->m_buffer)
+                    {
+                        sqe->addr = reinterpret_cast<uint64_t>(done->m_buffer->data);
+                        sqe->len = static_cast<uint32_t>(done->m_buffer->size);
+                        if (done->m_buffer->index >= 0)
+                            sqe->buf_index = static_cast<uint16_t>(done->m_buffer->index);
+                    }
+                    sqe->fsync_flags = fsync_flags;
+                    sqe->user_data = reinterpret_cast<uint64_t>(done);
+                    m_sq_tail->store(m_sq_tail->load(std::memory_order_relaxed) + 1, std::memory_order_release);
+                    ++m_in_flight;
+                    ++m_unsubmitted;
+                    m_submitted.fetch_add(1, std::memory_order_relaxed);
+                    sleeping = !m_sq_poll && m_sleeping.exchange(false);
+                    break;
+                }
+            }
+            // full, the thread submits what is there and makes room
+            if (m_sq_poll)
+                wake_poller();
+            else if (m_sleeping.exchange(false))
+                wake();
+            backoff.wait();
+        }
+
+        if (quit)
+        {
+            delete done;
+            return false;
+        }
+        // a thread that is not waiting in the kernel submits the entry next time round
+        if (m_sq_poll)
+            wake_poller();
+        else if (sleeping)
+            wake();
+        return true;
+    }
+
+    void file_io::wake()
+    {
+        uint64_t one = 1;
+        if (::write(m_wake_fd, &one, sizeof(one)) < 0)
+            TTLOG(WARNING, 0) << "io_uring thread could not be woken up, errno " << errno;
+    }
+
+    // The polling thread picks new entries up, unless it has gone to sleep
+    void file_io::wake_poller()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sq_flags->load(std::memory_order_relaxed) & IORING_SQ_NEED_WAKEUP)
+        {
+            uring_enter(m_ring_fd, 0, 0, IORING_ENTER_SQ_WAKEUP);
+            m_enters.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void file_io::run()
+    {
+        io_uring_cqe *cqes = static_cast<io_uring_cqe *>(m_cqes);
+        for (;;)
+        {
+            // what completed, the wake up read it re-arms goes with the next batch
+            uint32_t head = m_cq_head->load(std::memory_order_relaxed);
+            uint32_t tail = m_cq_tail->load(std::memory_order_acquire);
+            for (; head != tail; ++head)
+            {
+                io_uring_cqe *cqe = &cqes[head & m_cq_mask];
+                if (cqe->user_data != WAKE_DATA)
+                {
+                    complete(reinterpret_cast<file_io_done *>(cqe->user_data), cqe->res);
+                    continue;
+                }
+
+                // read the eventfd again, for the next wake up
+                miscutils::SpinLockMonitor<detail::file_io_lock> lock(m_lock);
+                if (m_quit)
+                    continue;
+                io_uring_sqe *sqe = next_sqe(true);
+                if (sqe)
+                {
+                    sqe->opcode = IORING_OP_READ;
+                    sqe->fd = m_wake_fd;
+                    sqe->addr = reinterpret_cast<uint64_t>(&m_wake_value);
+                    sqe->len = sizeof(m_wake_value);
+                    sqe->user_data = WAKE_DATA;
+                    m_sq_tail->store(m_sq_tail->load(std::memory_order_relaxed) + 1, std::memory_order_release);
+                    ++m_unsubmitted;
+                }
+            }
+            m_cq_head->store(head, std::memory_order_release);
+
+            // The entries added so far are in to_submit. A completion ends
+            // the wait for the ones added after, submitters only wake the
+            // thread when none is coming.
+            uint32_t to_submit;
+            size_t in_flight;
+            {
+                miscutils::SpinLockMonitor<detail::file_io_lock> lock(m_lock);
+                if (m_quit && m_in_flight == 0)
+                    break;
+                to_submit = m_unsubmitted;
+                m_unsubmitted = 0;
+                in_flight = m_in_flight;
+                if (in_flight == 0 && !m_sq_poll)
+                    m_sleeping.store(true, std::memory_order_seq_cst);
+            }
+            if (m_sq_poll && to_submit != 0)
+            {
+                // the kernel submits them, for the re-armed wake up read
+                wake_poller();
+                to_submit = 0;
+            }
+
+            // one call submits the batch and waits for completions
+            unsigned int min_complete = in_flight >= BATCH_WAIT ? static_cast<unsigned int>(in_flight / 4) : 1;
+            int submitted = uring_enter(m_ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS);
+            m_sleeping.store(false, std::memory_order_relaxed);
+            m_enters.fetch_add(1, std::memory_order_relaxed);
+            if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                TTLOG(ERROR, 13) << "io_uring_enter failed, errno " << errno;
+            if (submitted < static_cast<int>(to_submit))
+            {
+                miscutils::SpinLockMonitor<detail::file_io_lock> lock(m_lock);
+                m_unsubmitted += to_submit - std::max(submitted, 0);
+            }
+        }
+    }
+
+    void file_io::complete(file_io_done *done, int result)
+    {
+        {
+            miscutils::SpinLockMonitor<detail::file_io_lock> lock(m_lock);
+            --m_in_flight;
+        }
+        m_completed.fetch_add(1, std::memory_order_relaxed);
+        if (result < 0)
+            m_failed.fetch_add(1, std::memory_order_relaxed);
+
+        done->result = result;
+        if (done->op == FILE_WRITE && done->m_buffer)
+        {
+            // written, the next write can have it
+            put_buffer(done->m_buffer);
+            done->m_buffer = nullptr;
+        }
+        if (done->m_to)
+            done->m_to.enqueue(done);
+        else
+            delete done;
+    }
+
+    file_io_stats file_io::get_stats() const
+    {
+        file_io_stats stats;
+        stats.submitted = m_submitted.load(std::memory_order_relaxed);
+        stats.completed = m_completed.load(std::memory_order_relaxed);
+        stats.failed = m_failed.load(std::memory_order_relaxed);
+        stats.enters = m_enters.load(std::memory_order_relaxed);
+        stats.copies = m_copies.load(std::memory_order_relaxed);
+        return stats;
+    }
+} // cppactor
@@ -1,19 +1,34 @@
 #include "cppactor/framework.h"
 #include "cppactor/detail/pool.h"
 #include <utility>
+#include <algorithm>
 #include "cppactor/timer.h"
 #include "cppactor/detail/system_messages.h"
+#include "cppactor/detail/shutdown_state.h"
 #include "cppactor/detail/timer_actor.h"
+#include "cppactor/detail/reactor.h"
 #include "cppactor/utility.h"
+#include "logger/logger.h"
+#include <fcntl.h>
 
 namespace cppactor
 {
     framework *framework::theObject = nullptr;
 
+    namespace
+    {
+        bool is_internal_pool(uint32_t poolid)
+        {
+            return poolid == static_cast<uint32_t>(POOLID_INTERNAL) || poolid == static_cast<uint32_t>(POOLID_REACTOR);
+        }
+    }
+
     framework::framework()
     :m_timerActorId(0)
     , m_timeridpool(0)
     {
+        for (auto& p : m_pool_index)
+            p.store(nullptr, std::memory_order_relaxed);
         theObject = this;
         // Create the thread for the timer actor
         create_pool<detail::timer_actor>(POOLID_INTERNAL, 1);
@@ -38,20 +53,16 @@ namespace cppactor
         return tid;
     }
 
-    int framework::set_timer(actor_iptr actor, int period, bool repeat)
+    int framework::set_timer(const actor_iptr& actor, int period, bool repeat)
     {
         assert(0 == period % 10);
 
-        // We hold on to the actorid instead of the actor itself as a sort of
+        // We hold on to the actor's address instead of the actor itself as a sort of
         // weak reference. We don't want to keep it alive if the actor is stopped.
-        uint32_t aid = actor->get_actorid();
+        actor_ref ref = actor->get_ref();
 
-        return set_timer(period, repeat, [=](int timer_id) {
-            actor_iptr a = framework::instance()->get_actor(aid);
-            if (a)
-            {
-                a->enqueue(new detail::timer_on_timer(timer_id));
-            }
+        return set_timer(period, repeat, [ref](int timer_id) {
+            ref.enqueue(new detail::timer_on_timer(timer_id));
         });
     }
 
@@ -63,6 +74,46 @@ namespace cppactor
         t->enqueue(m);
     }
 
+    instrusive_ptr<detail::reactor_actor> framework::get_reactor()
+    {
+        std::call_once(m_reactor_once, [this] {
+            create_pool<detail::reactor_actor>(POOLID_REACTOR, 1);
+            actor_iptr a = create_actor<detail::reactor_actor>(POOLID_REACTOR);
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_reactor = a;
+        });
+        std::lock_guard<std::mutex> lock(m_mtx);
+        return m_reactor.cast<detail::reactor_actor>();
+    }
+
+    void framework::watch_fd(const actor_iptr& actor, int fd, io_mode mode)
+    {
+        instrusive_ptr<detail::reactor_actor> reactor = get_reactor();
+        if (!reactor)
+        {
+            TTLOG(WARNING, 0) << "CPPACTOR | watch_fd() after shutdown, descriptor " << fd << " is not watched";
+            return;
+        }
+        int flags = fcntl(fd, F_GETFL);
+        if (flags >= 0 && (flags & O_NONBLOCK) == 0)
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        reactor->post(new detail::reactor_watch_msg(fd, mode, actor->get_ref()));
+    }
+
+    void framework::unwatch_fd(int fd)
+    {
+        // after shutdown() there is nothing left watching it
+        if (instrusive_ptr<detail::reactor_actor> reactor = get_reactor())
+            reactor->post(new detail::reactor_unwatch_msg(fd));
+    }
+
+    reactor_stats framework::get_reactor_stats()
+    {
+        if (instrusive_ptr<detail::reactor_actor> reactor = get_reactor())
+            return reactor->get_stats();
+        return reactor_stats();
+    }
+
     detail::pool_t framework::get_pool(uint32_t poolid)
     {
         std::lock_guard<std::mutex> lock(m_mtx);
@@ -72,6 +123,60 @@ namespace cppactor
         return (*it).second;
     }
 
+    std::vector<detail::pool_t> framework::get_pools()
+    {
+        std::vector<detail::pool_t> pools;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (auto it = m_pools.begin(); it != m_pools.end(); ++it)
+            pools.push_back((*it).second);
+        return pools;
+    }
+
+    size_t framework::get_pool_size(uint32_t poolid)
+    {
+        detail::pool_t p = get_pool(poolid);
+        return p ? p->get_thread_count() : 0;
+    }
+
+    deadline_stats framework::get_deadline_stats(uint32_t poolid)
+    {
+        deadline_stats stats = {0, 0, 0, 0};
+        detail::pool_t p = get_pool(poolid);
+        if (p)
+        {
+            stats.handled = p->get_deadlines_handled();
+            stats.missed = p->get_deadlines_missed();
+            stats.max_lateness_ns = p->get_max_lateness_ns();
+            stats.promoted = p->get_promoted();
+        }
+        return stats;
+    }
+
+    void framework::start_watchdog(int threshold_ms, std::function<void (const stalled_handler&)> report)
+    {
+        m_watchdog.start(threshold_ms, std::move(report));
+    }
+
+    void framework::stop_watchdog()
+    {
+        m_watchdog.stop();
+    }
+
+    watchdog_stats framework::get_watchdog_stats()
+    {
+        return m_watchdog.get_stats();
+    }
+
+    void framework::set_dead_letter_actor(actor_ref to, int max_per_second)
+    {
+        m_dead_letters.set_actor(to, max_per_second);
+    }
+
+    dead_letter_stats framework::get_dead_letter_stats()
+    {
+        return m_dead_letters.get_stats();
+    }
+
     actor_iptr framework::get_actor(uint32_t actorid)
     {
         std::lock_guard<std::mutex> lock(m_mtx);
@@ -81,30 +186,106 @@ namespace cppactor
         return (*it).second;
     }
 
-    void framework::add_pool(detail::pool_t p)
+    hibernation_stats framework::get_hibernation_stats()
+    {
+        hibernation_stats stats;
+        size_t actors;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            actors = m_actors.size();
+        }
+        stats.hibernated = m_hibernation.get_hibernated();
+        stats.resident = actors > stats.hibernated ? actors - stats.hibernated : 0;
+        stats.hibernations = m_hibernation.get_hibernations();
+        stats.wakeups = m_hibernation.get_wakeups();
+        stats.bytes_reclaimed = m_hibernation.get_bytes_reclaimed();
+        return stats;
+    }
+
+    void framework::add_pool(const detail::pool_t& p)
     {
         std::lock_guard<std::mutex> lock(m_mtx);
-        m_pools.insert(std::make_pair(p->get_poolid(), p));
+        auto it = m_pools.insert(std::make_pair(p->get_poolid(), p)).first;
+        if (p->get_poolid() < POOL_INDEX_SIZE)
+            m_pool_index[p->get_poolid()].store(it->second.get(), std::memory_order_release);
     }
 
-    void framework::add_actor(actor_iptr a)
+    void framework::submit_task(uint32_t poolid, detail::task_function&& task)
+    {
+        // no reference is taken, shutdown() keeps the pools of the index alive in m_stopped_pools
+        detail::pool_base *pool = poolid < POOL_INDEX_SIZE ? m_pool_index[poolid].load(std::memory_order_acquire) : nullptr;
+        if (pool)
+        {
+            pool->submit(std::move(task));
+            return;
+        }
+        detail::pool_t p = get_pool(poolid);
+        if (p)
+        {
+            p->submit(std::move(task));
+            return;
+        }
+        // no such pool, or it has been shut down
+        TTLOG(WARNING, 0) << "CPPACTOR | task submitted to pool " << poolid << " cancelled, there is no such pool";
+        detail::pool_base::cancel_task(task);
+    }
+
+    void framework::add_actor(const actor_iptr& a)
     {
         std::lock_guard<std::mutex> lock(m_mtx);
+        m_actor_table.add(a);
         m_actors.insert(std::make_pair(a->get_actorid(), a));
     }
 
+    void framework::add_actors(actor *const *actors, size_t count)
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_actors.reserve(m_actors.size() + count);
+        m_actor_table.add(actors, count);
+        for (size_t i = 0; i < count; ++i)
+            m_actors.insert(std::make_pair(actors[i]->get_actorid(), actor_iptr(actors[i])));
+    }
+
     void framework::stop_actor(actor_iptr actor)
     {
         {
             std::lock_guard<std::mutex> lock(m_mtx);
             m_actors.erase(actor->get_actorid());
         }
+        m_actor_table.retire(actor->get_ref());
         actor->on_exit();
         actor->stop();
     }
 
-    void framework::shutdown()
+    bool framework::wait_idle(std::vector<detail::pool_t>& pools, std::chrono::steady_clock::time_point deadline)
     {
+        // Idle twice in a row with no thread woken up in between means no
+        // message was handled meanwhile. The internal pools are never idle, their
+        // timer and reactor actors tick every 10ms.
+        bool was_idle = false;
+        uint64_t last_wakeups = 0;
+        for (;;)
+        {
+            bool idle = true;
+            uint64_t wakeups = 0;
+            for (detail::pool_t& p : pools)
+            {
+                if (!is_internal_pool(p->get_poolid()))
+                    idle = p->is_idle(wakeups) && idle;
+            }
+            if (idle && was_idle && wakeups == last_wakeups)
+                return true;
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+            was_idle = idle;
+            last_wakeups = wakeups;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    shutdown_report framework::shutdown(shutdown_mode mode, int deadline_ms)
+    {
+        auto start = std::chrono::steady_clock::now();
         std::vector<detail::pool_t> pools;
         std::vector<actor_iptr> actors;
 
@@ -120,19 +301,85 @@ namespace cppactor
             }
         }
 
+        shutdown_report report;
+        report.actors = actors.size();
+        report.drained = false;
+        if (mode == SHUTDOWN_DRAIN)
+            report.drained = wait_idle(pools, start + std::chrono::milliseconds(deadline_ms));
+
+        // Every actor exits on its own pool, the exit message goes ahead of its queued messages.
+        // The deadline_ms of the exits starts now, a drain may have used its own up already.
+        std::vector<uint32_t> actorids;
+        actorids.reserve(actors.size());
+        for (actor_iptr& a : actors)
+            actorids.push_back(a->get_actorid());
+        instrusive_ptr<detail::shutdown_state> state(new detail::shutdown_state(std::move(actorids)));
+        auto exit_start = std::chrono::steady_clock::now();
+        for (actor_iptr& a : actors)
+        {
+            bool internal = is_internal_pool(a->pool()->get_poolid());
+            a->begin_exit(new detail::exit_msg(state, !internal));
+        }
+        if (deadline_ms > 0)
+        {
+            if (!state->wait_until(exit_start + std::chrono::milliseconds(deadline_ms)))
+                report.not_exited = state->pending();
+        }
+        else
+            state->wait();
+        report.dropped_messages = state->dropped();
+
+        // The pools of the actors stuck in a handler cannot be joined, they
+        // quit on their own once the last of those has exited
+        std::vector<detail::pool_base *> stuck;
+        for (actor_iptr& a : actors)
+        {
+            if (std::find(report.not_exited.begin(), report.not_exited.end(), a->get_actorid()) == report.not_exited.end())
+                continue;
+            TTLOG(WARNING, 0) << "CPPACTOR | Actor " << a->get_actorid() << " of type " << detail::actor_type_name(a->type_id)
+                              << " did not exit within " << deadline_ms << "ms, pool " << a->pool()->get_poolid() << " is left running";
+            if (std::find(stuck.begin(), stuck.end(), a->pool()) == stuck.end())
+                stuck.push_back(a->pool());
+        }
+        for (detail::pool_base *p : stuck)
+        {
+            p->abandon();   // leaked, so the pointers stay valid
+            pools.erase(std::find_if(pools.begin(), pools.end(), [p](detail::pool_t& x) {return x.get() == p;}));
+        }
+        if (!stuck.empty())
+        {
+            state->when_done([stuck] {
+                for (detail::pool_base *p : stuck)
+                    p->signal_quit();
+            });
+        }
+
         for (auto it = pools.begin(); it != pools.end(); ++it)
         {
-            (*it)->wait_quit();
+            (*it)->signal_quit();
         }
-        for (auto ait = actors.begin(); ait != actors.end(); ++ait)
+        for (auto it = pools.begin(); it != pools.end(); ++it)
         {
-            (*ait)->on_exit();
+            (*it)->join();
         }
-        
+        m_watchdog.stop();
+
         {
             std::lock_guard<std::mutex> lock(m_mtx);
+            for (auto& p : m_pool_index)
+                p.store(nullptr, std::memory_order_relaxed);
+            // a submit_task() racing with us may still hold a pool from the index
+            for (auto& p : m_pools)
+                m_stopped_pools.push_back(p.second);
             m_pools.clear();
             m_actors.clear();
+            m_reactor = actor_iptr();
         }
+        // a first watch_fd() after this must not create the reactor
+        std::call_once(m_reactor_once, [] {});
+        m_actor_table.clear();
+
+        report.elapsed_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+        return report;
     }
 }
@@ -0,0 +1,55 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <chrono>
+#include "cppactor/detail/hibernation.h"
+#include "cppactor/detail/actor_table.h"
+#include "cppactor/actor.h"
+#include "cppactor/framework.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        uint32_t hibernation::now()
+        {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch());
+            return static_cast<uint32_t>(ms.count() / TICK_MS);
+        }
+
+        void hibernation::tick()
+        {
+            if (!m_any.load(std::memory_order_relaxed))
+                return;
+
+            // the timer thread is a pool thread, the actors it finds stay valid during the tick
+            actor_table& table = framework::instance()->get_actor_table();
+            uint32_t stamp = now();
+            for (int n = 0; n < SWEEP_SLOTS; ++n)
+            {
+                actor *a;
+                if (!table.peek(m_cursor, a))
+                {
+                    m_cursor = 0;   // past the last segment, start over on the next tick
+                    return;
+                }
+                ++m_cursor;
+                if (a && a->m_hibernate_ticks != 0)
+                    a->sweep_idle(stamp);
+            }
+        }
+    } // detail
+} // cppactor
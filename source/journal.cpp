@@ -0,0 +1,587 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include "cppactor/journal.h"
+#include "cppactor/message.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    namespace
+    {
+        enum
+        {
+            RECORD_MESSAGE = 1
+            , RECORD_SNAPSHOT = 2
+        };
+
+        // Records are 8 byte aligned, a zero kind marks the end of a segment
+        struct record_header
+        {
+            uint32_t size;          // payload bytes
+            uint32_t checksum;      // of the other fields and the payload
+            uint64_t key;
+            int32_t msg_id;
+            uint32_t kind;
+        };
+
+        size_t padded(size_t n)
+        {
+            return (n + 7) & ~size_t(7);
+        }
+
+        // Orders records across segments
+        uint64_t position(uint64_t index, size_t offset)
+        {
+            return (index << 32) | offset;
+        }
+
+        // FNV-1a
+        uint32_t hash(uint32_t h, const void *data, size_t size)
+        {
+            const unsigned char *p = static_cast<const unsigned char *>(data);
+            for (size_t i = 0; i < size; ++i)
+                h = (h ^ p[i]) * 16777619u;
+            return h;
+        }
+
+        uint32_t checksum(const record_header& h, const char *payload)
+        {
+            uint32_t c = 2166136261u;
+            c = hash(c, &h.size, sizeof(h.size));
+            c = hash(c, &h.key, sizeof(h.key));
+            c = hash(c, &h.msg_id, sizeof(h.msg_id));
+            c = hash(c, &h.kind, sizeof(h.kind));
+            return hash(c, payload, h.size);
+        }
+
+        // Calls f(header, payload, offset) for each record of a segment.
+        // Returns false if the segment ends in a damaged record.
+        template <typename F>
+        bool scan(const char *base, size_t size, F&& f)
+        {
+            size_t offset = 0;
+            while (size - offset >= sizeof(record_header))
+            {
+                record_header h;
+                memcpy(&h, base + offset, sizeof(h));
+                if (h.kind == 0)
+                    return true;
+                const char *payload = base + offset + sizeof(h);
+                if (h.size > size - offset - sizeof(h) || checksum(h, payload) != h.checksum)
+                    return false;
+                f(h, payload, offset);
+                offset = std::min(size, offset + sizeof(h) + padded(h.size));
+            }
+            return true;
+        }
+
+        std::mutex s_codecs_mtx;
+        std::unordered_map<int, detail::journal_codec> s_codecs;
+
+        thread_local journal_writer t_writer;
+
+        // Shared by the snapshot requests of one checkpoint. The last one
+        // to go, run or dropped, truncates the log if all of them ran.
+        class checkpoint_state
+        {
+        public:
+            checkpoint_state(journal *j, uint64_t before, size_t actors)
+            : m_journal(j)
+            , m_before(before)
+            , m_remaining(actors)
+            {}
+
+            ~checkpoint_state()
+            {
+                m_journal->checkpoint_done(m_before, m_remaining.load(std::memory_order_acquire) == 0);
+            }
+
+            void done()
+            {
+                m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+            }
+
+        private:
+            journal *m_journal;
+            uint64_t m_before;
+            std::atomic<size_t> m_remaining;
+        };
+    }
+
+    namespace detail
+    {
+        void add_journal_codec(int msg_id, const journal_codec& codec)
+        {
+            std::lock_guard<std::mutex> lock(s_codecs_mtx);
+            s_codecs[msg_id] = codec;
+        }
+
+        // Read without the lock, the types are registered at startup
+        const journal_codec *find_journal_codec(int msg_id)
+        {
+            auto it = s_codecs.find(msg_id);
+            return it == s_codecs.end() ? nullptr : &it->second;
+        }
+    }
+
+    std::mutex journal::s_slots_mtx;
+    std::atomic<journal *> journal::s_slots[MAX_JOURNALS];
+
+    journal::journal(const std::string& directory, const std::string& name, const journal_options& options)
+    : m_directory(directory)
+    , m_name(name)
+    , m_options(options)
+    , m_slot(1)
+    , m_offset(0)
+    , m_failed(false)
+    , m_records(0)
+    , m_checkpointing(false)
+    , m_first_new(1)
+    , m_quit(false)
+    , m_sync_requested(false)
+    , m_flushed(0)
+    , m_synced_index(0)
+    , m_synced_offset(0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(s_slots_mtx);
+            while (m_slot < MAX_JOURNALS && s_slots[m_slot].load(std::memory_order_relaxed) != nullptr)
+                ++m_slot;
+            assert(m_slot < MAX_JOURNALS);     // too many journals
+            s_slots[m_slot].store(this, std::memory_order_release);
+        }
+
+        if (mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST)
+            TTLOG(ERROR, 13) << "Journal directory " << m_directory << " could not be created, errno " << errno;
+
+        // <name>.<index>.log
+        std::vector<uint64_t> found;
+        if (DIR *dir = opendir(m_directory.c_str()))
+        {
+            std::string prefix = m_name + ".";
+            while (dirent *e = readdir(dir))
+            {
+                std::string file(e->d_name);
+                if (file.size() <= prefix.size() + 4 || file.compare(0, prefix.size(), prefix) != 0 || file.compare(file.size() - 4, 4, ".log") != 0)
+                    continue;
+                std::string digits = file.substr(prefix.size(), file.size() - prefix.size() - 4);
+                if (digits.find_first_not_of("0123456789") == std::string::npos)
+                    found.push_back(strtoull(digits.c_str(), nullptr, 10));
+            }
+            closedir(dir);
+        }
+        std::sort(found.begin(), found.end());
+        m_files.assign(found.begin(), found.end());
+        m_first_new = found.empty() ? 1 : found.back() + 1;
+
+        if (open_segment(m_first_new, true, m_current))
+        {
+            m_files.push_back(m_first_new);
+        }
+        else
+        {
+            TTLOG(ERROR, 13) << "Journal segment " << segment_path(m_first_new) << " could not be created, errno " << errno;
+            m_failed = true;
+        }
+        m_flushed = position(m_first_new, 0);
+        m_flusher = std::thread([this] {run_flusher();});
+    }
+
+    journal::~journal()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_flush_mtx);
+            m_quit = true;
+            m_flush_cv.notify_all();
+        }
+        m_flusher.join();
+        flush();
+
+        // a run that only replayed leaves no empty segment behind
+        uint64_t last = m_current.index;
+        close_segment(m_current);
+        if (!m_failed && m_offset == 0)
+        {
+            std::lock_guard<std::mutex> lock(m_files_mtx);
+            unlink(segment_path(last).c_str());
+        }
+
+        std::lock_guard<std::mutex> lock(s_slots_mtx);
+        s_slots[m_slot].store(nullptr, std::memory_order_relaxed);
+    }
+
+    std::string journal::segment_path(uint64_t index) const
+    {
+        char number[32];
+        snprintf(number, sizeof(number), "%010llu", static_cast<unsigned long long>(index));
+        return m_directory + "/" + m_name + "." + number + ".log";
+    }
+
+    bool journal::open_segment(uint64_t index, bool writable, segment& s)
+    {
+        std::string path = segment_path(index);
+        int fd = writable ? open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        size_t size = m_options.segment_size;
+        if (writable)
+        {
+            // sparse, and zero filled so the records end at the first zero kind
+            if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+            {
+                close(fd);
+                return false;
+            }
+        }
+        else
+        {
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size == 0)
+            {
+                close(fd);
+                return false;
+            }
+            size = static_cast<size_t>(st.st_size);
+        }
+
+        void *base = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        s.index = index;
+        s.base = static_cast<char *>(base);
+        s.size = size;
+        s.fd = fd;
+        return true;
+    }
+
+    void journal::close_segment(segment& s)
+    {
+        if (s.base)
+            munmap(s.base, s.size);
+        if (s.fd >= 0)
+            close(s.fd);
+        s = segment();
+    }
+
+    void journal::add_actor(actor *a, uint64_t key)
+    {
+        miscutils::SpinLockMonitor<detail::journal_lock> lock(m_lock);
+        entry& e = m_actors[a];
+        e.key = key;
+        e.ref = a->get_ref();
+    }
+
+    void journal::forget(const actor *a)
+    {
+        miscutils::SpinLockMonitor<detail::journal_lock> lock(m_lock);
+        m_actors.erase(a);
+    }
+
+    void journal::append(const actor *a, const message *msg)
+    {
+        if (msg->m_replayed)
+            return;
+        const detail::journal_codec *codec = detail::find_journal_codec(msg->msg_id);
+        if (codec == nullptr)
+            return;
+
+        t_writer.clear();
+        codec->save(*msg, t_writer);
+
+        uint64_t key;
+        {
+            miscutils::SpinLockMonitor<detail::journal_lock> lock(m_lock);
+            auto it = m_actors.find(a);
+            if (it == m_actors.end())
+                return;
+            key = it->second.key;
+        }
+        append_record(RECORD_MESSAGE, key, msg->msg_id, t_writer);
+    }
+
+    void journal::write_snapshot(actor *a, uint64_t key)
+    {
+        t_writer.clear();
+        a->on_journal_snapshot(t_writer);
+        append_record(RECORD_SNAPSHOT, key, 0, t_writer);
+    }
+
+    void journal::append_record(uint32_t kind, uint64_t key, int msg_id, const journal_writer& payload)
+    {
+        size_t need = sizeof(record_header) + padded(payload.size());
+        if (need > m_options.segment_size)
+        {
+            TTLOG(ERROR, 13) << "Journal record of " << payload.size() << " bytes does not fit in a segment, dropped";
+            return;
+        }
+
+        miscutils::SpinLockMonitor<detail::journal_lock> lock(m_lock);
+        if (m_failed)
+            return;
+        if (m_offset + need > m_current.size)
+        {
+            // rare, the syscalls are made under the lock
+            segment next;
+            if (!open_segment(m_current.index + 1, true, next))
+            {
+                TTLOG(ERROR, 13) << "Journal segment " << segment_path(m_current.index + 1) << " could not be created, errno " << errno << ", journaling stopped";
+                m_failed = true;
+                return;
+            }
+            m_retired.push_back(m_current);
+            m_current = next;
+            m_offset = 0;
+            std::lock_guard<std::mutex> files(m_files_mtx);
+            m_files.push_back(next.index);
+        }
+
+        char *p = m_current.base + m_offset;
+        record_header h;
+        h.size = static_cast<uint32_t>(payload.size());
+        h.key = key;
+        h.msg_id = msg_id;
+        h.kind = kind;
+        memcpy(p + sizeof(h), payload.data(), payload.size());
+        h.checksum = checksum(h, p + sizeof(h));
+        memcpy(p, &h, sizeof(h));
+        m_offset += need;
+        m_records.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void journal::run_flusher()
+    {
+        auto interval = std::chrono::milliseconds(std::max(1, m_options.flush_interval_ms));
+        auto checkpoint_interval = std::chrono::milliseconds(m_options.checkpoint_interval_ms);
+        auto next_checkpoint = std::chrono::steady_clock::now() + checkpoint_interval;
+
+        std::unique_lock<std::mutex> lock(m_flush_mtx);
+        while (!m_quit)
+        {
+            m_flush_cv.wait_for(lock, interval, [this] {return m_quit || m_sync_requested;});
+            m_sync_requested = false;
+            lock.unlock();
+
+            flush();
+            if (m_options.checkpoint_interval_ms > 0 && std::chrono::steady_clock::now() >= next_checkpoint)
+            {
+                checkpoint();
+                next_checkpoint = std::chrono::steady_clock::now() + checkpoint_interval;
+            }
+            lock.lock();
+        }
+    }
+
+    // One msync for everything appended since the last flush, the group commit
+    void journal::flush()
+    {
+        std::vector<segment> retired;
+        segment current;
+        size_t end;
+        {
+            miscutils::SpinLockMonitor<detail::journal_lock> lock(m_lock);
+            retired.swap(m_retired);
+            current = m_current;
+            end = m_offset;
+        }
+
+        for (segment& s : retired)
+        {
+            msync(s.base, s.size, MS_SYNC);
+            close_segment(s);
+        }
+        if (current.base)
+        {
+            size_t from = current.index == m_synced_index ? m_synced_offset : 0;
+            if (end > from)
+            {
+                size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                size_t start = from & ~(page - 1);
+                msync(current.base + start, end - start, MS_SYNC);
+            }
+            m_synced_index = current.index;
+            m_synced_offset = end;
+        }
+
+        std::lock_guard<std::mutex> lock(m_flush_mtx);
+        m_flushed = position(current.index, end);
+        m_flush_cv.notify_all();
+    }
+
+    void journal::sync()
+    {
+        uint64_t target;
+        {
+            miscutils::SpinLockMonitor<detail::journal_lock> lock(m_lock);
+            target = position(m_current.index, m_offset);
+        }
+        std::unique_lock<std::mutex> lock(m_flush_mtx);
+        m_sync_requested = true;
+        m_flush_cv.notify_all();
+        m_flush_cv.wait(lock, [&] {return m_flushed >= target || m_quit;});
+    }
+
+    void journal::checkpoint()
+    {
+        if (m_checkpointing.exchange(true))
+            return;     // the last one is still running
+
+        std::vector<entry> actors;
+        uint64_t before;
+        {
+            miscutils::SpinLockMonitor<detail::journal_lock> lock(m_lock);
+            before = m_current.index;
+            actors.reserve(m_actors.size());
+            for (auto& e : m_actors)
+                actors.push_back(e.second);
+        }
+
+        std::shared_ptr<checkpoint_state> state(new checkpoint_state(this, before, actors.size()));
+        for (const entry& e : actors)
+        {
+            actor_iptr a = e.ref.resolve();
+            if (!a)
+            {
+                state->done();  // stopped, nothing of it to keep
+                continue;
+            }
+            uint64_t key = e.key;
+            // on the actor's thread, between two of its messages
+            a->enqueue([this, state, key](actor_iptr self) {
+                write_snapshot(self.get(), key);
+                state->done();
+            });
+        }
+    }
+
+    void journal::checkpoint_done(uint64_t before, bool complete)
+    {
+        if (complete)
+            truncate(before);
+        m_checkpointing.store(false);
+    }
+
+    void journal::truncate(uint64_t before)
+    {
+        std::lock_guard<std::mutex> lock(m_files_mtx);
+        while (!m_files.empty() && m_files.front() < before)
+        {
+            unlink(segment_path(m_files.front()).c_str());
+            m_files.pop_front();
+        }
+    }
+
+    size_t journal::get_segment_count()
+    {
+        std::lock_guard<std::mutex> lock(m_files_mtx);
+        return m_files.size();
+    }
+
+    journal_replay_stats journal::replay(const std::function<actor_iptr(uint64_t key)>& resolve)
+    {
+        journal_replay_stats stats = {0, 0, 0, 0, 0};
+
+        std::vector<segment> segments;
+        {
+            std::lock_guard<std::mutex> lock(m_files_mtx);
+            for (uint64_t index : m_files)
+            {
+                segment s;
+                if (index < m_first_new && open_segment(index, false, s))
+                    segments.push_back(s);
+            }
+        }
+        stats.segments = segments.size();
+
+        // the latest snapshot of each key, older records of the key are not needed
+        std::unordered_map<uint64_t, uint64_t> latest;
+        for (const segment& s : segments)
+        {
+            scan(s.base, s.size, [&](const record_header& h, const char *, size_t offset) {
+                if (h.kind == RECORD_SNAPSHOT)
+                    latest[h.key] = position(s.index, offset);
+            });
+        }
+
+        std::unordered_map<uint64_t, actor_iptr> actors;
+        for (const segment& s : segments)
+        {
+            bool intact = scan(s.base, s.size, [&](const record_header& h, const char *payload, size_t offset) {
+                auto found = actors.find(h.key);
+                if (found == actors.end())
+                    found = actors.emplace(h.key, resolve(h.key)).first;
+                actor *a = found->second.get();
+                auto snapshot = latest.find(h.key);
+                uint64_t pos = position(s.index, offset);
+                if (a == nullptr || (snapshot != latest.end() && pos < snapshot->second))
+                {
+                    ++stats.skipped;
+                    return;
+                }
+
+                if (h.kind == RECORD_SNAPSHOT)
+                {
+                    std::shared_ptr<std::vector<char> > data(new std::vector<char>(payload, payload + h.size));
+                    a->enqueue([data](actor_iptr self) {
+                        journal_reader in(data->data(), data->size());
+                        self->on_journal_restore(in);
+                    });
+                    ++stats.snapshots;
+                    return;
+                }
+
+                const detail::journal_codec *codec = detail::find_journal_codec(h.msg_id);
+                journal_reader in(payload, h.size);
+                message *msg = codec ? codec->load(in) : nullptr;
+                if (msg == nullptr)
+                {
+                    ++stats.skipped;
+                    return;
+                }
+                msg->m_replayed = true;
+                if (a->enqueue(msg) == 0)
+                {
+                    delete msg;
+                    ++stats.skipped;
+                    return;
+                }
+                ++stats.messages;
+            });
+            if (!intact)
+                ++stats.torn;
+        }
+
+        for (segment& s : segments)
+            close_segment(s);
+        return stats;
+    }
+} // cppactor
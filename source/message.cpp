@@ -21,17 +21,33 @@ namespace cppactor
 {
     message::message(int id)
     : msg_id(id)
+    , m_request_token(0)
+    , m_reply_token(0)
+    , m_replayed(false)
+    , m_deadline(0)
     {}
 
     message::message(int id, actor_iptr& replyto)
     : msg_id(id)
-    , m_reply_to(replyto)
+    , m_reply_to(replyto ? replyto->get_ref() : actor_ref())
+    , m_request_token(0)
+    , m_reply_token(0)
+    , m_replayed(false)
+    , m_deadline(0)
     {}
 
+    message::message(int id, actor_ref replyto)
+    : msg_id(id)
+    , m_reply_to(replyto)
+    , m_request_token(0)
+    , m_reply_token(0)
+    , m_replayed(false)
+    , m_deadline(0)
+    {}
 
-    actor_iptr message::get_reply_to() 
+    actor_iptr message::get_reply_to() const
     {
-        return m_reply_to;
+        return m_reply_to.resolve();
     }
 
 } //cppactor
@@ -0,0 +1,116 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <algorithm>
+#include "cppactor/detail/parallel_job.h"
+#include "cppactor/framework.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        parallel_plan plan_parallel(uint32_t poolid, size_t first, size_t last, size_t grain)
+        {
+            parallel_plan plan;
+            plan.first = first;
+            plan.last = std::max(first, last);
+            size_t n = plan.last - first;
+            size_t threads = framework::instance()->get_pool_size(poolid);
+            if (grain == 0)
+                grain = std::max<size_t>(1, n / ((threads + 1) * 4));
+            plan.grain = grain;
+            plan.chunks = (n + grain - 1) / grain;
+            plan.helpers = static_cast<unsigned>(std::min(threads, plan.chunks > 0 ? plan.chunks - 1 : 0));
+            return plan;
+        }
+
+        parallel_job::parallel_job(const parallel_plan& plan, chunk_fn fn, void *ctx)
+        : m_plan(plan)
+        , m_participants(plan.helpers + 1)
+        , m_spans(new span[plan.helpers + 1])
+        , m_completed(0)
+        , m_fn(fn)
+        , m_ctx(ctx)
+        {
+            size_t per = plan.chunks / m_participants;
+            size_t extra = plan.chunks % m_participants;
+            size_t next = 0;
+            for (unsigned i = 0; i < m_participants; ++i)
+            {
+                m_spans[i].next.store(next, std::memory_order_relaxed);
+                next += per + (i < extra ? 1 : 0);
+                m_spans[i].end = next;
+            }
+        }
+
+        void parallel_job::work(unsigned participant)
+        {
+            for (unsigned i = 0; i < m_participants; ++i)
+            {
+                span& s = m_spans[(participant + i) % m_participants];
+                for (;;)
+                {
+                    if (s.next.load(std::memory_order_relaxed) >= s.end)
+                        break;
+                    size_t chunk = s.next.fetch_add(1, std::memory_order_relaxed);
+                    if (chunk >= s.end)
+                        break;
+                    size_t begin = m_plan.first + chunk * m_plan.grain;
+                    size_t end = std::min(begin + m_plan.grain, m_plan.last);
+                    try
+                    {
+                        m_fn(m_ctx, chunk, begin, end);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(m_mtx);
+                        if (!m_error)
+                            m_error = std::current_exception();
+                    }
+                    if (m_completed.fetch_add(1, std::memory_order_acq_rel) + 1 == m_plan.chunks)
+                    {
+                        std::lock_guard<std::mutex> lock(m_mtx);
+                        m_cv.notify_all();
+                    }
+                }
+            }
+        }
+
+        void parallel_job::wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [this] {return m_completed.load(std::memory_order_acquire) == m_plan.chunks;});
+            if (m_error)
+                std::rethrow_exception(m_error);
+        }
+
+        void run_parallel(uint32_t poolid, const parallel_plan& plan, parallel_job::chunk_fn fn, void *ctx)
+        {
+            if (plan.chunks == 0)
+                return;
+            instrusive_ptr<parallel_job> job(new parallel_job(plan, fn, ctx));
+            framework& fw = *framework::instance();
+            for (unsigned p = 1; p <= plan.helpers; ++p)
+                fw.submit(poolid, [job, p]() mutable {job->work(p);});
+
+            // The caller works too, so the call completes even if every
+            // thread of the pool is busy, or the caller is one of them.
+            // It must not leave while a helper is still in a chunk.
+            job->work(0);
+            job->wait();
+        }
+    } // detail
+} // cppactor
@@ -0,0 +1,116 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <chrono>
+#include <cstdlib>
+#include <cassert>
+#include <exception>
+#include <pthread.h>
+#include <sched.h>
+#include "cppactor/detail/pipeline_segment.h"
+#include "cppactor/detail/spin_locks.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        void stage_backoff::wait()
+        {
+            if (m_count < SPINS)
+                spin_pause();
+            else if (m_count < SPINS + YIELDS)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(SLEEP_US));
+            if (m_count < SPINS + YIELDS)
+                ++m_count;
+        }
+
+        void pipeline_segment::start()
+        {
+            m_thread = std::thread([this] {run();});
+            if (m_cpu >= 0)
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(m_cpu, &cpus);
+                if (pthread_setaffinity_np(m_thread.native_handle(), sizeof(cpus), &cpus) != 0)
+                    TTLOG(WARNING, 0) << "Pipeline thread could not be pinned to cpu " << m_cpu;
+            }
+        }
+
+        void pipeline_segment::join()
+        {
+            if (m_thread.joinable())
+                m_thread.join();
+        }
+
+        void pipeline_segment::run()
+        {
+            try
+            {
+                stage_backoff backoff;
+                for (;;)
+                {
+                    if (poll(backoff))
+                    {
+                        backoff.reset();
+                    }
+                    else if (m_upstream_done->load(std::memory_order_acquire))
+                    {
+                        // everything upstream pushed is visible now, finish the ring
+                        while (poll(backoff))
+                            ;
+                        break;
+                    }
+                    else
+                    {
+                        backoff.wait();
+                    }
+                }
+            }
+            catch (std::exception& e)
+            {
+                assert(false);
+                TTLOG( ERROR, 13 )  << "standard exception in cppa pipeline -  will terminate, what:" << e.what();
+                quick_exit(EXIT_FAILURE);
+            }
+            catch (...)
+            {
+                assert(false);
+                TTLOG( ERROR, 13 )  << "Unknown exception in cppa pipeline -  will terminate";
+                quick_exit(EXIT_FAILURE);
+            }
+            m_done.store(true, std::memory_order_release);
+        }
+
+        void pipeline_core::start()
+        {
+            assert(!m_started);
+            m_started = true;
+            for (auto& segment : m_segments)
+                segment->start();
+        }
+
+        void pipeline_core::stop()
+        {
+            m_closed.store(true, std::memory_order_release);
+            for (auto& segment : m_segments)
+                segment->join();
+        }
+    } // detail
+} // cppactor
@@ -15,11 +15,15 @@
  *
  ***************************************************************************/
 #include <memory>
+#include <utility>
+#include <chrono>
 #include "cppactor/actor.h"
 #include "miscutils/LockFreeMultiProducerQueue.h"
 #include <cassert>
 #include "cppactor/instrusive_ptr.h"
 #include "cppactor/detail/pool_base.h"
+#include "cppactor/task_handle.h"
+#include "logger/logger.h"
 
 namespace cppactor
 {
@@ -28,15 +32,43 @@ namespace cppactor
         class actor;
         typedef instrusive_ptr<actor> actor_iptr;
 
-        pool_base::pool_base(uint32_t poolid_)
+        std::mutex pool_base::s_slots_mtx;
+        std::atomic<pool_base *> pool_base::s_slots[MAX_POOLS];
+
+        pool_base::pool_base(uint32_t poolid_, bool by_deadline)
         :m_quit(false)
         ,m_pool_id(poolid_)
+        ,m_idle(0)
+        ,m_wakeups(0)
+        ,m_by_deadline(by_deadline ? new deadline_queue() : nullptr)
+        ,m_slot(0)
+        ,m_deadlines_handled(0)
+        ,m_deadlines_missed(0)
+        ,m_max_lateness_ns(0)
         {
+            std::lock_guard<std::mutex> lock(s_slots_mtx);
+            while (m_slot < MAX_POOLS && s_slots[m_slot].load(std::memory_order_relaxed) != nullptr)
+                ++m_slot;
+            assert(m_slot < MAX_POOLS);     // too many pools
+            s_slots[m_slot].store(this, std::memory_order_release);
         }
 
-        void pool_base::notify_one(cppactor::actor_iptr actor)
+        pool_base::~pool_base()
         {
-            m_actorsWaitingForWork.Produce(actor);
+            std::lock_guard<std::mutex> lock(s_slots_mtx);
+            s_slots[m_slot].store(nullptr, std::memory_order_relaxed);
+        }
+
+        void pool_base::notify_one(cppactor::actor_iptr&& actor)
+        {
+            if (m_by_deadline)
+            {
+                // under the actor's mailbox lock, like every caller
+                uint64_t deadline = actor->m_queue.earliest_deadline();
+                m_by_deadline->push(std::move(actor), deadline);
+            }
+            else
+                m_actorsWaitingForWork.push(std::move(actor));
             std::unique_lock<std::mutex> lockList(m_lockJobsList);
             m_notify_job.notify_one();// wake up a thread if any are idle
         }
@@ -46,16 +78,102 @@ namespace cppactor
             m_notify_job.notify_one();// wake up a thread if any are idle
         }
 
+        void pool_base::handled_deadline(uint64_t deadline)
+        {
+            uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            m_deadlines_handled.fetch_add(1, std::memory_order_relaxed);
+            if (now <= deadline)
+                return;
+            m_deadlines_missed.fetch_add(1, std::memory_order_relaxed);
+            uint64_t late = now - deadline;
+            uint64_t max = m_max_lateness_ns.load(std::memory_order_relaxed);
+            while (late > max && !m_max_lateness_ns.compare_exchange_weak(max, late, std::memory_order_relaxed))
+                ;
+        }
+
+        void pool_base::submit(task_function&& task)
+        {
+            m_tasks.push(std::move(task));
+            std::unique_lock<std::mutex> lockList(m_lockJobsList);
+            if (!m_quit)
+            {
+                m_notify_job.notify_one();
+                return;
+            }
+            // signal_quit() is under the same lock, the threads may be gone already
+            lockList.unlock();
+            cancel_tasks();
+        }
+
+        void pool_base::cancel_task(task_function& task)
+        {
+            task_handle *handle = task.get_handle();
+            task.reset();
+            if (handle)
+                handle->complete(false);
+        }
+
+        void pool_base::cancel_tasks()
+        {
+            task_function task;
+            size_t cancelled = 0;
+            while (m_tasks.try_pop(task))
+            {
+                cancel_task(task);
+                ++cancelled;
+            }
+            if (cancelled != 0)
+                TTLOG(WARNING, 0) << "CPPACTOR | " << cancelled << " task(s) of pool " << m_pool_id << " cancelled, the pool has been shut down";
+        }
+
+        void pool_base::run_task(task_function& task)
+        {
+            task();
+            task_handle *handle = task.get_handle();
+            task.reset();   // release the captures before reporting completion
+            if (handle)
+                handle->complete();
+        }
+
         void pool_base::wait_quit()
         {
+            signal_quit();
+            join();
+        }
+
+        void pool_base::signal_quit()
+        {
+            // under the lock, a thread about to wait either sees m_quit or gets the notification
+            std::lock_guard<std::mutex> lock(m_lockJobsList);
             m_quit = true;
             m_notify_job.notify_all();
+        }
 
+        void pool_base::join()
+        {
             // Wait for all the threads to terminate
             for(std::unique_ptr<std::thread>& worker: m_workers)
             {
                 worker->join();
             }
+            // submitted too late to be run
+            cancel_tasks();
+        }
+
+        void pool_base::abandon()
+        {
+            for(std::unique_ptr<std::thread>& worker: m_workers)
+            {
+                worker->detach();
+            }
+            inc_ref();
+        }
+
+        bool pool_base::is_idle(uint64_t& wakeups)
+        {
+            std::lock_guard<std::mutex> lock(m_lockJobsList);
+            wakeups += m_wakeups;
+            return m_idle == m_workers.size();
         }
     } // detail
 } // cppactor
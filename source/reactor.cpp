@@ -0,0 +1,352 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include "cppactor/reactor.h"
+#include "cppactor/detail/reactor.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    io_ready::io_ready(const instrusive_ptr<detail::io_watch>& watch, int fd_)
+    : message(msg_id)
+    , fd(fd_)
+    , m_watch(watch)
+    {
+    }
+
+    io_ready::~io_ready()
+    {
+        static_cast<detail::reactor_actor *>(m_watch->reactor.get())->io_ready_done(m_watch);
+    }
+
+    io_data::io_data(const instrusive_ptr<detail::io_watch>& watch, int fd_, char *buffer, size_t size)
+    : message(msg_id)
+    , fd(fd_)
+    , m_watch(watch)
+    , m_buffer(buffer)
+    , m_size(size)
+    {
+    }
+
+    io_data::~io_data()
+    {
+        static_cast<detail::reactor_actor *>(m_watch->reactor.get())->io_data_done(m_watch, m_buffer);
+    }
+
+    namespace detail
+    {
+        io_buffer_pool::io_buffer_pool()
+        : m_allocated(0)
+        , m_reused(0)
+        {
+        }
+
+        io_buffer_pool::~io_buffer_pool()
+        {
+            for (char *buffer : m_free)
+                delete [] buffer;
+        }
+
+        char *io_buffer_pool::get()
+        {
+            {
+                miscutils::SpinLockMonitor<io_buffer_lock> lock(m_lock);
+                if (!m_free.empty())
+                {
+                    char *buffer = m_free.back();
+                    m_free.pop_back();
+                    m_reused.fetch_add(1, std::memory_order_relaxed);
+                    return buffer;
+                }
+            }
+            m_allocated.fetch_add(1, std::memory_order_relaxed);
+            return new char[io_data::BUFFER_SIZE];
+        }
+
+        void io_buffer_pool::put(char *buffer)
+        {
+            {
+                miscutils::SpinLockMonitor<io_buffer_lock> lock(m_lock);
+                if (m_free.size() < MAX_KEPT)
+                {
+                    m_free.push_back(buffer);
+                    return;
+                }
+            }
+            delete [] buffer;
+        }
+
+        io_buffer_pool& io_buffers()
+        {
+            static io_buffer_pool pool;
+            return pool;
+        }
+
+        reactor_actor::reactor_actor()
+        : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+        , m_wake_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+        , m_next_token(0)
+        , m_events(MAX_EVENTS)
+        , m_watched(0)
+        , m_wakeups(0)
+        , m_event_count(0)
+        , m_messages(0)
+        , m_bytes(0)
+        , m_throttled(0)
+        {
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u64 = 0;
+            if (m_epoll_fd < 0 || m_wake_fd < 0 || epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wake_fd, &ev) != 0)
+                TTLOG(ERROR, 13) << "CPPACTOR | The reactor could not be set up, errno " << errno;
+        }
+
+        reactor_actor::~reactor_actor()
+        {
+            if (m_wake_fd >= 0)
+                close(m_wake_fd);
+            if (m_epoll_fd >= 0)
+                close(m_epoll_fd);
+        }
+
+        void reactor_actor::on_start()
+        {
+            this->enqueue(new message(reactor_message_poll));
+        }
+
+        // The watches hold the reactor, let it go
+        void reactor_actor::on_exit()
+        {
+            for (auto& it : m_watches)
+                it.second->removed.store(true, std::memory_order_relaxed);
+            m_watches.clear();
+            m_tokens.clear();
+            m_watched.store(0, std::memory_order_relaxed);
+        }
+
+        void reactor_actor::on_message(message_uptr& msg, actor_ref& replyto)
+        {
+            switch (msg->msg_id)
+            {
+                case reactor_message_poll:
+                    poll(msg);
+                    break;
+                case reactor_message_watch:
+                    watch(static_cast<reactor_watch_msg&>(*msg));
+                    break;
+                case reactor_message_unwatch:
+                    unwatch(static_cast<reactor_unwatch_msg *>(msg.get())->fd);
+                    break;
+                case reactor_message_resume:
+                {
+                    instrusive_ptr<io_watch>& w = static_cast<reactor_resume_msg *>(msg.get())->watch;
+                    if (!w->removed.load(std::memory_order_relaxed))
+                        receive(w, true);
+                    break;
+                }
+            }
+        }
+
+        void reactor_actor::post(message *msg)
+        {
+            if (this->enqueue(msg) == 0)
+            {
+                delete msg;
+                return;
+            }
+            uint64_t one = 1;
+            if (write(m_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                TTLOG(WARNING, 0) << "CPPACTOR | The reactor could not be woken up, errno " << errno;
+        }
+
+        void reactor_actor::poll(message_uptr& msg)
+        {
+            int n = epoll_wait(m_epoll_fd, m_events.data(), MAX_EVENTS, TICK_MS);
+            if (n > 0)
+                m_wakeups.fetch_add(1, std::memory_order_relaxed);
+            for (int i = 0; i < n; ++i)
+            {
+                uint64_t token = m_events[i].data.u64;
+                if (token == 0)
+                {
+                    // registrations are queued behind this poll
+                    uint64_t count;
+                    if (read(m_wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                        TTLOG(WARNING, 0) << "CPPACTOR | The reactor wake up could not be read, errno " << errno;
+                    continue;
+                }
+                m_event_count.fetch_add(1, std::memory_order_relaxed);
+                auto it = m_watches.find(token);
+                if (it == m_watches.end())
+                    continue;
+                instrusive_ptr<io_watch> w = it->second;
+                if (w->mode == IO_RECEIVE)
+                    receive(w, (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0);
+                else
+                    ready(w);
+            }
+
+            // post the message again to keep us going
+            this->enqueue(msg.release());
+        }
+
+        void reactor_actor::watch(reactor_watch_msg& msg)
+        {
+            unwatch(msg.fd);
+
+            int type = 0;
+            socklen_t len = sizeof(type);
+            bool stream = getsockopt(msg.fd, SOL_SOCKET, SO_TYPE, &type, &len) != 0 || type == SOCK_STREAM;
+            instrusive_ptr<io_watch> w(new io_watch(actor_iptr(this), msg.fd, msg.mode, stream, msg.owner, ++m_next_token));
+
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+            ev.data.u64 = w->token;
+            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, msg.fd, &ev) != 0)
+            {
+                w->removed.store(true, std::memory_order_relaxed);
+                msg.owner.enqueue(new io_closed(msg.fd, errno));
+                return;
+            }
+            m_watches.insert(std::make_pair(w->token, w));
+            m_tokens[msg.fd] = w->token;
+            m_watched.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void reactor_actor::unwatch(int fd)
+        {
+            auto it = m_tokens.find(fd);
+            if (it == m_tokens.end())
+                return;
+            auto wit = m_watches.find(it->second);
+            if (wit != m_watches.end())
+                remove(wit->second);
+        }
+
+        void reactor_actor::remove(instrusive_ptr<io_watch>& w)
+        {
+            if (w->removed.exchange(true, std::memory_order_relaxed))
+                return;
+            // fails if the owner closed it already, which removed it as well
+            epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, w->fd, nullptr);
+            m_tokens.erase(w->fd);
+            m_watched.fetch_sub(1, std::memory_order_relaxed);
+            m_watches.erase(w->token);     // may release w's last reference from the map, the caller holds another
+        }
+
+        // Reads until the descriptor is drained, one io_data per read. A
+        // short read of a stream drains it, unless edges were missed while
+        // throttled or the end is near, then only EAGAIN does.
+        void reactor_actor::receive(instrusive_ptr<io_watch>& w, bool drain)
+        {
+            for (;;)
+            {
+                if (w->in_flight.load() >= io_data::MAX_IN_FLIGHT)
+                {
+                    // the io_data deleted next sends a resume, unless all of
+                    // them were deleted before the flag was seen
+                    w->throttled.store(true);
+                    if (w->in_flight.load() >= io_data::MAX_IN_FLIGHT || !w->throttled.exchange(false))
+                    {
+                        m_throttled.fetch_add(1, std::memory_order_relaxed);
+                        return;
+                    }
+                }
+
+                char *buffer = io_buffers().get();
+                ssize_t n = read(w->fd, buffer, io_data::BUFFER_SIZE);
+                if (n > 0)
+                {
+                    m_bytes.fetch_add(n, std::memory_order_relaxed);
+                    w->in_flight.fetch_add(1);
+                    if (!deliver(w, new io_data(w, w->fd, buffer, n)))
+                        return;
+                    if (w->stream && !drain && n < io_data::BUFFER_SIZE)
+                        return;
+                    continue;
+                }
+                io_buffers().put(buffer);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return;
+
+                // the owner gets the descriptor back
+                int error = n == 0 ? 0 : errno;
+                remove(w);
+                w->owner.enqueue(new io_closed(w->fd, error));
+                return;
+            }
+        }
+
+        void reactor_actor::ready(instrusive_ptr<io_watch>& w)
+        {
+            if (w->edges.fetch_add(1) == 0)
+                deliver(w, new io_ready(w, w->fd));
+        }
+
+        // false if the owner is gone, the watch is removed
+        bool reactor_actor::deliver(instrusive_ptr<io_watch>& w, message *msg)
+        {
+            if (w->owner.enqueue(msg) == 0)
+            {
+                remove(w);
+                return false;
+            }
+            m_messages.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // The handler read until EAGAIN. Edges seen while it ran may have
+        // brought data after that, send another io_ready for them.
+        void reactor_actor::io_ready_done(instrusive_ptr<io_watch>& w)
+        {
+            if (w->edges.exchange(0) > 1 && !w->removed.load(std::memory_order_relaxed) && w->edges.fetch_add(1) == 0)
+            {
+                if (w->owner.enqueue(new io_ready(w, w->fd)) != 0)
+                    m_messages.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        void reactor_actor::io_data_done(instrusive_ptr<io_watch>& w, char *buffer)
+        {
+            io_buffers().put(buffer);
+            w->in_flight.fetch_sub(1);
+            if (w->throttled.exchange(false) && !w->removed.load(std::memory_order_relaxed))
+                post(new reactor_resume_msg(w));
+        }
+
+        reactor_stats reactor_actor::get_stats() const
+        {
+            reactor_stats stats;
+            stats.watched = m_watched.load(std::memory_order_relaxed);
+            stats.wakeups = m_wakeups.load(std::memory_order_relaxed);
+            stats.events = m_event_count.load(std::memory_order_relaxed);
+            stats.messages = m_messages.load(std::memory_order_relaxed);
+            stats.bytes = m_bytes.load(std::memory_order_relaxed);
+            stats.throttled = m_throttled.load(std::memory_order_relaxed);
+            stats.buffers_allocated = io_buffers().get_allocated();
+            stats.buffers_reused = io_buffers().get_reused();
+            return stats;
+        }
+    }
+} // cppactor
@@ -0,0 +1,78 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include "cppactor/detail/send_buffer.h"
+#include "cppactor/actor.h"
+#include "cppactor/message.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        send_buffer::send_buffer()
+        : m_used(0)
+        , m_last(0)
+        {
+        }
+
+        send_buffer::~send_buffer()
+        {
+            // a pool thread never exits with staged sends, but don't leak them
+            for (size_t i = 0; i < m_used; ++i)
+            {
+                for (message *pMsg : m_batches[i].msgs)
+                    delete pMsg;
+            }
+        }
+
+        void send_buffer::add(actor *target, message *pMsg)
+        {
+            if (m_used == 0 || m_batches[m_last].target.get() != target)
+            {
+                auto it = m_index.find(target);
+                if (it != m_index.end())
+                {
+                    m_last = it->second;
+                }
+                else
+                {
+                    if (m_used == m_batches.size())
+                        m_batches.emplace_back();
+                    m_last = m_used++;
+                    m_batches[m_last].target = actor_iptr(target);
+                    m_index.emplace(target, m_last);
+                }
+            }
+            m_batches[m_last].msgs.push_back(pMsg);
+        }
+
+        void send_buffer::flush()
+        {
+            for (size_t i = 0; i < m_used; ++i)
+            {
+                batch& b = m_batches[i];
+                b.target->enqueue_batch(b.msgs.data(), b.msgs.size());
+                b.target.reset(nullptr);
+                if (b.msgs.capacity() > MAX_KEPT)
+                    std::vector<message *>().swap(b.msgs);
+                else
+                    b.msgs.clear();
+            }
+            m_used = 0;
+            m_index.clear();
+        }
+    } // detail
+} // cppactor
@@ -0,0 +1,309 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include "cppactor/shm_transport.h"
+#include "cppactor/detail/pipeline_segment.h"
+#include "cppactor/detail/spin_locks.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    namespace
+    {
+        std::mutex s_codecs_mtx;
+        std::unordered_map<int, detail::shm_codec> s_codecs;
+
+        // Not FUTEX_PRIVATE_FLAG, the word is shared between processes
+        void futex_wait(std::atomic<uint32_t> *word, uint32_t expected, int timeout_ms)
+        {
+            timespec timeout;
+            timeout.tv_sec = timeout_ms / 1000;
+            timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+        }
+
+        void futex_wake(std::atomic<uint32_t> *word)
+        {
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+        }
+
+        uint32_t round_up_pow2(uint32_t n)
+        {
+            uint32_t p = 1;
+            while (p < n)
+                p <<= 1;
+            return p;
+        }
+
+        size_t header_size()
+        {
+            return (sizeof(detail::shm_ring_header) + 63) & ~size_t(63);
+        }
+    }
+
+    namespace detail
+    {
+        void add_shm_codec(int msg_id, const shm_codec& codec)
+        {
+            std::lock_guard<std::mutex> lock(s_codecs_mtx);
+            s_codecs[msg_id] = codec;
+        }
+
+        // Read without the lock, the types are registered at startup
+        const shm_codec *find_shm_codec(int msg_id)
+        {
+            auto it = s_codecs.find(msg_id);
+            return it == s_codecs.end() ? nullptr : &it->second;
+        }
+
+        bool shm_ring::open(const std::string& name, uint32_t slot_count, uint32_t slot_size)
+        {
+            static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                          "the ring's atomics must be lock free to be shared between processes");
+            close();
+            slot_count = round_up_pow2(std::max<uint32_t>(slot_count, 2));
+            slot_size = (std::max<uint32_t>(slot_size, sizeof(shm_slot) + 8) + 7) & ~uint32_t(7);
+            size_t size = header_size() + size_t(slot_count) * slot_size;
+
+            int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+            if (fd < 0)
+            {
+                TTLOG(ERROR, 13) << "Shared memory " << name << " could not be opened, errno " << errno;
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (st.st_size == 0 && ftruncate(fd, size) != 0))
+            {
+                TTLOG(ERROR, 13) << "Shared memory " << name << " could not be sized, errno " << errno;
+                ::close(fd);
+                return false;
+            }
+            if (st.st_size != 0 && static_cast<size_t>(st.st_size) != size)
+            {
+                TTLOG(ERROR, 13) << "Shared memory " << name << " is " << st.st_size << " bytes, expected " << size << ", the sides disagree on shm_options";
+                ::close(fd);
+                return false;
+            }
+            void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (base == MAP_FAILED)
+            {
+                TTLOG(ERROR, 13) << "Shared memory " << name << " could not be mapped, errno " << errno;
+                return false;
+            }
+
+            // the first side to get here sets the ring up, the other waits for it
+            shm_ring_header *header = static_cast<shm_ring_header *>(base);
+            uint32_t state = 0;
+            if (header->state.compare_exchange_strong(state, 1, std::memory_order_acq_rel))
+            {
+                header->magic = MAGIC;
+                header->slot_size = slot_size;
+                header->slot_count = slot_count;
+                header->state.store(2, std::memory_order_release);
+            }
+            else
+            {
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+                while (header->state.load(std::memory_order_acquire) != 2 && std::chrono::steady_clock::now() < deadline)
+                    std::this_thread::yield();
+            }
+            if (header->state.load(std::memory_order_acquire) != 2 || header->magic != MAGIC
+                || header->slot_size != slot_size || header->slot_count != slot_count)
+            {
+                TTLOG(ERROR, 13) << "Shared memory " << name << " is not a ring with the same shm_options";
+                munmap(base, size);
+                return false;
+            }
+
+            m_header = header;
+            m_slots = static_cast<char *>(base) + header_size();
+            m_size = size;
+            m_mask = slot_count - 1;
+            m_slot_size = slot_size;
+            m_cached_head = header->head.load(std::memory_order_acquire);
+            m_cached_tail = header->tail.load(std::memory_order_acquire);
+            return true;
+        }
+
+        void shm_ring::close()
+        {
+            if (m_header)
+                munmap(m_header, m_size);
+            m_header = nullptr;
+            m_slots = nullptr;
+            m_size = 0;
+        }
+
+        bool shm_ring::attach_producer()
+        {
+            int32_t self = getpid();
+            int32_t current = m_header->producer.load(std::memory_order_acquire);
+            for (;;)
+            {
+                // a proxy that went away without detaching
+                if (current != 0 && current != self && kill(current, 0) == 0)
+                    return false;
+                if (current == self)
+                    return false;
+                if (m_header->producer.compare_exchange_weak(current, self, std::memory_order_acq_rel))
+                    return true;
+            }
+        }
+
+        void shm_ring::detach_producer()
+        {
+            int32_t self = getpid();
+            m_header->producer.compare_exchange_strong(self, 0, std::memory_order_acq_rel);
+        }
+
+        // The consumer announces it sleeps before looking at the ring one
+        // last time, publish() stores the tail before looking at 'sleeping'.
+        // One of them sees the other.
+        void shm_ring::wait(int timeout_ms)
+        {
+            m_header->sleeping.store(1, std::memory_order_seq_cst);
+            uint32_t wakeups = m_header->wakeups.load(std::memory_order_seq_cst);
+            if (m_header->tail.load(std::memory_order_seq_cst) == m_header->head.load(std::memory_order_relaxed))
+                futex_wait(&m_header->wakeups, wakeups, timeout_ms);
+            m_header->sleeping.store(0, std::memory_order_relaxed);
+        }
+
+        void shm_ring::wake()
+        {
+            m_header->wakeups.fetch_add(1, std::memory_order_seq_cst);
+            futex_wake(&m_header->wakeups);
+        }
+    }
+
+    shm_proxy::shm_proxy(const std::string& name, const shm_options& options)
+    : m_options(options)
+    , m_connected(false)
+    , m_sent(0)
+    , m_dropped(0)
+    {
+        if (m_ring.open(name, options.slot_count, options.slot_size))
+        {
+            m_connected = m_ring.attach_producer();
+            if (!m_connected)
+                TTLOG(ERROR, 13) << "Shared memory " << name << " already has a proxy sending on it";
+        }
+    }
+
+    shm_proxy::~shm_proxy()
+    {
+        if (m_connected)
+            m_ring.detach_producer();
+    }
+
+    void shm_proxy::on_message(message_uptr& msg, actor_ref& replyto)
+    {
+        const detail::shm_codec *codec = detail::find_shm_codec(msg->msg_id);
+        if (!m_connected || codec == nullptr || codec->size > m_ring.payload_capacity())
+        {
+            if (m_connected && m_dropped.load(std::memory_order_relaxed) == 0)
+                TTLOG(WARNING, 0) << "Message " << msg->msg_id << " is not registered with register_shm_message<>() or does not fit a slot, dropped";
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        detail::shm_slot *slot = m_ring.claim();
+        if (slot == nullptr)
+        {
+            // backpressure, the receiver is behind
+            detail::stage_backoff backoff;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_options.full_timeout_ms);
+            while ((slot = m_ring.claim()) == nullptr && std::chrono::steady_clock::now() < deadline)
+                backoff.wait();
+            if (slot == nullptr)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        slot->msg_id = msg->msg_id;
+        slot->size = codec->size;
+        codec->save(*msg, slot + 1);
+        m_ring.publish();
+        m_sent.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    shm_receiver::shm_receiver(const std::string& name, const actor_iptr& target, const shm_options& options)
+    : m_name(name)
+    , m_target(target)
+    , m_options(options)
+    , m_quit(false)
+    , m_received(0)
+    , m_dropped(0)
+    {
+        if (m_ring.open(name, options.slot_count, options.slot_size))
+            m_thread = std::thread([this] {run();});
+    }
+
+    shm_receiver::~shm_receiver()
+    {
+        m_quit.store(true, std::memory_order_release);
+        if (m_thread.joinable())
+        {
+            m_ring.wake();
+            m_thread.join();
+        }
+        m_ring.close();
+        shm_unlink(m_name.c_str());
+    }
+
+    void shm_receiver::run()
+    {
+        uint32_t empty = 0;
+        while (!m_quit.load(std::memory_order_acquire))
+        {
+            detail::shm_slot *slot = m_ring.front();
+            if (slot == nullptr)
+            {
+                if (m_options.busy_poll || ++empty < m_options.spin_polls)
+                    detail::spin_pause();
+                else
+                    m_ring.wait(100);
+                continue;
+            }
+            empty = 0;
+
+            const detail::shm_codec *codec = detail::find_shm_codec(slot->msg_id);
+            message *msg = (codec && codec->size == slot->size) ? codec->load(slot + 1) : nullptr;
+            m_ring.pop();
+            if (msg == nullptr || m_target->enqueue(msg) == 0)
+            {
+                delete msg;
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            m_received.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+} // cppactor
@@ -0,0 +1,96 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include "cppactor/detail/timer_wheel.h"
+#include "cppactor/detail/system_messages.h"
+#include "cppactor/actor.h"
+#include "cppactor/framework.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        timer_wheel::timer_wheel()
+        : m_cursor(0)
+        , m_last(std::chrono::steady_clock::now())
+        {
+        }
+
+        void timer_wheel::add(actor_ref target, uint32_t token, int milliseconds)
+        {
+            entry e;
+            e.target = target;
+            e.token = token;
+            e.ticks = milliseconds <= TICK_MS ? 1 : (milliseconds + TICK_MS - 1) / TICK_MS;
+
+            miscutils::SpinLockMonitor<timer_wheel_lock> lock(m_lock);
+            m_staged.push_back(e);
+        }
+
+        void timer_wheel::tick()
+        {
+            {
+                miscutils::SpinLockMonitor<timer_wheel_lock> lock(m_lock);
+                m_incoming.swap(m_staged);
+            }
+
+            // entries are placed relative to the current position, so they never expire early
+            for (const entry& e : m_incoming)
+            {
+                entry placed(e);
+                placed.ticks = (e.ticks - 1) / WHEEL_SIZE;
+                m_buckets[(m_cursor + e.ticks) % WHEEL_SIZE].push_back(placed);
+            }
+            m_incoming.clear();
+
+            auto now = std::chrono::steady_clock::now();
+            auto tick = std::chrono::milliseconds(TICK_MS);
+            while (now - m_last >= tick)
+            {
+                m_last += tick;
+                m_cursor = (m_cursor + 1) % WHEEL_SIZE;
+
+                std::vector<entry>& bucket = m_buckets[m_cursor];
+                size_t keep = 0;
+                for (size_t i = 0; i < bucket.size(); ++i)
+                {
+                    if (bucket[i].ticks == 0)
+                    {
+                        expire(bucket[i]);
+                    }
+                    else
+                    {
+                        --bucket[i].ticks;
+                        bucket[keep++] = bucket[i];
+                    }
+                }
+                bucket.resize(keep);
+            }
+        }
+
+        void timer_wheel::expire(const entry& e)
+        {
+            // the timer thread is a pool thread, the lookup needs no reference
+            actor *a = framework::instance()->get_actor_table().resolve(e.target);
+            if (a && a->ask_pending(e.token))
+            {
+                message *pMsg = new ask_timeout_msg(e.token);
+                if (a->enqueue(pMsg) == 0)
+                    delete pMsg;    // stopped meanwhile, enqueue() only reported it
+            }
+        }
+    } // detail
+} // cppactor
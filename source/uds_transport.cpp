@@ -0,0 +1,507 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include "cppactor/uds_transport.h"
+#include "cppactor/journal.h"
+#include "cppactor/message.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    namespace
+    {
+        // Each message on the wire is a frame header followed by 'size' bytes
+        struct frame_header
+        {
+            uint32_t size;
+            int32_t msg_id;
+            uint64_t id;            // the remote actor
+        };
+
+        // batches kept for reuse by a connection
+        const size_t SPARE_BATCHES = 4;
+
+        thread_local journal_writer t_writer;
+
+        bool make_address(const std::string& path, sockaddr_un& addr)
+        {
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(addr.sun_path))
+            {
+                TTLOG(ERROR, 13) << "Socket path " << path << " is too long";
+                return false;
+            }
+            memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+            return true;
+        }
+    }
+
+    unsigned int remote_actor::enqueue(message *msg) const
+    {
+        return m_connection->send(m_id, msg);
+    }
+
+    uds_connection::uds_connection(const std::string& path, const uds_options& options)
+    : m_options(options)
+    , m_fd(-1)
+    , m_connected(false)
+    , m_pending(0)
+    , m_queued_bytes(0)
+    , m_wake(false)
+    , m_flush_requested(false)
+    , m_quit(false)
+    , m_written_bytes(0)
+    , m_messages(0)
+    , m_bytes(0)
+    , m_syscalls(0)
+    , m_dropped(0)
+    {
+        sockaddr_un addr;
+        if (!make_address(path, addr))
+            return;
+
+        // the server may still be starting
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.connect_timeout_ms);
+        for (;;)
+        {
+            m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (m_fd >= 0 && connect(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0)
+                break;
+            int error = errno;
+            if (m_fd >= 0)
+                close(m_fd);
+            m_fd = -1;
+            if (std::chrono::steady_clock::now() >= deadline || (error != ENOENT && error != ECONNREFUSED))
+            {
+                TTLOG(ERROR, 13) << "Socket " << path << " could not be connected, errno " << error;
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        m_connected = true;
+        m_writer = std::thread([this] {run_writer();});
+    }
+
+    uds_connection::~uds_connection()
+    {
+        if (m_writer.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_writer_mtx);
+                m_quit = true;
+            }
+            m_writer_cv.notify_one();
+            m_writer.join();
+        }
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    unsigned int uds_connection::send(uint64_t id, message *msg)
+    {
+        const detail::journal_codec *codec = detail::find_journal_codec(msg->msg_id);
+        if (!is_connected() || codec == nullptr)
+        {
+            delete msg;
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        t_writer.clear();
+        codec->save(*msg, t_writer);
+        frame_header h;
+        h.size = static_cast<uint32_t>(t_writer.size());
+        h.msg_id = msg->msg_id;
+        h.id = id;
+        delete msg;
+
+        size_t need = sizeof(h) + t_writer.size();
+        bool wake = false;
+        {
+            miscutils::SpinLockMonitor<detail::remote_lock> lock(m_lock);
+            if (m_pending + need > m_options.max_pending)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return 0;
+            }
+            // the writer only needs waking for the first message it has to
+            // write, and for a full batch that should not wait for the linger
+            wake = m_pending == 0;
+            if (m_current.data.empty())
+            {
+                m_current_start = std::chrono::steady_clock::now();
+                if (m_current.data.capacity() < m_options.batch_bytes)
+                    m_current.data.reserve(m_options.batch_bytes);
+            }
+            const char *p = reinterpret_cast<const char *>(&h);
+            m_current.data.insert(m_current.data.end(), p, p + sizeof(h));
+            m_current.data.insert(m_current.data.end(), t_writer.data(), t_writer.data() + t_writer.size());
+            ++m_current.messages;
+            m_pending += need;
+            m_queued_bytes += need;
+            if (m_current.data.size() >= m_options.batch_bytes)
+            {
+                m_full.push_back(std::move(m_current));
+                m_current = batch();
+                if (!m_spare.empty())
+                {
+                    m_current = std::move(m_spare.back());
+                    m_spare.pop_back();
+                }
+                wake = true;
+            }
+        }
+        if (wake)
+            wake_writer();
+        return 1;
+    }
+
+    void uds_connection::wake_writer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_writer_mtx);
+            m_wake = true;
+        }
+        m_writer_cv.notify_one();
+    }
+
+    void uds_connection::flush()
+    {
+        uint64_t target;
+        {
+            miscutils::SpinLockMonitor<detail::remote_lock> lock(m_lock);
+            target = m_queued_bytes;
+        }
+        std::unique_lock<std::mutex> lock(m_writer_mtx);
+        if (!m_writer.joinable())
+            return;
+        m_flush_requested = true;
+        m_writer_cv.notify_one();
+        m_flushed_cv.wait(lock, [&] {return m_written_bytes >= target;});
+    }
+
+    uds_stats uds_connection::get_stats() const
+    {
+        uds_stats stats;
+        stats.messages = m_messages.load(std::memory_order_relaxed);
+        stats.bytes = m_bytes.load(std::memory_order_relaxed);
+        stats.syscalls = m_syscalls.load(std::memory_order_relaxed);
+        stats.dropped = m_dropped.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void uds_connection::run_writer()
+    {
+        std::vector<batch> batches;
+        std::unique_lock<std::mutex> lock(m_writer_mtx);
+        for (;;)
+        {
+            m_writer_cv.wait(lock, [this] {return m_wake || m_flush_requested || m_quit;});
+            if (!m_quit && !m_flush_requested && m_options.linger_us > 0)
+            {
+                // give the batch time to fill, unless it fills first
+                bool full;
+                std::chrono::steady_clock::time_point start;
+                {
+                    miscutils::SpinLockMonitor<detail::remote_lock> spin(m_lock);
+                    full = !m_full.empty();
+                    start = m_current_start;
+                }
+                m_wake = false;
+                if (!full)
+                    m_writer_cv.wait_until(lock, start + std::chrono::microseconds(m_options.linger_us),
+                                           [this] {return m_wake || m_flush_requested || m_quit;});
+            }
+            m_wake = false;
+            m_flush_requested = false;
+            bool quit = m_quit;
+            lock.unlock();
+
+            uint64_t end;
+            {
+                miscutils::SpinLockMonitor<detail::remote_lock> spin(m_lock);
+                batches.swap(m_full);
+                if (!m_current.data.empty())
+                {
+                    batches.push_back(std::move(m_current));
+                    m_current = batch();
+                }
+                m_pending = 0;
+                end = m_queued_bytes;
+            }
+            write_batches(batches);
+            {
+                miscutils::SpinLockMonitor<detail::remote_lock> spin(m_lock);
+                for (batch& b : batches)
+                {
+                    if (m_spare.size() >= SPARE_BATCHES)
+                        break;
+                    b.data.clear();
+                    b.messages = 0;
+                    m_spare.push_back(std::move(b));
+                }
+            }
+            batches.clear();
+
+            lock.lock();
+            m_written_bytes = end;
+            m_flushed_cv.notify_all();
+            if (quit)
+                break;
+        }
+    }
+
+    // One sendmsg() for as many batches as it takes, the gather write
+    void uds_connection::write_batches(std::vector<batch>& batches)
+    {
+        size_t messages = 0;
+        std::vector<iovec> iov;
+        for (batch& b : batches)
+        {
+            iovec v = {b.data.data(), b.data.size()};
+            iov.push_back(v);
+            messages += b.messages;
+        }
+        if (iov.empty())
+            return;
+        if (!is_connected())
+        {
+            m_dropped.fetch_add(messages, std::memory_order_relaxed);
+            return;
+        }
+
+        size_t first = 0;
+        while (first < iov.size())
+        {
+            msghdr mh;
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = &iov[first];
+            mh.msg_iovlen = std::min<size_t>(iov.size() - first, IOV_MAX);
+            ssize_t n = sendmsg(m_fd, &mh, MSG_NOSIGNAL);
+            m_syscalls.fetch_add(1, std::memory_order_relaxed);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+            {
+                TTLOG(ERROR, 13) << "Socket write failed, errno " << errno << ", the connection is closed";
+                m_connected = false;
+                m_dropped.fetch_add(messages, std::memory_order_relaxed);
+                return;
+            }
+            m_bytes.fetch_add(n, std::memory_order_relaxed);
+
+            // skip what was written, a partial write leaves the rest of a batch
+            size_t left = n;
+            while (first < iov.size() && left >= iov[first].iov_len)
+                left -= iov[first++].iov_len;
+            if (left > 0)
+            {
+                iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+                iov[first].iov_len -= left;
+            }
+        }
+        m_messages.fetch_add(messages, std::memory_order_relaxed);
+    }
+
+    uds_server::uds_server(const std::string& path, const uds_options& options)
+    : m_path(path)
+    , m_options(options)
+    , m_listen_fd(-1)
+    , m_wake_fd(-1)
+    , m_quit(false)
+    , m_messages(0)
+    , m_bytes(0)
+    , m_syscalls(0)
+    , m_dropped(0)
+    {
+        sockaddr_un addr;
+        if (!make_address(path, addr))
+            return;
+
+        // a server that went away without removing its path
+        unlink(path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 64) != 0)
+        {
+            TTLOG(ERROR, 13) << "Socket " << path << " could not be listened on, errno " << errno;
+            if (fd >= 0)
+                close(fd);
+            return;
+        }
+        m_listen_fd = fd;
+        m_wake_fd = eventfd(0, EFD_CLOEXEC);
+        m_thread = std::thread([this] {run();});
+    }
+
+    uds_server::~uds_server()
+    {
+        if (m_thread.joinable())
+        {
+            m_quit.store(true, std::memory_order_release);
+            uint64_t one = 1;
+            if (write(m_wake_fd, &one, sizeof(one)) < 0)
+                TTLOG(WARNING, 0) << "Socket server could not be woken up, errno " << errno;
+            m_thread.join();
+        }
+        if (m_listen_fd >= 0)
+        {
+            close(m_listen_fd);
+            unlink(m_path.c_str());
+        }
+        if (m_wake_fd >= 0)
+            close(m_wake_fd);
+    }
+
+    void uds_server::bind(uint64_t id, const actor_iptr& a)
+    {
+        miscutils::SpinLockMonitor<detail::remote_lock> lock(m_lock);
+        m_bound[id] = a;
+    }
+
+    void uds_server::unbind(uint64_t id)
+    {
+        miscutils::SpinLockMonitor<detail::remote_lock> lock(m_lock);
+        m_bound.erase(id);
+    }
+
+    uds_stats uds_server::get_stats() const
+    {
+        uds_stats stats;
+        stats.messages = m_messages.load(std::memory_order_relaxed);
+        stats.bytes = m_bytes.load(std::memory_order_relaxed);
+        stats.syscalls = m_syscalls.load(std::memory_order_relaxed);
+        stats.dropped = m_dropped.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void uds_server::run()
+    {
+        std::vector<client> clients;
+        std::vector<pollfd> fds;
+        while (!m_quit.load(std::memory_order_acquire))
+        {
+            fds.clear();
+            pollfd listen_fd = {m_listen_fd, POLLIN, 0};
+            pollfd wake_fd = {m_wake_fd, POLLIN, 0};
+            fds.push_back(listen_fd);
+            fds.push_back(wake_fd);
+            for (client& c : clients)
+            {
+                pollfd client_fd = {c.fd, POLLIN, 0};
+                fds.push_back(client_fd);
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                TTLOG(ERROR, 13) << "Socket server poll failed, errno " << errno;
+                break;
+            }
+
+            // clients first, the vector may grow below
+            for (size_t i = clients.size(); i-- > 0; )
+            {
+                if (fds[i + 2].revents != 0 && !read_client(clients[i]))
+                {
+                    close(clients[i].fd);
+                    clients.erase(clients.begin() + i);
+                }
+            }
+            if (fds[0].revents & POLLIN)
+            {
+                int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd >= 0)
+                {
+                    client c;
+                    c.fd = fd;
+                    c.buffer.resize(std::max<size_t>(m_options.batch_bytes, 4096));
+                    c.used = 0;
+                    clients.push_back(std::move(c));
+                }
+            }
+        }
+        for (client& c : clients)
+            close(c.fd);
+    }
+
+    // Reads what is there and delivers the complete frames, false once
+    // the connection is closed or sends garbage
+    bool uds_server::read_client(client& c)
+    {
+        if (c.used == c.buffer.size())
+            c.buffer.resize(c.buffer.size() * 2);
+        ssize_t n = read(c.fd, c.buffer.data() + c.used, c.buffer.size() - c.used);
+        m_syscalls.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0 && errno == EINTR)
+            return true;
+        if (n <= 0)
+            return false;
+        m_bytes.fetch_add(n, std::memory_order_relaxed);
+        c.used += n;
+
+        size_t offset = 0;
+        while (c.used - offset >= sizeof(frame_header))
+        {
+            frame_header h;
+            memcpy(&h, c.buffer.data() + offset, sizeof(h));
+            if (h.size > m_options.max_pending)
+            {
+                TTLOG(ERROR, 13) << "Socket server read a frame of " << h.size << " bytes, the connection is closed";
+                return false;
+            }
+            if (c.used - offset - sizeof(h) < h.size)
+                break;
+            deliver(h.id, h.msg_id, c.buffer.data() + offset + sizeof(h), h.size);
+            offset += sizeof(h) + h.size;
+        }
+        memmove(c.buffer.data(), c.buffer.data() + offset, c.used - offset);
+        c.used -= offset;
+        return true;
+    }
+
+    void uds_server::deliver(uint64_t id, int msg_id, const char *payload, uint32_t size)
+    {
+        const detail::journal_codec *codec = detail::find_journal_codec(msg_id);
+        journal_reader in(payload, size);
+        message *msg = codec ? codec->load(in) : nullptr;
+
+        actor_iptr target;
+        {
+            miscutils::SpinLockMonitor<detail::remote_lock> lock(m_lock);
+            auto it = m_bound.find(id);
+            if (it != m_bound.end())
+                target = it->second;
+        }
+        if (msg == nullptr || !target || target->enqueue(msg) == 0)
+        {
+            delete msg;
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        m_messages.fetch_add(1, std::memory_order_relaxed);
+    }
+} // cppactor
@@ -0,0 +1,146 @@
+/***************************************************************************
+ *
+ *                    Unpublished Work Copyright (c) 2014
+ *                  Trading Technologies International, Inc.
+ *                       All Rights Reserved Worldwide
+ *
+ *          * * *   S T R I C T L Y   P R O P R I E T A R Y   * * *
+ *
+ * WARNING:  This program (or document) is unpublished, proprietary property
+ * of Trading Technologies International, Inc. and is to be maintained in
+ * strict confidence. Unauthorized reproduction, distribution or disclosure
+ * of this program (or document), or any program (or document) derived from
+ * it is prohibited by State and Federal law, and by local law outside of
+ * the U.S.
+ *
+ ***************************************************************************/
+#include <chrono>
+#include <algorithm>
+#include "cppactor/actor.h"
+#include "cppactor/detail/pool_base.h"
+#include "cppactor/detail/watchdog.h"
+#include "cppactor/framework.h"
+#include "cppactor/utility.h"
+#include "logger/logger.h"
+
+namespace cppactor
+{
+    namespace detail
+    {
+        std::atomic<uint32_t> watchdog::s_now_ms(0);
+
+        watchdog::watchdog()
+        : m_quit(false)
+        , m_threshold_ms(0)
+        , m_start_ms(0)
+        , m_stalls(0)
+        {
+        }
+
+        watchdog::~watchdog()
+        {
+            stop();
+        }
+
+        uint32_t watchdog::clock_ms()
+        {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch());
+            return static_cast<uint32_t>(ms.count());
+        }
+
+        void watchdog::start(int threshold_ms, callback report)
+        {
+            stop();
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_quit = false;
+            m_threshold_ms = std::max(threshold_ms, 1);
+            m_report = std::move(report);
+            m_start_ms = clock_ms();
+            s_now_ms.store(m_start_ms, std::memory_order_relaxed);
+            m_thread = std::thread([this] {run();});
+        }
+
+        void watchdog::stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mtx);
+                if (!m_thread.joinable())
+                    return;
+                m_quit = true;
+                m_cv.notify_all();
+            }
+            m_thread.join();
+        }
+
+        void watchdog::run()
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            std::chrono::milliseconds period(std::max(m_threshold_ms / 4, 1));
+            while (!m_quit)
+            {
+                m_cv.wait_for(lock, period);
+                if (m_quit)
+                    break;
+                uint32_t now_ms = clock_ms();
+                s_now_ms.store(now_ms, std::memory_order_relaxed);
+                lock.unlock();
+                check(now_ms);
+                lock.lock();
+            }
+        }
+
+        void watchdog::check(uint32_t now_ms)
+        {
+            std::vector<pool_t> pools = framework::instance()->get_pools();
+            for (pool_t& p : pools)
+            {
+                if (p->get_poolid() >= static_cast<uint32_t>(POOLID_INTERNAL))
+                    continue;   // the timer and the reactor wait in their handlers
+                handler_slot *slots = p->get_handler_slots();
+                for (size_t i = 0; i < p->get_thread_count(); ++i)
+                {
+                    handler_slot& slot = slots[i];
+                    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+                    if ((seq & 1) == 0 || slot.reported == seq)
+                        continue;
+                    stalled_handler h;
+                    h.poolid = p->get_poolid();
+                    h.thread = static_cast<int>(i);
+                    h.actor_id = slot.actor_id.load(std::memory_order_relaxed);
+                    uint16_t type_id = slot.type_id.load(std::memory_order_relaxed);
+                    h.msg_id = slot.msg_id.load(std::memory_order_relaxed);
+                    uint32_t start_ms = slot.start_ms.load(std::memory_order_relaxed);
+                    h.elapsed_ms = static_cast<int>(now_ms - start_ms);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (slot.seq.load(std::memory_order_relaxed) != seq || h.elapsed_ms < m_threshold_ms)
+                        continue;   // done meanwhile, or not long enough yet
+                    if (static_cast<int32_t>(start_ms - m_start_ms) < 0)
+                        continue;   // began while stopped, how long it has run is not known
+
+                    slot.reported = seq;
+                    h.actor_type = type_id ? actor_type_name(type_id) : "";
+                    {
+                        std::lock_guard<std::mutex> lock(m_mtx);
+                        ++m_stalls;
+                        ++m_by_msg_id[h.msg_id];
+                    }
+                    if (m_report)
+                        m_report(h);
+                    else
+                        TTLOG(WARNING, 0) << "CPPACTOR | Handler running for " << h.elapsed_ms << "ms, pool " << h.poolid
+                                          << " thread " << h.thread << " actor " << h.actor_id << " (" << h.actor_type << ") msg_id " << h.msg_id;
+                }
+            }
+        }
+
+        watchdog_stats watchdog::get_stats()
+        {
+            watchdog_stats stats;
+            std::lock_guard<std::mutex> lock(m_mtx);
+            stats.stalls = m_stalls;
+            stats.by_msg_id.assign(m_by_msg_id.begin(), m_by_msg_id.end());
+            std::sort(stats.by_msg_id.begin(), stats.by_msg_id.end());
+            return stats;
+        }
+    }
+} // cppactor
@@ -4,22 +4,88 @@
 #include <map>
 #include <memory>
 #include <typeinfo>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
 #include "cppactor/framework.h"
 #include "cppactor/actor.h"
 #include "cppactor/message.h"
 #include "cppactor/utility.h"
+#include "cppactor/message_id.h"
+#include "cppactor/ask.h"
+#include "cppactor/mpmc_queue.h"
+#include "cppactor/detail/spin_locks.h"
+#include "cppactor/pipeline.h"
+#include "cppactor/journal.h"
+#include "cppactor/capture.h"
+#include "cppactor/reactor.h"
+#include "cppactor/file_io.h"
+#include "cppactor/shm_transport.h"
+#include "cppactor/uds_transport.h"
+#include "cppactor/parallel.h"
+#include "cppactor/task_handle.h"
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#define TEST_COROUTINES
+#include "cppactor/coroutine.h"
+#endif
 
-enum Messages
+// Heap allocations made by the calling thread, counted by the replacement
+// operator new below as in the bench
+namespace
 {
-    MESSAGE_START_PING
-    , MESSAGE_PING
-    , MESSAGE_PONG
-    , MESSAGE_TEST
-};
+    thread_local uint64_t t_allocations = 0;
+}
+
+void *operator new(size_t n)
+{
+    ++t_allocations;
+    if (void *p = malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"     // new is malloc above
+#endif
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+struct StartPingMessage;
+struct Ping;
+struct Pong;
+struct TestMessage;
+typedef cppactor::message_list<1, StartPingMessage, Ping, Pong, TestMessage> test_messages;
+CPPACTOR_MESSAGE_BLOCK(test_messages)
 
 struct StartPingMessage : public cppactor::message
 {
-    enum {msg_id=MESSAGE_START_PING};
+    enum {msg_id=test_messages::id<StartPingMessage>()};
 
     StartPingMessage(cppactor::actor_iptr pingto_, const std::string& pingmsg_)
     :cppactor::message(msg_id)
@@ -33,7 +99,7 @@ struct StartPingMessage : public cppactor::message
 
 struct Ping : public cppactor::message
 {
-    enum {msg_id=MESSAGE_PING};
+    enum {msg_id=test_messages::id<Ping>()};
 
     Ping(const std::string& s, cppactor::actor_iptr& replyto)
     :cppactor::message(msg_id, replyto)
@@ -45,7 +111,7 @@ struct Ping : public cppactor::message
 
 struct Pong : public cppactor::message
 {
-    enum {msg_id=MESSAGE_PONG};
+    enum {msg_id=test_messages::id<Pong>()};
 
     Pong(const std::string& s)
     :cppactor::message(msg_id)
@@ -57,7 +123,7 @@ struct Pong : public cppactor::message
 
 struct TestMessage: public cppactor::message
 {
-    enum {msg_id=MESSAGE_TEST};
+    enum {msg_id=test_messages::id<TestMessage>()};
     TestMessage(int n_,  const std::string& s)
     :cppactor::message(msg_id)
     , n(n_)
@@ -176,94 +242,2299 @@ public:
     std::string m_name;
 };
 
+// An actor with no state of its own, for measuring the framework's cost per actor
+class EmptyActor : public cppactor::actor
+{
+public:
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to) {}
+};
+
 enum POOLIDS
 {
     POOLID_INVALID = 0
     , POOLID_QUICK = 1
     , POOLID_LONGRUNNING = 2
+    , POOLID_FOOTPRINT = 3
+    , POOLID_TESTS = 4
+    , POOLID_COROUTINES = 5
+    , POOLID_DEADLINE = 6
 };
 
 /*************************************
- * Run some tests
- * We create two pools, one for processing actors that handle messages quickly(Actor1, Actor2), another pool
- * for long running actors that remain blocked for long times (to simulate web requests)
- *
- * This demonstrates how to send a message to a particular actor, as well has having the framework pick the actor
- * to peform the work.
+ * Helpers of the tests below
  */
+struct Tick;
+struct Question;
+struct Answer;
+struct Deposit;
+struct ShmOrder;
+typedef cppactor::message_list<2, Tick, Question, Answer, Deposit, ShmOrder> unit_messages;
+CPPACTOR_MESSAGE_BLOCK(unit_messages)
 
-void foo(int)
+struct Tick : public cppactor::message
 {
-    std::cout << "foo called" << std::endl;
+    enum {msg_id = unit_messages::id<Tick>()};
+    Tick(int n_ = 0)
+    :cppactor::message(msg_id)
+    , n(n_)
+    {}
+
+    int n;
+};
+
+struct Question : public cppactor::message
+{
+    enum {msg_id = unit_messages::id<Question>()};
+    Question(int n_)
+    :cppactor::message(msg_id)
+    , n(n_)
+    {}
+
+    int n;
+};
+
+struct Answer : public cppactor::message
+{
+    enum {msg_id = unit_messages::id<Answer>()};
+    Answer(int n_)
+    :cppactor::message(msg_id)
+    , n(n_)
+    {}
+
+    int n;
+};
+
+// A journaled message
+struct Deposit : public cppactor::message
+{
+    enum {msg_id = unit_messages::id<Deposit>()};
+    Deposit(int64_t amount_ = 0)
+    :cppactor::message(msg_id)
+    , amount(amount_)
+    {}
+
+    void journal_save(cppactor::journal_writer& out) const
+    {
+        out.put(amount);
+    }
+
+    static Deposit *journal_load(cppactor::journal_reader& in)
+    {
+        Deposit *d = new Deposit();
+        if (!in.get(d->amount))
+        {
+            delete d;
+            return nullptr;
+        }
+        return d;
+    }
+
+    int64_t amount;
+};
+
+// Crosses processes through the shared memory transport
+struct ShmOrder : public cppactor::message
+{
+    enum {msg_id = unit_messages::id<ShmOrder>()};
+    struct layout
+    {
+        int64_t seq;
+        int64_t sent_ns;
+    };
+    typedef layout shm_layout;
+
+    ShmOrder(int64_t seq_, int64_t sent_ns_)
+    :cppactor::message(msg_id)
+    , seq(seq_)
+    , sent_ns(sent_ns_)
+    {}
+
+    void shm_save(shm_layout& out) const
+    {
+        out.seq = seq;
+        out.sent_ns = sent_ns;
+    }
+
+    static ShmOrder *shm_load(const shm_layout& in)
+    {
+        return new ShmOrder(in.seq, in.sent_ns);
+    }
+
+    int64_t seq;
+    int64_t sent_ns;
+};
+
+// Records the Ticks it is sent
+class CountingActor : public cppactor::actor
+{
+public:
+    CountingActor()
+    : count(0)
+    {}
+
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        seen.push_back(msg->n);
+        ++count;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    std::vector<int> get_seen()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return seen;
+    }
+
+    std::atomic<int> count;
+    std::mutex mtx;
+    std::vector<int> seen;
+};
+
+// Answers a Question with twice its n, or keeps it until answer_held() while holding
+class Responder : public cppactor::actor
+{
+public:
+    Responder()
+    : holding(false)
+    , asked(0)
+    , answered(0)
+    {}
+
+    void on_message(std::unique_ptr<Question>& msg, cppactor::actor_ref& reply_to)
+    {
+        ++asked;
+        if (holding)
+        {
+            held.push_back(std::move(msg));
+            return;
+        }
+        cppactor::reply(*msg, new Answer(msg->n * 2));
+        ++answered;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Question>::on_message(this, msg, reply_to);
+    }
+
+    void answer_held()
+    {
+        enqueue([this](cppactor::actor_iptr) {
+            for (auto& q : held)
+                cppactor::reply(*q, new Answer(q->n * 2));
+            answered += held.size();
+            held.clear();
+        });
+    }
+
+    std::atomic<bool> holding;
+    std::atomic<int> asked;
+    std::atomic<int> answered;
+    std::vector<std::unique_ptr<Question> > held;
+};
+
+bool check(bool ok, const char *what)
+{
+    if (!ok)
+        std::cout << "FAILED: " << what << std::endl;
+    return ok;
 }
 
-int main(int argc, char *argv[])
+// Runs test() in a child process, for the tests that need a framework of
+// their own. Call before the parent creates its framework and threads.
+bool run_forked(bool (*test)(), const char *what)
 {
-    // Create the framework
-    cppactor::framework framework;
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        bool ok = test();
+        std::cout.flush();
+        _exit(ok ? 0 : 1);
+    }
+    int status = 0;
+    return check(pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0, what);
+}
 
-    // Create two thread pools
-    // The template arguments define the types of actors this pool will process, each pool requires
-    // a application defined pool id, and the number of threads to create
-    cppactor::create_pool<Actor1, Actor2>(POOLID_QUICK, 3);
-    cppactor::create_pool<LongRunningActor>(POOLID_LONGRUNNING, 3);
+// Polls done() until it is true, for at most timeout_ms
+template <typename F>
+bool wait_until(F done, int timeout_ms = 5000)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!done())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
 
-    std::vector<cppactor::actor_iptr> longrunningActors;
-    // Create our actors
-    // The create_actor<>() function requires the type of actor to create, and the pool id this actor will be 
-    // associated with
-    cppactor::instrusive_ptr<Actor1> a1 = cppactor::create_actor<Actor1>(POOLID_QUICK);
-    cppactor::instrusive_ptr<Actor2> a2 = cppactor::create_actor<Actor2>(POOLID_QUICK);
-    cppactor::instrusive_ptr<LongRunningActor> l1 = cppactor::create_actor<LongRunningActor>(POOLID_LONGRUNNING, "lra 1");
-    cppactor::instrusive_ptr<LongRunningActor> l2 = cppactor::create_actor<LongRunningActor>(POOLID_LONGRUNNING, "lra 2");
+/*************************************
+ * Footprint regression test
+ * The actor base class, and the resident memory per actor for a million idle
+ * actors made by create_actors(), including the framework's bookkeeping.
+ */
+#ifndef CPPACTOR_SPLIT_ACTOR_LINES
+static_assert(sizeof(cppactor::actor) <= 72, "the actor base class has grown");
+#endif
 
-    longrunningActors.push_back(l1);
-    longrunningActors.push_back(l2);
+size_t resident_bytes()
+{
+    size_t pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
 
-    a1->enqueue([=](cppactor::actor_iptr a) {std::cout << "Function object called" << std::endl;});
+bool test_footprint()
+{
+    const size_t ACTORS = 1000000;
+    const size_t MAX_BYTES_PER_ACTOR = 192;
 
-    // Start a timer
-    int tid = framework.set_timer(5000, true, [=](int timer_id) {
-        std::cout << "on_timer" << std::endl;
+    size_t before = resident_bytes();
+    std::vector<cppactor::instrusive_ptr<EmptyActor> > actors = cppactor::create_actors<EmptyActor>(POOLID_FOOTPRINT, ACTORS);
+    size_t per_actor = (resident_bytes() - before) / ACTORS;
+    std::cout << "Footprint: sizeof(actor) " << sizeof(cppactor::actor) << ", " << per_actor << " resident bytes per actor" << std::endl;
+
+    for (auto& a : actors)
+        cppactor::framework::instance()->stop_actor(a);
+    if (per_actor > MAX_BYTES_PER_ACTOR)
+    {
+        std::cout << "Footprint: more than " << MAX_BYTES_PER_ACTOR << " bytes per actor" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*************************************
+ * find_any(), broadcast() and broadcast_call() over a map of actors
+ */
+bool test_map_containers()
+{
+    std::map<int, cppactor::instrusive_ptr<CountingActor> > actors;
+    for (int i = 0; i < 3; ++i)
+        actors[i] = cppactor::create_actor<CountingActor>(POOLID_TESTS);
+
+    cppactor::find_any(actors)->enqueue(new Tick(1));
+    cppactor::find_any<CountingActor>(actors)->enqueue(new Tick(2));
+    cppactor::broadcast<Tick>(actors, 3);
+    std::atomic<int> calls(0);
+    cppactor::broadcast_call(actors, [&calls](cppactor::actor_iptr) {++calls;});
+
+    bool ok = check(wait_until([&]() {
+        int n = 0;
+        for (auto& it : actors)
+            n += it.second->count;
+        return n == 5 && calls == 3;
+    }), "map containers: every actor gets the broadcasts");
+
+    for (auto& it : actors)
+        cppactor::framework::instance()->stop_actor(it.second);
+    return ok;
+}
+
+/*************************************
+ * ask<>(), a reply runs the continuation, so does a timeout with no reply,
+ * and a reply arriving after the timeout is dropped
+ */
+struct ask_results
+{
+    std::atomic<int> replies{0};
+    std::atomic<int> timeouts{0};
+    std::atomic<int> value{0};
+};
+
+void ask_question(cppactor::instrusive_ptr<CountingActor> asker, const cppactor::actor_iptr& target, int n, int timeout_ms, ask_results *r)
+{
+    cppactor::actor_ref to = target->get_ref();
+    asker->enqueue([=](cppactor::actor_iptr) {
+        cppactor::ask<Answer>(to, new Question(n), timeout_ms, [r](std::unique_ptr<Answer>& answer) {
+            if (answer)
+            {
+                r->value = answer->n;
+                ++r->replies;
+            }
+            else
+                ++r->timeouts;
+        });
     });
+}
 
-    std::this_thread::sleep_for(std::chrono::seconds(20));
-    std::cout << "Canceling timer" << std::endl;
-    framework.cancel_timer(tid);
-    std::this_thread::sleep_for(std::chrono::seconds(30));
+bool test_ask()
+{
+    cppactor::framework *fw = cppactor::framework::instance();
+    cppactor::instrusive_ptr<CountingActor> asker = cppactor::create_actor<CountingActor>(POOLID_TESTS);
+    cppactor::instrusive_ptr<Responder> responder = cppactor::create_actor<Responder>(POOLID_TESTS);
+    ask_results r;
 
-    // have actor1 ping actor2
-    a1->StartPing(a2, "Ping msg");
+    ask_question(asker, responder, 21, 1000, &r);
+    bool ok = check(wait_until([&]() {return r.replies == 1;}) && r.value == 42 && r.timeouts == 0, "ask: the reply runs the continuation");
 
-    // Send a message to a particular LongRunningActor using the enqueue interface
-    l1->enqueue(new TestMessage(5, "Wait 5 sec, I chose actor"));
+    responder->holding = true;
+    ask_question(asker, responder, 5, 20, &r);
+    ok = check(wait_until([&]() {return r.timeouts == 1;}) && r.replies == 1, "ask: no reply runs the continuation on timeout") && ok;
 
-    // Have the framework pick an actor (based on queue length)
-    cppactor::find_any(longrunningActors)->enqueue(new TestMessage(5, "Wait 5 sec, framework chose actor"));
+    uint64_t unhandled = fw->get_dead_letter_stats().by_reason[cppactor::DEAD_LETTER_UNHANDLED];
+    responder->answer_held();
+    ok = check(wait_until([&]() {return responder->answered == 2;}), "ask: the held question is answered") && ok;
+    std::atomic<int> in_flight(-1);
+    asker->enqueue([&in_flight](cppactor::actor_iptr a) {in_flight = a->get_asks().in_flight();});
+    ok = check(wait_until([&]() {return in_flight != -1;}), "ask: the asker runs") && ok;
+    ok = check(r.replies == 1 && r.timeouts == 1 && r.value == 42 && in_flight == 0 && asker->count == 0
+            && fw->get_dead_letter_stats().by_reason[cppactor::DEAD_LETTER_UNHANDLED] == unhandled,
+        "ask: a reply after the timeout is dropped") && ok;
 
-    // Send a message to a particular LongRunningActor using an actor interface
-    l1->Test(5, "Wait 5 sec, I chose actor interface");
+    fw->stop_actor(asker);
+    fw->stop_actor(responder);
+    return ok;
+}
 
-    // Have the framework pick an actor (based on queue length), using actor's interface
-    cppactor::find_any<LongRunningActor>(longrunningActors)->Test(5, "Wait 5 sec, framework chose actor interface");
-    
-    // Broadcast to actors
-    cppactor::broadcast<TestMessage>(longrunningActors, 5, "Wait 5 sec, broadcast");
+/*************************************
+ * detail/spin_locks.h, each lock keeps a plain counter consistent under
+ * contention through SpinLockMonitor, nested mcs locks are released in
+ * reverse order, and spin_lock_stats counts a waiter as contended
+ */
+struct ttas_test_tag {};
+struct ticket_test_tag {};
+struct mcs_test_tag {};
 
-    std::this_thread::sleep_for(std::chrono::seconds(5));
+template <typename Lock, typename Tag>
+bool test_spin_lock(const char *what)
+{
+    const int THREADS = 4, PER_THREAD = 20000;
+    typedef cppactor::detail::spin_lock_stats<Tag> stats;
+    stats::counters().reset();
+    Lock lock;
+    uint64_t counter = 0;
+    std::atomic<int> inside(0);
+    std::atomic<bool> overlapped(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t)
+        threads.emplace_back([&]() {
+            for (int i = 0; i < PER_THREAD; ++i)
+            {
+                miscutils::SpinLockMonitor<Lock> monitor(lock);
+                if (inside.fetch_add(1, std::memory_order_relaxed) != 0)
+                    overlapped = true;
+                ++counter;
+                inside.fetch_sub(1, std::memory_order_relaxed);
+            }
+        });
+    for (auto& t : threads)
+        t.join();
+    bool ok = check(counter == uint64_t(THREADS) * PER_THREAD && !overlapped && !lock.is_locked(), what);
+    ok = check(stats::counters().acquisitions == uint64_t(THREADS) * PER_THREAD
+               && stats::counters().contended <= stats::counters().acquisitions, "spin locks: every acquisition is counted") && ok;
 
-    // Test actor stop functionality
-       // pump a bunch of messages
-    std::cout << "Test actor stop" << std::endl;
-    for (int i = 0; i < 1000; i++)
+    // a waiter that has to spin is counted as contended, with its spin time
+    stats::counters().reset();
+    lock.lock();
+    std::atomic<bool> waiting(false);
+    std::thread waiter([&]() {
+        waiting = true;
+        miscutils::SpinLockMonitor<Lock> monitor(lock);
+    });
+    wait_until([&] {return waiting.load();});
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    lock.unlock();
+    waiter.join();
+    return check(stats::counters().acquisitions == 2 && stats::counters().contended == 1 && stats::counters().spin_cycles > 0,
+        "spin locks: a waiter is counted as contended") && ok;
+}
+
+bool test_spin_locks()
+{
+    using namespace cppactor::detail;
+    bool ok = test_spin_lock<ttas_spin_lock<spin_lock_stats<ttas_test_tag> >, ttas_test_tag>("spin locks: ttas_spin_lock excludes");
+    ok = test_spin_lock<ticket_spin_lock<spin_lock_stats<ticket_test_tag> >, ticket_test_tag>("spin locks: ticket_spin_lock excludes") && ok;
+    ok = test_spin_lock<mcs_spin_lock<spin_lock_stats<mcs_test_tag> >, mcs_test_tag>("spin locks: mcs_spin_lock excludes") && ok;
+
+    // Two threads take three mcs locks nested, each thread's queue nodes
+    // come off its node stack in reverse order
+    const int PER_THREAD = 20000;
+    mcs_spin_lock<> outer, middle, inner;
+    uint64_t counter = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; ++t)
+        threads.emplace_back([&]() {
+            for (int i = 0; i < PER_THREAD; ++i)
+            {
+                miscutils::SpinLockMonitor<mcs_spin_lock<> > a(outer);
+                miscutils::SpinLockMonitor<mcs_spin_lock<> > b(middle);
+                {
+                    miscutils::SpinLockMonitor<mcs_spin_lock<> > c(inner);
+                    ++counter;
+                }
+                ++counter;
+            }
+        });
+    for (auto& t : threads)
+        t.join();
+    return check(counter == 2 * 2 * PER_THREAD && !outer.is_locked() && !middle.is_locked() && !inner.is_locked(),
+        "spin locks: nested mcs_spin_lock's are released in reverse order") && ok;
+}
+
+/*************************************
+ * mpmc_queue.h, every element is popped exactly once while segments of the
+ * unbounded queue are recycled, and a closed bounded queue refuses pushes
+ * but drains
+ */
+bool test_unbounded_mpmc(size_t segment_size)
+{
+    const int PRODUCERS = 2, CONSUMERS = 2, PER_PRODUCER = 20000, TOTAL = PRODUCERS * PER_PRODUCER;
+    cppactor::unbounded_mpmc_queue<std::unique_ptr<int> > q(segment_size);
+    std::vector<std::atomic<int> > seen(TOTAL);
+    std::atomic<int> popped(0);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < PRODUCERS; ++p)
+        threads.emplace_back([&, p]() {
+            for (int i = 0; i < PER_PRODUCER; ++i)
+                q.push(std::unique_ptr<int>(new int(p * PER_PRODUCER + i)));
+        });
+    for (int c = 0; c < CONSUMERS; ++c)
+        threads.emplace_back([&]() {
+            std::unique_ptr<int> v;
+            while (popped < TOTAL)
+            {
+                if (q.try_pop(v))
+                {
+                    ++seen[*v];
+                    ++popped;
+                }
+                else
+                    std::this_thread::yield();
+            }
+        });
+    for (auto& t : threads)
+        t.join();
+
+    bool once = true;
+    for (auto& n : seen)
+        once = once && n == 1;
+    std::unique_ptr<int> v;
+    bool ok = check(once && !q.try_pop(v), "mpmc: every element is popped exactly once");
+
+    // one element at a time, the drained segments are reused rather than allocated
+    size_t allocated = q.segments_allocated();
+    for (int i = 0; i < 1000; ++i)
     {
-        std::cout << "Enqueue " << i << ":" << "test" << std::endl;
-        a1->enqueue(new TestMessage(i, "test"));
+        q.push(std::unique_ptr<int>(new int(i)));
+        ok = q.try_pop(v) && *v == i && ok;
     }
-    //framework.stop_actor(a1);
+    return check(ok && q.segments_allocated() <= allocated + 2, "mpmc: segments are recycled") && ok;
+}
 
-    std::this_thread::sleep_for(std::chrono::seconds(10));
-    framework.shutdown();
+bool test_mpmc()
+{
+    bool ok = test_unbounded_mpmc(2);
+    ok = test_unbounded_mpmc(64) && ok;
+
+    cppactor::bounded_mpmc_queue<std::unique_ptr<int> > b(3);
+    int pushed = 0;
+    while (b.try_push(std::unique_ptr<int>(new int(pushed))))
+        ++pushed;
+    ok = check(b.capacity() == 4 && pushed == 4, "mpmc: the bounded queue holds its capacity") && ok;
+
+    std::unique_ptr<int> v;
+    ok = check(b.try_pop(v) && *v == 0, "mpmc: the bounded queue pops in order") && ok;
+    ok = check(b.close() == 4 && !b.try_push(std::unique_ptr<int>(new int(4))), "mpmc: a closed queue refuses pushes") && ok;
+    bool drained = true;
+    for (int i = 1; i < 4; ++i)
+        drained = b.try_pop(v) && *v == i && drained;
+    ok = check(drained && !b.try_pop(v) && !b.try_push(std::unique_ptr<int>(new int(4))), "mpmc: a closed queue drains and stays closed") && ok;
+
+    b.reopen();
+    drained = true;
+    for (int i = 4; i < 8; ++i)
+        drained = b.try_push(std::unique_ptr<int>(new int(i))) && drained;
+    for (int i = 4; i < 8; ++i)
+        drained = b.try_pop(v) && *v == i && drained;
+    return check(drained && !b.try_pop(v), "mpmc: a reopened queue carries on") && ok;
+}
+
+#ifdef TEST_COROUTINES
+/*************************************
+ * Coroutine handlers, Tick 0 waits for an answer and Tick 1 for a delay,
+ * the Ticks behind them are held meanwhile and handled in order after
+ */
+class CoroActor : public cppactor::actor
+{
+public:
+    CoroActor()
+    : answer(0)
+    , overlaps(0)
+    , busy(false)
+    {}
+
+    cppactor::task on_message(std::unique_ptr<Tick> msg, cppactor::actor_ref reply_to)
+    {
+        if (busy)
+            ++overlaps;
+        busy = true;
+        record(started, msg->n);
+        if (msg->n == 0)
+        {
+            std::unique_ptr<Answer> a = co_await cppactor::ask<Answer>(responder, new Question(21), 5000);
+            answer = a ? a->n : -1;
+        }
+        else if (msg->n == 1)
+            co_await cppactor::delay(20);
+        record(finished, msg->n);
+        busy = false;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    void record(std::vector<int>& v, int n)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        v.push_back(n);
+    }
+
+    std::vector<int> get(const std::vector<int>& v)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return v;
+    }
+
+    cppactor::actor_ref responder;
+    std::atomic<int> answer;
+    std::atomic<int> overlaps;
+    bool busy;
+    std::mutex mtx;
+    std::vector<int> started;
+    std::vector<int> finished;
+};
+
+bool test_coroutines()
+{
+    const int TICKS = 10;
+    cppactor::instrusive_ptr<Responder> responder = cppactor::create_actor<Responder>(POOLID_TESTS);
+    cppactor::instrusive_ptr<CoroActor> coro = cppactor::create_actor<CoroActor>(POOLID_COROUTINES);
+    coro->responder = responder->get_ref();
+    responder->holding = true;
+
+    for (int i = 0; i < TICKS; ++i)
+        coro->enqueue(new Tick(i));
+
+    bool ok = check(wait_until([&]() {return responder->asked == 1;}), "coroutines: the handler asks");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ok = check(coro->get(coro->started) == std::vector<int>{0} && coro->get(coro->finished).empty(),
+        "coroutines: messages are held while the handler is suspended") && ok;
+
+    responder->answer_held();
+    std::vector<int> expected;
+    for (int i = 0; i < TICKS; ++i)
+        expected.push_back(i);
+    ok = check(wait_until([&]() {return coro->get(coro->finished).size() == TICKS;}), "coroutines: the handlers resume") && ok;
+    ok = check(coro->answer == 42, "coroutines: ask resumes with the answer") && ok;
+    ok = check(coro->get(coro->started) == expected && coro->get(coro->finished) == expected && coro->overlaps == 0,
+        "coroutines: held messages are handled in order") && ok;
+
+    cppactor::framework::instance()->stop_actor(coro);
+    cppactor::framework::instance()->stop_actor(responder);
+    return ok;
+}
+#endif
+
+/*************************************
+ * Hibernation, idle actors hibernate and the next message wakes them up
+ * with their state rebuilt before it is handled
+ */
+class HibernatingActor : public cppactor::actor
+{
+public:
+    enum {STATE_BYTES = 1000};
+
+    HibernatingActor()
+    : state(STATE_BYTES)
+    , handled(0)
+    , hibernations(0)
+    , wakeups(0)
+    , without_state(0)
+    {}
+
+    void on_start()
+    {
+        hibernate_after(50);
+    }
+
+    size_t on_hibernate()
+    {
+        std::vector<char>().swap(state);
+        ++hibernations;
+        return STATE_BYTES;
+    }
+
+    void on_wake()
+    {
+        state.resize(STATE_BYTES);
+        ++wakeups;
+    }
+
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        if (state.empty())
+            ++without_state;
+        ++handled;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    std::vector<char> state;
+    std::atomic<int> handled;
+    std::atomic<int> hibernations;
+    std::atomic<int> wakeups;
+    std::atomic<int> without_state;
+};
+
+bool test_hibernation()
+{
+    const int ACTORS = 10;
+    cppactor::framework *fw = cppactor::framework::instance();
+    cppactor::hibernation_stats before = fw->get_hibernation_stats();
+    std::vector<cppactor::instrusive_ptr<HibernatingActor> > actors;
+    for (int i = 0; i < ACTORS; ++i)
+        actors.push_back(cppactor::create_actor<HibernatingActor>(POOLID_TESTS));
+    cppactor::broadcast<Tick>(actors, 1);
+
+    bool ok = check(wait_until([&]() {
+        cppactor::hibernation_stats s = fw->get_hibernation_stats();
+        return s.hibernations >= before.hibernations + ACTORS && s.hibernated >= before.hibernated + ACTORS;
+    }), "hibernation: idle actors hibernate");
+    cppactor::hibernation_stats idle = fw->get_hibernation_stats();
+    ok = check(idle.bytes_reclaimed >= before.bytes_reclaimed + ACTORS * HibernatingActor::STATE_BYTES,
+        "hibernation: on_hibernate() bytes are reported") && ok;
+    ok = check(cppactor::find_any(actors) == actors[0].get(), "hibernation: find_any() reads the freed mailboxes as empty") && ok;
+
+    actors[0]->enqueue(new Tick(2));
+    ok = check(wait_until([&]() {return actors[0]->handled == 2;}), "hibernation: a message wakes the actor") && ok;
+    cppactor::hibernation_stats woken = fw->get_hibernation_stats();
+    ok = check(actors[0]->wakeups == 1 && woken.wakeups == idle.wakeups + 1,
+        "hibernation: the wakeup is counted") && ok;
+
+    int without_state = 0;
+    for (auto& a : actors)
+        without_state += a->without_state;
+    ok = check(without_state == 0, "hibernation: messages are handled with the state rebuilt") && ok;
+
+    for (auto& a : actors)
+        fw->stop_actor(a);
+    return ok;
+}
+
+/*************************************
+ * create_actors(), the actors are built by the factory, registered with
+ * consecutive ids and started, on the pool or on the calling thread
+ */
+class StartedActor : public cppactor::actor
+{
+public:
+    explicit StartedActor(int index_ = -1)
+    : index(index_)
+    , starts(0)
+    , ticks(0)
+    {}
+
+    void on_start()
+    {
+        ++starts;
+        started_on = std::this_thread::get_id();
+    }
+
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        ++ticks;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    int index;
+    int starts;
+    std::thread::id started_on;
+    std::atomic<int> ticks;
+};
+
+bool test_create_actors(bool start_on_pool)
+{
+    const size_t ACTORS = 1000;
+    cppactor::framework *fw = cppactor::framework::instance();
+    std::vector<cppactor::instrusive_ptr<StartedActor> > actors = cppactor::create_actors<StartedActor>(POOLID_TESTS, ACTORS,
+        [](size_t i) {return StartedActor(static_cast<int>(i));}, start_on_pool);
+
+    bool built = actors.size() == ACTORS;
+    bool started = true;
+    for (size_t i = 0; built && i < ACTORS; ++i)
+    {
+        built = actors[i]->index == static_cast<int>(i) && actors[i]->get_actorid() == actors[0]->get_actorid() + i
+            && fw->get_actor(actors[i]->get_actorid()) == actors[i];
+        started = started && actors[i]->starts == 1 && (actors[i]->started_on == std::this_thread::get_id()) != start_on_pool;
+    }
+    bool ok = check(built, "create_actors: the factory's actors are registered with consecutive ids");
+    ok = check(started, start_on_pool ? "create_actors: on_start() runs once on the pool" : "create_actors: on_start() runs once on the caller") && ok;
+
+    cppactor::broadcast<Tick>(actors, 1);
+    ok = check(wait_until([&]() {
+        for (auto& a : actors)
+        {
+            if (a->ticks != 1)
+                return false;
+        }
+        return true;
+    }), "create_actors: the actors handle messages") && ok;
+
+    for (auto& a : actors)
+        fw->stop_actor(a);
+    return ok;
+}
+
+/*************************************
+ * Pipelines, items go through every stage in order while the small rings
+ * between the stages fill up behind a slow stage
+ */
+bool test_pipeline()
+{
+    const int ITEMS = 2000;
+    cppactor::instrusive_ptr<CountingActor> target = cppactor::create_actor<CountingActor>(POOLID_TESTS);
+    std::vector<int> sunk;
+    int full = 0;
+    {
+        cppactor::pipeline<int> p = cppactor::make_pipeline<int>(4)
+            .stage([](int&& n) {return n + 1;})
+            .stage([](int&& n) {
+                if (n % 50 == 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return n * 2;
+            })
+            .fuse([&sunk](int&& n) {
+                sunk.push_back(n);
+                return n;
+            })
+            .to_actor(target, [](int&& n) {return new Tick(n);})
+            .build();
+        for (int i = 0; i < ITEMS; ++i)
+        {
+            while (!p.try_push(i))
+            {
+                ++full;
+                std::this_thread::yield();
+            }
+        }
+        p.stop();
+    }
+
+    std::vector<int> expected;
+    for (int i = 0; i < ITEMS; ++i)
+        expected.push_back((i + 1) * 2);
+    bool ok = check(full > 0, "pipeline: the slow stage holds up the producer");
+    ok = check(sunk == expected, "pipeline: every stage sees the items in order") && ok;
+    ok = check(wait_until([&]() {return target->count == ITEMS;}) && target->get_seen() == expected,
+        "pipeline: the actor is sent the items in order") && ok;
+
+    cppactor::framework::instance()->stop_actor(target);
+    return ok;
+}
+
+/*************************************
+ * Journal, an actor's messages are replayed into a fresh actor, a
+ * checkpoint truncates the older segments and replays from the snapshot,
+ * and a damaged last record is counted as torn and not delivered
+ */
+class AccountActor : public cppactor::actor
+{
+public:
+    AccountActor()
+    : balance(0)
+    , deposits(0)
+    {}
+
+    void on_message(std::unique_ptr<Deposit>& msg, cppactor::actor_ref& reply_to)
+    {
+        balance += msg->amount;
+        ++deposits;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Deposit>::on_message(this, msg, reply_to);
+    }
+
+    void on_journal_snapshot(cppactor::journal_writer& out)
+    {
+        out.put(static_cast<int64_t>(balance));
+        out.put(static_cast<int>(deposits));
+    }
+
+    void on_journal_restore(cppactor::journal_reader& in)
+    {
+        int64_t b = 0;
+        int d = 0;
+        in.get(b);
+        in.get(d);
+        balance = b;
+        deposits = d;
+    }
+
+    std::atomic<int64_t> balance;
+    std::atomic<int> deposits;
+};
+
+void remove_directory(const std::string& path)
+{
+    if (DIR *dir = opendir(path.c_str()))
+    {
+        while (struct dirent *e = readdir(dir))
+        {
+            if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+                unlink((path + "/" + e->d_name).c_str());
+        }
+        closedir(dir);
+    }
+    rmdir(path.c_str());
+}
+
+// Deposits 1..count into a new actor journaled under key 7, then stops it
+void journal_deposits(cppactor::journal& j, int count)
+{
+    cppactor::instrusive_ptr<AccountActor> a = cppactor::create_actor<AccountActor>(POOLID_TESTS);
+    a->journal_to(j, 7);
+    for (int i = 1; i <= count; ++i)
+        a->enqueue(new Deposit(i));
+    wait_until([&]() {return a->deposits == count;});
+    j.sync();
+    cppactor::framework::instance()->stop_actor(a);
+}
+
+// Replays the journal into a new actor
+cppactor::journal_replay_stats journal_replay(cppactor::journal& j, cppactor::instrusive_ptr<AccountActor>& a, int deposits)
+{
+    a = cppactor::create_actor<AccountActor>(POOLID_TESTS);
+    cppactor::instrusive_ptr<AccountActor> target = a;
+    cppactor::journal_replay_stats stats = j.replay([target](uint64_t key) -> cppactor::actor_iptr {
+        return key == 7 ? target : nullptr;
+    });
+    wait_until([&]() {return a->deposits == deposits;});
+    return stats;
+}
+
+bool test_journal()
+{
+    cppactor::framework *fw = cppactor::framework::instance();
+    cppactor::register_journal_message<Deposit>();
+    char dir_template[] = "/tmp/cppactor_journal.XXXXXX";
+    std::string dir = mkdtemp(dir_template);
+    char torn_template[] = "/tmp/cppactor_journal.XXXXXX";
+    cppactor::journal_options options;
+    options.segment_size = 4096;
+    bool ok = true;
+
+    // replay into a fresh actor
+    {
+        cppactor::journal j(dir, "accounts", options);
+        journal_deposits(j, 300);
+    }
+    {
+        cppactor::journal j(dir, "accounts", options);
+        cppactor::instrusive_ptr<AccountActor> a;
+        cppactor::journal_replay_stats stats = journal_replay(j, a, 300);
+        ok = check(stats.segments > 1 && stats.messages == 300 && stats.snapshots == 0 && stats.torn == 0,
+            "journal: every message is replayed") && ok;
+        ok = check(a->deposits == 300 && a->balance == 45150, "journal: the replayed actor has the state") && ok;
+
+        // a checkpoint snapshots the actor and deletes the segments before it
+        a->journal_to(j, 7);
+        for (int i = 0; i < 10; ++i)
+            a->enqueue(new Deposit(1));
+        wait_until([&]() {return a->deposits == 310;});
+        size_t segments = j.get_segment_count();
+        j.checkpoint();
+        ok = check(wait_until([&]() {return j.get_segment_count() == 1;}) && segments > 1, "journal: a checkpoint truncates the older segments") && ok;
+        a->enqueue(new Deposit(1000));
+        wait_until([&]() {return a->deposits == 311;});
+        j.sync();
+        fw->stop_actor(a);
+    }
+    {
+        cppactor::journal j(dir, "accounts", options);
+        cppactor::instrusive_ptr<AccountActor> a;
+        cppactor::journal_replay_stats stats = journal_replay(j, a, 311);
+        ok = check(stats.snapshots == 1 && stats.messages == 1 && stats.torn == 0, "journal: replay starts from the snapshot") && ok;
+        ok = check(a->deposits == 311 && a->balance == 45150 + 10 + 1000, "journal: the actor is restored from the snapshot") && ok;
+        fw->stop_actor(a);
+    }
+    remove_directory(dir);
+
+    // a torn last record
+    dir = mkdtemp(torn_template);
+    std::string first_segment = dir + "/accounts.0000000001.log";
+    {
+        cppactor::journal j(dir, "accounts", options);
+        journal_deposits(j, 10);
+    }
+    {
+        // damage the last byte written, in the payload of the last record
+        std::vector<char> data(options.segment_size);
+        int fd = open(first_segment.c_str(), O_RDWR);
+        ssize_t n = fd >= 0 ? pread(fd, data.data(), data.size(), 0) : -1;
+        ssize_t last = n - 1;
+        while (last >= 0 && data[last] == 0)
+            --last;
+        char damaged = static_cast<char>(~data[last]);
+        ok = check(last >= 0 && pwrite(fd, &damaged, 1, last) == 1, "journal: damage the last record") && ok;
+        if (fd >= 0)
+            close(fd);
+    }
+    {
+        cppactor::journal j(dir, "accounts", options);
+        cppactor::instrusive_ptr<AccountActor> a;
+        cppactor::journal_replay_stats stats = journal_replay(j, a, 9);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ok = check(stats.torn == 1 && stats.messages == 9, "journal: a torn record is counted") && ok;
+        ok = check(a->deposits == 9 && a->balance == 45, "journal: a torn record is not delivered") && ok;
+        fw->stop_actor(a);
+    }
+    remove_directory(dir);
+    return ok;
+}
+
+/*************************************
+ * Traffic capture, the messages captured are replayed as fast as possible
+ * into new actors, which see the same sequence
+ */
+class RecordingActor : public cppactor::actor
+{
+public:
+    RecordingActor()
+    : handled(0)
+    {}
+
+    void on_message(std::unique_ptr<Deposit>& msg, cppactor::actor_ref& reply_to)
+    {
+        record(msg->msg_id, msg->amount);
+    }
+
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        record(msg->msg_id, msg->n);
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Deposit, Tick>::on_message(this, msg, reply_to);
+    }
+
+    void record(int msg_id, int64_t value)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        seen.push_back(std::make_pair(msg_id, value));
+        ++handled;
+    }
+
+    std::vector<std::pair<int, int64_t> > get_seen(int msg_id)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::vector<std::pair<int, int64_t> > v;
+        for (auto& m : seen)
+        {
+            if (m.first == msg_id)
+                v.push_back(m);
+        }
+        return v;
+    }
+
+    std::atomic<int> handled;
+    std::mutex mtx;
+    std::vector<std::pair<int, int64_t> > seen;
+};
+
+bool test_capture()
+{
+    const int MESSAGES = 1000;
+    cppactor::framework *fw = cppactor::framework::instance();
+    cppactor::register_journal_message<Deposit>();
+    char path_template[] = "/tmp/cppactor_capture.XXXXXX";
+    int fd = mkstemp(path_template);
+    close(fd);
+    std::string path = path_template;
+
+    // Deposits are registered for journaling and replayed, Ticks are recorded without a payload and skipped
+    std::vector<cppactor::instrusive_ptr<RecordingActor> > recorded;
+    int deposits = 0, ticks = 0;
+    uint64_t records = 0, dropped = 0;
+    bool capture_ok = false;
+    {
+        cppactor::traffic_capture capture(path);
+        for (int key = 0; key < 2; ++key)
+        {
+            recorded.push_back(cppactor::create_actor<RecordingActor>(POOLID_TESTS));
+            recorded.back()->capture_to(capture, key);
+        }
+        for (int i = 0; i < MESSAGES; ++i)
+        {
+            recorded[i % 2]->enqueue(new Deposit(i));
+            ++deposits;
+            if (i % 25 == 0)
+            {
+                recorded[i % 2]->enqueue(new Tick(i));
+                ++ticks;
+            }
+        }
+        wait_until([&]() {return recorded[0]->handled + recorded[1]->handled == deposits + ticks;});
+        capture.stop();
+        records = capture.get_record_count();
+        dropped = capture.get_dropped_count();
+        capture_ok = capture.ok();
+    }
+    bool ok = check(capture_ok && records == static_cast<uint64_t>(deposits + ticks) && dropped == 0, "capture: every message is recorded");
+
+    cppactor::traffic_replay replay(path);
+    ok = check(replay.ok() && replay.get_record_count() == records, "capture: the capture is read back") && ok;
+
+    std::vector<cppactor::instrusive_ptr<RecordingActor> > replayed;
+    for (int key = 0; key < 2; ++key)
+        replayed.push_back(cppactor::create_actor<RecordingActor>(POOLID_TESTS));
+    cppactor::traffic_replay_options options;
+    options.speed = 0;
+    options.latency_sample = 4;
+    cppactor::traffic_replay_stats stats = replay.run([&](uint64_t key) -> cppactor::actor_iptr {
+        return key < replayed.size() ? replayed[key] : nullptr;
+    }, options);
+    ok = check(stats.messages == static_cast<size_t>(deposits) && stats.skipped == static_cast<size_t>(ticks) && stats.drained,
+        "capture: the report counts the messages sent and skipped") && ok;
+    ok = check(stats.samples > 0 && stats.latency_max_ns >= stats.latency_p50_ns && stats.messages_per_sec > 0,
+        "capture: the report has the latencies") && ok;
+    for (int key = 0; key < 2; ++key)
+    {
+        ok = check(replayed[key]->get_seen(Deposit::msg_id) == recorded[key]->get_seen(Deposit::msg_id)
+            && replayed[key]->get_seen(Tick::msg_id).empty(), "capture: the replayed actors see the same sequence") && ok;
+    }
+
+    for (auto& a : recorded)
+        fw->stop_actor(a);
+    for (auto& a : replayed)
+        fw->stop_actor(a);
+    unlink(path.c_str());
+    return ok;
+}
+
+/*************************************
+ * A message no handler of the actor's Dispatch<> takes is a dead letter
+ * of that actor, also when it is dispatched outside its turn
+ */
+bool test_unhandled()
+{
+    cppactor::framework *fw = cppactor::framework::instance();
+    cppactor::instrusive_ptr<RecordingActor> recorder = cppactor::create_actor<RecordingActor>(POOLID_TESTS);
+    cppactor::message_uptr msg(new Answer(1));
+    cppactor::actor_ref none;
+    recorder->on_message(msg, none);
+
+    bool found = false;
+    for (const cppactor::dead_letter_count& c : fw->get_dead_letter_stats().counts)
+    {
+        if (c.reason == cppactor::DEAD_LETTER_UNHANDLED && c.msg_id == Answer::msg_id)
+            found = c.count == 1 && c.actor_type[0] != '\0';
+    }
+    fw->stop_actor(recorder);
+    return check(found, "unhandled: the dead letter is counted for the actor dispatching it");
+}
+
+/*************************************
+ * Shared memory transport between two processes. The proxy fills the
+ * small ring before the receiver exists and waits for room, then sends one
+ * more message once the receiver has gone to sleep, which must wake it
+ * rather than wait for its poll timeout. Everything arrives in order.
+ */
+int64_t steady_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class ShmTarget : public cppactor::actor
+{
+public:
+    ShmTarget()
+    : received(0)
+    , out_of_order(0)
+    , last_latency_ns(0)
+    , next(0)
+    {}
+
+    void on_message(std::unique_ptr<ShmOrder>& msg, cppactor::actor_ref& reply_to)
+    {
+        if (msg->seq != next)
+            ++out_of_order;
+        next = msg->seq + 1;
+        if (msg->sent_ns != 0)
+            last_latency_ns = steady_now_ns() - msg->sent_ns;
+        ++received;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<ShmOrder>::on_message(this, msg, reply_to);
+    }
+
+    std::atomic<int> received;
+    std::atomic<int> out_of_order;
+    std::atomic<int64_t> last_latency_ns;
+    int64_t next;
+};
+
+const int SHM_BATCH = 100;
+
+cppactor::shm_options shm_test_options()
+{
+    cppactor::shm_options options;
+    options.slot_count = 8;
+    options.spin_polls = 16;
+    options.full_timeout_ms = 5000;
+    return options;
+}
+
+// The sending process
+bool shm_send(const std::string& name)
+{
+    cppactor::framework fw;
+    cppactor::create_pool<cppactor::shm_proxy>(POOLID_TESTS, 1);
+    cppactor::register_shm_message<ShmOrder>();
+    cppactor::instrusive_ptr<cppactor::shm_proxy> proxy = cppactor::create_actor<cppactor::shm_proxy>(POOLID_TESTS, name, shm_test_options());
+    bool ok = proxy->is_connected();
+    for (int i = 0; ok && i < SHM_BATCH; ++i)
+        proxy->enqueue(new ShmOrder(i, 0));
+    ok = ok && wait_until([&]() {return proxy->get_sent_count() + proxy->get_dropped_count() == SHM_BATCH;});
+
+    // the receiver drains the ring and goes to sleep
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    proxy->enqueue(new ShmOrder(SHM_BATCH, steady_now_ns()));
+    ok = ok && wait_until([&]() {return proxy->get_sent_count() + proxy->get_dropped_count() == SHM_BATCH + 1;});
+    ok = ok && proxy->get_dropped_count() == 0;
+    fw.shutdown();
+    return ok;
+}
+
+bool test_shm()
+{
+    std::string name = "/cppactor_test." + std::to_string(getpid());
+    shm_unlink(name.c_str());
+    pid_t sender = fork();
+    if (sender == 0)
+        _exit(shm_send(name) ? 0 : 1);
+
+    // the sender fills the ring meanwhile
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    cppactor::framework fw;
+    cppactor::create_pool<ShmTarget>(POOLID_TESTS, 1);
+    cppactor::register_shm_message<ShmOrder>();
+    cppactor::instrusive_ptr<ShmTarget> target = cppactor::create_actor<ShmTarget>(POOLID_TESTS);
+    bool ok;
+    {
+        cppactor::shm_receiver receiver(name, target, shm_test_options());
+        ok = check(receiver.is_open(), "shm: the receiver opens the ring");
+        ok = check(wait_until([&]() {return target->received == SHM_BATCH;}), "shm: the proxy waits for room in a full ring") && ok;
+        ok = check(wait_until([&]() {return target->received == SHM_BATCH + 1;}) && target->last_latency_ns < 50 * 1000000LL,
+            "shm: a message wakes the sleeping receiver") && ok;
+        ok = check(target->out_of_order == 0 && receiver.get_received_count() == SHM_BATCH + 1 && receiver.get_dropped_count() == 0,
+            "shm: the messages arrive in order") && ok;
+    }
+    int status = 0;
+    ok = check(waitpid(sender, &status, 0) == sender && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        "shm: the proxy sends every message") && ok;
+    fw.shutdown();
+    return ok;
+}
+
+/*************************************
+ * A SCHEDULE_DEADLINE pool, one thread held up while actors become ready.
+ * The actor sent a deadline runs before those that were ready earlier, an
+ * actor sent one while it waits is moved up, and the deadline stats count
+ * the messages handled too late.
+ */
+class DeadlineActor : public cppactor::actor
+{
+public:
+    explicit DeadlineActor(int id_)
+    : id(id_)
+    {}
+
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        if (msg->n < 0)
+        {
+            // hold the pool's thread
+            blocked = true;
+            while (!release)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        order.push_back(id);
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    int id;
+    static std::atomic<bool> blocked;
+    static std::atomic<bool> release;
+    static std::mutex mtx;
+    static std::vector<int> order;
+};
+
+std::atomic<bool> DeadlineActor::blocked(false);
+std::atomic<bool> DeadlineActor::release(false);
+std::mutex DeadlineActor::mtx;
+std::vector<int> DeadlineActor::order;
+
+bool test_deadline_scheduling()
+{
+    const int READY = 5;
+    cppactor::framework *fw = cppactor::framework::instance();
+    cppactor::instrusive_ptr<DeadlineActor> blocker = cppactor::create_actor<DeadlineActor>(POOLID_DEADLINE, 0);
+    std::vector<cppactor::instrusive_ptr<DeadlineActor> > actors;
+    for (int i = 1; i <= READY + 2; ++i)
+        actors.push_back(cppactor::create_actor<DeadlineActor>(POOLID_DEADLINE, i));
+    blocker->enqueue(new Tick(-1));
+    bool ok = check(wait_until([&]() {return DeadlineActor::blocked.load();}), "deadline: the pool's thread is held");
+
+    // 1 to 5 become ready without a deadline, then 6 with one
+    for (int i = 0; i < READY; ++i)
+        actors[i]->enqueue(new Tick(i));
+    Tick *urgent = new Tick(READY);
+    urgent->set_deadline_after(std::chrono::seconds(10));
+    actors[READY]->enqueue(urgent);
+
+    // 7 waits behind them all, until it is sent a deadline that has passed
+    actors[READY + 1]->enqueue(new Tick(READY + 1));
+    Tick *late = new Tick(READY + 2);
+    late->set_deadline_after(std::chrono::nanoseconds(1));
+    actors[READY + 1]->enqueue(late);
+    DeadlineActor::release = true;
+
+    ok = check(wait_until([&]() {
+        std::lock_guard<std::mutex> lock(DeadlineActor::mtx);
+        return DeadlineActor::order.size() == READY + 3;
+    }), "deadline: every message is handled") && ok;
+    std::vector<int> order;
+    {
+        std::lock_guard<std::mutex> lock(DeadlineActor::mtx);
+        order = DeadlineActor::order;
+    }
+    std::vector<int> expected = {READY + 2, READY + 2, READY + 1, 1, 2, 3, 4, 5};
+    ok = check(order == expected, "deadline: the earliest deadline runs first, ahead of actors ready before it") && ok;
+
+    cppactor::deadline_stats stats = fw->get_deadline_stats(POOLID_DEADLINE);
+    ok = check(stats.handled == 2 && stats.missed == 1 && stats.max_lateness_ns > 0 && stats.promoted == 1,
+        "deadline: the stats count the deadlines missed and the actor moved up") && ok;
+    for (auto& a : actors)
+        fw->stop_actor(a);
+    fw->stop_actor(blocker);
+    return ok;
+}
+
+/*************************************
+ * The reactor reading a socket for an IO_RECEIVE actor. It reads until
+ * EAGAIN, stops at MAX_IN_FLIGHT io_data the actor has not deleted, goes
+ * on once it does and ends with an io_closed.
+ */
+class SocketActor : public cppactor::actor
+{
+public:
+    SocketActor()
+    : holding(false)
+    , bytes(0)
+    , held(0)
+    , closed(0)
+    , close_error(-1)
+    {}
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        switch (msg->msg_id)
+        {
+        case cppactor::io_data::msg_id:
+            bytes += static_cast<cppactor::io_data *>(msg.get())->size();
+            if (holding)
+            {
+                kept.push_back(std::move(msg));
+                held = kept.size();
+            }
+            break;
+        case cppactor::io_closed::msg_id:
+        {
+            cppactor::io_closed *c = static_cast<cppactor::io_closed *>(msg.get());
+            close_error = c->error;
+            close(c->fd);
+            ++closed;
+            break;
+        }
+        case Tick::msg_id:
+            // the io_data go, the reactor resumes
+            holding = false;
+            kept.clear();
+            held = 0;
+            break;
+        }
+    }
+
+    std::atomic<bool> holding;
+    std::atomic<size_t> bytes;
+    std::atomic<size_t> held;
+    std::atomic<int> closed;
+    std::atomic<int> close_error;
+    std::vector<cppactor::message_uptr> kept;
+};
+
+bool test_reactor()
+{
+    cppactor::framework *fw = cppactor::framework::instance();
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0)
+        return check(false, "reactor: socketpair");
+    cppactor::instrusive_ptr<SocketActor> session = cppactor::create_actor<SocketActor>(POOLID_TESTS);
+    cppactor::reactor_stats before = fw->get_reactor_stats();
+    fw->watch_fd(session, sv[0], cppactor::IO_RECEIVE);
+
+    // more than one read's worth, all of it arrives
+    std::vector<char> chunk(3 * cppactor::io_data::BUFFER_SIZE + 100, 'x');
+    size_t written = write(sv[1], chunk.data(), chunk.size());
+    bool ok = check(wait_until([&]() {return session->bytes == written;}), "reactor: the io_data hold everything written");
+
+    // the reactor stops reading once the actor keeps MAX_IN_FLIGHT of them
+    session->holding = true;
+    const size_t TOTAL = written + (cppactor::io_data::MAX_IN_FLIGHT + 16) * cppactor::io_data::BUFFER_SIZE;
+    std::thread writer([&]() {
+        while (written < TOTAL)
+        {
+            ssize_t n = write(sv[1], chunk.data(), std::min(chunk.size(), TOTAL - written));
+            if (n <= 0)
+                break;
+            written += n;
+        }
+    });
+    ok = check(wait_until([&]() {return session->held == cppactor::io_data::MAX_IN_FLIGHT;}), "reactor: the actor gets MAX_IN_FLIGHT io_data") && ok;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    cppactor::reactor_stats throttled = fw->get_reactor_stats();
+    ok = check(session->held == cppactor::io_data::MAX_IN_FLIGHT && session->bytes < TOTAL && throttled.throttled > before.throttled,
+        "reactor: the reactor stops reading at MAX_IN_FLIGHT") && ok;
+
+    // deleting them resumes the reads
+    session->enqueue(new Tick());
+    writer.join();
+    ok = check(written == TOTAL && wait_until([&]() {return session->bytes == TOTAL;}), "reactor: the reads resume when the io_data are deleted") && ok;
+
+    close(sv[1]);
+    ok = check(wait_until([&]() {return session->closed == 1;}) && session->close_error == 0, "reactor: end of file is an io_closed") && ok;
+    ok = check(fw->get_reactor_stats().watched == before.watched, "reactor: the closed descriptor is no longer watched") && ok;
+    return ok;
+}
+
+/*************************************
+ * file_io, the completions of writes from a registered buffer and from
+ * plain memory, an fsync and reads come back as file_io_done, with and
+ * without the kernel polling the ring
+ */
+class FileActor : public cppactor::actor
+{
+public:
+    struct done
+    {
+        cppactor::file_op op;
+        uint64_t tag;
+        int result;
+        std::string data;
+    };
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        if (msg->msg_id != cppactor::file_io_done::msg_id)
+            return;
+        cppactor::file_io_done *d = static_cast<cppactor::file_io_done *>(msg.get());
+        done entry = {d->op, d->tag, d->result, std::string(d->data() ? d->data() : "", d->size())};
+        std::lock_guard<std::mutex> lock(mtx);
+        completed.push_back(entry);
+    }
+
+    bool find(uint64_t tag, done& entry)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (done& d : completed)
+        {
+            if (d.tag == tag)
+            {
+                entry = d;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t count()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return completed.size();
+    }
+
+    std::mutex mtx;
+    std::vector<done> completed;
+};
+
+bool test_file_io(bool sq_poll)
+{
+    const std::string name = sq_poll ? "file_io sqpoll: " : "file_io: ";
+    char path_template[] = "/tmp/cppactor_fileio.XXXXXX";
+    int fd = mkstemp(path_template);
+    cppactor::file_io_options options;
+    options.buffer_size = 4096;
+    options.sq_poll_idle_ms = sq_poll ? 10 : 0;
+    cppactor::instrusive_ptr<FileActor> owner = cppactor::create_actor<FileActor>(POOLID_TESTS);
+    bool ok;
+    {
+        cppactor::file_io io(options);
+        int file = io.register_file(fd);
+        ok = check(fd >= 0 && io.is_open() && file >= 0, (name + "the ring is set up").c_str());
+        if (!ok)
+        {
+            close(fd);
+            unlink(path_template);
+            return false;
+        }
+
+        cppactor::file_buffer *b = io.get_buffer();
+        memcpy(b->data, "hello", 5);
+        b->size = 5;
+        io.write(owner->get_ref(), file, 0, b, 1);
+        io.write(owner->get_ref(), file, 5, "world", 5, 2);
+        std::string big(3 * options.buffer_size, 'x');
+        io.write(owner->get_ref(), file, 10, big.data(), big.size(), 3);
+        ok = check(wait_until([&]() {return owner->count() == 3;}), (name + "the writes complete").c_str());
+
+        io.fsync(owner->get_ref(), file, true, 4);
+        ok = check(wait_until([&]() {return owner->count() == 4;}), (name + "the fsync completes").c_str()) && ok;
+        io.read(owner->get_ref(), file, 0, 10, 5);
+        io.read(owner->get_ref(), file, 10, big.size(), 6);
+        ok = check(wait_until([&]() {return owner->count() == 6;}), (name + "the reads complete").c_str()) && ok;
+
+        // no file registered at that index
+        io.read(owner->get_ref(), file + 1, 0, 10, 7);
+        ok = check(wait_until([&]() {return owner->count() == 7;}), (name + "a failed read completes").c_str()) && ok;
+
+        FileActor::done d[7];
+        bool found = true;
+        for (int i = 0; i < 7; ++i)
+            found = owner->find(i + 1, d[i]) && found;
+        ok = check(found && d[0].op == cppactor::FILE_WRITE && d[0].result == 5 && d[1].result == 5
+            && d[2].result == static_cast<int>(big.size()), (name + "a write's result is the bytes written").c_str()) && ok;
+        ok = check(found && d[3].op == cppactor::FILE_FSYNC && d[3].result == 0, (name + "an fsync's result is 0").c_str()) && ok;
+        ok = check(found && d[4].op == cppactor::FILE_READ && d[4].data == "helloworld" && d[5].data == big,
+            (name + "a read's message holds the data").c_str()) && ok;
+        ok = check(found && d[6].result < 0, (name + "a failed read's result is -errno").c_str()) && ok;
+
+        cppactor::file_io_stats stats = io.get_stats();
+        ok = check(stats.submitted == 7 && stats.completed == 7 && stats.failed == 1 && stats.copies == 2 && stats.enters > 0,
+            (name + "the stats count the operations").c_str()) && ok;
+        io.unregister_file(file);
+    }
+    close(fd);
+    unlink(path_template);
+    return ok;
+}
+
+/*************************************
+ * Unix domain socket transport, against a plain socket at the other end.
+ * The server reassembles frames split across reads, grows its buffer for
+ * a frame bigger than it and drops a client announcing one over
+ * max_pending. The connection's writer resumes a sendmsg() cut short.
+ */
+struct uds_frame
+{
+    uint32_t size;
+    int32_t msg_id;
+    uint64_t id;
+};
+
+// A Deposit frame, its payload padded to 'size' bytes
+void append_uds_frame(std::string& stream, uint64_t id, int64_t amount, uint32_t size = sizeof(int64_t))
+{
+    uds_frame h = {size, Deposit::msg_id, id};
+    stream.append(reinterpret_cast<const char *>(&h), sizeof(h));
+    stream.append(reinterpret_cast<const char *>(&amount), sizeof(amount));
+    stream.append(size - sizeof(amount), '\0');
+}
+
+int uds_connect(const std::string& path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool test_uds_server()
+{
+    const int FRAMES = 200;
+    const uint32_t BIG = 20000;
+    cppactor::register_journal_message<Deposit>();
+    std::string path = "/tmp/cppactor_test." + std::to_string(getpid()) + ".sock";
+    unlink(path.c_str());
+    cppactor::instrusive_ptr<RecordingActor> recorder = cppactor::create_actor<RecordingActor>(POOLID_TESTS);
+
+    cppactor::uds_options options;
+    options.batch_bytes = 64;
+    options.max_pending = 64 << 10;
+    cppactor::uds_server server(path, options);
+    server.bind(1, recorder);
+    int fd = uds_connect(path);
+    bool ok = check(server.is_open() && fd >= 0, "uds: a client connects to the server");
+    if (!ok)
+        return false;
+
+    // every tenth frame is bigger than the server's 4K read buffer
+    std::string stream;
+    for (int i = 0; i < FRAMES; ++i)
+        append_uds_frame(stream, 1, i, i % 10 == 9 ? BIG : sizeof(int64_t));
+
+    // written in odd sizes, so headers and payloads are split across reads
+    const size_t chunks[] = {1, 7, 15, 16, 23, 300, 5000};
+    size_t sent = 0;
+    for (int i = 0; ok && sent < stream.size(); ++i)
+    {
+        size_t n = std::min(chunks[i % 7], stream.size() - sent);
+        ok = send(fd, stream.data() + sent, n, MSG_NOSIGNAL) == static_cast<ssize_t>(n);
+        sent += n;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    ok = check(ok && wait_until([&]() {return recorder->handled == FRAMES;}), "uds: the server delivers the frames split across reads");
+    std::vector<std::pair<int, int64_t> > seen = recorder->get_seen(Deposit::msg_id);
+    bool in_order = seen.size() == FRAMES;
+    for (size_t i = 0; in_order && i < seen.size(); ++i)
+        in_order = seen[i].second == static_cast<int64_t>(i);
+    cppactor::uds_stats stats = server.get_stats();
+    ok = check(in_order && stats.messages == FRAMES && stats.dropped == 0 && stats.syscalls > FRAMES,
+        "uds: the frames arrive whole and in order") && ok;
+
+    // a frame over max_pending closes the connection, what follows is not read
+    stream.clear();
+    append_uds_frame(stream, 1, FRAMES, static_cast<uint32_t>(options.max_pending + 1));
+    send(fd, stream.data(), sizeof(uds_frame), MSG_NOSIGNAL);
+    stream.clear();
+    append_uds_frame(stream, 1, FRAMES + 1);
+    send(fd, stream.data(), stream.size(), MSG_NOSIGNAL);
+    pollfd pfd = {fd, POLLIN, 0};
+    char c;
+    ok = check(poll(&pfd, 1, 5000) == 1 && read(fd, &c, 1) == 0, "uds: the server drops a client sending an oversized frame") && ok;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ok = check(recorder->handled == FRAMES && server.get_stats().messages == FRAMES,
+        "uds: nothing after the oversized frame is delivered") && ok;
+    close(fd);
+    return ok;
+}
+
+void ignore_signal(int)
+{
+}
+
+// In a process of its own, the signals interrupt the connection's writer
+bool test_uds_partial_writes()
+{
+    const int MESSAGES = 100000;
+    const int SIGNALS = 5;
+    cppactor::register_journal_message<Deposit>();
+    std::string path = "/tmp/cppactor_test." + std::to_string(getpid()) + ".sock";
+    unlink(path.c_str());
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 1) != 0)
+        return check(false, "uds: listen");
+
+    // no SA_RESTART, a signal ends a blocked sendmsg() early
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ignore_signal;
+    sigaction(SIGUSR1, &sa, nullptr);
+
+    cppactor::uds_options options;
+    options.batch_bytes = 4096;
+    options.linger_us = 0;
+    bool ok;
+    {
+        cppactor::uds_connection connection(path, options);
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        cppactor::remote_actor remote = connection.remote(1);
+        for (int i = 0; i < MESSAGES; ++i)
+            remote.enqueue(new Deposit(i));
+
+        // nothing is read yet, the writer blocks on the full socket
+        std::vector<pid_t> writers;
+        if (DIR *dir = opendir("/proc/self/task"))
+        {
+            while (dirent *entry = readdir(dir))
+            {
+                pid_t tid = atoi(entry->d_name);
+                if (tid > 0 && tid != getpid())
+                    writers.push_back(tid);
+            }
+            closedir(dir);
+        }
+        for (int i = 0; i < SIGNALS; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            for (pid_t tid : writers)
+                syscall(SYS_tgkill, getpid(), tid, SIGUSR1);
+        }
+
+        std::thread flusher([&]() {connection.flush();});
+        std::string stream;
+        std::string expected;
+        for (int i = 0; i < MESSAGES; ++i)
+            append_uds_frame(expected, 1, i);
+        char buffer[65536];
+        while (stream.size() < expected.size())
+        {
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n <= 0)
+                break;
+            stream.append(buffer, n);
+        }
+        flusher.join();
+        cppactor::uds_stats stats = connection.get_stats();
+        ok = check(writers.size() == 1, "uds: the connection has one writer thread");
+        ok = check(stats.syscalls > SIGNALS, "uds: the signals cut the writes short") && ok;
+        ok = check(stream == expected && stats.messages == MESSAGES && stats.bytes == expected.size() && stats.dropped == 0,
+            "uds: a partial write resumes where it stopped") && ok;
+        close(fd);
+    }
+    close(listen_fd);
+    unlink(path.c_str());
+    return ok;
+}
+
+/*************************************
+ * parallel_for() and parallel_reduce() on the tests pool. Every index is
+ * visited once whatever the grain, the chunks are folded in index order,
+ * a throwing chunk reaches the caller, and a pool thread can run a loop
+ * on its own pool.
+ */
+bool test_parallel()
+{
+    const size_t N = 1000;
+    const size_t FIRST = 7;
+    bool ok = true;
+    const size_t grains[] = {0, 1, N + 1};
+    for (size_t grain : grains)
+    {
+        std::vector<std::atomic<int> > visits(N);
+        cppactor::parallel_for(POOLID_TESTS, FIRST, N, grain, [&](size_t i) {++visits[i];});
+        bool once = true;
+        for (size_t i = 0; i < N; ++i)
+            once = once && visits[i] == (i < FIRST ? 0 : 1);
+        ok = check(once, "parallel: parallel_for() visits every index once") && ok;
+
+        uint64_t serial = 0;
+        for (size_t i = FIRST; i < N; ++i)
+            serial += i * i;
+        uint64_t sum = cppactor::parallel_reduce(POOLID_TESTS, FIRST, N, grain, uint64_t(0),
+            [](size_t b, size_t e) {uint64_t s = 0; for (size_t i = b; i < e; ++i) s += i * i; return s;},
+            [](uint64_t a, uint64_t b) {return a + b;});
+        ok = check(sum == serial, "parallel: parallel_reduce() matches a serial reduce") && ok;
+    }
+
+    // concatenation is not commutative, the chunks are folded in index order
+    std::vector<size_t> order = cppactor::parallel_reduce(POOLID_TESTS, 0, N, 16, std::vector<size_t>(),
+        [](size_t b, size_t e) {std::vector<size_t> v; for (size_t i = b; i < e; ++i) v.push_back(i); return v;},
+        [](std::vector<size_t> a, std::vector<size_t> b) {a.insert(a.end(), b.begin(), b.end()); return a;});
+    bool in_order = order.size() == N;
+    for (size_t i = 0; in_order && i < N; ++i)
+        in_order = order[i] == i;
+    ok = check(in_order, "parallel: parallel_reduce() combines the chunks in index order") && ok;
+
+    bool caught = false;
+    try
+    {
+        cppactor::parallel_for(POOLID_TESTS, 0, N, 10, [](size_t i) {
+            if (i == N / 2)
+                throw std::runtime_error("chunk failed");
+        });
+    }
+    catch (std::runtime_error& e)
+    {
+        caught = strcmp(e.what(), "chunk failed") == 0;
+    }
+    ok = check(caught, "parallel: an exception thrown in a chunk reaches the caller") && ok;
+
+    std::atomic<int> calls(0);
+    cppactor::parallel_for(POOLID_TESTS, 5, 5, 0, [&](size_t) {++calls;});
+    int empty = cppactor::parallel_reduce(POOLID_TESTS, 5, 5, 0, 42,
+        [&](size_t, size_t) {++calls; return 0;},
+        [](int a, int b) {return a + b;});
+    ok = check(calls == 0 && empty == 42, "parallel: an empty range runs nothing and reduces to the identity") && ok;
+
+    // Both pool threads call a loop on their own pool, each completes
+    // even with no other thread free to help
+    cppactor::framework *fw = cppactor::framework::instance();
+    uint64_t from_pool[2] = {0, 0};
+    cppactor::task_handle done[2];
+    for (int t = 0; t < 2; ++t)
+    {
+        fw->submit(POOLID_TESTS, [&from_pool, t, N] {
+            from_pool[t] = cppactor::parallel_reduce(POOLID_TESTS, 0, N, 0, uint64_t(0),
+                [](size_t b, size_t e) {return uint64_t(e - b);},
+                [](uint64_t a, uint64_t b) {return a + b;});
+        }, &done[t]);
+    }
+    bool completed = done[0].wait_for(std::chrono::seconds(5)) && done[1].wait_for(std::chrono::seconds(5));
+    ok = check(completed && from_pool[0] == N && from_pool[1] == N, "parallel: a pool thread runs a loop on its own pool") && ok;
+    return ok;
+}
+
+/*************************************
+ * framework::submit(). Tasks run on the pool's threads, outside of any
+ * actor, interleaved with the messages of the pool's actors, and each
+ * handle completes once its task has run. A small task is stored in its
+ * task_function without an allocation.
+ */
+bool test_submit()
+{
+    const int TASKS = 200;
+    cppactor::framework *fw = cppactor::framework::instance();
+    cppactor::instrusive_ptr<CountingActor> counter = cppactor::create_actor<CountingActor>(POOLID_TESTS);
+
+    std::mutex mtx;
+    std::vector<std::thread::id> task_threads;
+    std::vector<int> ran(TASKS, 0);
+    std::atomic<bool> in_actor(false);
+    std::unique_ptr<cppactor::task_handle[]> done(new cppactor::task_handle[TASKS]);
+    for (int i = 0; i < TASKS; ++i)
+    {
+        counter->enqueue(new Tick(i));
+        fw->submit(POOLID_TESTS, [&, i] {
+            if (cppactor::actor::current() != nullptr)
+                in_actor = true;
+            std::lock_guard<std::mutex> lock(mtx);
+            task_threads.push_back(std::this_thread::get_id());
+            ran[i] = 1;
+        }, &done[i]);
+    }
+
+    bool completed = true;
+    for (int i = 0; i < TASKS; ++i)
+        completed = done[i].wait_for(std::chrono::seconds(5)) && !done[i].cancelled() && ran[i] == 1 && completed;
+    bool ok = check(completed, "submit: every handle completes once its task has run");
+    ok = check(wait_until([&] {return counter->count == TASKS;}), "submit: the pool's actors are handled alongside the tasks") && ok;
+
+    std::sort(task_threads.begin(), task_threads.end());
+    task_threads.erase(std::unique(task_threads.begin(), task_threads.end()), task_threads.end());
+    bool on_pool = !in_actor && !task_threads.empty() && task_threads.size() <= fw->get_pool_size(POOLID_TESTS)
+        && std::find(task_threads.begin(), task_threads.end(), std::this_thread::get_id()) == task_threads.end();
+    ok = check(on_pool, "submit: tasks run on the pool's threads, outside of any actor") && ok;
+
+    // captures within INLINE_SIZE stay in place, through moves too
+    int a = 1, b = 2;
+    uint64_t before = t_allocations;
+    {
+        cppactor::detail::task_function small([&a, &b] {a += b;}, nullptr);
+        cppactor::detail::task_function moved(std::move(small));
+        moved();
+    }
+    uint64_t small_allocations = t_allocations - before;
+    char big[cppactor::detail::task_function::INLINE_SIZE + 1] = {};
+    before = t_allocations;
+    {
+        cppactor::detail::task_function large([big, &a] {a += big[0];}, nullptr);
+        large();
+    }
+    ok = check(a == 3 && small_allocations == 0 && t_allocations - before == 1,
+        "submit: a small task is stored without an allocation, a large one allocates") && ok;
+
+    fw->stop_actor(counter);
+    return ok;
+}
+
+/*************************************
+ * actor::defer_sends(). A handler stages Ticks to several targets while
+ * the main thread sends them Ticks directly. Each target sees each
+ * sender's Ticks in order, and the Ticks staged for a target stopped
+ * before the flush become dead letters and are deleted.
+ */
+struct CountedTick : public Tick
+{
+    CountedTick(int n_)
+    : Tick(n_)
+    {}
+
+    ~CountedTick() {++deleted;}
+
+    static std::atomic<int> deleted;
+};
+
+std::atomic<int> CountedTick::deleted(0);
+
+class FanOutActor : public cppactor::actor
+{
+public:
+    FanOutActor()
+    : staged(true)
+    {
+        defer_sends(true);
+    }
+
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        for (int i = 0; i < msg->n; ++i)
+        {
+            for (cppactor::actor_iptr& t : targets)
+                staged = t->enqueue(new Tick(i)) == 1 && staged;
+            doomed->enqueue(new CountedTick(i));
+        }
+        cppactor::framework::instance()->stop_actor(doomed);
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    std::vector<cppactor::actor_iptr> targets;
+    cppactor::instrusive_ptr<CountingActor> doomed;
+    bool staged;
+};
+
+bool test_deferred_sends()
+{
+    const int PER = 500;
+    const int DIRECT = 1000000;
+    cppactor::framework *fw = cppactor::framework::instance();
+    std::vector<cppactor::instrusive_ptr<CountingActor> > targets = cppactor::create_actors<CountingActor>(POOLID_TESTS, 3);
+    cppactor::instrusive_ptr<FanOutActor> fan = cppactor::create_actor<FanOutActor>(POOLID_TESTS);
+    fan->targets.assign(targets.begin(), targets.end());
+    fan->doomed = cppactor::create_actor<CountingActor>(POOLID_TESTS);
+    uint64_t stopped = fw->get_dead_letter_stats().by_reason[cppactor::DEAD_LETTER_STOPPED];
+
+    fan->enqueue(new Tick(PER));
+    for (int i = 0; i < PER; ++i)
+    {
+        for (auto& t : targets)
+            t->enqueue(new Tick(DIRECT + i));
+    }
+
+    bool ok = check(wait_until([&] {
+            for (auto& t : targets)
+            {
+                if (t->count != 2 * PER)
+                    return false;
+            }
+            return true;
+        }), "deferred sends: every target gets the staged and the direct Ticks");
+    ok = check(fan->staged, "deferred sends: enqueue() returns 1 while staged") && ok;
+
+    bool in_order = true;
+    for (auto& t : targets)
+    {
+        int next_staged = 0;
+        int next_direct = DIRECT;
+        for (int n : t->get_seen())
+        {
+            if (n < DIRECT)
+                in_order = n == next_staged++ && in_order;
+            else
+                in_order = n == next_direct++ && in_order;
+        }
+    }
+    ok = check(in_order, "deferred sends: each sender's Ticks arrive in order") && ok;
+
+    ok = check(CountedTick::deleted == PER && fan->doomed->count == 0
+               && fw->get_dead_letter_stats().by_reason[cppactor::DEAD_LETTER_STOPPED] - stopped == PER,
+        "deferred sends: the Ticks staged for a stopped target are dead letters") && ok;
+
+    for (auto& t : targets)
+        fw->stop_actor(t);
+    fw->stop_actor(fan);
+    return ok;
+}
+
+/*************************************
+ * framework::shutdown(), each in a framework of its own. Every actor's
+ * on_exit() runs on its pool's thread, SHUTDOWN_DROP counts the messages
+ * it drops and SHUTDOWN_DRAIN handles them first
+ */
+class ExitingActor : public cppactor::actor
+{
+public:
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        ++handled;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    void on_exit()
+    {
+        ++exits;
+        if (cppactor::actor::current() == this && std::this_thread::get_id() != main_thread)
+            ++exits_on_pool;
+    }
+
+    static std::atomic<int> handled;
+    static std::atomic<int> exits;
+    static std::atomic<int> exits_on_pool;
+    static std::thread::id main_thread;
+};
+
+std::atomic<int> ExitingActor::handled(0);
+std::atomic<int> ExitingActor::exits(0);
+std::atomic<int> ExitingActor::exits_on_pool(0);
+std::thread::id ExitingActor::main_thread;
+
+// ACTORS actors sent 'each' Ticks, then shut down
+cppactor::shutdown_report run_shutdown(cppactor::shutdown_mode mode, int deadline_ms, int each)
+{
+    const int ACTORS = 20;
+    cppactor::framework fw;
+    cppactor::create_pool<ExitingActor>(POOLID_TESTS, 2);
+    ExitingActor::main_thread = std::this_thread::get_id();
+    std::vector<cppactor::instrusive_ptr<ExitingActor> > actors = cppactor::create_actors<ExitingActor>(POOLID_TESTS, ACTORS);
+    for (int i = 0; i < each; ++i)
+        cppactor::broadcast<Tick>(actors, i);
+    return fw.shutdown(mode, deadline_ms);
+}
+
+bool test_shutdown_drop()
+{
+    cppactor::shutdown_report r = run_shutdown(cppactor::SHUTDOWN_DROP, 0, 50);
+    // r.actors includes the framework's own timer actor
+    bool ok = check(r.actors > 20 && ExitingActor::exits == 20 && ExitingActor::exits_on_pool == 20, "shutdown: on_exit() runs on the pool thread");
+    return check(r.dropped_messages > 0 && ExitingActor::handled + r.dropped_messages == 20 * 50 && !r.drained,
+        "shutdown: SHUTDOWN_DROP counts the queued messages as dropped") && ok;
+}
+
+bool test_shutdown_drain()
+{
+    cppactor::shutdown_report r = run_shutdown(cppactor::SHUTDOWN_DRAIN, 5000, 5);
+    bool ok = check(ExitingActor::exits == 20 && ExitingActor::exits_on_pool == 20, "shutdown: on_exit() runs on the pool thread after draining");
+    return check(r.drained && r.dropped_messages == 0 && ExitingActor::handled == 20 * 5 && r.elapsed_ms < 5000,
+        "shutdown: SHUTDOWN_DRAIN handles the queued messages before the deadline") && ok;
+}
+
+bool test_shutdown_drain_deadline()
+{
+    cppactor::shutdown_report r = run_shutdown(cppactor::SHUTDOWN_DRAIN, 100, 200);
+    return check(!r.drained && r.not_exited.empty() && r.dropped_messages > 0 && ExitingActor::handled + r.dropped_messages == 20 * 200,
+        "shutdown: SHUTDOWN_DRAIN drops what is left at the deadline");
+}
+
+// Stays in its handler until released
+class StuckActor : public cppactor::actor
+{
+public:
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        entered = true;
+        while (!released)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    void on_exit()
+    {
+        ++exits;
+    }
+
+    static std::atomic<bool> entered;
+    static std::atomic<bool> released;
+    static std::atomic<int> exits;
+};
+
+std::atomic<bool> StuckActor::entered(false);
+std::atomic<bool> StuckActor::released(false);
+std::atomic<int> StuckActor::exits(0);
+
+// The deadline bounds the wait for an actor that never returns from its
+// handler, its pool is left running and it exits once it does
+bool test_shutdown_stuck()
+{
+    cppactor::framework fw;
+    cppactor::create_pool<ExitingActor>(POOLID_TESTS, 2);
+    cppactor::create_pool<StuckActor>(POOLID_QUICK, 1);
+    ExitingActor::main_thread = std::this_thread::get_id();
+    std::vector<cppactor::instrusive_ptr<ExitingActor> > actors = cppactor::create_actors<ExitingActor>(POOLID_TESTS, 5);
+    cppactor::instrusive_ptr<StuckActor> stuck = cppactor::create_actor<StuckActor>(POOLID_QUICK);
+    uint32_t stuck_id = stuck->get_actorid();
+    stuck->enqueue(new Tick(1));
+    bool ok = check(wait_until([] {return StuckActor::entered.load();}), "shutdown: the stuck actor is in its handler");
+
+    cppactor::shutdown_report r = fw.shutdown(cppactor::SHUTDOWN_DROP, 100);
+    ok = check(r.elapsed_ms < 2000 && r.not_exited.size() == 1 && r.not_exited[0] == stuck_id && ExitingActor::exits == 5 && StuckActor::exits == 0,
+        "shutdown: the deadline reports the actor stuck in a handler") && ok;
+
+    // the reactor went with the pools, it is not created again
+    int fds[2];
+    ok = check(pipe(fds) == 0, "shutdown: pipe()") && ok;
+    fw.watch_fd(actors[0], fds[0], cppactor::IO_READABLE);
+    fw.unwatch_fd(fds[0]);
+    ok = check(fw.get_reactor_stats().watched == 0, "shutdown: no reactor after shutdown") && ok;
+    close(fds[0]);
+    close(fds[1]);
+
+    // a late exit, the shutdown state outlived shutdown()
+    StuckActor::released = true;
+    ok = check(wait_until([] {return StuckActor::exits.load() == 1;}), "shutdown: the stuck actor exits once released") && ok;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    return ok;
+}
+
+/*************************************
+ * framework::start_watchdog(), in a framework of its own. A handler that
+ * runs past the threshold is reported once, a short one is not.
+ */
+class SlowActor : public cppactor::actor
+{
+public:
+    void on_message(std::unique_ptr<Tick>& msg, cppactor::actor_ref& reply_to)
+    {
+        ++started;
+        std::this_thread::sleep_for(std::chrono::milliseconds(msg->n));
+        ++handled;
+    }
+
+    void on_message(cppactor::message_uptr& msg, cppactor::actor_ref& reply_to)
+    {
+        cppactor::Dispatch<Tick>::on_message(this, msg, reply_to);
+    }
+
+    static std::atomic<int> started;
+    static std::atomic<int> handled;
+};
+
+std::atomic<int> SlowActor::started(0);
+std::atomic<int> SlowActor::handled(0);
+
+bool test_watchdog()
+{
+    cppactor::framework fw;
+    cppactor::create_pool<SlowActor>(POOLID_TESTS, 1);
+    cppactor::instrusive_ptr<SlowActor> slow = cppactor::create_actor<SlowActor>(POOLID_TESTS);
+
+    std::mutex mtx;
+    std::vector<cppactor::stalled_handler> reports;
+    fw.start_watchdog(20, [&](const cppactor::stalled_handler& h) {
+        std::lock_guard<std::mutex> lock(mtx);
+        reports.push_back(h);
+    });
+
+    slow->enqueue(new Tick(2));
+    bool ok = check(wait_until([] {return SlowActor::handled == 1;}), "watchdog: short handler");
+    slow->enqueue(new Tick(200));
+    ok = check(wait_until([] {return SlowActor::handled == 2;}), "watchdog: long handler") && ok;
+    fw.stop_watchdog();
+
+    ok = check(reports.size() == 1, "watchdog: the long handler is reported once, the short one not at all") && ok;
+    if (reports.size() == 1)
+    {
+        const cppactor::stalled_handler& h = reports[0];
+        ok = check(h.poolid == POOLID_TESTS && h.thread == 0 && h.actor_id == slow->get_actorid() && strcmp(h.actor_type, "SlowActor") == 0
+                   && h.msg_id == Tick::msg_id && h.elapsed_ms >= 20 && h.elapsed_ms < 200,
+            "watchdog: the report names the pool, actor type and msg_id") && ok;
+    }
+    cppactor::watchdog_stats stats = fw.get_watchdog_stats();
+    ok = check(stats.stalls == 1 && stats.by_msg_id.size() == 1 && stats.by_msg_id[0].first == Tick::msg_id && stats.by_msg_id[0].second == 1,
+        "watchdog: get_watchdog_stats() counts the report by msg_id") && ok;
+
+    // A handler that began while stopped was stamped with a stale clock, it
+    // is not reported as having run for all that time
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    slow->enqueue(new Tick(60));
+    ok = check(wait_until([] {return SlowActor::started == 3;}), "watchdog: handler started while stopped") && ok;
+    fw.start_watchdog(20, [&](const cppactor::stalled_handler& h) {
+        std::lock_guard<std::mutex> lock(mtx);
+        reports.push_back(h);
+    });
+    ok = check(wait_until([] {return SlowActor::handled == 3;}), "watchdog: handler started while stopped returns") && ok;
+    fw.stop_watchdog();
+    ok = check(reports.size() == 1, "watchdog: a handler started while stopped is not reported") && ok;
+
+    fw.shutdown();
+    return ok;
+}
+
+/*************************************
+ * Run some tests
+ * We create two pools, one for processing actors that handle messages quickly(Actor1, Actor2), another pool
+ * for long running actors that remain blocked for long times (to simulate web requests)
+ *
+ * This demonstrates how to send a message to a particular actor, as well has having the framework pick the actor
+ * to peform the work.
+ */
+
+void foo(int)
+{
+    std::cout << "foo called" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    // Tests with a framework of their own, before this one exists
+    if (!run_forked(test_shutdown_drop, "shutdown: drop")
+        || !run_forked(test_shutdown_drain, "shutdown: drain")
+        || !run_forked(test_shutdown_drain_deadline, "shutdown: drain deadline")
+        || !run_forked(test_shutdown_stuck, "shutdown: stuck handler")
+        || !run_forked(test_watchdog, "watchdog")
+        || !run_forked(test_shm, "shm transport")
+        || !run_forked(test_uds_partial_writes, "uds transport: partial writes"))
+        return 1;
+
+    // Create the framework
+    cppactor::framework framework;
+
+    // Create two thread pools
+    // The template arguments define the types of actors this pool will process, each pool requires
+    // a application defined pool id, and the number of threads to create
+    cppactor::create_pool<Actor1, Actor2>(POOLID_QUICK, 3);
+    cppactor::create_pool<LongRunningActor>(POOLID_LONGRUNNING, 3);
+    cppactor::create_pool<EmptyActor>(POOLID_FOOTPRINT, 1);
+    cppactor::create_pool<CountingActor, Responder, HibernatingActor, StartedActor, AccountActor, RecordingActor, SocketActor, FileActor, FanOutActor>(POOLID_TESTS, 2);
+#ifdef TEST_COROUTINES
+    cppactor::create_pool<CoroActor>(POOLID_COROUTINES, 1);
+#endif
+    cppactor::create_pool<DeadlineActor>(POOLID_DEADLINE, 1, cppactor::SCHEDULE_DEADLINE);
+
+    if (!test_footprint())
+        return 1;
+    if (!test_map_containers())
+        return 1;
+    if (!test_ask())
+        return 1;
+    if (!test_mpmc())
+        return 1;
+    if (!test_spin_locks())
+        return 1;
+    if (!test_hibernation())
+        return 1;
+    if (!test_create_actors(false) || !test_create_actors(true))
+        return 1;
+    if (!test_pipeline())
+        return 1;
+    if (!test_journal())
+        return 1;
+    if (!test_capture())
+        return 1;
+    if (!test_unhandled())
+        return 1;
+    if (!test_deadline_scheduling())
+        return 1;
+    if (!test_reactor())
+        return 1;
+    if (!test_file_io(false) || !test_file_io(true))
+        return 1;
+    if (!test_uds_server())
+        return 1;
+    if (!test_parallel())
+        return 1;
+    if (!test_submit())
+        return 1;
+    if (!test_deferred_sends())
+        return 1;
+#ifdef TEST_COROUTINES
+    if (!test_coroutines())
+        return 1;
+#endif
+
+    std::vector<cppactor::actor_iptr> longrunningActors;
+    // Create our actors
+    // The create_actor<>() function requires the type of actor to create, and the pool id this actor will be 
+    // associated with
+    cppactor::instrusive_ptr<Actor1> a1 = cppactor::create_actor<Actor1>(POOLID_QUICK);
+    cppactor::instrusive_ptr<Actor2> a2 = cppactor::create_actor<Actor2>(POOLID_QUICK);
+    cppactor::instrusive_ptr<LongRunningActor> l1 = cppactor::create_actor<LongRunningActor>(POOLID_LONGRUNNING, "lra 1");
+    cppactor::instrusive_ptr<LongRunningActor> l2 = cppactor::create_actor<LongRunningActor>(POOLID_LONGRUNNING, "lra 2");
+
+    longrunningActors.push_back(l1);
+    longrunningActors.push_back(l2);
+
+    a1->enqueue([=](cppactor::actor_iptr a) {std::cout << "Function object called" << std::endl;});
+
+    // Start a timer
+    int tid = framework.set_timer(5000, true, [=](int timer_id) {
+        std::cout << "on_timer" << std::endl;
+    });
+
+    std::this_thread::sleep_for(std::chrono::seconds(20));
+    std::cout << "Canceling timer" << std::endl;
+    framework.cancel_timer(tid);
+    std::this_thread::sleep_for(std::chrono::seconds(30));
+
+    // have actor1 ping actor2
+    a1->StartPing(a2, "Ping msg");
+
+    // Send a message to a particular LongRunningActor using the enqueue interface
+    l1->enqueue(new TestMessage(5, "Wait 5 sec, I chose actor"));
+
+    // Have the framework pick an actor (based on queue length)
+    cppactor::find_any(longrunningActors)->enqueue(new TestMessage(5, "Wait 5 sec, framework chose actor"));
+
+    // Send a message to a particular LongRunningActor using an actor interface
+    l1->Test(5, "Wait 5 sec, I chose actor interface");
+
+    // Have the framework pick an actor (based on queue length), using actor's interface
+    cppactor::find_any<LongRunningActor>(longrunningActors)->Test(5, "Wait 5 sec, framework chose actor interface");
+    
+    // Broadcast to actors
+    cppactor::broadcast<TestMessage>(longrunningActors, 5, "Wait 5 sec, broadcast");
+
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+
+    // Test actor stop functionality
+       // pump a bunch of messages
+    std::cout << "Test actor stop" << std::endl;
+    for (int i = 0; i < 1000; i++)
+    {
+        std::cout << "Enqueue " << i << ":" << "test" << std::endl;
+        a1->enqueue(new TestMessage(i, "test"));
+    }
+    //framework.stop_actor(a1);
+
+    std::this_thread::sleep_for(std::chrono::seconds(10));
+    framework.shutdown();
+
+    // a task submitted after shutdown is cancelled rather than lost
+    cppactor::task_handle late;
+    framework.submit(POOLID_TESTS, []() {}, &late);
+    if (!check(late.done() && late.cancelled(), "submit: a task after shutdown is cancelled"))
+        return 1;
 
     return 0;
 }